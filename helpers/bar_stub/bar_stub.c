@@ -0,0 +1,281 @@
+// Stand-in bar for profiling helpers without a running SketchyBar.
+//
+// Listens on the Unix socket used by the socket transport in sketchybar.h,
+// decodes each frame's NUL-separated arguments and records its arrival time.
+//
+// Usage: bar_stub [-s <socket>] [-o <log>] [-n <count>] [-q]
+//
+// - Every message is logged as "<arrival_ns>\t<latency_ns>\t<args...>" where
+//   arguments are separated by spaces (to stdout unless -o is given, never
+//   with -q).
+// - On exit (SIGINT/SIGTERM, or after -n messages) a summary with the
+//   message rate and p50/p90/p99/max latency is printed to stderr.
+// - Helpers connect to it with SKETCHYBAR_SOCKET=<socket> (the default
+//   socket path is shared with sketchybar.h, so it can be omitted).
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../sketchybar.h"
+
+#define MAX_CLIENTS 32
+#define MAX_MESSAGE_SIZE (1 << 20)
+
+struct client {
+  int fd;
+  uint32_t filled;
+  uint32_t capacity;
+  char* buffer;
+};
+
+struct stats {
+  uint64_t messages;
+  uint64_t bytes;
+  uint64_t first_ns;
+  uint64_t last_ns;
+  uint64_t* latencies;
+  uint64_t latency_count;
+  uint64_t latency_capacity;
+};
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void handle_signal(int sig) {
+  (void)sig;
+  g_stop = 1;
+}
+
+static void record_latency(struct stats* stats, uint64_t latency) {
+  if (stats->latency_count == stats->latency_capacity) {
+    uint64_t capacity = stats->latency_capacity ? stats->latency_capacity * 2 : 4096;
+    uint64_t* latencies = realloc(stats->latencies, capacity * sizeof(uint64_t));
+    if (!latencies) return;
+    stats->latencies = latencies;
+    stats->latency_capacity = capacity;
+  }
+  stats->latencies[stats->latency_count++] = latency;
+}
+
+static int compare_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+static uint64_t percentile(struct stats* stats, double p) {
+  if (stats->latency_count == 0) return 0;
+  uint64_t index = (uint64_t)(p * (double)(stats->latency_count - 1) + 0.5);
+  return stats->latencies[index];
+}
+
+static void print_summary(struct stats* stats) {
+  double duration = (double)(stats->last_ns - stats->first_ns) / 1e9;
+  qsort(stats->latencies, stats->latency_count, sizeof(uint64_t), compare_u64);
+
+  fprintf(stderr,
+          "messages=%llu bytes=%llu duration=%.3fs rate=%.1f/s "
+          "latency_us p50=%.1f p90=%.1f p99=%.1f max=%.1f\n",
+          (unsigned long long)stats->messages,
+          (unsigned long long)stats->bytes,
+          duration,
+          duration > 0.0 ? (double)stats->messages / duration : 0.0,
+          (double)percentile(stats, 0.50) / 1e3,
+          (double)percentile(stats, 0.90) / 1e3,
+          (double)percentile(stats, 0.99) / 1e3,
+          (double)percentile(stats, 1.00) / 1e3);
+}
+
+static void log_message(FILE* log,
+                        uint64_t arrival,
+                        uint64_t latency,
+                        const char* payload,
+                        uint32_t length) {
+  fprintf(log, "%llu\t%llu\t", (unsigned long long)arrival, (unsigned long long)latency);
+
+  // Arguments are NUL-terminated; the message itself ends in an empty one.
+  uint32_t caret = 0;
+  bool first = true;
+  while (caret < length && payload[caret] != '\0') {
+    const char* arg = payload + caret;
+    size_t arg_length = strnlen(arg, length - caret);
+    fprintf(log, "%s%.*s", first ? "" : " ", (int)arg_length, arg);
+    caret += arg_length + 1;
+    first = false;
+  }
+  fputc('\n', log);
+}
+
+// Consumes every complete frame in the client buffer. Returns false when the
+// client sent something that cannot be a frame.
+static bool drain_client(struct client* client, struct stats* stats, FILE* log) {
+  const uint32_t header_size = sizeof(struct sketchybar_frame_header);
+
+  uint32_t caret = 0;
+  while (client->filled - caret >= header_size) {
+    struct sketchybar_frame_header header;
+    memcpy(&header, client->buffer + caret, header_size);
+    if (header.length > MAX_MESSAGE_SIZE) return false;
+    if (client->filled - caret - header_size < header.length) break;
+
+    uint64_t arrival = sketchybar_now_ns();
+    uint64_t latency = arrival > header.sent_ns ? arrival - header.sent_ns : 0;
+    if (stats->messages == 0) stats->first_ns = arrival;
+    stats->last_ns = arrival;
+    stats->messages++;
+    stats->bytes += header.length;
+    record_latency(stats, latency);
+
+    if (log) {
+      log_message(log, arrival, latency, client->buffer + caret + header_size, header.length);
+    }
+    caret += header_size + header.length;
+  }
+
+  if (caret > 0) {
+    memmove(client->buffer, client->buffer + caret, client->filled - caret);
+    client->filled -= caret;
+  }
+  return true;
+}
+
+static bool read_client(struct client* client, struct stats* stats, FILE* log) {
+  if (client->capacity - client->filled < 4096) {
+    uint32_t capacity = client->capacity ? client->capacity * 2 : 65536;
+    if (capacity > MAX_MESSAGE_SIZE * 2) return false;
+    char* buffer = realloc(client->buffer, capacity);
+    if (!buffer) return false;
+    client->buffer = buffer;
+    client->capacity = capacity;
+  }
+
+  ssize_t received = read(client->fd,
+                          client->buffer + client->filled,
+                          client->capacity - client->filled);
+  if (received <= 0) return received < 0 && errno == EINTR;
+
+  client->filled += received;
+  return drain_client(client, stats, log);
+}
+
+static void close_client(struct client* client) {
+  close(client->fd);
+  free(client->buffer);
+  memset(client, 0, sizeof(struct client));
+  client->fd = -1;
+}
+
+int main(int argc, char** argv) {
+  char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+  socket_transport_path(path, sizeof(path));
+  const char* log_path = NULL;
+  uint64_t max_messages = 0;
+  bool quiet = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:o:n:q")) != -1) {
+    switch (opt) {
+      case 's': snprintf(path, sizeof(path), "%s", optarg); break;
+      case 'o': log_path = optarg; break;
+      case 'n': max_messages = strtoull(optarg, NULL, 10); break;
+      case 'q': quiet = true; break;
+      default:
+        printf("Usage: %s [-s <socket>] [-o <log>] [-n <count>] [-q]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  FILE* log = NULL;
+  if (!quiet) {
+    log = log_path ? fopen(log_path, "w") : stdout;
+    if (!log) {
+      fprintf(stderr, "Failed to open %s\n", log_path);
+      return 1;
+    }
+  }
+
+  struct sockaddr_un addr = { 0 };
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+  unlink(path);
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0
+      || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0
+      || listen(listener, MAX_CLIENTS) != 0) {
+    fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+
+  struct sigaction action = { 0 };
+  action.sa_handler = handle_signal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  struct client clients[MAX_CLIENTS];
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    memset(&clients[i], 0, sizeof(struct client));
+    clients[i].fd = -1;
+  }
+
+  struct stats stats = { 0 };
+  while (!g_stop && (max_messages == 0 || stats.messages < max_messages)) {
+    struct pollfd fds[MAX_CLIENTS + 1];
+    int owners[MAX_CLIENTS + 1];
+    int count = 0;
+
+    fds[count] = (struct pollfd){ .fd = listener, .events = POLLIN };
+    owners[count++] = -1;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+      if (clients[i].fd < 0) continue;
+      fds[count] = (struct pollfd){ .fd = clients[i].fd, .events = POLLIN };
+      owners[count++] = i;
+    }
+
+    if (poll(fds, count, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    for (int i = 0; i < count; i++) {
+      if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+      if (owners[i] < 0) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) continue;
+        int slot = 0;
+        while (slot < MAX_CLIENTS && clients[slot].fd >= 0) slot++;
+        if (slot == MAX_CLIENTS) {
+          close(fd);
+          continue;
+        }
+        clients[slot].fd = fd;
+        continue;
+      }
+
+      struct client* client = &clients[owners[i]];
+      if (!read_client(client, &stats, log)) close_client(client);
+    }
+  }
+
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    if (clients[i].fd >= 0) close_client(&clients[i]);
+  }
+  close(listener);
+  unlink(path);
+
+  if (log) fflush(log);
+  if (log && log != stdout) fclose(log);
+  print_summary(&stats);
+  free(stats.latencies);
+  return 0;
+}
@@ -0,0 +1,601 @@
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOKitLib.h>
+#include <IOKit/ps/IOPowerSources.h>
+#include <IOKit/ps/IOPSKeys.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "../control.h"
+#include "../json.h"
+#include "../sketchybar.h"
+
+// Battery state from the power source description and the AppleSmartBattery
+// registry entry, collected into a flat list of fields in a fixed array.
+//
+// Every value is kept as text together with its kind, which is all the JSON
+// writer needs to emit it and all watch mode needs to diff two snapshots.
+
+enum battery_kind {
+  BATTERY_NUMBER,
+  BATTERY_BOOL,
+  BATTERY_STRING,
+  // Numbers joined with ",", written as a JSON array.
+  BATTERY_LIST,
+};
+
+// Longer strings (none of the registry strings are) are dropped.
+#define BATTERY_TEXT_MAX 64
+#define BATTERY_FIELDS_MAX 96
+
+struct battery_field {
+  const char *key;
+  enum battery_kind kind;
+  char text[BATTERY_TEXT_MAX];
+};
+
+struct battery_snapshot {
+  struct battery_field fields[BATTERY_FIELDS_MAX];
+  int count;
+};
+
+static struct battery_field *add_field(struct battery_snapshot *snapshot,
+                                       const char *key,
+                                       enum battery_kind kind) {
+  if (snapshot->count == BATTERY_FIELDS_MAX) return NULL;
+  struct battery_field *field = &snapshot->fields[snapshot->count++];
+  field->key = key;
+  field->kind = kind;
+  field->text[0] = '\0';
+  return field;
+}
+
+static void set_int(struct battery_snapshot *snapshot, const char *key, int64_t value) {
+  struct battery_field *field = add_field(snapshot, key, BATTERY_NUMBER);
+  if (field) snprintf(field->text, sizeof(field->text), "%lld", (long long)value);
+}
+
+// Derived values are rounded to one decimal.
+static void set_double(struct battery_snapshot *snapshot, const char *key, double value) {
+  if (!isfinite(value)) return;
+  struct battery_field *field = add_field(snapshot, key, BATTERY_NUMBER);
+  if (field) snprintf(field->text, sizeof(field->text), "%.1f", round(value * 10.0) / 10.0);
+}
+
+static void set_bool(struct battery_snapshot *snapshot, const char *key, bool value) {
+  struct battery_field *field = add_field(snapshot, key, BATTERY_BOOL);
+  if (field) strcpy(field->text, value ? "true" : "false");
+}
+
+static void set_string(struct battery_snapshot *snapshot, const char *key, const char *value) {
+  if (!value || value[0] == '\0' || strlen(value) >= BATTERY_TEXT_MAX) return;
+  struct battery_field *field = add_field(snapshot, key, BATTERY_STRING);
+  if (field) strcpy(field->text, value);
+}
+
+static bool int_from_cf(CFTypeRef value, int64_t *out) {
+  if (!value || CFGetTypeID(value) != CFNumberGetTypeID()) return false;
+  return CFNumberGetValue((CFNumberRef)value, kCFNumberSInt64Type, out);
+}
+
+static void set_cf_int(struct battery_snapshot *snapshot,
+                       const char *key,
+                       CFDictionaryRef dict,
+                       CFStringRef name) {
+  int64_t value;
+  if (int_from_cf(CFDictionaryGetValue(dict, name), &value)) set_int(snapshot, key, value);
+}
+
+static void set_cf_bool(struct battery_snapshot *snapshot,
+                        const char *key,
+                        CFDictionaryRef dict,
+                        CFStringRef name) {
+  CFTypeRef value = CFDictionaryGetValue(dict, name);
+  if (!value || CFGetTypeID(value) != CFBooleanGetTypeID()) return;
+  set_bool(snapshot, key, value == kCFBooleanTrue);
+}
+
+static void set_cf_string(struct battery_snapshot *snapshot,
+                          const char *key,
+                          CFDictionaryRef dict,
+                          CFStringRef name) {
+  CFTypeRef value = CFDictionaryGetValue(dict, name);
+  if (!value || CFGetTypeID(value) != CFStringGetTypeID()) return;
+  char text[BATTERY_TEXT_MAX];
+  if (CFStringGetCString((CFStringRef)value, text, sizeof(text), kCFStringEncodingUTF8)) {
+    set_string(snapshot, key, text);
+  }
+}
+
+static CFDictionaryRef dict_from_cf(CFTypeRef value) {
+  if (!value || CFGetTypeID(value) != CFDictionaryGetTypeID()) return NULL;
+  return (CFDictionaryRef)value;
+}
+
+static bool string_equals(CFTypeRef value, CFStringRef expected) {
+  return value && CFGetTypeID(value) == CFStringGetTypeID()
+         && CFStringCompare((CFStringRef)value, expected, 0) == kCFCompareEqualTo;
+}
+
+static void add_power_source_info(struct battery_snapshot *snapshot) {
+  CFTypeRef blob = IOPSCopyPowerSourcesInfo();
+  if (!blob) return;
+
+  CFArrayRef list = IOPSCopyPowerSourcesList(blob);
+  if (!list) {
+    CFRelease(blob);
+    return;
+  }
+
+  CFIndex count = CFArrayGetCount(list);
+  for (CFIndex i = 0; i < count; i++) {
+    CFTypeRef ps = CFArrayGetValueAtIndex(list, i);
+    if (!ps) continue;
+
+    CFDictionaryRef desc = IOPSGetPowerSourceDescription(blob, ps);
+    if (!desc || CFGetTypeID(desc) != CFDictionaryGetTypeID()) continue;
+
+    // Prefer internal battery if present.
+    CFTypeRef type = CFDictionaryGetValue(desc, CFSTR(kIOPSTypeKey));
+    // kIOPSInternalBatteryType is a C-string on some SDKs; compare by value.
+    if (type && CFGetTypeID(type) == CFStringGetTypeID()
+        && !string_equals(type, CFSTR("InternalBattery"))) {
+      continue;
+    }
+
+    int64_t cur, max;
+    if (int_from_cf(CFDictionaryGetValue(desc, CFSTR(kIOPSCurrentCapacityKey)), &cur)
+        && int_from_cf(CFDictionaryGetValue(desc, CFSTR(kIOPSMaxCapacityKey)), &max)
+        && max > 0) {
+      int64_t pct = (int64_t)llround((double)cur * 100.0 / (double)max);
+      if (pct < 0) pct = 0;
+      if (pct > 100) pct = 100;
+      set_int(snapshot, "percent", pct);
+    }
+
+    set_cf_bool(snapshot, "is_charging", desc, CFSTR(kIOPSIsChargingKey));
+    set_cf_bool(snapshot, "is_charged", desc, CFSTR(kIOPSIsChargedKey));
+
+    int64_t minutes;
+    if (int_from_cf(CFDictionaryGetValue(desc, CFSTR(kIOPSTimeToEmptyKey)), &minutes)
+        && minutes >= 0) {
+      set_int(snapshot, "time_to_empty_min", minutes);
+    }
+    if (int_from_cf(CFDictionaryGetValue(desc, CFSTR(kIOPSTimeToFullChargeKey)), &minutes)
+        && minutes >= 0) {
+      set_int(snapshot, "time_to_full_min", minutes);
+    }
+
+    CFTypeRef state = CFDictionaryGetValue(desc, CFSTR(kIOPSPowerSourceStateKey));
+    // kIOPSACPowerValue / kIOPSBatteryPowerValue may be C-strings; compare by value.
+    if (string_equals(state, CFSTR("AC Power"))) {
+      set_string(snapshot, "power_source", "AC");
+    } else if (string_equals(state, CFSTR("Battery Power"))) {
+      set_string(snapshot, "power_source", "Battery");
+    } else {
+      set_cf_string(snapshot, "power_source", desc, CFSTR(kIOPSPowerSourceStateKey));
+    }
+
+    // Only one internal battery expected; stop after first match.
+    break;
+  }
+
+  CFRelease(list);
+  CFRelease(blob);
+}
+
+static void add_smart_battery_info(struct battery_snapshot *snapshot) {
+  io_service_t service = IOServiceGetMatchingService(kIOMainPortDefault, IOServiceMatching("AppleSmartBattery"));
+  if (!service) return;
+
+  CFMutableDictionaryRef props = NULL;
+  kern_return_t kr = IORegistryEntryCreateCFProperties(service, &props, kCFAllocatorDefault, 0);
+  IOObjectRelease(service);
+  if (kr != KERN_SUCCESS || !props) return;
+
+  set_cf_int(snapshot, "cycle_count", props, CFSTR("CycleCount"));
+  set_cf_int(snapshot, "design_capacity", props, CFSTR("DesignCapacity"));
+  set_cf_int(snapshot, "design_cycle_count", props, CFSTR("DesignCycleCount9C"));
+
+  // Common state flags.
+  set_cf_bool(snapshot, "critical", props, CFSTR("AtCriticalLevel"));
+  set_cf_bool(snapshot, "battery_installed", props, CFSTR("BatteryInstalled"));
+  set_cf_bool(snapshot, "fully_charged", props, CFSTR("FullyCharged"));
+  set_cf_bool(snapshot, "external_connected", props, CFSTR("ExternalConnected"));
+  set_cf_bool(snapshot, "external_charge_capable", props, CFSTR("ExternalChargeCapable"));
+
+  set_cf_int(snapshot, "max_capacity", props, CFSTR("MaxCapacity"));
+  set_cf_int(snapshot, "current_capacity", props, CFSTR("CurrentCapacity"));
+  set_cf_int(snapshot, "raw_current_capacity", props, CFSTR("AppleRawCurrentCapacity"));
+  set_cf_int(snapshot, "raw_max_capacity", props, CFSTR("AppleRawMaxCapacity"));
+  set_cf_int(snapshot, "nominal_capacity", props, CFSTR("NominalChargeCapacity"));
+  set_cf_int(snapshot, "voltage_mv", props, CFSTR("Voltage"));
+  set_cf_int(snapshot, "amperage_ma", props, CFSTR("Amperage"));
+  set_cf_int(snapshot, "instant_amperage_ma", props, CFSTR("InstantAmperage"));
+  set_cf_int(snapshot, "permanent_failure_status", props, CFSTR("PermanentFailureStatus"));
+  set_cf_bool(snapshot, "is_charging_smart", props, CFSTR("IsCharging"));
+
+  set_cf_string(snapshot, "serial", props, CFSTR("Serial"));
+  set_cf_string(snapshot, "device_name", props, CFSTR("DeviceName"));
+  set_cf_int(snapshot, "gas_gauge_fw", props, CFSTR("GasGaugeFirmwareVersion"));
+
+  // Raw time fields (often 65535 when unknown).
+  set_cf_int(snapshot, "time_remaining_raw", props, CFSTR("TimeRemaining"));
+  set_cf_int(snapshot, "avg_time_to_empty_raw", props, CFSTR("AvgTimeToEmpty"));
+  set_cf_int(snapshot, "avg_time_to_full_raw", props, CFSTR("AvgTimeToFull"));
+
+  set_cf_int(snapshot, "pack_reserve", props, CFSTR("PackReserve"));
+
+  CFDictionaryRef adapter = dict_from_cf(CFDictionaryGetValue(props, CFSTR("AdapterDetails")));
+  if (adapter) {
+    set_cf_int(snapshot, "adapter_watts", adapter, CFSTR("Watts"));
+    set_cf_int(snapshot, "adapter_voltage_mv", adapter, CFSTR("AdapterVoltage"));
+    set_cf_int(snapshot, "adapter_current_ma", adapter, CFSTR("Current"));
+    set_cf_string(snapshot, "adapter_desc", adapter, CFSTR("Description"));
+  }
+
+  CFDictionaryRef charger = dict_from_cf(CFDictionaryGetValue(props, CFSTR("ChargerData")));
+  if (charger) {
+    set_cf_int(snapshot, "charger_voltage_mv", charger, CFSTR("ChargingVoltage"));
+    set_cf_int(snapshot, "charger_current_ma", charger, CFSTR("ChargingCurrent"));
+    set_cf_int(snapshot, "charger_id", charger, CFSTR("ChargerID"));
+    set_cf_int(snapshot, "charger_not_charging_reason", charger, CFSTR("NotChargingReason"));
+    set_cf_int(snapshot, "charger_slow_charging_reason", charger, CFSTR("SlowChargingReason"));
+    set_cf_int(snapshot, "charger_inhibit_reason", charger, CFSTR("ChargerInhibitReason"));
+  }
+
+  CFDictionaryRef batt = dict_from_cf(CFDictionaryGetValue(props, CFSTR("BatteryData")));
+  if (batt) {
+    CFTypeRef cells = CFDictionaryGetValue(batt, CFSTR("CellVoltage"));
+    if (cells && CFGetTypeID(cells) == CFArrayGetTypeID() && CFArrayGetCount(cells) > 0) {
+      struct battery_field *field = add_field(snapshot, "cell_voltage_mv", BATTERY_LIST);
+      int64_t min_v = INT64_MAX;
+      int64_t max_v = INT64_MIN;
+      size_t length = 0;
+      CFIndex count = CFArrayGetCount(cells);
+      for (CFIndex i = 0; i < count && field; i++) {
+        int64_t v;
+        if (!int_from_cf(CFArrayGetValueAtIndex(cells, i), &v)) continue;
+        int written = snprintf(field->text + length, sizeof(field->text) - length,
+                               length ? ",%lld" : "%lld", (long long)v);
+        if (written < 0 || (size_t)written >= sizeof(field->text) - length) break;
+        length += (size_t)written;
+        if (v < min_v) min_v = v;
+        if (v > max_v) max_v = v;
+      }
+      if (field && length == 0) snapshot->count--;
+      if (min_v != INT64_MAX && max_v != INT64_MIN) {
+        set_int(snapshot, "cell_voltage_min_mv", min_v);
+        set_int(snapshot, "cell_voltage_max_mv", max_v);
+        set_int(snapshot, "cell_voltage_delta_mv", max_v - min_v);
+      }
+    }
+
+    set_cf_int(snapshot, "soc_percent", batt, CFSTR("StateOfCharge"));
+    set_cf_int(snapshot, "daily_min_soc", batt, CFSTR("DailyMinSoc"));
+    set_cf_int(snapshot, "daily_max_soc", batt, CFSTR("DailyMaxSoc"));
+  }
+
+  CFDictionaryRef tele = dict_from_cf(CFDictionaryGetValue(props, CFSTR("PowerTelemetryData")));
+  if (tele) {
+    set_cf_int(snapshot, "telemetry_system_voltage_in_mv", tele, CFSTR("SystemVoltageIn"));
+    set_cf_int(snapshot, "telemetry_system_current_in_ma", tele, CFSTR("SystemCurrentIn"));
+    int64_t sys_p;
+    if (int_from_cf(CFDictionaryGetValue(tele, CFSTR("SystemPowerIn")), &sys_p)) {
+      set_double(snapshot, "telemetry_system_power_in_w", (double)sys_p / 1000.0);
+    }
+    set_cf_int(snapshot, "telemetry_system_load", tele, CFSTR("SystemLoad"));
+    set_cf_int(snapshot, "telemetry_battery_power", tele, CFSTR("BatteryPower"));
+  }
+
+  set_cf_string(snapshot, "health", props, CFSTR("BatteryHealth"));
+
+  int64_t temp_raw;
+  if (int_from_cf(CFDictionaryGetValue(props, CFSTR("Temperature")), &temp_raw)) {
+    set_int(snapshot, "temperature_raw", temp_raw);
+    // Best-effort conversion: many Macs expose Temperature as 0.1 Kelvin.
+    if (temp_raw > 1000) set_double(snapshot, "temperature_c", (double)temp_raw / 10.0 - 273.15);
+  }
+
+  int64_t voltage, amperage;
+  if (int_from_cf(CFDictionaryGetValue(props, CFSTR("Voltage")), &voltage)
+      && int_from_cf(CFDictionaryGetValue(props, CFSTR("Amperage")), &amperage)) {
+    set_double(snapshot, "power_w", ((double)voltage / 1000.0) * ((double)amperage / 1000.0));
+  }
+
+  int64_t raw_max, design;
+  if (int_from_cf(CFDictionaryGetValue(props, CFSTR("AppleRawMaxCapacity")), &raw_max)
+      && int_from_cf(CFDictionaryGetValue(props, CFSTR("DesignCapacity")), &design)
+      && design > 0) {
+    set_double(snapshot, "health_percent", (double)raw_max / (double)design * 100.0);
+  }
+
+  CFRelease(props);
+}
+
+static void collect_info(struct battery_snapshot *snapshot) {
+  snapshot->count = 0;
+  add_power_source_info(snapshot);
+  add_smart_battery_info(snapshot);
+}
+
+static void write_json(struct json_writer *json, const struct battery_snapshot *snapshot) {
+  json_begin_object(json);
+  for (int i = 0; i < snapshot->count; i++) {
+    const struct battery_field *field = &snapshot->fields[i];
+    json_key(json, field->key);
+    switch (field->kind) {
+      case BATTERY_NUMBER:
+      case BATTERY_BOOL:
+        json_raw(json, field->text, strlen(field->text));
+        break;
+      case BATTERY_STRING:
+        json_string(json, field->text);
+        break;
+      case BATTERY_LIST: {
+        json_begin_array(json);
+        const char *value = field->text;
+        while (*value) {
+          size_t length = strcspn(value, ",");
+          json_raw(json, value, length);
+          value += length;
+          if (*value == ',') value++;
+        }
+        json_end_array(json);
+        break;
+      }
+    }
+  }
+  json_end_object(json);
+}
+
+// Watch mode: stay resident, re-read the battery when the power sources or
+// the AppleSmartBattery registry entry change, and trigger the bar with only
+// the keys whose values differ from the last snapshot sent.
+//
+// Trigger arguments are flat strings: booleans as true/false, lists joined
+// with ",". `full=true` marks a complete snapshot (the first one, and every
+// one asked for with the `snapshot` command); it carries every key, so it
+// leaves out the `keys` list. A diff lists the keys it carries in `keys` and
+// the ones that disappeared in `removed`.
+
+// Notifications tend to arrive in bursts (a power source change also
+// updates the registry entry); they are folded into one read this much later.
+#define WATCH_COALESCE_S 0.1
+#define WATCH_LIFETIME_S 5.0
+
+struct watch {
+  const char *event;
+  struct battery_snapshot sent;
+  struct battery_snapshot next;
+  bool has_sent;
+  bool paused;
+  bool dirty;
+  bool full;
+  // Resync generation (sketchybar.h) the last full trigger answered.
+  uint64_t resync_seen;
+
+  struct control control;
+  CFRunLoopTimerRef coalesce;
+  // A longer message would not fit the async ring's slots anyway.
+  char buffer[SB_SLOT_SIZE];
+  struct sb_message msg;
+};
+
+// Fields come in the same order every time, so the search starts at the
+// field's own index.
+static const struct battery_field *find_field(const struct battery_snapshot *snapshot,
+                                              const char *key,
+                                              int hint) {
+  for (int n = 0; n < snapshot->count; n++) {
+    const struct battery_field *field = &snapshot->fields[(hint + n) % snapshot->count];
+    if (strcmp(field->key, key) == 0) return field;
+  }
+  return NULL;
+}
+
+static bool field_changed(const struct battery_snapshot *sent,
+                          const struct battery_field *field,
+                          int index) {
+  const struct battery_field *old = find_field(sent, field->key, index);
+  return !old || old->kind != field->kind || strcmp(old->text, field->text) != 0;
+}
+
+static void watch_update(struct watch *watch) {
+  if (watch->paused) {
+    watch->dirty = true;
+    return;
+  }
+  watch->dirty = false;
+
+  struct battery_snapshot *info = &watch->next;
+  struct battery_snapshot *sent = &watch->sent;
+  collect_info(info);
+  uint64_t generation = sketchybar_resync_generation();
+  bool full = watch->full || !watch->has_sent || generation != watch->resync_seen;
+  bool changed = full;
+  for (int i = 0; i < info->count && !changed; i++) changed = field_changed(sent, &info->fields[i], i);
+  for (int i = 0; i < sent->count && !changed; i++) changed = !find_field(info, sent->fields[i].key, i);
+  if (!changed) return;
+
+  struct sb_message *msg = &watch->msg;
+  sb_msg_reset(msg);
+  sb_msg_arg(msg, "--trigger");
+  sb_msg_arg(msg, watch->event);
+  sb_msg_str(msg, "full", full ? "true" : "false");
+
+  if (!full) {
+    sb_msg_key(msg, "keys");
+    bool first = true;
+    for (int i = 0; i < info->count; i++) {
+      if (!field_changed(sent, &info->fields[i], i)) continue;
+      if (!first) sb_msg_append(msg, ",", 1);
+      sb_msg_append(msg, info->fields[i].key, (uint32_t)strlen(info->fields[i].key));
+      first = false;
+    }
+    sb_msg_end_arg(msg);
+
+    sb_msg_key(msg, "removed");
+    first = true;
+    for (int i = 0; i < sent->count; i++) {
+      if (find_field(info, sent->fields[i].key, i)) continue;
+      if (!first) sb_msg_append(msg, ",", 1);
+      sb_msg_append(msg, sent->fields[i].key, (uint32_t)strlen(sent->fields[i].key));
+      first = false;
+    }
+    sb_msg_end_arg(msg);
+  }
+
+  for (int i = 0; i < info->count; i++) {
+    if (!full && !field_changed(sent, &info->fields[i], i)) continue;
+    sb_msg_str(msg, info->fields[i].key, info->fields[i].text);
+  }
+
+  // A diff is a partial message: it must not be coalesced with another one,
+  // and one that may not have arrived makes the next trigger a full one. A
+  // message that does not fit or finds the ring full is dropped; keep the old
+  // snapshot so the next change is diffed against what the bar actually has.
+  if (msg->overflow) {
+    fprintf(stderr, "%s trigger with %d keys does not fit %zu bytes, dropped\n",
+            full ? "Full" : "Partial", info->count, sizeof(watch->buffer));
+    return;
+  }
+  if (!(full ? sb_msg_send(msg) : sb_msg_send_partial(msg))) return;
+  *sent = *info;
+  watch->has_sent = true;
+  watch->full = false;
+  if (full) watch->resync_seen = generation;
+}
+
+static void watch_schedule(struct watch *watch) {
+  CFRunLoopTimerSetNextFireDate(watch->coalesce, CFAbsoluteTimeGetCurrent() + WATCH_COALESCE_S);
+}
+
+static void watch_on_coalesce(CFRunLoopTimerRef timer, void *context) {
+  (void)timer;
+  watch_update(context);
+}
+
+static void watch_on_power_source(void *context) {
+  watch_schedule(context);
+}
+
+static void watch_on_registry(void *context, io_service_t service, natural_t type, void *argument) {
+  (void)service;
+  (void)type;
+  (void)argument;
+  watch_schedule(context);
+}
+
+// Also catches a diff that was lost while the battery stays put.
+static void watch_on_lifetime(CFRunLoopTimerRef timer, void *context) {
+  (void)timer;
+  struct watch *watch = context;
+  sb_lifetime_check();
+  if (watch->has_sent && sketchybar_resync_generation() != watch->resync_seen) {
+    watch_schedule(watch);
+  }
+}
+
+// `snapshot` sends every key, `refresh` re-reads right away, `pause` holds
+// back triggers until `resume`, which sends whatever changed meanwhile.
+static void watch_on_control(CFFileDescriptorRef descriptor, CFOptionFlags flags, void *context) {
+  (void)flags;
+  struct watch *watch = context;
+  char command[128];
+  while (control_next(&watch->control, command, sizeof(command))) {
+    if (control_match(command, "snapshot")) {
+      watch->full = true;
+      watch_schedule(watch);
+    } else if (control_match(command, "refresh")) {
+      watch_schedule(watch);
+    } else if (control_match(command, "pause")) {
+      watch->paused = true;
+    } else if (control_match(command, "resume") && watch->paused) {
+      watch->paused = false;
+      if (watch->dirty || watch->full) watch_schedule(watch);
+    }
+  }
+  CFFileDescriptorEnableCallBacks(descriptor, kCFFileDescriptorReadCallBack);
+}
+
+static int watch_run(int argc, char **argv, const char *event, const char *control_path) {
+  static struct watch watch;
+  watch.event = event;
+  control_init(&watch.control);
+  sb_msg_init(&watch.msg, watch.buffer, sizeof(watch.buffer));
+
+  alarm(0);
+  sketchybar_resilient_start_from_env(argc, argv);
+  char event_message[512];
+  snprintf(event_message, sizeof(event_message), "--add event '%s'", event);
+  sketchybar(event_message);
+
+  CFRunLoopRef loop = CFRunLoopGetCurrent();
+  CFRunLoopTimerContext timer_context = { 0, &watch, NULL, NULL, NULL };
+  watch.coalesce = CFRunLoopTimerCreate(NULL, CFAbsoluteTimeGetCurrent(), 1e9, 0, 0,
+                                        watch_on_coalesce, &timer_context);
+  CFRunLoopAddTimer(loop, watch.coalesce, kCFRunLoopDefaultMode);
+  CFRunLoopTimerRef lifetime = CFRunLoopTimerCreate(NULL,
+                                                    CFAbsoluteTimeGetCurrent() + WATCH_LIFETIME_S,
+                                                    WATCH_LIFETIME_S, 0, 0,
+                                                    watch_on_lifetime, &timer_context);
+  CFRunLoopAddTimer(loop, lifetime, kCFRunLoopDefaultMode);
+
+  CFRunLoopSourceRef power_source = IOPSNotificationCreateRunLoopSource(watch_on_power_source, &watch);
+  if (power_source) CFRunLoopAddSource(loop, power_source, kCFRunLoopDefaultMode);
+
+  IONotificationPortRef port = IONotificationPortCreate(kIOMainPortDefault);
+  io_service_t service = IOServiceGetMatchingService(kIOMainPortDefault,
+                                                     IOServiceMatching("AppleSmartBattery"));
+  io_object_t interest = IO_OBJECT_NULL;
+  if (port && service) {
+    CFRunLoopAddSource(loop, IONotificationPortGetRunLoopSource(port), kCFRunLoopDefaultMode);
+    IOServiceAddInterestNotification(port, service, kIOGeneralInterest,
+                                     watch_on_registry, &watch, &interest);
+  }
+  if (service) IOObjectRelease(service);
+
+  if (control_path) {
+    if (control_open(&watch.control, control_path)) {
+      CFFileDescriptorContext fd_context = { 0, &watch, NULL, NULL, NULL };
+      CFFileDescriptorRef descriptor = CFFileDescriptorCreate(NULL, watch.control.fd, false,
+                                                              watch_on_control, &fd_context);
+      CFFileDescriptorEnableCallBacks(descriptor, kCFFileDescriptorReadCallBack);
+      CFRunLoopSourceRef source = CFFileDescriptorCreateRunLoopSource(NULL, descriptor, 0);
+      CFRunLoopAddSource(loop, source, kCFRunLoopDefaultMode);
+    } else {
+      fprintf(stderr, "Could not create control fifo %s\n", control_path);
+    }
+  }
+
+  sketchybar_async_start_from_env();
+  CFRunLoopRun();
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "--watch") == 0) {
+    const char *control_path = NULL;
+    if (argc == 5 && strcmp(argv[3], "--control") == 0) control_path = argv[4];
+    if (argc != 3 && !control_path) {
+      printf("Usage: %s [--watch <event-name> [--control <fifo>]]\n", argv[0]);
+      return 1;
+    }
+    return watch_run(argc, argv, argv[2], control_path);
+  }
+
+  static struct battery_snapshot info;
+  collect_info(&info);
+
+  char buffer[4096];
+  struct json_writer json;
+  json_init(&json, buffer, sizeof(buffer), STDOUT_FILENO);
+  write_json(&json, &info);
+  if (!json_finish(&json)) {
+    fprintf(stderr, "Failed to write JSON\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,353 @@
+#pragma once
+
+// Minimal benchmark harness shared by the programs in helpers/bench.
+//
+// bench_run() calls fn(ctx) in groups until at least BENCH_MIN_NS elapsed and
+// prints the mean cost per call, the p50/p99 per-call latency and the heap
+// allocations and syscalls per call. Groups are sized from the warmup to
+// last about BENCH_GROUP_NS, so anything slower than that is timed call by
+// call and faster functions get the percentiles of their group means.
+//
+// Allocations and syscalls are counted in a separate pass afterwards, so the
+// counting never shows up in the timings:
+//
+// - allocations: malloc/calloc/realloc calls made by the process, counted by
+//   wrappers around the glibc allocator below (not counted elsewhere)
+// - syscalls: on Linux every syscall the calling thread enters, counted by a
+//   forked child that ptrace()s it for the pass; on macOS the task's Unix and
+//   Mach syscall counters (all threads)
+//
+// What cannot be counted (no glibc, ptrace not permitted) prints as "-".
+//
+// With BENCH_JSON set to a path, every result is also appended to that file
+// as one JSON object per line, tagged with BENCH_COMMIT when that is set.
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../json.h"
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+#ifdef __linux__
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#endif
+
+#define BENCH_MIN_NS 200000000ull
+#define BENCH_GROUP_NS 2000ull
+#define BENCH_SAMPLES 16384
+// The counting pass runs for about this long untraced, 1 to 1000 calls.
+#define BENCH_COUNT_NS 20000000ull
+
+static volatile uint64_t g_bench_sink = 0;
+
+static inline uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Allocations
+
+#ifdef __GLIBC__
+#define BENCH_ALLOCS 1
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* pointer, size_t size);
+extern void __libc_free(void* pointer);
+
+static uint64_t g_bench_allocs = 0;
+
+// glibc lets the program replace the allocator, and its own internal calls
+// (fopen, strdup, getline) come through here too.
+void* malloc(size_t size) {
+  g_bench_allocs++;
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  g_bench_allocs++;
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+  g_bench_allocs++;
+  return __libc_realloc(pointer, size);
+}
+
+void free(void* pointer) {
+  __libc_free(pointer);
+}
+#else
+#define BENCH_ALLOCS 0
+static uint64_t g_bench_allocs = 0;
+#endif
+
+// Syscalls
+
+// Calls fn calls times, counting its allocations.
+static inline void bench_calls(void (*fn)(void* ctx), void* ctx, uint64_t calls, uint64_t* allocs) {
+  uint64_t before = g_bench_allocs;
+  for (uint64_t i = 0; i < calls; i++) fn(ctx);
+  *allocs = g_bench_allocs - before;
+}
+
+#if defined(__linux__) && defined(PTRACE_GET_SYSCALL_INFO)
+// close() on these descriptors fails harmlessly and marks where the traced
+// pass starts and ends.
+#define BENCH_MARK_START -4201
+#define BENCH_MARK_STOP -4202
+
+// The tracer child: counts the syscall entries of target between the two
+// markers and writes the count (-1 when it cannot trace) to fd.
+static inline void bench_tracer(pid_t target, int go, int fd) {
+  int64_t count = -1;
+  char byte;
+  if (read(go, &byte, 1) != 1 || ptrace(PTRACE_SEIZE, target, 0, PTRACE_O_TRACESYSGOOD) != 0
+      || ptrace(PTRACE_INTERRUPT, target, 0, 0) != 0) {
+    if (write(fd, &count, sizeof(count)) < 0) _exit(1);
+    _exit(0);
+  }
+  count = 0;
+  if (write(fd, &count, sizeof(count)) < 0) _exit(1);
+
+  bool counting = false;
+  int status = 0;
+  while (waitpid(target, &status, __WALL) == target && WIFSTOPPED(status)) {
+    int signal = 0;
+    if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+      struct __ptrace_syscall_info info;
+      if (ptrace(PTRACE_GET_SYSCALL_INFO, target, sizeof(info), &info) > 0
+          && info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+        bool mark = info.entry.nr == SYS_close;
+        if (mark && (int)info.entry.args[0] == BENCH_MARK_START) {
+          counting = true;
+        } else if (mark && (int)info.entry.args[0] == BENCH_MARK_STOP) {
+          ptrace(PTRACE_DETACH, target, 0, 0);
+          if (write(fd, &count, sizeof(count)) < 0) _exit(1);
+          _exit(0);
+        } else if (counting) {
+          count++;
+        }
+      }
+    } else if (status >> 16 != PTRACE_EVENT_STOP) {
+      // A signal for the target, passed on.
+      signal = WSTOPSIG(status);
+    }
+    ptrace(PTRACE_SYSCALL, target, 0, signal);
+  }
+  _exit(1);
+}
+
+// Calls fn calls times under the tracer (untraced when it cannot trace, and
+// then returns -1).
+static inline int64_t bench_count(void (*fn)(void* ctx), void* ctx, uint64_t calls, uint64_t* allocs) {
+  int go[2], result[2];
+  if (pipe(go) != 0) {
+    bench_calls(fn, ctx, calls, allocs);
+    return -1;
+  }
+  if (pipe(result) != 0) {
+    close(go[0]);
+    close(go[1]);
+    bench_calls(fn, ctx, calls, allocs);
+    return -1;
+  }
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(go[1]);
+    close(result[0]);
+    bench_tracer(getppid(), go[0], result[1]);
+  }
+  close(go[0]);
+  close(result[1]);
+
+  int64_t count = -1;
+  if (pid > 0) {
+    // Yama only lets a child trace its parent when the parent asks for it.
+    prctl(PR_SET_PTRACER, pid, 0, 0, 0);
+    int64_t ready = -1;
+    if (write(go[1], "g", 1) == 1 && read(result[0], &ready, sizeof(ready)) == sizeof(ready)
+        && ready == 0) {
+      close(BENCH_MARK_START);
+      bench_calls(fn, ctx, calls, allocs);
+      close(BENCH_MARK_STOP);
+      if (read(result[0], &count, sizeof(count)) != sizeof(count)) count = -1;
+    }
+    waitpid(pid, NULL, 0);
+  }
+  if (count < 0) bench_calls(fn, ctx, calls, allocs);
+  close(go[1]);
+  close(result[0]);
+  return count;
+}
+#elif defined(__APPLE__)
+static inline uint64_t bench_task_syscalls(void) {
+  task_events_info_data_t info;
+  mach_msg_type_number_t count = TASK_EVENTS_INFO_COUNT;
+  if (task_info(mach_task_self(), TASK_EVENTS_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+    return 0;
+  }
+  return (uint64_t)info.syscalls_unix + (uint64_t)info.syscalls_mach;
+}
+
+static inline int64_t bench_count(void (*fn)(void* ctx), void* ctx, uint64_t calls, uint64_t* allocs) {
+  // Reading the counters is a Mach call itself; two reads in a row measure
+  // how much that adds.
+  uint64_t first = bench_task_syscalls();
+  uint64_t start = bench_task_syscalls();
+  bench_calls(fn, ctx, calls, allocs);
+  if (start == 0) return -1;
+  uint64_t end = bench_task_syscalls();
+  uint64_t overhead = start - first;
+  return end - start > overhead ? (int64_t)(end - start - overhead) : 0;
+}
+#else
+static inline int64_t bench_count(void (*fn)(void* ctx), void* ctx, uint64_t calls, uint64_t* allocs) {
+  bench_calls(fn, ctx, calls, allocs);
+  return -1;
+}
+#endif
+
+// Results
+
+struct bench_result {
+  double ns_per_op;
+  double p50_ns;
+  double p99_ns;
+  uint64_t ops;
+  // Per call over the counting pass; negative when not counted.
+  double allocs_per_op;
+  double syscalls_per_op;
+  uint64_t counted_ops;
+};
+
+static inline int bench_compare_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+static inline void bench_write_json(const char* file, const char* name,
+                                    const struct bench_result* result) {
+  const char* path = getenv("BENCH_JSON");
+  if (!path || !*path) return;
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) return;
+
+  // The program is the source file's name without its extension.
+  const char* slash = strrchr(file, '/');
+  const char* program = slash ? slash + 1 : file;
+  size_t length = strcspn(program, ".");
+
+  // One line per result, written in one go so lines never interleave.
+  char buffer[1024];
+  struct json_writer json;
+  json_init(&json, buffer, sizeof(buffer), -1);
+  json_begin_object(&json);
+  json_key(&json, "program");
+  json_string_n(&json, program, length);
+  json_field_string(&json, "name", name);
+  const char* commit = getenv("BENCH_COMMIT");
+  if (commit && *commit) json_field_string(&json, "commit", commit);
+  json_field_double(&json, "ns_per_op", result->ns_per_op, 2);
+  json_field_double(&json, "p50_ns", result->p50_ns, 2);
+  json_field_double(&json, "p99_ns", result->p99_ns, 2);
+  json_field_uint(&json, "ops", result->ops);
+  json_key(&json, "allocs_per_op");
+  if (result->allocs_per_op < 0) json_null(&json);
+  else json_double(&json, result->allocs_per_op, 3);
+  json_key(&json, "syscalls_per_op");
+  if (result->syscalls_per_op < 0) json_null(&json);
+  else json_double(&json, result->syscalls_per_op, 3);
+  json_field_uint(&json, "counted_ops", result->counted_ops);
+  json_end_object(&json);
+  if (json_finish(&json) && write(fd, buffer, json.length) < 0) {
+    fprintf(stderr, "bench: could not write %s\n", path);
+  }
+  close(fd);
+}
+
+static inline void bench_print_count(double value, const char* unit) {
+  if (value < 0) printf(" %8s %s", "-", unit);
+  else printf(" %8.2f %s", value, unit);
+}
+
+static inline double bench_run_in(const char* file, const char* name,
+                                  void (*fn)(void* ctx), void* ctx) {
+  // Warm up caches and branch predictors before measuring, and size the
+  // groups from it.
+  uint64_t start = bench_now_ns();
+  for (int i = 0; i < 1000; i++) fn(ctx);
+  uint64_t warmup = bench_now_ns() - start;
+  uint64_t group = BENCH_GROUP_NS * 1000 / (warmup + 1);
+  if (group < 1) group = 1;
+
+  // Group times, thinned to every other one whenever the buffer fills up so
+  // the samples always span the whole run.
+  static uint64_t samples[BENCH_SAMPLES];
+  size_t kept = 0;
+  uint64_t stride = 1;
+  uint64_t groups = 0;
+
+  uint64_t iterations = 0;
+  start = bench_now_ns();
+  uint64_t mark = start;
+  uint64_t elapsed = 0;
+  while (elapsed < BENCH_MIN_NS) {
+    for (uint64_t i = 0; i < group; i++) fn(ctx);
+    uint64_t now = bench_now_ns();
+    if (groups % stride == 0) {
+      if (kept == BENCH_SAMPLES) {
+        for (size_t i = 0; i < BENCH_SAMPLES / 2; i++) samples[i] = samples[2 * i];
+        kept = BENCH_SAMPLES / 2;
+        stride *= 2;
+      }
+      if (groups % stride == 0) samples[kept++] = now - mark;
+    }
+    groups++;
+    mark = now;
+    iterations += group;
+    elapsed = now - start;
+  }
+  qsort(samples, kept, sizeof(uint64_t), bench_compare_u64);
+
+  struct bench_result result = { 0 };
+  result.ns_per_op = (double)elapsed / (double)iterations;
+  result.p50_ns = (double)samples[kept / 2] / (double)group;
+  result.p99_ns = (double)samples[kept * 99 / 100] / (double)group;
+  result.ops = iterations;
+
+  uint64_t calls = BENCH_COUNT_NS / ((uint64_t)result.ns_per_op + 1);
+  if (calls < 1) calls = 1;
+  if (calls > 1000) calls = 1000;
+  result.counted_ops = calls;
+  uint64_t allocs = 0;
+  int64_t syscalls = bench_count(fn, ctx, calls, &allocs);
+  result.allocs_per_op = BENCH_ALLOCS ? (double)allocs / (double)calls : -1.0;
+  result.syscalls_per_op = syscalls >= 0 ? (double)syscalls / (double)calls : -1.0;
+
+  printf("%-40s %12.1f ns/op %10.1f p50 %10.1f p99", name, result.ns_per_op, result.p50_ns,
+         result.p99_ns);
+  bench_print_count(result.allocs_per_op, "allocs/op");
+  bench_print_count(result.syscalls_per_op, "syscalls/op");
+  printf(" %12llu ops\n", (unsigned long long)iterations);
+  bench_write_json(file, name, &result);
+  return result.ns_per_op;
+}
+
+#define bench_run(name, fn, ctx) bench_run_in(__FILE__, name, fn, ctx)
@@ -0,0 +1,246 @@
+// Async sender and resilient mode from helpers/sketchybar.h, over a transport
+// that records what reaches the "bar":
+//
+// - check: with the sender thread held inside a send, two partial messages
+//   under one key must both arrive, in order; two full-state messages must
+//   coalesce to the newest; full state must replace a partial one queued
+//   before it but not one queued after it. A partial message dropped from a
+//   full ring, or sent while the bar is away, must move the resync
+//   generation; a reconnect must replay only full-state messages, then send
+//   the partial one that found the bar back. A relaunch's resync signal must
+//   make the next send replay the full state first, and move the generation.
+// - enqueue: sketchybar_send() and sketchybar_send_partial() on the caller's
+//   thread
+
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../sketchybar.h"
+
+#define RECEIVED_MAX 64
+#define WAIT_NS 2000000000ull
+
+// What the bar received, each message as its arguments joined by spaces.
+struct bar {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  bool hold;
+  bool held;
+  bool connectable;
+  int count;
+  char received[RECEIVED_MAX][256];
+};
+
+static struct bar g_bar = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                            false, false, true, 0, { { 0 } } };
+
+static bool bar_connect(void) {
+  return g_bar.connectable;
+}
+
+// With hold set, the send that takes the message stays in here until the
+// hold is released, like a send to a stalled bar.
+static bool bar_send(char* message, uint32_t length) {
+  pthread_mutex_lock(&g_bar.lock);
+  if (g_bar.count < RECEIVED_MAX) {
+    char* out = g_bar.received[g_bar.count++];
+    uint32_t n = 0;
+    for (uint32_t i = 0; i + 1 < length && n + 1 < sizeof(g_bar.received[0]); i++) {
+      out[n++] = message[i] ? message[i] : ' ';
+    }
+    while (n > 0 && out[n - 1] == ' ') n--;
+    out[n] = '\0';
+  }
+  g_bar.held = g_bar.hold;
+  pthread_cond_broadcast(&g_bar.changed);
+  while (g_bar.hold) pthread_cond_wait(&g_bar.changed, &g_bar.lock);
+  g_bar.held = false;
+  pthread_mutex_unlock(&g_bar.lock);
+  return true;
+}
+
+static void bar_disconnect(void) {
+}
+
+static const struct sketchybar_transport g_bar_transport = {
+  .name = "bar",
+  .connect = bar_connect,
+  .send = bar_send,
+  .disconnect = bar_disconnect,
+};
+
+static void bar_reset(void) {
+  pthread_mutex_lock(&g_bar.lock);
+  g_bar.count = 0;
+  pthread_mutex_unlock(&g_bar.lock);
+}
+
+static bool send_text(const char* text, bool partial) {
+  char message[256];
+  snprintf(message, sizeof(message), "%s", text);
+  char formatted[258];
+  uint32_t length = format_message(message, formatted);
+  return partial ? sketchybar_send_partial(formatted, length) : sketchybar_send(formatted, length);
+}
+
+// Blocks the sender thread inside the send of a message of its own.
+static bool hold_sender(void) {
+  pthread_mutex_lock(&g_bar.lock);
+  g_bar.hold = true;
+  pthread_mutex_unlock(&g_bar.lock);
+  send_text("--set blocker drawing=on", false);
+
+  uint64_t deadline = bench_now_ns() + WAIT_NS;
+  pthread_mutex_lock(&g_bar.lock);
+  while (!g_bar.held && bench_now_ns() < deadline) {
+    pthread_mutex_unlock(&g_bar.lock);
+    usleep(1000);
+    pthread_mutex_lock(&g_bar.lock);
+  }
+  bool held = g_bar.held;
+  pthread_mutex_unlock(&g_bar.lock);
+  return held;
+}
+
+// Lets the sender go and waits until the ring is empty and nothing is in
+// flight.
+static bool release_sender(void) {
+  pthread_mutex_lock(&g_bar.lock);
+  g_bar.hold = false;
+  pthread_cond_broadcast(&g_bar.changed);
+  pthread_mutex_unlock(&g_bar.lock);
+
+  uint64_t deadline = bench_now_ns() + WAIT_NS;
+  for (;;) {
+    struct sb_async_stats stats;
+    sketchybar_async_stats(&stats);
+    uint64_t done = stats.sent + stats.timed_out + stats.coalesced + stats.dropped
+                    + stats.oversized;
+    if (done == stats.enqueued) return true;
+    if (bench_now_ns() > deadline) return false;
+    usleep(1000);
+  }
+}
+
+// The bar received exactly these messages after the blocker, in order.
+static bool received(const char* name, const char* const* expected, int count) {
+  bool ok = g_bar.count == count + 1 && strcmp(g_bar.received[0], "--set blocker drawing=on") == 0;
+  for (int i = 0; ok && i < count; i++) ok = strcmp(g_bar.received[i + 1], expected[i]) == 0;
+  if (!ok) {
+    fprintf(stderr, "%s: received %d messages\n", name, g_bar.count);
+    for (int i = 0; i < g_bar.count; i++) fprintf(stderr, "  %s\n", g_bar.received[i]);
+  }
+  return ok;
+}
+
+// Resilient mode, on the caller's thread (before the sender thread starts).
+static bool check_resilient(void) {
+  g_resilient.enabled = true;
+  bar_reset();
+  g_bar.connectable = false;
+  uint64_t generation = sketchybar_resync_generation();
+  bool lost = !send_text("--trigger stats cpu=1", true);
+  bool moved = sketchybar_resync_generation() != generation;
+
+  g_resilient.next_attempt_ns = 0;
+  send_text("--add event stats", false);
+  g_resilient.next_attempt_ns = 0;
+  send_text("--trigger stats cpu=2 temp=40", false);
+  g_resilient.next_attempt_ns = 0;
+  send_text("--trigger stats cpu=3", true);
+
+  g_bar.connectable = true;
+  g_resilient.next_attempt_ns = 0;
+  generation = sketchybar_resync_generation();
+  bool sent = send_text("--trigger stats cpu=4", true);
+  bool replayed = g_bar.count == 3 && strcmp(g_bar.received[0], "--add event stats") == 0
+                  && strcmp(g_bar.received[1], "--trigger stats cpu=2 temp=40") == 0
+                  && strcmp(g_bar.received[2], "--trigger stats cpu=4") == 0;
+  bool resynced = sketchybar_resync_generation() != generation;
+
+  bar_reset();
+  generation = sketchybar_resync_generation();
+  sb_resync_signal(SIGUSR1);
+  bool signalled = sketchybar_resync_generation() != generation;
+  send_text("--trigger stats cpu=5", true);
+  bool reloaded = g_bar.count == 3 && strcmp(g_bar.received[0], "--add event stats") == 0
+                  && strcmp(g_bar.received[1], "--trigger stats cpu=2 temp=40") == 0
+                  && strcmp(g_bar.received[2], "--trigger stats cpu=5") == 0;
+  g_resilient.enabled = false;
+
+  if (!lost || !moved || !sent || !replayed || !resynced || !signalled || !reloaded) {
+    fprintf(stderr,
+            "resilient: lost %d moved %d sent %d replayed %d resynced %d signalled %d"
+            " reloaded %d\n",
+            lost, moved, sent, replayed, resynced, signalled, reloaded);
+    for (int i = 0; i < g_bar.count; i++) fprintf(stderr, "  %s\n", g_bar.received[i]);
+    return false;
+  }
+  return true;
+}
+
+static bool check_async(void) {
+  bar_reset();
+  bool ok = hold_sender();
+  send_text("--trigger stats cpu_total=10", true);
+  send_text("--trigger stats cpu_temp=50", true);
+  ok = ok && release_sender();
+  static const char* const partials[] = { "--trigger stats cpu_total=10",
+                                          "--trigger stats cpu_temp=50" };
+  ok = ok && received("two partial messages", partials, 2);
+
+  bar_reset();
+  ok = ok && hold_sender();
+  send_text("--trigger network upload=1", false);
+  send_text("--trigger network upload=2", false);
+  ok = ok && release_sender();
+  static const char* const fulls[] = { "--trigger network upload=2" };
+  ok = ok && received("two full messages", fulls, 1);
+
+  bar_reset();
+  ok = ok && hold_sender();
+  send_text("--trigger stats cpu_total=11", true);
+  send_text("--trigger stats cpu_total=12 cpu_temp=51", false);
+  send_text("--trigger stats cpu_temp=52", true);
+  ok = ok && release_sender();
+  static const char* const mixed[] = { "--trigger stats cpu_total=12 cpu_temp=51",
+                                       "--trigger stats cpu_temp=52" };
+  ok = ok && received("partial, full, partial", mixed, 2);
+
+  bar_reset();
+  ok = ok && hold_sender();
+  uint64_t generation = sketchybar_resync_generation();
+  // The blocker already left the ring, so it takes one more than it holds.
+  for (int i = 0; i <= SB_ASYNC_SLOTS; i++) send_text("--trigger stats cpu_total=1", true);
+  bool moved = sketchybar_resync_generation() != generation;
+  ok = ok && release_sender();
+  if (!moved) fprintf(stderr, "a partial message dropped from a full ring kept the generation\n");
+  return ok && moved;
+}
+
+static void bench_full(void* ctx) {
+  (void)ctx;
+  static char message[] = "--trigger\0network\0upload=1.00\0download=2.00\0";
+  g_bench_sink += sketchybar_send(message, sizeof(message));
+}
+
+static void bench_partial(void* ctx) {
+  (void)ctx;
+  static char message[] = "--trigger\0stats\0cpu_total=10\0cpu_temp=50\0";
+  g_bench_sink += sketchybar_send_partial(message, sizeof(message));
+}
+
+int main(void) {
+  sketchybar_set_transport(&g_bar_transport);
+  if (!check_resilient()) return 1;
+  if (!sketchybar_async_start(250)) return 1;
+  if (!check_async()) return 1;
+  printf("async: partial messages under one key all arrive in order, full state coalesces"
+         " and replaces earlier partials, lost partials move the resync generation,"
+         " reconnects and resync signals replay only full state\n");
+
+  bar_reset();
+  bench_run("sketchybar_send (async, full)", bench_full, NULL);
+  bench_run("sketchybar_send_partial (async)", bench_partial, NULL);
+  return 0;
+}
@@ -0,0 +1,138 @@
+// Per-core CPU collector from helpers/system_stats/cpu.h:
+//
+// - compute: the single-pass delta/load/cluster math over a synthetic
+//   snapshot, against a straightforward per-core reference
+// - update: a full cpu_update() through the platform source (/proc/stat or
+//   host_processor_info)
+//
+// The synthetic run doubles as a correctness check: loads and cluster
+// aggregates must match the reference for every core count up to the max.
+
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../system_stats/cpu.h"
+
+struct synthetic {
+  uint64_t step;
+  int count;
+};
+
+static uint64_t synthetic_ticks(uint64_t step, int core, int state) {
+  // Large bases so the 64-bit counters are well past 32 bits.
+  uint64_t rate = (uint64_t)((core * 7 + state * 13) % 31 + 1);
+  return (1ull << 40) + (uint64_t)core * 977 + step * rate * 3;
+}
+
+static bool synthetic_read(void* context, struct cpu_ticks* out) {
+  struct synthetic* synthetic = context;
+  for (int state = 0; state < CPU_TICK_STATES; state++) {
+    for (int i = 0; i < synthetic->count; i++) {
+      out->ticks[state][i] = synthetic_ticks(synthetic->step, i, state);
+    }
+  }
+  out->count = synthetic->count;
+  synthetic->step++;
+  return true;
+}
+
+static void synthetic_clusters(void* context, uint8_t* kinds, int count) {
+  (void)context;
+  for (int i = 0; i < count; i++) kinds[i] = i < count / 3 ? CPU_CLUSTER_E : CPU_CLUSTER_P;
+}
+
+static int reference_load(uint64_t busy, uint64_t total) {
+  return total ? (int)((double)busy / (double)total * 100.0) : 0;
+}
+
+static bool check(struct cpu* cpu, uint64_t step) {
+  uint64_t user = 0, sys = 0, all = 0, e_busy = 0, e_all = 0;
+  for (int i = 0; i < cpu->core_count; i++) {
+    uint64_t d[CPU_TICK_STATES];
+    for (int state = 0; state < CPU_TICK_STATES; state++) {
+      d[state] = synthetic_ticks(step, i, state) - synthetic_ticks(step - 1, i, state);
+    }
+    uint64_t core_user = d[CPU_TICK_USER] + d[CPU_TICK_NICE];
+    uint64_t core_busy = core_user + d[CPU_TICK_SYSTEM];
+    uint64_t core_all = core_busy + d[CPU_TICK_IDLE];
+    int load = reference_load(core_busy, core_all);
+    // Float vs double rounding may differ by one at exact boundaries.
+    if (abs(load - cpu->core_load[i]) > 1) {
+      fprintf(stderr, "core %d: load %d, expected %d\n", i, cpu->core_load[i], load);
+      return false;
+    }
+    user += core_user;
+    sys += d[CPU_TICK_SYSTEM];
+    all += core_all;
+    if (cpu->core_cluster[i] == CPU_CLUSTER_E) {
+      e_busy += core_busy;
+      e_all += core_all;
+    }
+  }
+
+  int e_load = cpu->e_count ? reference_load(e_busy, e_all) : -1;
+  int p_load = cpu->p_count ? reference_load(user + sys - e_busy, all - e_all) : -1;
+  if (cpu->user_load != reference_load(user, all)
+      || cpu->sys_load != reference_load(sys, all)
+      || cpu->e_load != e_load
+      || cpu->p_load != p_load) {
+    fprintf(stderr, "%d cores: aggregates differ\n", cpu->core_count);
+    return false;
+  }
+  return true;
+}
+
+static struct cpu g_cpu;
+static struct synthetic g_synthetic;
+
+static void bench_compute(void* ctx) {
+  (void)ctx;
+  cpu_compute(&g_cpu, &g_cpu.snapshots[0], &g_cpu.snapshots[1]);
+  g_bench_sink += (uint64_t)g_cpu.total_load;
+}
+
+static void bench_update(void* ctx) {
+  struct cpu* cpu = ctx;
+  cpu_update(cpu);
+  g_bench_sink += (uint64_t)cpu->total_load;
+}
+
+int main(void) {
+  for (int count = 1; count <= CPU_MAX_CORES; count++) {
+    g_synthetic = (struct synthetic){ .step = 1, .count = count };
+    cpu_init_with(&g_cpu, (struct cpu_source){ "synthetic",
+                                               synthetic_read,
+                                               synthetic_clusters,
+                                               &g_synthetic });
+    for (int round = 0; round < 3; round++) {
+      cpu_update(&g_cpu);
+      if (round > 0 && !check(&g_cpu, g_synthetic.step - 1)) return 1;
+    }
+  }
+  printf("cpu_compute matches the reference for 1..%d cores\n", CPU_MAX_CORES);
+
+  int counts[] = { 8, 12, 64, 256 };
+  for (int i = 0; i < 4; i++) {
+    g_synthetic = (struct synthetic){ .step = 1, .count = counts[i] };
+    cpu_init_with(&g_cpu, (struct cpu_source){ "synthetic",
+                                               synthetic_read,
+                                               synthetic_clusters,
+                                               &g_synthetic });
+    cpu_update(&g_cpu);
+    cpu_update(&g_cpu);
+    char name[64];
+    snprintf(name, sizeof(name), "cpu_compute %d cores", counts[i]);
+    bench_run(name, bench_compute, NULL);
+  }
+
+  static struct cpu platform;
+  cpu_init(&platform);
+  cpu_update(&platform);
+  if (platform.core_count > 0) {
+    char name[64];
+    snprintf(name, sizeof(name), "cpu_update %s %d cores (%dP/%dE)",
+             platform.source.name, platform.core_count, platform.p_count, platform.e_count);
+    bench_run(name, bench_update, &platform);
+  }
+  return 0;
+}
@@ -0,0 +1,207 @@
+// Disk collector from helpers/system_stats/disk.h:
+//
+// - check: generated /proc/diskstats files with partitions, virtual devices,
+//   a disk that appears, one that resets its counters and a reordering,
+//   read through the proc source; every disk's rates and the totals are
+//   compared against the counters written; a file cut off mid-line (a read
+//   that filled the buffer) must not report the cut line as a disk
+// - update: disk_update() over 16 synthetic disks, and through the platform
+//   source
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../system_stats/disk.h"
+
+#define STEPS 12
+#define STEP_NS 2000000000ull
+
+struct device {
+  const char* name;
+  // Whole disks are reported; partitions and virtual devices are not.
+  bool disk;
+  // Bytes read per step (writes are a third), one op per 16 KB.
+  uint64_t rate;
+  int appears;
+  int resets;
+};
+
+static const struct device g_devices[] = {
+  { "loop0", false, 4096, 0, -1 },
+  { "sda", true, 8 << 20, 0, 7 },
+  { "sda1", false, 6 << 20, 0, -1 },
+  { "sda2", false, 2 << 20, 0, -1 },
+  { "nvme0n1", true, 64 << 20, 0, -1 },
+  { "nvme0n1p1", false, 64 << 20, 0, -1 },
+  { "mmcblk0", true, 1 << 20, 4, -1 },
+  { "mmcblk0p1", false, 1 << 20, 4, -1 },
+  { "dm-0", false, 64 << 20, 0, -1 },
+  { "zram0", false, 1 << 20, 0, -1 },
+};
+
+#define DEVICES (int)(sizeof(g_devices) / sizeof(g_devices[0]))
+
+static bool present(const struct device* device, int step) {
+  return step >= device->appears;
+}
+
+static uint64_t bytes_read(const struct device* device, int step) {
+  uint64_t steps = (uint64_t)step + 1000;
+  if (device->resets >= 0 && step >= device->resets) steps = (uint64_t)(step - device->resets);
+  return steps * device->rate;
+}
+
+static void write_step(const char* path, int step) {
+  char text[4096];
+  int length = 0;
+  // From step 9 on the disks are listed in another order (each still ahead
+  // of its partitions, as the kernel lists them).
+  static const int reordered[DEVICES] = { 9, 6, 7, 0, 8, 4, 5, 1, 2, 3 };
+  for (int k = 0; k < DEVICES; k++) {
+    int i = step >= 9 ? reordered[k] : k;
+    const struct device* device = &g_devices[i];
+    if (!present(device, step)) continue;
+    uint64_t read = bytes_read(device, step);
+    uint64_t written = read / 3;
+    length += snprintf(text + length, sizeof(text) - (size_t)length,
+                       "%4d %7d %s %llu 17 %llu 930 %llu 4 %llu 1200 0 2100 3000 0 0 0 0 0 0\n",
+                       8, i, device->name,
+                       (unsigned long long)(read >> 14), (unsigned long long)(read / 512),
+                       (unsigned long long)(written >> 14), (unsigned long long)(written / 512));
+  }
+  FILE* file = fopen(path, "w");
+  fputs(text, file);
+  fclose(file);
+}
+
+static bool near(double value, double want) {
+  return fabs(value - want) <= 1e-6 * (want > 1.0 ? want : 1.0);
+}
+
+static bool check_step(const struct disk* disk, int step) {
+  int expected_count = 0;
+  double read_total = 0.0, write_total = 0.0, ops_total = 0.0;
+  double seconds = STEP_NS / 1e9;
+  for (int i = 0; i < DEVICES; i++) {
+    const struct device* device = &g_devices[i];
+    if (!device->disk || !present(device, step)) continue;
+    expected_count++;
+
+    const struct disk_rate* rate = NULL;
+    for (int j = 0; j < disk->count; j++) {
+      if (strcmp(disk->rates[j].name, device->name) == 0) rate = &disk->rates[j];
+    }
+    if (!rate) {
+      fprintf(stderr, "step %d: %s missing\n", step, device->name);
+      return false;
+    }
+
+    double read = 0.0, written = 0.0, reads = 0.0, writes = 0.0;
+    if (step > 0 && present(device, step - 1) && step != device->resets) {
+      uint64_t now = bytes_read(device, step), before = bytes_read(device, step - 1);
+      read = (double)(now - before) / seconds;
+      written = (double)(now / 3 - before / 3) / seconds;
+      reads = (double)((now >> 14) - (before >> 14)) / seconds;
+      writes = (double)(((now / 3) >> 14) - ((before / 3) >> 14)) / seconds;
+    }
+    // Sectors are 512 bytes, so bytes are only exact to a sector.
+    if (fabs(rate->read_bps - read) > 512 / seconds || fabs(rate->write_bps - written) > 512 / seconds
+        || !near(rate->read_iops, reads) || !near(rate->write_iops, writes)) {
+      fprintf(stderr, "step %d: %s %.0f/%.0f B/s %.1f/%.1f op/s, expected %.0f/%.0f %.1f/%.1f\n",
+              step, device->name, rate->read_bps, rate->write_bps, rate->read_iops,
+              rate->write_iops, read, written, reads, writes);
+      return false;
+    }
+    read_total += rate->read_bps;
+    write_total += rate->write_bps;
+    ops_total += rate->read_iops + rate->write_iops;
+  }
+
+  if (disk->count != expected_count || !near(disk->read_bps, read_total)
+      || !near(disk->write_bps, write_total)
+      || !near(disk->read_iops + disk->write_iops, ops_total)) {
+    fprintf(stderr, "step %d: %d disks, totals differ\n", step, disk->count);
+    return false;
+  }
+  return true;
+}
+
+static bool check(void) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/bench_disk_XXXXXX");
+  int fd = mkstemp(path);
+  if (fd < 0) return false;
+  close(fd);
+
+  static struct disk disk;
+  disk_init_with(&disk, disk_proc_source(path));
+  bool ok = true;
+  for (int step = 0; ok && step < STEPS; step++) {
+    write_step(path, step);
+    ok = disk_update(&disk, 1000000000ull + (uint64_t)step * STEP_NS) && check_step(&disk, step);
+  }
+
+  // The last line lost its newline and counters: not a device.
+  FILE* file = fopen(path, "w");
+  fputs("   8       0 sda 100 17 200 930 50 4 100 1200 0 2100 3000\n   8      16 sdb 10", file);
+  fclose(file);
+  disk_reset(&disk);
+  if (ok && (!disk_update(&disk, 1000000000ull) || disk.count != 1
+             || strcmp(disk.rates[0].name, "sda") != 0)) {
+    fprintf(stderr, "truncated line: %d disks\n", disk.count);
+    ok = false;
+  }
+
+  disk_proc_source(NULL);
+  unlink(path);
+  return ok;
+}
+
+struct synthetic {
+  uint64_t calls;
+};
+
+static bool synthetic_read(void* context, struct disk_snapshot* out) {
+  struct synthetic* synthetic = context;
+  synthetic->calls++;
+  out->count = 16;
+  for (int i = 0; i < 16; i++) {
+    struct disk_counters* entry = &out->entries[i];
+    // The names only need filling once per snapshot buffer.
+    if (synthetic->calls <= 2) snprintf(entry->name, sizeof(entry->name), "disk%d", i);
+    entry->bytes_read = synthetic->calls * (uint64_t)(i + 1) * 65536;
+    entry->bytes_written = synthetic->calls * (uint64_t)(i + 1) * 16384;
+    entry->reads = synthetic->calls * (uint64_t)(i + 1) * 4;
+    entry->writes = synthetic->calls * (uint64_t)(i + 1);
+  }
+  return true;
+}
+
+static void bench_update(void* ctx) {
+  struct disk* disk = ctx;
+  static uint64_t now = 0;
+  now += STEP_NS;
+  disk_update(disk, now);
+  g_bench_sink += (uint64_t)disk->read_iops;
+}
+
+int main(void) {
+  if (!check()) return 1;
+  printf("disk: %d steps with partitions, virtual devices, a new disk, a reset and a reorder"
+         " match the written counters\n", STEPS);
+
+  static struct synthetic synthetic;
+  static struct disk disk;
+  disk_init_with(&disk, (struct disk_source){ "synthetic", synthetic_read, &synthetic });
+  bench_run("disk_update 16 synthetic disks", bench_update, &disk);
+
+  static struct disk platform;
+  disk_init(&platform);
+  if (disk_update(&platform, 0)) {
+    char name[64];
+    snprintf(name, sizeof(name), "disk_update %s (%d disks)", platform.source.name, platform.count);
+    bench_run(name, bench_update, &platform);
+  }
+  return 0;
+}
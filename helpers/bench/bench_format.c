@@ -0,0 +1,203 @@
+// Tokenizer equivalence fuzzing and throughput.
+//
+// 1. Random command strings that the previous format_message() handled
+//    correctly (no backslashes, no quote character inside a span quoted with
+//    the other one) must produce byte-identical output with the new
+//    tokenizer, both the scalar and the vectorized scan.
+// 2. Escaped quotes and apostrophes inside double quotes, which the previous
+//    implementation mangled, must come out right.
+// 3. Throughput of the previous implementation, the scalar scan and the
+//    vectorized scan on multi-KB payloads.
+
+#include <string.h>
+
+#include "bench.h"
+#include "../sketchybar.h"
+
+#define FUZZ_ITERATIONS 200000
+#define FUZZ_MAX_LENGTH 96
+
+// The implementation format_message() had before the tokenizer rewrite. The
+// caller pre-fills the output with non-NUL bytes, which makes its read of the
+// not yet written byte after the message deterministic.
+static uint32_t legacy_format_message(char* message, char* formatted_message) {
+  char outer_quote = 0;
+  uint32_t caret = 0;
+  uint32_t message_length = strlen(message) + 1;
+  for (uint32_t i = 0; i < message_length; ++i) {
+    if (message[i] == '"' || message[i] == '\'') {
+      if (outer_quote && outer_quote == message[i]) outer_quote = 0;
+      else if (!outer_quote) outer_quote = message[i];
+      continue;
+    }
+    formatted_message[caret] = message[i];
+    if (message[i] == ' ' && !outer_quote) formatted_message[caret] = '\0';
+    caret++;
+  }
+
+  if (caret > 0 && formatted_message[caret] == '\0'
+      && formatted_message[caret - 1] == '\0') {
+    caret--;
+  }
+  formatted_message[caret] = '\0';
+  return caret + 1;
+}
+
+static uint64_t g_rng = 0x9e3779b97f4a7c15ull;
+
+static uint32_t next_random(void) {
+  g_rng ^= g_rng << 13;
+  g_rng ^= g_rng >> 7;
+  g_rng ^= g_rng << 17;
+  return (uint32_t)g_rng;
+}
+
+static bool legacy_handles(const char* message) {
+  char quote = 0;
+  for (const char* c = message; *c; c++) {
+    if (*c == '\\') return false;
+    if (*c != '"' && *c != '\'') continue;
+    if (!quote) quote = *c;
+    else if (*c == quote) quote = 0;
+    else return false;
+  }
+  return true;
+}
+
+static void random_message(char* message, uint32_t length) {
+  static const char alphabet[] = "ab=_-.:;%  \"\"''";
+  for (uint32_t i = 0; i < length; i++) {
+    message[i] = alphabet[next_random() % (sizeof(alphabet) - 1)];
+  }
+  message[length] = '\0';
+}
+
+static bool check_equivalence(void) {
+  char message[FUZZ_MAX_LENGTH + 1];
+  char expected[FUZZ_MAX_LENGTH + 2];
+  char scalar[FUZZ_MAX_LENGTH + 2];
+  char vectorized[FUZZ_MAX_LENGTH + 2];
+
+  uint32_t checked = 0;
+  for (uint32_t n = 0; n < FUZZ_ITERATIONS; n++) {
+    uint32_t length = next_random() % (FUZZ_MAX_LENGTH + 1);
+    random_message(message, length);
+    if (!legacy_handles(message)) continue;
+
+    memset(expected, 0xff, sizeof(expected));
+    uint32_t expected_length = legacy_format_message(message, expected);
+    uint32_t scalar_length = sb_tokenize(message, length, scalar, false);
+    uint32_t vectorized_length = sb_tokenize(message, length, vectorized, true);
+
+    if (scalar_length != expected_length
+        || vectorized_length != expected_length
+        || memcmp(scalar, expected, expected_length) != 0
+        || memcmp(vectorized, expected, expected_length) != 0) {
+      fprintf(stderr, "tokenizer mismatch for [%s]\n", message);
+      return false;
+    }
+    checked++;
+  }
+  printf("%-40s %12u inputs\n", "fuzz equivalence", checked);
+  return true;
+}
+
+static bool check_case(const char* message, const char* expected, uint32_t expected_length) {
+  char formatted[256];
+  uint32_t length = format_message((char*)message, formatted);
+  if (length != expected_length || memcmp(formatted, expected, length) != 0) {
+    fprintf(stderr, "unexpected tokenizer output for [%s]\n", message);
+    return false;
+  }
+  return true;
+}
+
+static bool check_quoting(void) {
+  return check_case("--set a label=\"it's\"", "--set\0a\0label=it's\0", 20)
+         && check_case("--set a label='say \"hi\"'", "--set\0a\0label=say \"hi\"\0", 24)
+         && check_case("--set a label=\"a \\\"b\\\"\"", "--set\0a\0label=a \"b\"\0", 21)
+         && check_case("--set a label=it\\'s\\ ok", "--set\0a\0label=it's ok\0", 23)
+         && check_case("path=C:\\dir", "path=C:\\dir\0", 13);
+}
+
+struct payload {
+  char* message;
+  char* formatted;
+  uint32_t length;
+};
+
+// Dense payloads are many short --set commands; sparse ones carry long values
+// such as the gpu_procs list, where most bytes need no attention.
+static void build_payload(struct payload* payload, uint32_t size, bool dense) {
+  payload->message = malloc(size + 1);
+  payload->formatted = malloc(size + 2);
+
+  uint32_t caret = 0;
+  uint32_t item = 0;
+  while (caret < size) {
+    char chunk[128];
+    int written = dense
+                  ? snprintf(chunk,
+                             sizeof(chunk),
+                             "--set widgets.row.%u label=\"process name %u with spaces\" icon='x' ",
+                             item,
+                             item)
+                  : snprintf(chunk,
+                             sizeof(chunk),
+                             "%s'com.example.Process%u:%u;",
+                             item == 0 ? "--trigger system_stats_update gpu_procs=" : "",
+                             item,
+                             item * 7919);
+    item++;
+    if (caret + (uint32_t)written > size) break;
+    memcpy(payload->message + caret, chunk, written);
+    caret += written;
+  }
+  if (!dense && caret > 0) payload->message[caret - 1] = '\'';
+  payload->message[caret] = '\0';
+  payload->length = caret;
+}
+
+static void run_legacy(void* ctx) {
+  struct payload* payload = ctx;
+  g_bench_sink += legacy_format_message(payload->message, payload->formatted);
+}
+
+static void run_scalar(void* ctx) {
+  struct payload* payload = ctx;
+  g_bench_sink += sb_tokenize(payload->message, payload->length, payload->formatted, false);
+}
+
+static void run_vectorized(void* ctx) {
+  struct payload* payload = ctx;
+  g_bench_sink += sb_tokenize(payload->message, payload->length, payload->formatted, true);
+}
+
+static void report_throughput(const char* name,
+                              const char* kind,
+                              void (*fn)(void*),
+                              struct payload* payload) {
+  char label[64];
+  snprintf(label, sizeof(label), "%s %s %uB", name, kind, payload->length);
+  double ns = bench_run(label, fn, payload);
+  printf("%-40s %12.1f MB/s\n", "", (double)payload->length / ns * 1e3);
+}
+
+int main(void) {
+  if (!check_equivalence() || !check_quoting()) return 1;
+
+  const uint32_t sizes[] = { 1024, 4096, 16384 };
+  for (int dense = 1; dense >= 0; dense--) {
+    const char* kind = dense ? "dense" : "sparse";
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+      struct payload payload;
+      build_payload(&payload, sizes[i], dense);
+      report_throughput("legacy", kind, run_legacy, &payload);
+      report_throughput("scalar", kind, run_scalar, &payload);
+      report_throughput("vectorized", kind, run_vectorized, &payload);
+      free(payload.message);
+      free(payload.formatted);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,271 @@
+// Per-process GPU and energy rate tracker from helpers/system_stats/gpu_procs.h,
+// driven by a fake process source: a few thousand processes that start and
+// exit (with pid reuse), some of which cannot be inspected.
+//
+// - check: after every update the GPU and energy top-N lists must equal a
+//   full rescan that computes every process' rates and sorts them all, with
+//   one counter read per process and update for both
+// - update: one tracker update over the whole process list
+// - rescan: the previous approach, attaching to every process each sample
+//   and sorting everything
+
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../system_stats/gpu_procs.h"
+
+#define FAKE_PIDS 4096
+#define TOP_N 10
+
+struct fake_proc {
+  bool alive;
+  bool hidden;
+  uint32_t generation;
+  struct gpu_proc_counters counters;
+  struct gpu_proc_counters prev;
+  bool has_prev;
+  bool churned;
+};
+
+struct fake {
+  struct fake_proc procs[FAKE_PIDS];
+  uint64_t rng;
+  uint64_t attaches;
+  uint64_t reads;
+};
+
+static uint32_t fake_random(struct fake* fake) {
+  fake->rng = fake->rng * 6364136223846793005ull + 1442695040888963407ull;
+  return (uint32_t)(fake->rng >> 33);
+}
+
+static int fake_list(void* context, pid_t* pids, int capacity) {
+  struct fake* fake = context;
+  int count = 0;
+  for (int pid = 1; pid < FAKE_PIDS; pid++) {
+    if (!fake->procs[pid].alive) continue;
+    if (count < capacity) pids[count] = pid;
+    count++;
+  }
+  return count;
+}
+
+// Handles encode pid and generation so a handle to an exited process fails
+// even after its pid was reused.
+static bool fake_attach(void* context, pid_t pid, uint64_t* handle, char* name, size_t name_size) {
+  struct fake* fake = context;
+  fake->attaches++;
+  struct fake_proc* proc = &fake->procs[pid];
+  if (!proc->alive || proc->hidden) return false;
+  *handle = ((uint64_t)proc->generation << 32) | (uint32_t)pid;
+  snprintf(name, name_size, "proc%d.%u", pid, proc->generation);
+  return true;
+}
+
+static bool fake_read(void* context, uint64_t handle, struct gpu_proc_counters* out) {
+  struct fake* fake = context;
+  fake->reads++;
+  struct fake_proc* proc = &fake->procs[handle & 0xffffffffu];
+  if (!proc->alive || proc->generation != (uint32_t)(handle >> 32)) return false;
+  *out = proc->counters;
+  return true;
+}
+
+static void fake_start(struct fake* fake, struct fake_proc* proc) {
+  proc->hidden = fake_random(fake) % 5 == 0;
+  proc->counters.gpu_ns = fake_random(fake);
+  proc->counters.cpu_ns = fake_random(fake);
+  proc->counters.wakeups = fake_random(fake) % 100000;
+}
+
+static void fake_detach(void* context, uint64_t handle) {
+  (void)context;
+  (void)handle;
+}
+
+static void fake_init(struct fake* fake, int alive) {
+  memset(fake, 0, sizeof(struct fake));
+  fake->rng = 42;
+  for (int pid = 1; pid <= alive && pid < FAKE_PIDS; pid++) {
+    fake->procs[pid].alive = true;
+    fake_start(fake, &fake->procs[pid]);
+  }
+}
+
+// Advances every process by one interval and starts/ends a few of them.
+static void fake_step(struct fake* fake, int churn) {
+  for (int pid = 1; pid < FAKE_PIDS; pid++) {
+    struct fake_proc* proc = &fake->procs[pid];
+    proc->prev = proc->counters;
+    proc->has_prev = proc->alive;
+    proc->churned = false;
+    if (!proc->alive) continue;
+    // Most processes idle, a few are busy; ties are common.
+    uint32_t r = fake_random(fake) % 100;
+    if (r < 10) proc->counters.gpu_ns += (r + 1) * 100000;
+    else if (r < 12) proc->counters.gpu_ns += 1000000;
+    r = fake_random(fake) % 100;
+    if (r < 30) proc->counters.cpu_ns += (r + 1) * 50000;
+    if (r >= 20 && r < 40) proc->counters.wakeups += r - 19;
+  }
+
+  // A pid is not reused within the interval it exited in (see gpu_procs.h).
+  for (int i = 0; i < churn; i++) {
+    struct fake_proc* proc = &fake->procs[1 + fake_random(fake) % (FAKE_PIDS - 1)];
+    if (proc->churned) continue;
+    if (proc->alive) {
+      proc->alive = false;
+    } else {
+      proc->alive = true;
+      proc->generation++;
+      fake_start(fake, proc);
+    }
+    proc->has_prev = false;
+    proc->churned = true;
+  }
+}
+
+static struct gpu_proc_source fake_source(struct fake* fake) {
+  return (struct gpu_proc_source){ "fake", fake_list, fake_attach, fake_read, fake_detach, fake };
+}
+
+static int compare_top(const void* a, const void* b) {
+  const struct gpu_proc_top* x = a;
+  const struct gpu_proc_top* y = b;
+  if (gpu_proc_top_before(x, y)) return -1;
+  if (gpu_proc_top_before(y, x)) return 1;
+  return 0;
+}
+
+// Full rescan with a complete sort, computed from the fake's own state.
+static int reference_top(struct fake* fake, int rank, struct gpu_proc_top* top, int n) {
+  static struct gpu_proc_top all[FAKE_PIDS];
+  int count = 0;
+  for (int pid = 1; pid < FAKE_PIDS; pid++) {
+    struct fake_proc* proc = &fake->procs[pid];
+    if (!proc->alive || proc->hidden || !proc->has_prev) continue;
+    uint64_t delta = proc->counters.gpu_ns - proc->prev.gpu_ns;
+    if (rank == GPU_PROC_RANK_ENERGY) {
+      delta += proc->counters.cpu_ns - proc->prev.cpu_ns
+               + (proc->counters.wakeups - proc->prev.wakeups) * GPU_PROC_WAKEUP_NS;
+    }
+    if (delta == 0) continue;
+    all[count++] = (struct gpu_proc_top){ pid, delta, NULL };
+  }
+  qsort(all, count, sizeof(struct gpu_proc_top), compare_top);
+  if (count > n) count = n;
+  memcpy(top, all, sizeof(struct gpu_proc_top) * count);
+  return count;
+}
+
+static bool check(void) {
+  static struct fake fake;
+  fake_init(&fake, 1500);
+  struct gpu_procs procs;
+  if (!gpu_procs_init(&procs, fake_source(&fake))) return false;
+
+  uint64_t now = 1000000000ull;
+  gpu_procs_update(&procs, now);
+  for (int step = 0; step < 2000; step++) {
+    fake_step(&fake, step % 7 == 0 ? 200 : 5);
+    now += 1000000000ull;
+    uint64_t reads = fake.reads, attaches = fake.attaches;
+    gpu_procs_update(&procs, now);
+
+    for (int rank = GPU_PROC_RANK_GPU; rank <= GPU_PROC_RANK_ENERGY; rank++) {
+      struct gpu_proc_top got[TOP_N];
+      struct gpu_proc_top expected[TOP_N];
+      int got_count = gpu_procs_rank(&procs, rank, got, TOP_N);
+      int expected_count = reference_top(&fake, rank, expected, TOP_N);
+      if (got_count != expected_count) {
+        fprintf(stderr, "step %d: %d entries, expected %d\n", step, got_count, expected_count);
+        return false;
+      }
+      for (int i = 0; i < got_count; i++) {
+        if (got[i].pid != expected[i].pid || got[i].delta_ns != expected[i].delta_ns) {
+          fprintf(stderr, "step %d %s rank %d: pid %d (%llu), expected pid %d (%llu)\n",
+                  step, rank == GPU_PROC_RANK_GPU ? "gpu" : "energy", i, (int)got[i].pid,
+                  (unsigned long long)got[i].delta_ns, (int)expected[i].pid,
+                  (unsigned long long)expected[i].delta_ns);
+          return false;
+        }
+      }
+    }
+
+    // One read per attached process, plus a retry per re-attach.
+    uint64_t reattaches = fake.attaches - attaches;
+    uint64_t attached = 0;
+    for (uint32_t i = 0; i < procs.capacity; i++) attached += procs.entries[i].attached;
+    if (fake.reads - reads > attached + 2 * reattaches) {
+      fprintf(stderr, "step %d: %llu reads for %llu processes\n", step,
+              (unsigned long long)(fake.reads - reads), (unsigned long long)attached);
+      return false;
+    }
+
+    int alive = fake_list(&fake, NULL, 0);
+    if ((int)procs.count != alive) {
+      fprintf(stderr, "step %d: table holds %u pids, %d alive\n", step, procs.count, alive);
+      return false;
+    }
+  }
+
+  printf("gpu_procs GPU and energy rankings match a full rescan over 2000 samples "
+         "(%llu attaches for %llu listed pids)\n",
+         (unsigned long long)fake.attaches, (unsigned long long)procs.listed);
+  return true;
+}
+
+struct bench_state {
+  struct fake fake;
+  struct gpu_procs procs;
+  uint64_t now;
+  char buffer[2048];
+  char energy[2048];
+};
+
+static void bench_update(void* ctx) {
+  struct bench_state* state = ctx;
+  fake_step(&state->fake, 2);
+  state->now += 1000000000ull;
+  gpu_procs_update(&state->procs, state->now);
+  gpu_procs_format(&state->procs, state->buffer, sizeof(state->buffer), TOP_N);
+  gpu_procs_format_rank(&state->procs, GPU_PROC_RANK_ENERGY, state->energy,
+                        sizeof(state->energy), TOP_N);
+  g_bench_sink += (uint64_t)state->buffer[0] + (uint64_t)state->energy[0];
+}
+
+// What get_top_gpu_processes() did: attach to and read every process, keep
+// the cumulative counter, sort everything.
+static void bench_rescan(void* ctx) {
+  struct bench_state* state = ctx;
+  fake_step(&state->fake, 2);
+  static pid_t pids[FAKE_PIDS];
+  static struct gpu_proc_top all[FAKE_PIDS];
+  static char names[FAKE_PIDS][GPU_PROC_NAME_SIZE];
+  int count = fake_list(&state->fake, pids, FAKE_PIDS);
+  int valid = 0;
+  for (int i = 0; i < count; i++) {
+    uint64_t handle = 0;
+    struct gpu_proc_counters counters;
+    if (!fake_attach(&state->fake, pids[i], &handle, names[valid], GPU_PROC_NAME_SIZE)) continue;
+    if (!fake_read(&state->fake, handle, &counters) || counters.gpu_ns == 0) continue;
+    all[valid] = (struct gpu_proc_top){ pids[i], counters.gpu_ns, names[valid] };
+    valid++;
+  }
+  qsort(all, valid, sizeof(struct gpu_proc_top), compare_top);
+  g_bench_sink += (uint64_t)all[0].pid;
+}
+
+int main(void) {
+  if (!check()) return 1;
+
+  static struct bench_state state;
+  fake_init(&state.fake, 1500);
+  state.now = 1000000000ull;
+  if (!gpu_procs_init(&state.procs, fake_source(&state.fake))) return 1;
+  gpu_procs_update(&state.procs, state.now);
+
+  bench_run("gpu_procs update+top10 gpu+energy 1500 procs", bench_update, &state);
+  bench_run("full rescan+qsort 1500 procs", bench_rescan, &state);
+  return 0;
+}
@@ -0,0 +1,198 @@
+// Multi-interface throughput from helpers/network_load/interfaces.h:
+//
+// - check: generated /proc/net/dev files for a set of interfaces that
+//   appear, disappear, reorder and reset their counters, read through the
+//   proc source, with every rate compared against a per-name reference for
+//   both the `all` and a list filter; `all` leaves the tunnel out of the
+//   totals
+// - update: interfaces_update() over 32 synthetic interfaces, and through
+//   the platform source (/proc/net/dev or NET_RT_IFLIST2)
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../network_load/interfaces.h"
+
+#define STEPS 12
+#define STEP_NS 2000000000ull
+
+struct fake_interface {
+  const char* name;
+  int first_step;
+  int last_step;
+  int reset_step;
+  uint64_t rx_rate;
+  uint64_t tx_rate;
+};
+
+static const struct fake_interface g_fake[] = {
+  { "lo", 0, STEPS, -1, 5000, 5000 },
+  { "eth0", 0, STEPS, -1, 1250000, 250000 },
+  { "wlan0", 0, 7, -1, 90000, 12000 },
+  { "tun0", 0, STEPS, 5, 40000, 8000 },
+  { "docker0", 3, STEPS, -1, 700, 300 },
+  { "veth1", 0, STEPS, -1, 0, 0 },
+};
+
+#define FAKE_COUNT (int)(sizeof(g_fake) / sizeof(g_fake[0]))
+
+static bool fake_present(const struct fake_interface* fake, int step) {
+  return step >= fake->first_step && step < fake->last_step;
+}
+
+// Counters since the interface (re)appeared, per STEP_NS. An idle
+// interface never counted anything.
+static uint64_t fake_bytes(const struct fake_interface* fake, int step, uint64_t rate) {
+  if (!fake->rx_rate && !fake->tx_rate) return 0;
+  int since = fake->reset_step >= 0 && step >= fake->reset_step ? fake->reset_step : 0;
+  uint64_t base = since ? 4096 : (1ull << 33);
+  return base + rate * (uint64_t)(step - since) * 2;
+}
+
+static void write_fixture(const char* path, int step) {
+  FILE* file = fopen(path, "w");
+  fprintf(file, "Inter-|   Receive                                                |  Transmit\n");
+  fprintf(file, " face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets errs drop fifo colls carrier compressed\n");
+  // eth0 and tun0 swap places from step 6 on.
+  for (int k = 0; k < FAKE_COUNT; k++) {
+    int i = step >= 6 && k == 1 ? 3 : step >= 6 && k == 3 ? 1 : k;
+    const struct fake_interface* fake = &g_fake[i];
+    if (!fake_present(fake, step)) continue;
+    fprintf(file, "%6s: %llu 1234 0 0 0 0 0 0 %llu 567 0 0 0 0 0 0\n",
+            fake->name,
+            (unsigned long long)fake_bytes(fake, step, fake->rx_rate),
+            (unsigned long long)fake_bytes(fake, step, fake->tx_rate));
+  }
+  fclose(file);
+}
+
+static const struct interface_rate* find_rate(const struct interfaces* interfaces, const char* name) {
+  for (int i = 0; i < interfaces->count; i++) {
+    if (strcmp(interfaces->rates[i].name, name) == 0) return &interfaces->rates[i];
+  }
+  return NULL;
+}
+
+static bool close_to(double a, double b) {
+  return fabs(a - b) < 1e-9 * (fabs(b) + 1.0);
+}
+
+static bool check_step(const struct interfaces* interfaces, int step, bool all, int* checked) {
+  double up = 0.0, down = 0.0;
+  int expected = 0;
+  for (int i = 0; i < FAKE_COUNT; i++) {
+    const struct fake_interface* fake = &g_fake[i];
+    bool wanted = all ? strcmp(fake->name, "lo") != 0 && (fake->rx_rate || fake->tx_rate)
+                      : strcmp(fake->name, "wlan0") == 0 || strcmp(fake->name, "tun0") == 0;
+    if (!wanted || !fake_present(fake, step)) continue;
+    expected++;
+
+    const struct interface_rate* rate = find_rate(interfaces, fake->name);
+    if (!rate) {
+      fprintf(stderr, "step %d: %s missing\n", step, fake->name);
+      return false;
+    }
+    // A new interface and a reset counter report nothing for the interval.
+    bool valid = step > 0 && fake_present(fake, step - 1) && step != fake->reset_step;
+    double want_down = valid ? (double)fake->rx_rate * 8.0 / 1e6 : 0.0;
+    double want_up = valid ? (double)fake->tx_rate * 8.0 / 1e6 : 0.0;
+    if (!close_to(rate->down_mbps, want_down) || !close_to(rate->up_mbps, want_up)) {
+      fprintf(stderr, "step %d %s: %.6f/%.6f, expected %.6f/%.6f\n",
+              step, fake->name, rate->up_mbps, rate->down_mbps, want_up, want_down);
+      return false;
+    }
+    if (!all || !interface_is_virtual(fake->name)) {
+      up += want_up;
+      down += want_down;
+    }
+    (*checked)++;
+  }
+  if (interfaces->count != expected) {
+    fprintf(stderr, "step %d: %d interfaces, expected %d\n", step, interfaces->count, expected);
+    return false;
+  }
+  if (!close_to(interfaces->up_mbps, up) || !close_to(interfaces->down_mbps, down)) {
+    fprintf(stderr, "step %d: totals differ\n", step);
+    return false;
+  }
+  return true;
+}
+
+static bool check(const char* path, const char* filter, int* checked) {
+  static struct interfaces interfaces;
+  interfaces_init_with(&interfaces, interfaces_proc_source(path));
+  if (!interfaces_set_filter(&interfaces, filter)) return false;
+  for (int step = 0; step < STEPS; step++) {
+    write_fixture(path, step);
+    if (!interfaces_update(&interfaces, 1000000000ull + (uint64_t)step * STEP_NS)) return false;
+    if (!check_step(&interfaces, step, interfaces.all, checked)) return false;
+  }
+  return true;
+}
+
+struct synthetic {
+  uint64_t step;
+  int count;
+};
+
+static bool synthetic_read(void* context, struct interfaces_snapshot* out) {
+  struct synthetic* synthetic = context;
+  for (int i = 0; i < synthetic->count; i++) {
+    struct interface_counters* entry = &out->entries[i];
+    // Names stay put; the first two reads fill both snapshots.
+    if (synthetic->step <= 2) snprintf(entry->name, sizeof(entry->name), "utun%d", i);
+    entry->ibytes = (1ull << 36) + synthetic->step * (uint64_t)(i + 1) * 4096;
+    entry->obytes = (1ull << 34) + synthetic->step * (uint64_t)(i + 1) * 512;
+  }
+  out->count = synthetic->count;
+  synthetic->step++;
+  return true;
+}
+
+struct update_context {
+  struct interfaces* interfaces;
+  uint64_t now_ns;
+};
+
+static void bench_update(void* ctx) {
+  struct update_context* update = ctx;
+  update->now_ns += STEP_NS;
+  interfaces_update(update->interfaces, update->now_ns);
+  g_bench_sink += (uint64_t)update->interfaces->count;
+}
+
+int main(void) {
+  char path[] = "/tmp/bench_interfaces_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) return 1;
+  close(fd);
+
+  int checked = 0;
+  bool ok = check(path, "all", &checked) && check(path, "wlan0,tun0", &checked);
+  interfaces_proc_source(NULL);
+  unlink(path);
+  if (!ok) return 1;
+  printf("interfaces: %d rates over %d steps match the reference (appear, vanish, reorder, reset)\n",
+         checked, STEPS);
+
+  static struct interfaces synthetic_set;
+  static struct synthetic synthetic = { .step = 1, .count = 32 };
+  interfaces_init_with(&synthetic_set,
+                       (struct interfaces_source){ "synthetic", synthetic_read, &synthetic });
+  interfaces_set_filter(&synthetic_set, "all");
+  struct update_context update = { &synthetic_set, 0 };
+  bench_run("interfaces_update synthetic 32 ifs", bench_update, &update);
+
+  static struct interfaces platform;
+  interfaces_init(&platform);
+  interfaces_set_filter(&platform, "all");
+  if (interfaces_update(&platform, 0)) {
+    char name[64];
+    snprintf(name, sizeof(name), "interfaces_update %s %d ifs",
+             platform.source.name, platform.snapshots[platform.current].count);
+    struct update_context live = { &platform, 0 };
+    bench_run(name, bench_update, &live);
+  }
+  return 0;
+}
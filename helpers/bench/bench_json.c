@@ -0,0 +1,357 @@
+// Streaming JSON writer from helpers/json.h.
+//
+// - check: random byte strings must decode back to themselves, and a battery
+//   document must come out identical whether it is built in one buffer or
+//   flushed through a pipe a few bytes at a time
+// - document: the battery document through the writer and through the
+//   printf formatting popup_context used
+// - cold start: this program re-executed to print the document once each
+//   way, timed from fork to exit, with the heap in use at exit
+//
+// `bench_json <command> [args...]` instead times cold starts of any command
+// and reports its peak RSS, e.g. to compare two battery_info builds on macOS.
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "bench.h"
+#include "../json.h"
+
+#define CHECK_STRINGS 20000
+#define COLD_RUNS 200
+
+struct field {
+  const char* key;
+  char kind;  // 'i'nt, 'd'ouble, 'b'ool, 's'tring
+  int64_t i;
+  double d;
+  const char* s;
+};
+
+// Shaped like battery_info's output.
+static const struct field g_fields[] = {
+  { "percent", 'i', .i = 87 }, { "is_charging", 'b', .i = 1 }, { "is_charged", 'b', .i = 0 },
+  { "time_to_full_min", 'i', .i = 42 }, { "power_source", 's', .s = "AC" },
+  { "cycle_count", 'i', .i = 312 }, { "design_capacity", 'i', .i = 8579 },
+  { "design_cycle_count", 'i', .i = 1000 }, { "critical", 'b', .i = 0 },
+  { "battery_installed", 'b', .i = 1 }, { "fully_charged", 'b', .i = 0 },
+  { "external_connected", 'b', .i = 1 }, { "external_charge_capable", 'b', .i = 1 },
+  { "max_capacity", 'i', .i = 100 }, { "current_capacity", 'i', .i = 87 },
+  { "raw_current_capacity", 'i', .i = 6411 }, { "raw_max_capacity", 'i', .i = 7369 },
+  { "nominal_capacity", 'i', .i = 7551 }, { "voltage_mv", 'i', .i = 12871 },
+  { "amperage_ma", 'i', .i = 1912 }, { "instant_amperage_ma", 'i', .i = 1899 },
+  { "permanent_failure_status", 'i', .i = 0 }, { "is_charging_smart", 'b', .i = 1 },
+  { "serial", 's', .s = "F8Y2281A0ZQ1PXLAY" }, { "device_name", 's', .s = "bq40z651" },
+  { "gas_gauge_fw", 'i', .i = 1538 }, { "time_remaining_raw", 'i', .i = 65535 },
+  { "avg_time_to_empty_raw", 'i', .i = 65535 }, { "avg_time_to_full_raw", 'i', .i = 41 },
+  { "pack_reserve", 'i', .i = 200 }, { "adapter_watts", 'i', .i = 96 },
+  { "adapter_voltage_mv", 'i', .i = 20000 }, { "adapter_current_ma", 'i', .i = 4700 },
+  { "adapter_desc", 's', .s = "pd charger" }, { "charger_voltage_mv", 'i', .i = 13050 },
+  { "charger_current_ma", 'i', .i = 2368 }, { "charger_id", 'i', .i = 1 },
+  { "charger_not_charging_reason", 'i', .i = 0 }, { "soc_percent", 'i', .i = 86 },
+  { "daily_min_soc", 'i', .i = 31 }, { "daily_max_soc", 'i', .i = 100 },
+  { "telemetry_system_voltage_in_mv", 'i', .i = 19970 },
+  { "telemetry_system_current_in_ma", 'i', .i = 2291 },
+  { "telemetry_system_power_in_w", 'd', .d = 45.7 }, { "telemetry_system_load", 'i', .i = 2318 },
+  { "health", 's', .s = "Good \"ish\"\n" }, { "temperature_raw", 'i', .i = 3052 },
+  { "temperature_c", 'd', .d = 32.0 }, { "power_w", 'd', .d = 24.6 },
+  { "health_percent", 'd', .d = 85.9 },
+};
+#define FIELDS (sizeof(g_fields) / sizeof(g_fields[0]))
+
+static void write_writer(struct json_writer* json) {
+  json_begin_object(json);
+  for (size_t i = 0; i < FIELDS; i++) {
+    const struct field* f = &g_fields[i];
+    switch (f->kind) {
+      case 'i': json_field_int(json, f->key, f->i); break;
+      case 'd': json_field_double(json, f->key, f->d, 1); break;
+      case 'b': json_field_bool(json, f->key, f->i != 0); break;
+      case 's': json_field_string(json, f->key, f->s); break;
+    }
+  }
+  json_key(json, "cell_voltage_mv");
+  json_begin_array(json);
+  json_int(json, 4291);
+  json_int(json, 4290);
+  json_int(json, 4292);
+  json_end_array(json);
+  json_end_object(json);
+}
+
+// The printf way: every value through a format string, escaping left out
+// (the strings popup_context printed needed none).
+static size_t write_printf(char* out, size_t size) {
+  size_t length = 0;
+  out[length++] = '{';
+  for (size_t i = 0; i < FIELDS && length < size; i++) {
+    const struct field* f = &g_fields[i];
+    const char* comma = i ? "," : "";
+    int written = 0;
+    switch (f->kind) {
+      case 'i': written = snprintf(out + length, size - length, "%s\"%s\":%lld", comma, f->key, (long long)f->i); break;
+      case 'd': written = snprintf(out + length, size - length, "%s\"%s\":%.1f", comma, f->key, f->d); break;
+      case 'b': written = snprintf(out + length, size - length, "%s\"%s\":%s", comma, f->key, f->i ? "true" : "false"); break;
+      case 's': written = snprintf(out + length, size - length, "%s\"%s\":\"%s\"", comma, f->key, f->s); break;
+    }
+    if (written > 0) length += (size_t)written;
+  }
+  if (length < size) {
+    int written = snprintf(out + length, size - length, ",\"cell_voltage_mv\":[%d,%d,%d]}\n", 4291, 4290, 4292);
+    if (written > 0) length += (size_t)written;
+  }
+  return length < size ? length : size;
+}
+
+static uint64_t g_rng = 42;
+
+static uint32_t next_random(void) {
+  g_rng = g_rng * 6364136223846793005ull + 1442695040888963407ull;
+  return (uint32_t)(g_rng >> 33);
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+// Decodes one JSON string as json.h writes it; -1 when it is malformed.
+static int decode_string(const char* in, size_t length, char* out) {
+  if (length < 2 || in[0] != '"' || in[length - 1] != '"') return -1;
+  int count = 0;
+  for (size_t i = 1; i < length - 1; i++) {
+    unsigned char c = (unsigned char)in[i];
+    if (c < 0x20 || c == '"') return -1;
+    if (c != '\\') {
+      out[count++] = (char)c;
+      continue;
+    }
+    if (++i >= length - 1) return -1;
+    switch (in[i]) {
+      case '"': out[count++] = '"'; break;
+      case '\\': out[count++] = '\\'; break;
+      case 'b': out[count++] = '\b'; break;
+      case 'f': out[count++] = '\f'; break;
+      case 'n': out[count++] = '\n'; break;
+      case 'r': out[count++] = '\r'; break;
+      case 't': out[count++] = '\t'; break;
+      case 'u': {
+        if (i + 4 >= length - 1 || in[i + 1] != '0' || in[i + 2] != '0') return -1;
+        int hi = hex_value(in[i + 3]);
+        int lo = hex_value(in[i + 4]);
+        if (hi < 0 || lo < 0 || hi > 1) return -1;
+        out[count++] = (char)(hi << 4 | lo);
+        i += 4;
+        break;
+      }
+      default: return -1;
+    }
+  }
+  return count;
+}
+
+static bool check_strings(void) {
+  char text[64];
+  char buffer[512];
+  char decoded[512];
+  for (int n = 0; n < CHECK_STRINGS; n++) {
+    size_t length = next_random() % sizeof(text);
+    for (size_t i = 0; i < length; i++) {
+      // Mostly the bytes that need escaping.
+      text[i] = (char)(next_random() % 4 ? next_random() % 0x24 : next_random() % 256);
+    }
+    struct json_writer json;
+    json_init(&json, buffer, sizeof(buffer), -1);
+    json_string_n(&json, text, length);
+    int decoded_length = decode_string(buffer, json.length, decoded);
+    if (json.failed || decoded_length != (int)length || memcmp(decoded, text, length) != 0) {
+      fprintf(stderr, "string %d does not round-trip\n", n);
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool check_document(void) {
+  static const char expected_tail[] =
+    "\"health\":\"Good \\\"ish\\\"\\n\",\"temperature_raw\":3052,\"temperature_c\":32.0,"
+    "\"power_w\":24.6,\"health_percent\":85.9,\"cell_voltage_mv\":[4291,4290,4292]}\n";
+
+  char whole[4096];
+  struct json_writer json;
+  json_init(&json, whole, sizeof(whole), -1);
+  write_writer(&json);
+  if (!json_finish(&json) || strncmp(whole, "{\"percent\":87,\"is_charging\":true,", 33) != 0
+      || json.length < sizeof(expected_tail)
+      || memcmp(whole + json.length - (sizeof(expected_tail) - 1), expected_tail,
+                sizeof(expected_tail) - 1) != 0) {
+    fprintf(stderr, "document: %.*s\n", (int)json.length, whole);
+    return false;
+  }
+
+  // Too small for one document: fails instead of writing half of it.
+  char small[64];
+  json_init(&json, small, sizeof(small), -1);
+  write_writer(&json);
+  if (json_finish(&json)) {
+    fprintf(stderr, "a document larger than the buffer was accepted\n");
+    return false;
+  }
+
+  int fds[2];
+  if (pipe(fds) != 0) return false;
+  char tiny[7];
+  json_init(&json, tiny, sizeof(tiny), fds[1]);
+  write_writer(&json);
+  bool ok = json_finish(&json);
+  close(fds[1]);
+  char streamed[4096];
+  size_t received = 0;
+  ssize_t n;
+  while ((n = read(fds[0], streamed + received, sizeof(streamed) - received)) > 0) received += (size_t)n;
+  close(fds[0]);
+  // The streamed writer's length is 0 after the last flush; compare against a
+  // buffered run.
+  struct json_writer reference;
+  json_init(&reference, whole, sizeof(whole), -1);
+  write_writer(&reference);
+  json_finish(&reference);
+  if (!ok || received != reference.length || memcmp(streamed, whole, received) != 0) {
+    fprintf(stderr, "streamed document differs from the buffered one\n");
+    return false;
+  }
+
+  printf("json: %d strings round-trip, %zu byte document identical buffered and streamed\n",
+         CHECK_STRINGS, reference.length);
+  return true;
+}
+
+static void bench_writer(void* ctx) {
+  (void)ctx;
+  char buffer[4096];
+  struct json_writer json;
+  json_init(&json, buffer, sizeof(buffer), -1);
+  write_writer(&json);
+  json_finish(&json);
+  g_bench_sink += json.length;
+}
+
+static void bench_printf(void* ctx) {
+  (void)ctx;
+  char buffer[4096];
+  g_bench_sink += write_printf(buffer, sizeof(buffer));
+}
+
+static uint64_t heap_in_use(void) {
+#ifdef __APPLE__
+  malloc_statistics_t stats;
+  malloc_zone_statistics(NULL, &stats);
+  return stats.size_in_use;
+#elif defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+// Child side of the cold start: print the document once, then report the
+// heap in use on fd 3.
+static int emit(const char* how) {
+  uint64_t before = heap_in_use();
+  if (strcmp(how, "writer") == 0) {
+    char buffer[4096];
+    struct json_writer json;
+    json_init(&json, buffer, sizeof(buffer), STDOUT_FILENO);
+    write_writer(&json);
+    json_finish(&json);
+  } else {
+    char buffer[4096];
+    write_printf(buffer, sizeof(buffer));
+    printf("%s", buffer);
+    fflush(stdout);
+  }
+  char report[32];
+  int length = snprintf(report, sizeof(report), "%llu\n",
+                        (unsigned long long)(heap_in_use() - before));
+  if (write(3, report, (size_t)length) < 0) return 1;
+  return 0;
+}
+
+static int compare_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+// Runs argv COLD_RUNS times with stdout on /dev/null. Returns the heap
+// reported on fd 3 by the last run (0 when the command reports nothing).
+static uint64_t cold_start(const char* name, char* const* argv) {
+  static uint64_t times[COLD_RUNS];
+  uint64_t heap = 0;
+  for (int run = 0; run < COLD_RUNS; run++) {
+    int fds[2];
+    if (pipe(fds) != 0) return 0;
+    uint64_t start = bench_now_ns();
+    pid_t pid = fork();
+    if (pid == 0) {
+      int null = open("/dev/null", O_WRONLY);
+      dup2(null, STDOUT_FILENO);
+      dup2(fds[1], 3);
+      execvp(argv[0], argv);
+      _exit(127);
+    }
+    close(fds[1]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    times[run] = bench_now_ns() - start;
+    char report[32] = { 0 };
+    if (read(fds[0], report, sizeof(report) - 1) > 0) heap = strtoull(report, NULL, 10);
+    close(fds[0]);
+  }
+
+  qsort(times, COLD_RUNS, sizeof(uint64_t), compare_u64);
+  uint64_t total = 0;
+  for (int run = 0; run < COLD_RUNS; run++) total += times[run];
+  printf("%-40s %9.1f us mean %9.1f us p50 %9.1f us p99\n", name,
+         (double)total / COLD_RUNS / 1e3, (double)times[COLD_RUNS / 2] / 1e3,
+         (double)times[COLD_RUNS * 99 / 100] / 1e3);
+  return heap;
+}
+
+int main(int argc, char** argv) {
+  if (argc == 3 && strcmp(argv[1], "--emit") == 0) return emit(argv[2]);
+  if (argc > 1) {
+    cold_start("cold start", argv + 1);
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+#ifdef __APPLE__
+    printf("peak rss %ld KB\n", usage.ru_maxrss / 1024);
+#else
+    printf("peak rss %ld KB\n", usage.ru_maxrss);
+#endif
+    return 0;
+  }
+
+  if (!check_strings() || !check_document()) return 1;
+
+  bench_run("document (json.h)", bench_writer, NULL);
+  bench_run("document (snprintf)", bench_printf, NULL);
+
+  char* writer[] = { argv[0], "--emit", "writer", NULL };
+  char* stdio[] = { argv[0], "--emit", "printf", NULL };
+  uint64_t writer_heap = cold_start("cold start (json.h)", writer);
+  uint64_t stdio_heap = cold_start("cold start (printf)", stdio);
+  printf("heap in use after printing: json.h %llu bytes, printf %llu bytes\n",
+         (unsigned long long)writer_heap, (unsigned long long)stdio_heap);
+  return 0;
+}
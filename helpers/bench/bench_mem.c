@@ -0,0 +1,180 @@
+// Memory collector from helpers/system_stats/mem.h:
+//
+// - check: generated /proc/meminfo, /proc/vmstat and /proc/pressure/memory
+//   files read through the proc source over a run of samples, with used
+//   percent, the breakdown, swap I/O rates (including a counter reset) and
+//   the pressure level compared against the values written; the invariants
+//   must be read exactly once
+// - update: mem_update() through the platform source
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../system_stats/mem.h"
+
+#define STEPS 10
+#define STEP_NS 5000000000ull
+#define TOTAL_KB 16777216ull
+
+struct paths {
+  char dir[64];
+  char meminfo[96];
+  char vmstat[96];
+  char pressure[96];
+};
+
+struct expected {
+  uint64_t available_kb;
+  uint64_t swapins;
+  uint64_t swapouts;
+  double stall;
+};
+
+static struct expected step_values(int step) {
+  struct expected e;
+  e.available_kb = TOTAL_KB / 2 - (uint64_t)step * 262144;
+  // pswpin grows by 100 pages a step, pswpout by 50; both reset at step 6.
+  uint64_t since = step >= 6 ? (uint64_t)(step - 6) : 1000 + (uint64_t)step;
+  e.swapins = since * 100;
+  e.swapouts = since * 50;
+  e.stall = step < 3 ? 0.0 : step < 7 ? 4.5 : 27.0;
+  return e;
+}
+
+static void write_file(const char* path, const char* text) {
+  FILE* file = fopen(path, "w");
+  fputs(text, file);
+  fclose(file);
+}
+
+static void write_step(const struct paths* paths, int step) {
+  struct expected e = step_values(step);
+  char text[2048];
+  snprintf(text, sizeof(text),
+           "MemTotal:       %llu kB\n"
+           "MemFree:         1048576 kB\n"
+           "MemAvailable:   %llu kB\n"
+           "Buffers:          102400 kB\n"
+           "Cached:          4194304 kB\n"
+           "Active(anon):    2097152 kB\n"
+           "Inactive(anon):   524288 kB\n"
+           "Active(file):    1572864 kB\n"
+           "Inactive(file):  2621440 kB\n"
+           "Unevictable:       65536 kB\n"
+           "SwapTotal:       8388608 kB\n"
+           "SwapFree:        %llu kB\n"
+           "Zswap:            131072 kB\n"
+           "Zswapped:         524288 kB\n",
+           (unsigned long long)TOTAL_KB,
+           (unsigned long long)e.available_kb,
+           (unsigned long long)(8388608 - (uint64_t)step * 1024));
+  write_file(paths->meminfo, text);
+
+  snprintf(text, sizeof(text),
+           "nr_free_pages 262144\npgpgin 123456\npswpin %llu\npswpout %llu\npgfault 99\n",
+           (unsigned long long)e.swapins, (unsigned long long)e.swapouts);
+  write_file(paths->vmstat, text);
+
+  snprintf(text, sizeof(text),
+           "some avg10=%.2f avg60=1.00 avg300=0.50 total=12345\n"
+           "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n",
+           e.stall);
+  write_file(paths->pressure, text);
+}
+
+static int g_invariant_calls;
+static struct mem_source g_proc;
+
+static bool counting_invariants(void* context, uint64_t* total_bytes, uint64_t* page_size) {
+  g_invariant_calls++;
+  return g_proc.invariants(context, total_bytes, page_size);
+}
+
+static bool check_step(const struct mem* mem, int step) {
+  struct expected e = step_values(step);
+  uint64_t total = TOTAL_KB * 1024;
+  uint64_t used = total - e.available_kb * 1024;
+  int percent = (int)((double)used / (double)total * 100.0);
+  const struct mem_reading* r = &mem->reading;
+  if (mem->total_bytes != total || r->used != used || mem->used_percent != percent
+      || r->wired != 65536ull * 1024 || r->compressed != 131072ull * 1024
+      || r->file_backed != (1572864ull + 2621440ull) * 1024
+      || r->swap_total != 8388608ull * 1024 || r->swap_used != (uint64_t)step * 1024 * 1024) {
+    fprintf(stderr, "step %d: usage differs\n", step);
+    return false;
+  }
+
+  // Rates from the previous step; nothing on the first and at the reset.
+  double in = 0.0, out = 0.0;
+  if (step > 0 && step != 6) {
+    in = 100.0 * (double)mem->page_size / (STEP_NS / 1e9);
+    out = 50.0 * (double)mem->page_size / (STEP_NS / 1e9);
+  }
+  if (fabs(mem->swapin_bps - in) > 1e-6 || fabs(mem->swapout_bps - out) > 1e-6) {
+    fprintf(stderr, "step %d: swap %.1f/%.1f B/s, expected %.1f/%.1f\n",
+            step, mem->swapin_bps, mem->swapout_bps, in, out);
+    return false;
+  }
+
+  int pressure = e.stall < 1.0 ? MEM_PRESSURE_NORMAL
+                 : e.stall < 10.0 ? MEM_PRESSURE_WARN
+                                  : MEM_PRESSURE_CRITICAL;
+  if (r->pressure != pressure) {
+    fprintf(stderr, "step %d: pressure %d, expected %d\n", step, r->pressure, pressure);
+    return false;
+  }
+  return true;
+}
+
+static bool check(void) {
+  struct paths paths;
+  snprintf(paths.dir, sizeof(paths.dir), "/tmp/bench_mem_XXXXXX");
+  if (!mkdtemp(paths.dir)) return false;
+  snprintf(paths.meminfo, sizeof(paths.meminfo), "%s/meminfo", paths.dir);
+  snprintf(paths.vmstat, sizeof(paths.vmstat), "%s/vmstat", paths.dir);
+  snprintf(paths.pressure, sizeof(paths.pressure), "%s/pressure", paths.dir);
+  write_step(&paths, 0);
+
+  g_proc = mem_proc_source(paths.meminfo, paths.vmstat, paths.pressure);
+  struct mem_source counting = g_proc;
+  counting.invariants = counting_invariants;
+
+  static struct mem mem;
+  bool ok = mem_init_with(&mem, counting);
+  for (int step = 0; ok && step < STEPS; step++) {
+    write_step(&paths, step);
+    ok = mem_update(&mem, 1000000000ull + (uint64_t)step * STEP_NS) && check_step(&mem, step);
+  }
+  ok = ok && g_invariant_calls == 1;
+
+  mem_proc_source(NULL, NULL, NULL);
+  unlink(paths.meminfo);
+  unlink(paths.vmstat);
+  unlink(paths.pressure);
+  rmdir(paths.dir);
+  return ok;
+}
+
+static void bench_update(void* ctx) {
+  struct mem* mem = ctx;
+  static uint64_t now = 0;
+  now += STEP_NS;
+  mem_update(mem, now);
+  g_bench_sink += (uint64_t)mem->used_percent;
+}
+
+int main(void) {
+  if (!check()) return 1;
+  printf("mem: %d samples match the written values (breakdown, swap rates across a reset,"
+         " pressure), invariants read once\n", STEPS);
+
+  static struct mem platform;
+  if (mem_init(&platform) && mem_update(&platform, 0)) {
+    char name[64];
+    snprintf(name, sizeof(name), "mem_update %s (%d%% used)", platform.source.name,
+             platform.used_percent);
+    bench_run(name, bench_update, &platform);
+  }
+  return 0;
+}
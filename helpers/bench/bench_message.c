@@ -0,0 +1,152 @@
+// Compares the two ways helpers build a message for the bar:
+//
+// - legacy: snprintf a quoted command string, then sketchybar() copies it into
+//   a VLA and runs format_message() over it
+// - builder: sb_msg_* appends typed arguments straight into wire format
+//
+// Both variants produce the system_stats trigger; sending is not included.
+
+#include <string.h>
+
+#include "bench.h"
+#include "../sketchybar.h"
+
+struct sample {
+  int cpu_user;
+  int cpu_sys;
+  int cpu_total;
+  int mem_percent;
+  uint64_t mem_used;
+  uint64_t mem_total;
+  int gpu_util;
+  int cpu_temp;
+  int gpu_temp;
+  const char* gpu_procs;
+  double up_mbps;
+  double down_mbps;
+};
+
+static struct sample g_sample = {
+  .cpu_user = 12,
+  .cpu_sys = 7,
+  .cpu_total = 19,
+  .mem_percent = 63,
+  .mem_used = 21645893632ull,
+  .mem_total = 34359738368ull,
+  .gpu_util = 4,
+  .cpu_temp = 48,
+  .gpu_temp = 41,
+  .gpu_procs = "WindowServer:1835329;Safari:20431;kitty:3310",
+  .up_mbps = 0.42,
+  .down_mbps = 12.87,
+};
+
+static uint32_t legacy_system_stats(struct sample* s, char* out) {
+  char trigger_message[4096];
+  snprintf(trigger_message,
+           sizeof(trigger_message),
+           "--trigger '%s' "
+           "cpu_user='%d' "
+           "cpu_sys='%d' "
+           "cpu_total='%d' "
+           "mem_used_percent='%d' "
+           "mem_used_bytes='%llu' "
+           "mem_total_bytes='%llu' "
+           "gpu_util='%d' "
+           "cpu_temp='%d' "
+           "gpu_temp='%d' "
+           "gpu_procs='%s'",
+           "system_stats_update",
+           s->cpu_user,
+           s->cpu_sys,
+           s->cpu_total,
+           s->mem_percent,
+           (unsigned long long)s->mem_used,
+           (unsigned long long)s->mem_total,
+           s->gpu_util,
+           s->cpu_temp,
+           s->gpu_temp,
+           s->gpu_procs);
+
+  // sketchybar() formats into a VLA of this size; out stands in for it.
+  return format_message(trigger_message, out);
+}
+
+static uint32_t builder_system_stats(struct sample* s, char* out) {
+  struct sb_message msg;
+  sb_msg_init(&msg, out, 4096);
+
+  sb_msg_arg(&msg, "--trigger");
+  sb_msg_arg(&msg, "system_stats_update");
+  sb_msg_int(&msg, "cpu_user", s->cpu_user);
+  sb_msg_int(&msg, "cpu_sys", s->cpu_sys);
+  sb_msg_int(&msg, "cpu_total", s->cpu_total);
+  sb_msg_int(&msg, "mem_used_percent", s->mem_percent);
+  sb_msg_uint(&msg, "mem_used_bytes", s->mem_used);
+  sb_msg_uint(&msg, "mem_total_bytes", s->mem_total);
+  sb_msg_int(&msg, "gpu_util", s->gpu_util);
+  sb_msg_int(&msg, "cpu_temp", s->cpu_temp);
+  sb_msg_int(&msg, "gpu_temp", s->gpu_temp);
+  sb_msg_str(&msg, "gpu_procs", s->gpu_procs);
+  return sb_msg_finish(&msg);
+}
+
+static uint32_t legacy_network_load(struct sample* s, char* out) {
+  char trigger_message[512];
+  snprintf(trigger_message,
+           512,
+           "--trigger '%s' upload='%.2f' download='%.2f'",
+           "network_update",
+           s->up_mbps,
+           s->down_mbps);
+
+  return format_message(trigger_message, out);
+}
+
+static uint32_t builder_network_load(struct sample* s, char* out) {
+  struct sb_message msg;
+  sb_msg_init(&msg, out, 4096);
+
+  sb_msg_arg(&msg, "--trigger");
+  sb_msg_arg(&msg, "network_update");
+  sb_msg_double(&msg, "upload", s->up_mbps, 2);
+  sb_msg_double(&msg, "download", s->down_mbps, 2);
+  return sb_msg_finish(&msg);
+}
+
+typedef uint32_t (*build_fn)(struct sample* s, char* out);
+
+static void run_build(void* ctx) {
+  static char out[4096];
+  build_fn build = (build_fn)ctx;
+  uint32_t length = build(&g_sample, out);
+  g_bench_sink += length + (uint8_t)out[length / 2];
+}
+
+// The builder must put the same bytes on the wire as the legacy path.
+static bool same_output(build_fn legacy, build_fn builder) {
+  char expected[4096];
+  char actual[4096];
+  memset(expected, 0xff, sizeof(expected));
+  uint32_t expected_length = legacy(&g_sample, expected);
+  uint32_t actual_length = builder(&g_sample, actual);
+  return expected_length == actual_length
+         && memcmp(expected, actual, actual_length) == 0;
+}
+
+int main(void) {
+  if (!same_output(legacy_system_stats, builder_system_stats)
+      || !same_output(legacy_network_load, builder_network_load)) {
+    fprintf(stderr, "builder output differs from format_message output\n");
+    return 1;
+  }
+
+  double legacy = bench_run("system_stats snprintf+format_message", run_build, legacy_system_stats);
+  double builder = bench_run("system_stats sb_msg builder", run_build, builder_system_stats);
+  printf("%-40s %12.2fx\n", "system_stats speedup", legacy / builder);
+
+  legacy = bench_run("network_load snprintf+format_message", run_build, legacy_network_load);
+  builder = bench_run("network_load sb_msg builder", run_build, builder_network_load);
+  printf("%-40s %12.2fx\n", "network_load speedup", legacy / builder);
+  return 0;
+}
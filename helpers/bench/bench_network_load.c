@@ -0,0 +1,232 @@
+// Sample tapes (helpers/tape.h) through helpers/network_load:
+//
+// - check: network_load runs over synthetic sources on a fake clock while
+//   recording a tape, once following an uplink that switches interfaces
+//   (auto mode, with --sample and a pause/resume and rate change) and once
+//   over several interfaces (all); replaying each tape must send the same
+//   triggers byte for byte and consume every record
+// - tick: one trigger tick of a single interface, live and while recording
+//   to /dev/null
+
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../network_load/network_load.h"
+
+#define STEPS 160
+#define STEP_NS 250000000ull
+#define ORIGIN_NS 1000000000ull
+#define SWITCH_STEP 60
+#define PAUSE_STEP 90
+#define RESUME_STEP 100
+#define RATE_STEP 120
+
+// The synthetic machine's state advances once per step.
+static uint64_t g_step;
+static char g_opened[IF_NAMESIZE];
+
+// Counters of an interface by name, busier in bursts.
+static void synthetic_counters(const char* name, uint64_t* ibytes, uint64_t* obytes) {
+  uint64_t scale = (uint64_t)name[strlen(name) - 1] - '0' + 1;
+  uint64_t burst = g_step % 20 < 3 ? 40 : 1;
+  *ibytes = (1ull << 32) + g_step * scale * burst * 300000;
+  *obytes = (1ull << 30) + g_step * scale * 40000 + (g_step * g_step) % 7919;
+}
+
+static bool synthetic_open(void* context, const char* ifname) {
+  (void)context;
+  if (strcmp(ifname, "en0") != 0 && strcmp(ifname, "en1") != 0) return false;
+  snprintf(g_opened, sizeof(g_opened), "%s", ifname);
+  return true;
+}
+
+static bool synthetic_read(void* context, uint64_t* ibytes, uint64_t* obytes) {
+  (void)context;
+  // A read fails now and then, like a sysctl on an interface going away.
+  if (g_step % 37 == 5) return false;
+  synthetic_counters(g_opened, ibytes, obytes);
+  return true;
+}
+
+// utun3 appears later, lo0 never counts toward anything.
+static bool synthetic_interfaces_read(void* context, struct interfaces_snapshot* out) {
+  (void)context;
+  static const char* const names[] = { "lo0", "en0", "en1", "utun3" };
+  out->count = g_step >= 30 ? 4 : 3;
+  for (int i = 0; i < out->count; i++) {
+    struct interface_counters* entry = &out->entries[i];
+    snprintf(entry->name, sizeof(entry->name), "%s", names[i]);
+    synthetic_counters(names[i], &entry->ibytes, &entry->obytes);
+  }
+  return true;
+}
+
+static bool synthetic_start(void* context) {
+  (void)context;
+  return true;
+}
+
+static bool synthetic_resolve(void* context, char* ifname, size_t size) {
+  (void)context;
+  snprintf(ifname, size, "%s", g_step >= SWITCH_STEP ? "en1" : "en0");
+  return true;
+}
+
+static void synthetic_stop(void* context) {
+  (void)context;
+}
+
+static struct network_load_sources synthetic_sources(void) {
+  return (struct network_load_sources){
+    { "synthetic", synthetic_open, synthetic_read, NULL },
+    { "synthetic", synthetic_interfaces_read, NULL },
+    { "synthetic", synthetic_start, synthetic_resolve, synthetic_stop, NULL },
+  };
+}
+
+// A transport that hashes what would be sent.
+struct capture {
+  uint64_t messages;
+  uint64_t bytes;
+  uint64_t hash;
+};
+
+static struct capture g_capture;
+
+static bool capture_connect(void) {
+  return true;
+}
+
+static bool capture_send(char* message, uint32_t length) {
+  g_capture.messages++;
+  g_capture.bytes += length;
+  for (uint32_t i = 0; i < length; i++) {
+    g_capture.hash = (g_capture.hash ^ (uint8_t)message[i]) * 1099511628211ull;
+  }
+  return true;
+}
+
+static void capture_disconnect(void) {
+}
+
+static const struct sketchybar_transport g_capture_transport = {
+  .name = "capture",
+  .connect = capture_connect,
+  .send = capture_send,
+  .disconnect = capture_disconnect,
+};
+
+static void capture_reset(void) {
+  g_capture = (struct capture){ 0, 0, 14695981039346656037ull };
+}
+
+// Options as network_load would get them, with the tape option appended.
+static bool parse(struct network_load* load,
+                  const char* interface,
+                  const char* tape_option,
+                  const char* path) {
+  const char* args[] = { "bench_network_load", interface, "bench_event", "1.0",
+                         "--sample", "250",
+                         tape_option, path,
+                         "--speed", "0" };
+  int count = (int)(sizeof(args) / sizeof(args[0]));
+  if (!tape_option) count -= 4;
+  return network_load_parse(count, (char**)args, load);
+}
+
+static struct network_load g_recorded;
+static struct network_load g_replayed;
+
+static bool record(const char* interface, const char* path, struct capture* out) {
+  capture_reset();
+  g_step = 0;
+  if (!parse(&g_recorded, interface, "--record", path)
+      || !network_load_init_with(&g_recorded, synthetic_sources(), ORIGIN_NS)) {
+    return false;
+  }
+  for (int step = 0; step < STEPS; step++) {
+    g_step = (uint64_t)step;
+    uint64_t now = ORIGIN_NS + (uint64_t)step * STEP_NS;
+    if (step == PAUSE_STEP) network_load_command_at(&g_recorded, "pause", now);
+    if (step == RESUME_STEP) network_load_command_at(&g_recorded, "resume", now);
+    if (step == RATE_STEP) network_load_command_at(&g_recorded, "rate 0.5", now);
+    if (network_load_next(&g_recorded) <= now) network_load_run(&g_recorded, now, now);
+  }
+  bool ok = !g_recorded.tape.failed;
+  *out = g_capture;
+  tape_close(&g_recorded.tape);
+  return ok;
+}
+
+static bool replay(const char* interface, const char* path, struct capture* out) {
+  capture_reset();
+  if (!parse(&g_replayed, interface, "--replay", path)
+      || !network_load_init_with(&g_replayed, synthetic_sources(), ORIGIN_NS)) {
+    return false;
+  }
+  bool ok = network_load_replay(&g_replayed) && g_replayed.tape.offset == g_replayed.tape.size;
+  *out = g_capture;
+  tape_close(&g_replayed.tape);
+  return ok;
+}
+
+static bool check_mode(const char* interface, const char* path) {
+  struct capture recorded, replayed;
+  if (!record(interface, path, &recorded)) {
+    fprintf(stderr, "%s: recording failed\n", interface);
+    return false;
+  }
+  if (!replay(interface, path, &replayed)) {
+    fprintf(stderr, "%s: replay failed after record %llu\n", interface,
+            (unsigned long long)g_replayed.tape.records);
+    return false;
+  }
+  if (replayed.messages != recorded.messages || replayed.bytes != recorded.bytes
+      || replayed.hash != recorded.hash || recorded.messages < 20) {
+    fprintf(stderr, "%s: replay sent %llu messages (%llu bytes), recorded %llu (%llu bytes)\n",
+            interface, (unsigned long long)replayed.messages, (unsigned long long)replayed.bytes,
+            (unsigned long long)recorded.messages, (unsigned long long)recorded.bytes);
+    return false;
+  }
+  printf("network_load %s: %d steps recorded and replayed, %llu messages (%llu bytes) identical\n",
+         interface, STEPS, (unsigned long long)recorded.messages,
+         (unsigned long long)recorded.bytes);
+  return true;
+}
+
+static bool check(void) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/bench_network_load_XXXXXX");
+  int fd = mkstemp(path);
+  if (fd < 0) return false;
+  close(fd);
+  bool ok = check_mode("auto", path) && check_mode("all", path);
+  unlink(path);
+  return ok;
+}
+
+static void bench_tick(void* ctx) {
+  struct network_load* load = ctx;
+  g_step++;
+  network_load_tick(load, ORIGIN_NS + g_step * STEP_NS, 1);
+  g_bench_sink += load->trigger.length;
+}
+
+int main(void) {
+  sketchybar_set_transport(&g_capture_transport);
+  if (!check()) return 1;
+
+  g_step = 0;
+  if (!parse(&g_recorded, "en0", NULL, NULL)
+      || !network_load_init_with(&g_recorded, synthetic_sources(), ORIGIN_NS)) {
+    return 1;
+  }
+  bench_run("network_load_tick synthetic", bench_tick, &g_recorded);
+
+  if (!parse(&g_replayed, "en0", "--record", "/dev/null")
+      || !network_load_init_with(&g_replayed, synthetic_sources(), ORIGIN_NS)) {
+    return 1;
+  }
+  bench_run("network_load_tick synthetic, recording", bench_tick, &g_replayed);
+  return 0;
+}
@@ -0,0 +1,231 @@
+// Process sampler from helpers/system_stats/proc_top.h.
+//
+// - check: a fake process source with churn, pid reuse and unreadable
+//   processes; every top-N by CPU delta and by resident size must equal a
+//   full sort computed from the fake's own state, and the unreadable ones
+//   must be counted.
+// - sample: one proc_top_sample() through the platform source (/proc on
+//   Linux), and a top-10 query on top of it
+//
+// The popup used to answer the same query with two `ps | head | tail`
+// pipelines per refresh.
+
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../system_stats/proc_top.h"
+
+#define FAKE_PIDS 4096
+#define TOP_N 10
+
+struct fake_proc {
+  bool alive;
+  bool hidden;
+  bool was_alive;
+  bool reused;
+  uint64_t cpu_ns;
+  uint64_t prev_cpu_ns;
+  uint64_t rss;
+};
+
+struct fake {
+  struct fake_proc procs[FAKE_PIDS];
+  uint64_t rng;
+  uint64_t names;
+};
+
+static uint32_t fake_random(struct fake* fake) {
+  fake->rng = fake->rng * 6364136223846793005ull + 1442695040888963407ull;
+  return (uint32_t)(fake->rng >> 33);
+}
+
+// Listed in descending pid order, like proc_listallpids().
+static int fake_list(void* context, pid_t* pids, int capacity) {
+  struct fake* fake = context;
+  int count = 0;
+  for (int pid = FAKE_PIDS - 1; pid > 0; pid--) {
+    if (!fake->procs[pid].alive) continue;
+    if (count < capacity) pids[count] = pid;
+    count++;
+  }
+  return count;
+}
+
+static bool fake_read(void* context, pid_t pid, struct proc_sample* out) {
+  struct fake* fake = context;
+  struct fake_proc* proc = &fake->procs[pid];
+  if (!proc->alive || proc->hidden) return false;
+  out->cpu_ns = proc->cpu_ns;
+  out->rss_bytes = proc->rss;
+  return true;
+}
+
+static bool fake_name(void* context, pid_t pid, char* name, size_t name_size) {
+  struct fake* fake = context;
+  fake->names++;
+  snprintf(name, name_size, "proc%d", (int)pid);
+  return true;
+}
+
+static void fake_init(struct fake* fake, int alive) {
+  memset(fake, 0, sizeof(struct fake));
+  fake->rng = 7;
+  for (int pid = 1; pid <= alive && pid < FAKE_PIDS; pid++) {
+    fake->procs[pid].alive = true;
+    fake->procs[pid].hidden = fake_random(fake) % 8 == 0;
+    fake->procs[pid].cpu_ns = (uint64_t)fake_random(fake) * 1000;
+    fake->procs[pid].rss = (uint64_t)(fake_random(fake) % 4096) * 4096;
+  }
+}
+
+// One interval: busy processes accumulate CPU time, memory drifts, and some
+// processes exit or start. A reused pid starts over with a small counter.
+static void fake_step(struct fake* fake, int churn) {
+  for (int pid = 1; pid < FAKE_PIDS; pid++) {
+    struct fake_proc* proc = &fake->procs[pid];
+    proc->was_alive = proc->alive;
+    proc->reused = false;
+    proc->prev_cpu_ns = proc->cpu_ns;
+    if (!proc->alive) continue;
+    uint32_t r = fake_random(fake) % 100;
+    if (r < 15) proc->cpu_ns += (uint64_t)(r % 5 + 1) * 10000000;
+    if (r < 5) proc->rss += 4096 * (r + 1);
+  }
+
+  for (int i = 0; i < churn; i++) {
+    struct fake_proc* proc = &fake->procs[1 + fake_random(fake) % (FAKE_PIDS - 1)];
+    if (proc->alive) {
+      proc->alive = false;
+    } else {
+      proc->alive = true;
+      proc->reused = true;
+      proc->hidden = fake_random(fake) % 8 == 0;
+      proc->cpu_ns = fake_random(fake) % 1000;
+      proc->rss = (uint64_t)(fake_random(fake) % 4096 + 1) * 4096;
+    }
+  }
+}
+
+static int compare_entries(const void* a, const void* b) {
+  const struct proc_top_entry* x = a;
+  const struct proc_top_entry* y = b;
+  if (proc_top_before(x, y)) return -1;
+  if (proc_top_before(y, x)) return 1;
+  return 0;
+}
+
+static int reference(struct fake* fake, bool cpu, struct proc_top_entry* top, int n) {
+  static struct proc_top_entry all[FAKE_PIDS];
+  int count = 0;
+  for (int pid = 1; pid < FAKE_PIDS; pid++) {
+    struct fake_proc* proc = &fake->procs[pid];
+    if (!proc->alive || proc->hidden) continue;
+    uint64_t value = proc->rss;
+    if (cpu) {
+      // The sampler cannot see a reuse whose counter happens to be larger,
+      // so only skip the ones it can detect.
+      if (!proc->was_alive || proc->cpu_ns <= proc->prev_cpu_ns) continue;
+      value = proc->cpu_ns - proc->prev_cpu_ns;
+    }
+    if (value == 0) continue;
+    all[count++] = (struct proc_top_entry){ .pid = pid, .value = value };
+  }
+  qsort(all, count, sizeof(struct proc_top_entry), compare_entries);
+  if (count > n) count = n;
+  memcpy(top, all, sizeof(struct proc_top_entry) * count);
+  return count;
+}
+
+static bool compare(const char* kind, int step, struct proc_top_entry* got, int got_count,
+                    struct proc_top_entry* expected, int expected_count) {
+  if (got_count != expected_count) {
+    fprintf(stderr, "%s step %d: %d entries, expected %d\n", kind, step, got_count, expected_count);
+    return false;
+  }
+  for (int i = 0; i < got_count; i++) {
+    if (got[i].pid != expected[i].pid || got[i].value != expected[i].value) {
+      fprintf(stderr, "%s step %d rank %d: pid %d (%llu), expected pid %d (%llu)\n",
+              kind, step, i, (int)got[i].pid, (unsigned long long)got[i].value,
+              (int)expected[i].pid, (unsigned long long)expected[i].value);
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool check(void) {
+  static struct fake fake;
+  fake_init(&fake, 2000);
+  struct proc_top top;
+  if (!proc_top_init(&top, (struct proc_top_source){ "fake", fake_list, fake_read, fake_name, &fake })) {
+    return false;
+  }
+
+  uint64_t now = 1000000000ull;
+  proc_top_sample(&top, now);
+  for (int step = 0; step < 1000; step++) {
+    // Keep reuse detectable: a reused pid's counter starts below its old one.
+    fake_step(&fake, step % 5 == 0 ? 150 : 3);
+    for (int pid = 1; pid < FAKE_PIDS; pid++) {
+      struct fake_proc* proc = &fake.procs[pid];
+      if (proc->reused && proc->was_alive) proc->cpu_ns = proc->prev_cpu_ns / 2;
+    }
+    now += 1000000000ull;
+    proc_top_sample(&top, now);
+
+    struct proc_top_entry got[TOP_N];
+    struct proc_top_entry expected[TOP_N];
+    int got_count = proc_top_cpu(&top, got, TOP_N);
+    int expected_count = reference(&fake, true, expected, TOP_N);
+    if (!compare("cpu", step, got, got_count, expected, expected_count)) return false;
+
+    got_count = proc_top_rss(&top, got, TOP_N);
+    expected_count = reference(&fake, false, expected, TOP_N);
+    if (!compare("rss", step, got, got_count, expected, expected_count)) return false;
+
+    int hidden = 0;
+    for (int pid = 1; pid < FAKE_PIDS; pid++) hidden += fake.procs[pid].alive && fake.procs[pid].hidden;
+    if (top.unreadable != hidden) {
+      fprintf(stderr, "step %d: %d unreadable, expected %d\n", step, top.unreadable, hidden);
+      return false;
+    }
+  }
+
+  printf("proc_top matches a full sort over 1000 samples (%llu name lookups)\n",
+         (unsigned long long)fake.names);
+  return true;
+}
+
+static void bench_sample(void* ctx) {
+  struct proc_top* top = ctx;
+  proc_top_sample(top, bench_now_ns());
+  g_bench_sink += (uint64_t)top->sample_counts[top->current];
+}
+
+static void bench_query(void* ctx) {
+  struct proc_top* top = ctx;
+  struct proc_top_entry entries[TOP_N];
+  g_bench_sink += (uint64_t)proc_top_cpu(top, entries, TOP_N);
+  g_bench_sink += (uint64_t)proc_top_rss(top, entries, TOP_N);
+}
+
+int main(void) {
+  if (!check()) return 1;
+
+  static struct proc_top top;
+#ifdef __APPLE__
+  struct proc_top_source source = proc_top_mach_source();
+#else
+  struct proc_top_source source = proc_top_proc_source("/proc");
+#endif
+  if (!proc_top_init(&top, source)) return 1;
+  proc_top_sample(&top, bench_now_ns());
+  proc_top_sample(&top, bench_now_ns());
+
+  char name[64];
+  snprintf(name, sizeof(name), "proc_top_sample %s %d procs",
+           source.name, top.sample_counts[top.current]);
+  bench_run(name, bench_sample, &top);
+  bench_run("proc_top cpu+rss top10", bench_query, &top);
+  return 0;
+}
@@ -0,0 +1,171 @@
+// Rate engine from helpers/network_load/rate.h, replayed over a generated
+// counter trace (250 ms samples with jitter, read out every 2 s):
+//
+// - steady 10/1 Mbps: the smoothed rates settle on the true ones
+// - a 250 ms burst at 400 Mbps: held as the peak at the next read-out, where
+//   a single 2 s delta (the previous network_update()) averages it away
+// - counters reset to zero: no spike and nothing negative
+// - a 10 s sampling gap (sleep): a new baseline, no average across it
+// - replaying the trace gives bit-identical read-outs
+//
+// Then measures a push and a read.
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../network_load/rate.h"
+
+#define SAMPLE_NS 250000000ull
+#define EMIT_NS 2000000000ull
+#define TRACE_NS 60000000000ull
+#define MAX_EMITS 64
+
+#define BURST_START_NS 12250000000ull
+#define BURST_END_NS 12500000000ull
+#define RESET_NS 30000000000ull
+#define GAP_START_NS 40000000000ull
+#define GAP_END_NS 50000000000ull
+
+struct trace {
+  uint32_t seed;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t last_ns;
+};
+
+static uint32_t next_random(uint32_t* seed) {
+  *seed = *seed * 1664525u + 1013904223u;
+  return *seed >> 8;
+}
+
+// Bytes per second over the interval that ends at the given tick.
+static double down_rate(uint64_t tick) {
+  return tick > BURST_START_NS && tick <= BURST_END_NS ? 50e6 : 1.25e6;
+}
+
+static double up_rate(uint64_t tick) {
+  (void)tick;
+  return 125e3;
+}
+
+// Advances the counters to t (the jittered tick); a reset starts them from
+// zero again.
+static void trace_advance(struct trace* trace, uint64_t tick, uint64_t t) {
+  double seconds = (double)(t - trace->last_ns) / 1e9;
+  trace->bytes_in += (uint64_t)llround(down_rate(tick) * seconds);
+  trace->bytes_out += (uint64_t)llround(up_rate(tick) * seconds);
+  if (trace->last_ns < RESET_NS && t >= RESET_NS) {
+    trace->bytes_in = 0;
+    trace->bytes_out = 0;
+  }
+  trace->last_ns = t;
+}
+
+static int replay(struct rate_engine* rate, struct rate_estimate* emits, double* old_down) {
+  struct trace trace = { .seed = 7, .bytes_in = 1ull << 40, .bytes_out = 1ull << 38 };
+  rate_init(rate, EMIT_NS, EMIT_NS, 4 * EMIT_NS);
+
+  int count = 0;
+  uint64_t old_in = 0, old_ns = 0;
+  for (uint64_t tick = SAMPLE_NS; tick <= TRACE_NS; tick += SAMPLE_NS) {
+    if (tick > GAP_START_NS && tick < GAP_END_NS) continue;
+    // Up to +-20 ms of scheduling jitter.
+    uint64_t t = tick - 20000000ull + (uint64_t)(next_random(&trace.seed) % 40000000u);
+    trace_advance(&trace, tick, t);
+    rate_push(rate, t, trace.bytes_in, trace.bytes_out);
+
+    if (tick % EMIT_NS == 0 && count < MAX_EMITS) {
+      emits[count] = rate_read(rate, t);
+      // What one delta per read-out reports.
+      old_down[count] = old_ns && trace.bytes_in >= old_in
+                          ? (double)(trace.bytes_in - old_in) * 8.0 / ((double)(t - old_ns) / 1e9)
+                          : 0.0;
+      old_in = trace.bytes_in;
+      old_ns = t;
+      count++;
+    }
+  }
+  return count;
+}
+
+static bool near(double value, double want, double tolerance) {
+  return fabs(value - want) <= tolerance * want;
+}
+
+static bool check(int* count) {
+  static struct rate_engine rate, again;
+  static struct rate_estimate emits[MAX_EMITS], replayed[MAX_EMITS];
+  double old_down[MAX_EMITS], old_again[MAX_EMITS];
+  *count = replay(&rate, emits, old_down);
+  if (replay(&again, replayed, old_again) != *count
+      || memcmp(emits, replayed, sizeof(struct rate_estimate) * (size_t)*count) != 0) {
+    fprintf(stderr, "replay differs\n");
+    return false;
+  }
+
+  for (int i = 0; i < *count; i++) {
+    const struct rate_estimate* e = &emits[i];
+    if (e->up < 0 || e->down < 0 || e->up_peak < e->up || e->down_peak < e->down) {
+      fprintf(stderr, "read-out %d: negative or peak below smoothed\n", i);
+      return false;
+    }
+  }
+
+  // Read-outs at 2s, 4s, ...: index 4 is 10 s, 6 is 14 s (after the burst).
+  if (!near(emits[4].down, 10e6, 0.01) || !near(emits[4].up, 1e6, 0.01)) {
+    fprintf(stderr, "steady: %.0f/%.0f bit/s\n", emits[4].up, emits[4].down);
+    return false;
+  }
+  if (!near(emits[6].down_peak, 400e6, 0.2) || emits[6].down < 20e6) {
+    fprintf(stderr, "burst: peak %.0f, smoothed %.0f bit/s\n", emits[6].down_peak, emits[6].down);
+    return false;
+  }
+  // The peak is released after the hold window.
+  if (emits[7].down_peak > 100e6) return false;
+
+  if (rate.resets != 1 || rate.gaps != 1) {
+    fprintf(stderr, "%llu resets, %llu gaps\n",
+            (unsigned long long)rate.resets, (unsigned long long)rate.gaps);
+    return false;
+  }
+  // Around the reset (30 s) and right after the gap (50 s) the rates stay
+  // at the steady ones.
+  for (int i = 14; i < *count; i++) {
+    if (emits[i].down > 0 && !near(emits[i].down_peak, 10e6, 0.1)) {
+      fprintf(stderr, "read-out %d: peak %.0f bit/s\n", i, emits[i].down_peak);
+      return false;
+    }
+  }
+  printf("rate: %d read-outs replay identically; 250 ms burst at 400 Mbps: peak %.1f, smoothed %.1f,"
+         " one 2 s delta %.1f Mbps\n",
+         *count, emits[6].down_peak / 1e6, emits[6].down / 1e6, old_down[6] / 1e6);
+  return true;
+}
+
+static struct rate_engine g_rate;
+static uint64_t g_now;
+static uint64_t g_bytes;
+
+static void bench_push(void* ctx) {
+  (void)ctx;
+  g_now += SAMPLE_NS;
+  g_bytes += 312500 + (g_now >> 20 & 1023);
+  rate_push(&g_rate, g_now, g_bytes, g_bytes / 8);
+}
+
+static void bench_read(void* ctx) {
+  (void)ctx;
+  struct rate_estimate estimate = rate_read(&g_rate, g_now);
+  g_bench_sink += (uint64_t)estimate.down_peak;
+}
+
+int main(void) {
+  int count = 0;
+  if (!check(&count)) return 1;
+
+  rate_init(&g_rate, EMIT_NS, EMIT_NS, 4 * EMIT_NS);
+  bench_run("rate_push", bench_push, NULL);
+  bench_run("rate_read (8 intervals held)", bench_read, NULL);
+  return 0;
+}
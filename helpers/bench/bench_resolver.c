@@ -0,0 +1,216 @@
+// Effective interface resolution from helpers/network_interface_store.h:
+//
+// - check: resolution over a fake store for the primary / single candidate /
+//   service order / score / fallback cases, and the cache resolving only
+//   after an invalidation
+// - resolve: a full resolution through the fake store and through
+//   getifaddrs() with a virtual primary (what every network_load tick used
+//   to cost, minus the dynamic store round trips), against a cached lookup
+
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../network_interface_store.h"
+
+#define UP (IFF_UP | IFF_RUNNING)
+
+struct fake_store {
+  const char* primary;
+  struct interface_address addresses[8];
+  size_t address_count;
+  const char* routers[4];
+  const char* order[4];
+  int calls;
+  int order_calls;
+};
+
+static bool fake_primary(void* context, char* buffer, size_t buffer_size) {
+  struct fake_store* fake = context;
+  fake->calls++;
+  if (!fake->primary) return false;
+  interface_copy_name(buffer, buffer_size, fake->primary);
+  return true;
+}
+
+static size_t fake_addresses(void* context, struct interface_address* out, size_t max) {
+  struct fake_store* fake = context;
+  fake->calls++;
+  size_t count = fake->address_count < max ? fake->address_count : max;
+  memcpy(out, fake->addresses, count * sizeof(struct interface_address));
+  return count;
+}
+
+static bool fake_has_router(void* context, const char* ifname) {
+  struct fake_store* fake = context;
+  fake->calls++;
+  for (int i = 0; i < 4 && fake->routers[i]; i++) {
+    if (strcmp(fake->routers[i], ifname) == 0) return true;
+  }
+  return false;
+}
+
+static size_t fake_service_order(void* context, char (*names)[IF_NAMESIZE], size_t max) {
+  struct fake_store* fake = context;
+  fake->calls++;
+  fake->order_calls++;
+  size_t count = 0;
+  for (; count < 4 && count < max && fake->order[count]; count++) {
+    interface_copy_name(names[count], IF_NAMESIZE, fake->order[count]);
+  }
+  return count;
+}
+
+static struct interface_store fake_store(struct fake_store* fake) {
+  return (struct interface_store){
+    "fake", fake_primary, fake_addresses, fake_has_router, fake_service_order, fake
+  };
+}
+
+static struct interface_address address(const char* name, unsigned int flags, uint32_t ipv4) {
+  struct interface_address out = { .flags = flags, .ipv4 = ipv4 };
+  interface_copy_name(out.name, sizeof(out.name), name);
+  return out;
+}
+
+// A VPN as primary, Wi-Fi (en0) with the router and a USB Ethernet (en5),
+// plus addresses that must never be candidates.
+static struct fake_store vpn_store(void) {
+  struct fake_store fake = { .primary = "utun4" };
+  fake.addresses[0] = address("lo0", UP | IFF_LOOPBACK, 0x7F000001u);
+  fake.addresses[1] = address("en0", UP, 0xC0A8010Au);
+  fake.addresses[2] = address("utun4", UP | IFF_POINTOPOINT, 0x0A080001u);
+  fake.addresses[3] = address("en5", UP, 0xC0A8020Bu);
+  fake.addresses[4] = address("en7", UP, 0xA9FE1234u);
+  fake.addresses[5] = address("en8", IFF_UP, 0xC0A8030Cu);
+  fake.addresses[6] = address("bridge0", UP, 0xC0A8040Du);
+  fake.address_count = 7;
+  fake.routers[0] = "en0";
+  return fake;
+}
+
+static bool expect(const char* what, struct fake_store* fake, const char* want) {
+  struct interface_store store = fake_store(fake);
+  char name[IF_NAMESIZE];
+  bool found = interface_resolve(&store, name, sizeof(name));
+  if (found != (want != NULL) || (want && strcmp(name, want) != 0)) {
+    fprintf(stderr, "%s: got %s, expected %s\n", what, found ? name : "nothing", want ? want : "nothing");
+    return false;
+  }
+  return true;
+}
+
+static bool check_resolve(void) {
+  struct fake_store fake = vpn_store();
+  fake.primary = "en5";
+  if (!expect("physical primary", &fake, "en5") || fake.calls != 1) return false;
+
+  fake = vpn_store();
+  fake.order[0] = "en5";
+  fake.order[1] = "en0";
+  if (!expect("service order", &fake, "en5")) return false;
+
+  // Services without an active interface are skipped.
+  fake = vpn_store();
+  fake.order[0] = "en9";
+  fake.order[1] = "en0";
+  if (!expect("service order skips inactive", &fake, "en0")) return false;
+
+  fake = vpn_store();
+  fake.routers[0] = "en5";
+  if (!expect("score (router)", &fake, "en5")) return false;
+
+  fake = vpn_store();
+  fake.address_count = 2;
+  if (!expect("single candidate", &fake, "en0") || fake.order_calls != 0) return false;
+
+  fake = vpn_store();
+  fake.addresses[1].ipv4 = 0xA9FE0001u;
+  fake.addresses[3].flags = IFF_UP;
+  if (!expect("virtual primary fallback", &fake, "utun4")) return false;
+
+  fake = vpn_store();
+  fake.primary = NULL;
+  fake.address_count = 1;
+  if (!expect("offline", &fake, NULL)) return false;
+  return true;
+}
+
+static bool check_cache(void) {
+  struct fake_store fake = vpn_store();
+  static struct interface_cache cache;
+  interface_cache_init(&cache, fake_store(&fake), true);
+
+  char name[IF_NAMESIZE];
+  for (int i = 0; i < 1000; i++) {
+    if (!interface_cache_get(&cache, name, sizeof(name)) || strcmp(name, "en0") != 0) return false;
+  }
+  if (cache.resolutions != 1) {
+    fprintf(stderr, "cache: %u resolutions without a change\n", cache.resolutions);
+    return false;
+  }
+
+  // The VPN goes away: the store changes, the notification invalidates.
+  fake.primary = "en5";
+  if (!interface_cache_get(&cache, name, sizeof(name)) || strcmp(name, "en0") != 0) return false;
+  interface_cache_invalidate(&cache);
+  interface_cache_invalidate(&cache);
+  if (!interface_cache_get(&cache, name, sizeof(name)) || strcmp(name, "en5") != 0) return false;
+  if (cache.resolutions != 2) return false;
+
+  // Offline is cached as well.
+  fake.primary = NULL;
+  fake.address_count = 0;
+  interface_cache_invalidate(&cache);
+  for (int i = 0; i < 10; i++) {
+    if (interface_cache_get(&cache, name, sizeof(name))) return false;
+  }
+  if (cache.resolutions != 3) return false;
+
+  // Without notifications every lookup resolves.
+  interface_cache_init(&cache, fake_store(&fake), false);
+  for (int i = 0; i < 10; i++) interface_cache_get(&cache, name, sizeof(name));
+  return cache.resolutions == 10;
+}
+
+static bool linux_primary(void* context, char* buffer, size_t buffer_size) {
+  (void)context;
+  interface_copy_name(buffer, buffer_size, "tun0");
+  return true;
+}
+
+static bool linux_has_router(void* context, const char* ifname) {
+  (void)context;
+  return strcmp(ifname, "eth0") == 0;
+}
+
+static void bench_resolve(void* ctx) {
+  struct interface_store* store = ctx;
+  char name[IF_NAMESIZE];
+  g_bench_sink += (uint64_t)interface_resolve(store, name, sizeof(name));
+}
+
+static void bench_cached(void* ctx) {
+  struct interface_cache* cache = ctx;
+  char name[IF_NAMESIZE];
+  g_bench_sink += (uint64_t)interface_cache_get(cache, name, sizeof(name));
+}
+
+int main(void) {
+  if (!check_resolve() || !check_cache()) return 1;
+  printf("resolver: primary/service order/score/fallback cases and cache invalidation ok\n");
+
+  struct fake_store fake = vpn_store();
+  fake.order[0] = "en5";
+  struct interface_store store = fake_store(&fake);
+  bench_run("interface_resolve fake store", bench_resolve, &store);
+
+  struct interface_store system = {
+    "getifaddrs", linux_primary, interface_getifaddrs, linux_has_router, NULL, NULL
+  };
+  bench_run("interface_resolve getifaddrs", bench_resolve, &system);
+
+  static struct interface_cache cache;
+  interface_cache_init(&cache, system, true);
+  bench_run("interface_cache_get (no change)", bench_cached, &cache);
+  return 0;
+}
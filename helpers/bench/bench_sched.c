@@ -0,0 +1,146 @@
+// Multi-rate deadline scheduler from helpers/sched.h, driven by
+// a fake clock.
+//
+// - check: cpu (1s), temps (5s) and gpu_procs (10s) over an hour of simulated
+//   ticks with random collection time and wake-up latency. Every run must
+//   happen on its task's grid, temps must run together with every fifth cpu
+//   tick, and a 3.5s stall must run the overdue tick once and skip the two
+//   after it. The previous sleep-after-work loop is simulated alongside to
+//   show its drift.
+// - due: sched_next() + sched_due() per tick
+
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../sched.h"
+
+#define NS 1000000000ull
+#define CHECK_SECONDS 3600
+
+enum { TASK_CPU, TASK_TEMPS, TASK_GPU_PROCS, TASKS };
+
+static const uint64_t periods[TASKS] = { 1 * NS, 5 * NS, 10 * NS };
+
+// Deterministic xorshift, so failures reproduce.
+static uint64_t g_random = 88172645463325252ull;
+
+static uint64_t random_below(uint64_t bound) {
+  g_random ^= g_random << 13;
+  g_random ^= g_random >> 7;
+  g_random ^= g_random << 17;
+  return g_random % bound;
+}
+
+static void add_tasks(struct sched* sched) {
+  sched_add(sched, "cpu", periods[TASK_CPU]);
+  sched_add(sched, "temps", periods[TASK_TEMPS]);
+  sched_add(sched, "gpu_procs", periods[TASK_GPU_PROCS]);
+}
+
+static bool check(void) {
+  const uint64_t origin = 1000 * NS;
+  const uint64_t stall_at = origin + 1800 * NS;
+  const uint64_t end = origin + CHECK_SECONDS * NS;
+  struct sched sched;
+  sched_init(&sched, origin);
+  add_tasks(&sched);
+
+  uint64_t now = origin;
+  bool stalled = false;
+  bool after_stall = false;
+  uint64_t late_max = 0;
+  while (now < end) {
+    uint64_t deadline = sched_next(&sched);
+    if (deadline > now) now = deadline;
+    // Wake-up latency of the sleep itself.
+    now += random_below(2000000);
+    if (!after_stall && now - deadline > late_max) late_max = now - deadline;
+    after_stall = false;
+
+    uint64_t expected[TASKS];
+    for (int i = 0; i < TASKS; i++) expected[i] = sched.tasks[i].next_ns;
+    uint32_t due = sched_due(&sched, now);
+    for (int i = 0; i < TASKS; i++) {
+      bool ran = (due >> i) & 1u;
+      if (ran != (expected[i] <= now)) {
+        fprintf(stderr, "%s: ran=%d with deadline %llu at %llu\n", sched.tasks[i].name, ran,
+                (unsigned long long)expected[i], (unsigned long long)now);
+        return false;
+      }
+      if (ran && (expected[i] - origin) % periods[i] != 0) {
+        fprintf(stderr, "%s: deadline %llu is off its grid\n", sched.tasks[i].name,
+                (unsigned long long)(expected[i] - origin));
+        return false;
+      }
+    }
+    if (((due >> TASK_TEMPS) & 1u) && !((due >> TASK_CPU) & 1u)) {
+      fprintf(stderr, "temps ran without cpu at %llu\n", (unsigned long long)(now - origin));
+      return false;
+    }
+
+    // Collection time; once, a stall longer than three cpu periods.
+    now += 1000000 + random_below(300000000);
+    if (!stalled && now >= stall_at) {
+      stalled = true;
+      after_stall = true;
+      now += 3500000000ull;
+    }
+  }
+
+  // Runs on ticks 0..end, minus the ticks the stall skipped.
+  uint64_t skipped = sched.tasks[TASK_CPU].skipped;
+  if (skipped != 2 || sched.tasks[TASK_TEMPS].skipped > 1
+      || sched.tasks[TASK_GPU_PROCS].skipped > 0) {
+    fprintf(stderr, "skipped %llu/%llu/%llu ticks, expected 2/<=1/0\n",
+            (unsigned long long)skipped,
+            (unsigned long long)sched.tasks[TASK_TEMPS].skipped,
+            (unsigned long long)sched.tasks[TASK_GPU_PROCS].skipped);
+    return false;
+  }
+  for (int i = 0; i < TASKS; i++) {
+    struct sched_task* task = &sched.tasks[i];
+    uint64_t ticks = (task->next_ns - origin) / periods[i];
+    if (task->runs + task->skipped != ticks) {
+      fprintf(stderr, "%s: %llu runs + %llu skipped, expected %llu ticks\n", task->name,
+              (unsigned long long)task->runs, (unsigned long long)task->skipped,
+              (unsigned long long)ticks);
+      return false;
+    }
+  }
+
+  // The previous loop: collect, then sleep one period.
+  g_random = 88172645463325252ull;
+  uint64_t sleeper = origin;
+  uint64_t sleeper_ticks = 0;
+  while (sleeper < end) {
+    sleeper += random_below(2000000);
+    sleeper += 1000000 + random_below(300000000);
+    sleeper += periods[TASK_CPU];
+    sleeper_ticks++;
+  }
+
+  printf("sched: %llu cpu runs in %ds, all on the grid (at most %.2fms late outside the stall), 2 skipped by the stall\n",
+         (unsigned long long)sched.tasks[TASK_CPU].runs, CHECK_SECONDS, (double)late_max / 1e6);
+  printf("sleep-after-work: %llu cpu runs in %ds (%.1f%% of the ticks lost to drift)\n",
+         (unsigned long long)sleeper_ticks, CHECK_SECONDS,
+         100.0 - (double)sleeper_ticks / CHECK_SECONDS * 100.0);
+  return true;
+}
+
+static struct sched g_sched;
+static uint64_t g_now;
+
+static void bench_due(void* ctx) {
+  (void)ctx;
+  g_now = sched_next(&g_sched);
+  g_bench_sink += sched_due(&g_sched, g_now);
+}
+
+int main(void) {
+  if (!check()) return 1;
+
+  sched_init(&g_sched, 0);
+  add_tasks(&g_sched);
+  bench_run("sched_next + sched_due", bench_due, NULL);
+  return 0;
+}
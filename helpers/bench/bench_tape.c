@@ -0,0 +1,428 @@
+// Sample tapes (helpers/tape.h) through helpers/system_stats:
+//
+// - check: system_stats runs over synthetic sources (cores of both kinds,
+//   sensors that fail and appear, a disk that appears, processes that come
+//   and go or cannot be inspected) on a fake clock with the emission gate,
+//   details and a pause/resume, recording a tape; replaying that tape must
+//   send the same messages byte for byte and consume every record. A tape
+//   with a tampered record must be rejected, one cut short must replay up
+//   to the cut, and one written by an older format version must not load. In direct-drive mode every CPU period must push the CPU
+//   graph, also while the gate holds the labels back.
+// - tick: one system_stats_tick() of every collector over the synthetic
+//   sources, live and while recording to /dev/null
+
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../system_stats/system_stats.h"
+
+#define STEPS 160
+#define STEP_NS 250000000ull
+#define ORIGIN_NS 1000000000ull
+#define PAUSE_STEP 70
+#define RESUME_STEP 84
+#define PIDS 48
+
+// The synthetic machine's state advances once per step.
+static uint64_t g_step;
+
+// CPU: 8 cores, the last two efficiency cores.
+
+struct synthetic_cpu {
+  uint64_t ticks[CPU_TICK_STATES][8];
+};
+
+static bool synthetic_cpu_read(void* context, struct cpu_ticks* out) {
+  struct synthetic_cpu* cpu = context;
+  out->count = 8;
+  for (int i = 0; i < 8; i++) {
+    uint64_t user = (g_step * 7 + (uint64_t)i * 13) % 60;
+    uint64_t sys = (g_step + (uint64_t)i) % 12;
+    cpu->ticks[CPU_TICK_USER][i] += user;
+    cpu->ticks[CPU_TICK_SYSTEM][i] += sys;
+    cpu->ticks[CPU_TICK_IDLE][i] += 100 - user - sys;
+    cpu->ticks[CPU_TICK_NICE][i] += (uint64_t)i % 2;
+    for (int state = 0; state < CPU_TICK_STATES; state++) {
+      out->ticks[state][i] = cpu->ticks[state][i];
+    }
+  }
+  return true;
+}
+
+static void synthetic_cpu_clusters(void* context, uint8_t* kinds, int count) {
+  (void)context;
+  for (int i = 0; i < count; i++) kinds[i] = i >= 6 ? CPU_CLUSTER_E : CPU_CLUSTER_P;
+}
+
+// Memory: usage and pressure cycle, swap I/O every few steps.
+
+static bool synthetic_mem_invariants(void* context, uint64_t* total_bytes, uint64_t* page_size) {
+  (void)context;
+  *total_bytes = 16ull << 30;
+  *page_size = 16384;
+  return true;
+}
+
+static bool synthetic_mem_read(void* context, struct mem_reading* out) {
+  (void)context;
+  memset(out, 0, sizeof(struct mem_reading));
+  out->used = (8ull << 30) + (g_step % 25) * (200ull << 20);
+  out->wired = 2ull << 30;
+  out->compressed = (g_step % 7) << 28;
+  out->file_backed = 3ull << 30;
+  out->swap_total = 4ull << 30;
+  out->swap_used = (g_step / 10) << 24;
+  out->swapins = g_step / 3 * 40;
+  out->swapouts = g_step / 4 * 25;
+  out->pressure = g_step % 40 < 30 ? MEM_PRESSURE_NORMAL : MEM_PRESSURE_WARN;
+  return true;
+}
+
+// GPU: unreadable for a stretch.
+
+static bool synthetic_gpu_read(void* context, struct gpu_reading* out) {
+  (void)context;
+  if (g_step >= 100 && g_step < 104) return false;
+  out->device_util = (int)((g_step * 11) % 101);
+  out->renderer_util = (int)((g_step * 5) % 101);
+  out->tiler_util = (int)((g_step * 3) % 101);
+  out->mem_used_bytes = (int64_t)((1ull << 30) + (g_step % 9) * (64ull << 20));
+  return true;
+}
+
+// Temperatures: one sensor fails for a while, another appears later.
+
+static int synthetic_temp_enumerate(void* context, struct temp_service* out, int capacity) {
+  (void)context;
+  static const char* const names[] = { "PMU tdie1", "battery", "PMU tdev1", "PMU tdie2",
+                                       "PMU tdev2", "PMU tdie3" };
+  int count = g_step >= 40 ? 6 : 5;
+  for (int i = 0; i < count && i < capacity; i++) {
+    snprintf(out[i].name, sizeof(out[i].name), "%s", names[i]);
+    out[i].handle = 100 + (uint64_t)i;
+  }
+  return count;
+}
+
+static bool synthetic_temp_read(void* context, uint64_t handle, double* celsius) {
+  (void)context;
+  if (handle == 103 && g_step >= 20 && g_step < 26) return false;
+  *celsius = 40.0 + (double)((g_step * 3 + handle) % 30) + 0.25;
+  return true;
+}
+
+static bool synthetic_temp_changed(void* context) {
+  (void)context;
+  return g_step == 40;
+}
+
+// Disks: a second one appears, all busy in bursts.
+
+static bool synthetic_disk_read(void* context, struct disk_snapshot* out) {
+  (void)context;
+  out->count = g_step >= 30 ? 2 : 1;
+  for (int i = 0; i < out->count; i++) {
+    struct disk_counters* entry = &out->entries[i];
+    snprintf(entry->name, sizeof(entry->name), "disk%d", i);
+    uint64_t busy = g_step % 16 < 4 ? g_step * (uint64_t)(i + 3) : g_step;
+    entry->bytes_read = busy * (8ull << 20);
+    entry->bytes_written = busy * (2ull << 20);
+    entry->reads = busy * 512;
+    entry->writes = busy * 128;
+  }
+  return true;
+}
+
+// GPU processes: every 10 steps some exit and new pids show up; every 11th
+// pid cannot be inspected.
+
+static int synthetic_gpu_proc_list(void* context, pid_t* pids, int capacity) {
+  (void)context;
+  if (capacity < PIDS) return PIDS;
+  for (int i = 0; i < PIDS; i++) {
+    pid_t pid = 100 + i;
+    if ((i + (int)(g_step / 10)) % 7 == 0) pid += 1000 * (pid_t)(g_step / 10 + 1);
+    pids[i] = pid;
+  }
+  return PIDS;
+}
+
+static bool synthetic_gpu_proc_attach(void* context,
+                                      pid_t pid,
+                                      uint64_t* handle,
+                                      char* name,
+                                      size_t name_size) {
+  (void)context;
+  if (pid % 11 == 0) return false;
+  *handle = (uint64_t)pid * 10 + 1;
+  snprintf(name, name_size, "proc%d", pid);
+  return true;
+}
+
+static bool synthetic_gpu_proc_read(void* context,
+                                    uint64_t handle,
+                                    struct gpu_proc_counters* out) {
+  (void)context;
+  uint64_t pid = handle / 10;
+  out->gpu_ns = g_step * (pid % 13) * 100000;
+  out->cpu_ns = g_step * (pid % 7) * 200000;
+  out->wakeups = g_step * (pid % 5);
+  return true;
+}
+
+static void synthetic_gpu_proc_detach(void* context, uint64_t handle) {
+  (void)context;
+  (void)handle;
+}
+
+static struct synthetic_cpu g_cpu;
+
+static struct system_stats_sources synthetic_sources(void) {
+  memset(&g_cpu, 0, sizeof(g_cpu));
+  return (struct system_stats_sources){
+    { "synthetic", synthetic_cpu_read, synthetic_cpu_clusters, &g_cpu },
+    { "synthetic", synthetic_mem_invariants, synthetic_mem_read, NULL },
+    { "synthetic", synthetic_gpu_read, NULL },
+    { "synthetic", synthetic_temp_enumerate, synthetic_temp_read, synthetic_temp_changed, NULL },
+    { "synthetic", synthetic_disk_read, NULL },
+    { "synthetic",
+      synthetic_gpu_proc_list,
+      synthetic_gpu_proc_attach,
+      synthetic_gpu_proc_read,
+      synthetic_gpu_proc_detach,
+      NULL },
+  };
+}
+
+// A transport that hashes what would be sent.
+struct capture {
+  uint64_t messages;
+  uint64_t bytes;
+  uint64_t hash;
+  uint64_t cpu_pushes;
+};
+
+static struct capture g_capture;
+
+static bool capture_connect(void) {
+  return true;
+}
+
+static bool capture_send(char* message, uint32_t length) {
+  g_capture.messages++;
+  g_capture.bytes += length;
+  for (uint32_t i = 0; i < length; i++) {
+    g_capture.hash = (g_capture.hash ^ (uint8_t)message[i]) * 1099511628211ull;
+  }
+  static const char push[] = "--push\0cpu\0";
+  for (uint32_t i = 0; i + sizeof(push) - 1 <= length; i++) {
+    if (memcmp(message + i, push, sizeof(push) - 1) == 0) g_capture.cpu_pushes++;
+  }
+  return true;
+}
+
+static void capture_disconnect(void) {
+}
+
+static const struct sketchybar_transport g_capture_transport = {
+  .name = "capture",
+  .connect = capture_connect,
+  .send = capture_send,
+  .disconnect = capture_disconnect,
+};
+
+static void capture_reset(void) {
+  g_capture = (struct capture){ 0, 0, 14695981039346656037ull, 0 };
+}
+
+// Options as system_stats would get them, with the tape option appended.
+static bool parse(struct system_stats* stats, const char* tape_option, const char* path) {
+  const char* args[] = { "bench_tape", "bench_event", "0.5",
+                         "--period", "temps=1.5",
+                         "--period", "gpu_procs=1",
+                         "--load-threshold", "3",
+                         "--temp-threshold", "1",
+                         "--heartbeat", "4",
+                         "--temp-detail", "--disk-detail",
+                         "--energy-procs", "5",
+                         tape_option, path,
+                         "--speed", "0" };
+  int count = (int)(sizeof(args) / sizeof(args[0]));
+  if (!tape_option) count -= 4;
+  return system_stats_parse(count, (char**)args, &stats->options);
+}
+
+static struct system_stats g_recorded;
+static struct system_stats g_replayed;
+
+static bool record(const char* path, struct capture* out) {
+  capture_reset();
+  g_step = 0;
+  if (!parse(&g_recorded, "--record", path)
+      || !system_stats_init_with(&g_recorded, synthetic_sources(), ORIGIN_NS)) {
+    return false;
+  }
+  for (int step = 0; step < STEPS; step++) {
+    g_step = (uint64_t)step;
+    uint64_t now = ORIGIN_NS + (uint64_t)step * STEP_NS;
+    if (step == PAUSE_STEP) system_stats_command_at(&g_recorded, "pause", now);
+    if (step == RESUME_STEP) system_stats_command_at(&g_recorded, "resume", now);
+    system_stats_run(&g_recorded, now, now);
+  }
+  bool ok = !g_recorded.tape.failed;
+  *out = g_capture;
+  out->hash ^= g_recorded.tape.records;
+  tape_close(&g_recorded.tape);
+  return ok;
+}
+
+// Replays path; tamper may change the loaded tape first. Returns what
+// system_stats_replay() returned.
+static bool replay(const char* path, void (*tamper)(struct tape* tape), struct capture* out) {
+  capture_reset();
+  if (!parse(&g_replayed, "--replay", path)
+      || !system_stats_init_with(&g_replayed, synthetic_sources(), ORIGIN_NS)) {
+    return false;
+  }
+  if (tamper) tamper(&g_replayed.tape);
+  bool ok = system_stats_replay(&g_replayed);
+  *out = g_capture;
+  out->hash ^= g_replayed.tape.records;
+  tape_close(&g_replayed.tape);
+  return ok;
+}
+
+// Finds the nth record on channel; the offset of its header, or 0.
+static size_t find_record(const struct tape* tape, uint16_t channel, int nth) {
+  size_t offset = TAPE_MAGIC_SIZE;
+  while (offset + sizeof(struct tape_header) <= tape->size) {
+    struct tape_header header;
+    memcpy(&header, tape->data + offset, sizeof(header));
+    if (header.channel == channel && nth-- == 0) return offset;
+    offset += sizeof(header) + header.length;
+  }
+  return 0;
+}
+
+// A sensor read that names another sensor.
+static void tamper_handle(struct tape* tape) {
+  size_t offset = find_record(tape, TAPE_TEMP_READ, 30);
+  if (offset) tape->data[offset + sizeof(struct tape_header)] ^= 1;
+}
+
+// A recording killed halfway through a disk read.
+static void tamper_cut(struct tape* tape) {
+  size_t offset = find_record(tape, TAPE_DISK_READ, 50);
+  if (offset) tape->size = offset + sizeof(struct tape_header) + 10;
+}
+
+// Direct drive with a gate that holds most labels back: one CPU push per
+// CPU period regardless.
+static bool check_direct(void) {
+  const char* args[] = { "bench_tape", "bench_event", "0.5",
+                         "--load-threshold", "50",
+                         "--temp-threshold", "50",
+                         "--disk-threshold", "1000",
+                         "--heartbeat", "30",
+                         "--direct", "cpu,gpu,mem" };
+  capture_reset();
+  g_step = 0;
+  if (!system_stats_parse((int)(sizeof(args) / sizeof(args[0])), (char**)args,
+                          &g_recorded.options)
+      || !system_stats_init_with(&g_recorded, synthetic_sources(), ORIGIN_NS)) {
+    return false;
+  }
+  for (int step = 0; step < STEPS; step++) {
+    g_step = (uint64_t)step;
+    uint64_t now = ORIGIN_NS + (uint64_t)step * STEP_NS;
+    system_stats_run(&g_recorded, now, now);
+  }
+  uint64_t periods = STEPS / 2;
+  if (g_capture.cpu_pushes != periods || g_recorded.gate.suppressed == 0) {
+    fprintf(stderr, "direct: %llu cpu pushes in %llu periods, %llu suppressed\n",
+            (unsigned long long)g_capture.cpu_pushes, (unsigned long long)periods,
+            (unsigned long long)g_recorded.gate.suppressed);
+    return false;
+  }
+  printf("direct: %llu cpu pushes in %llu periods with %llu samples suppressed\n",
+         (unsigned long long)g_capture.cpu_pushes, (unsigned long long)periods,
+         (unsigned long long)g_recorded.gate.suppressed);
+  return true;
+}
+
+static bool check(void) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/bench_tape_XXXXXX");
+  int fd = mkstemp(path);
+  if (fd < 0) return false;
+  close(fd);
+
+  struct capture recorded, replayed, tampered, cut;
+  bool ok = record(path, &recorded);
+  if (!ok) fprintf(stderr, "recording failed\n");
+
+  ok = ok && replay(path, NULL, &replayed);
+  if (ok && (replayed.messages != recorded.messages || replayed.bytes != recorded.bytes
+             || replayed.hash != recorded.hash)) {
+    fprintf(stderr, "replay sent %llu messages (%llu bytes), recorded %llu (%llu bytes)%s\n",
+            (unsigned long long)replayed.messages, (unsigned long long)replayed.bytes,
+            (unsigned long long)recorded.messages, (unsigned long long)recorded.bytes,
+            replayed.bytes == recorded.bytes ? " with other content" : "");
+    ok = false;
+  }
+
+  if (ok && (replay(path, tamper_handle, &tampered) || g_replayed.tape.ended)) {
+    fprintf(stderr, "a tampered sensor handle was replayed\n");
+    ok = false;
+  }
+  if (ok && (!replay(path, tamper_cut, &cut) || !g_replayed.tape.ended
+             || cut.messages == 0 || cut.messages >= recorded.messages)) {
+    fprintf(stderr, "a cut tape did not replay up to the cut\n");
+    ok = false;
+  }
+
+  if (ok) {
+    FILE* file = fopen(path, "r+b");
+    ok = file && fwrite("SBTAPE1\n", 1, TAPE_MAGIC_SIZE, file) == TAPE_MAGIC_SIZE;
+    if (file) fclose(file);
+    struct capture old;
+    if (!ok || replay(path, NULL, &old)) {
+      fprintf(stderr, "a tape of the previous format version was replayed\n");
+      ok = false;
+    }
+  }
+
+  if (ok) {
+    printf("tape: %d steps recorded and replayed, %llu messages (%llu bytes) identical,"
+           " tampered tape rejected, cut tape replayed up to the cut, old version refused\n",
+           STEPS, (unsigned long long)recorded.messages, (unsigned long long)recorded.bytes);
+  }
+  unlink(path);
+  return ok;
+}
+
+static void bench_tick(void* ctx) {
+  struct system_stats* stats = ctx;
+  g_step++;
+  system_stats_tick(stats, ORIGIN_NS + g_step * STEP_NS, (1u << COLLECTORS) - 1);
+  g_bench_sink += stats->message.length;
+}
+
+int main(void) {
+  sketchybar_set_transport(&g_capture_transport);
+  if (!check() || !check_direct()) return 1;
+
+  g_step = 0;
+  if (!parse(&g_recorded, NULL, NULL)
+      || !system_stats_init_with(&g_recorded, synthetic_sources(), ORIGIN_NS)) {
+    return 1;
+  }
+  bench_run("system_stats_tick synthetic", bench_tick, &g_recorded);
+
+  if (!parse(&g_replayed, "--record", "/dev/null")
+      || !system_stats_init_with(&g_replayed, synthetic_sources(), ORIGIN_NS)) {
+    return 1;
+  }
+  bench_run("system_stats_tick synthetic, recording", bench_tick, &g_replayed);
+  return 0;
+}
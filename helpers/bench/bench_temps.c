@@ -0,0 +1,197 @@
+// Temperature sensor set from helpers/system_stats/temps.h, replayed from a
+// recorded fixture (fixtures/temps.txt by default).
+//
+// - check: every tick, cluster min/avg/max must match the previous approach
+//   (classify every service by name, then read), and the set must be rebuilt
+//   exactly on the first tick, after the sensor that vanished, and after the
+//   notification
+// - update: temps_update() versus classify-and-read over the same services
+
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../system_stats/temps.h"
+
+#define FIXTURE_TICKS 64
+#define FIXTURE_SERVICES 64
+
+struct fixture_tick {
+  bool changed;
+  int count;
+  struct temp_service services[FIXTURE_SERVICES];
+  double celsius[FIXTURE_SERVICES];
+};
+
+struct fixture {
+  int tick_count;
+  int tick;
+  struct fixture_tick ticks[FIXTURE_TICKS];
+  uint64_t enumerations;
+};
+
+static bool fixture_load(struct fixture* fixture, const char* path) {
+  FILE* file = fopen(path, "r");
+  if (!file) return false;
+
+  memset(fixture, 0, sizeof(struct fixture));
+  char line[256];
+  struct fixture_tick* tick = NULL;
+  while (fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "\n")] = '\0';
+    if (line[0] == '#' || line[0] == '\0') continue;
+    if (strncmp(line, "tick", 4) == 0) {
+      if (fixture->tick_count == FIXTURE_TICKS) break;
+      tick = &fixture->ticks[fixture->tick_count++];
+      tick->changed = strstr(line, "changed") != NULL;
+      continue;
+    }
+
+    char* name = strchr(line, '\t');
+    char* value = name ? strchr(name + 1, '\t') : NULL;
+    if (!tick || !value || tick->count == FIXTURE_SERVICES) continue;
+    *name++ = '\0';
+    *value++ = '\0';
+    struct temp_service* service = &tick->services[tick->count];
+    service->handle = strtoull(line, NULL, 10);
+    snprintf(service->name, sizeof(service->name), "%s", name);
+    tick->celsius[tick->count] = strtod(value, NULL);
+    tick->count++;
+  }
+  fclose(file);
+  return fixture->tick_count > 0;
+}
+
+static int fixture_enumerate(void* context, struct temp_service* out, int capacity) {
+  struct fixture* fixture = context;
+  struct fixture_tick* tick = &fixture->ticks[fixture->tick];
+  fixture->enumerations++;
+  int count = tick->count < capacity ? tick->count : capacity;
+  memcpy(out, tick->services, sizeof(struct temp_service) * count);
+  return count;
+}
+
+static bool fixture_read(void* context, uint64_t handle, double* celsius) {
+  struct fixture* fixture = context;
+  struct fixture_tick* tick = &fixture->ticks[fixture->tick];
+  for (int i = 0; i < tick->count; i++) {
+    if (tick->services[i].handle != handle) continue;
+    *celsius = tick->celsius[i];
+    return true;
+  }
+  return false;
+}
+
+static bool fixture_changed(void* context) {
+  struct fixture* fixture = context;
+  return fixture->ticks[fixture->tick].changed;
+}
+
+static struct temp_source fixture_source(struct fixture* fixture) {
+  return (struct temp_source){ "fixture", fixture_enumerate, fixture_read, fixture_changed, fixture };
+}
+
+// What read_temperatures() did every tick: classify each service by name
+// before reading it.
+static void reference(struct fixture* fixture, struct temp_cluster* clusters) {
+  memset(clusters, 0, sizeof(struct temp_cluster) * TEMP_CLUSTERS);
+  struct temp_service services[FIXTURE_SERVICES];
+  int count = fixture_enumerate(fixture, services, FIXTURE_SERVICES);
+  for (int i = 0; i < count; i++) {
+    char name[TEMP_NAME_SIZE];
+    memcpy(name, services[i].name, sizeof(name));
+    int cluster = temp_classify(name);
+    if (cluster < 0) continue;
+
+    double celsius = -1.0;
+    if (!fixture_read(fixture, services[i].handle, &celsius)) continue;
+    if (!isfinite(celsius) || celsius <= 0.0) continue;
+    struct temp_cluster* stats = &clusters[cluster];
+    if (stats->count == 0 || celsius < stats->min) stats->min = celsius;
+    if (stats->count == 0 || celsius > stats->max) stats->max = celsius;
+    stats->sum += celsius;
+    stats->count++;
+  }
+}
+
+static bool check(struct fixture* fixture) {
+  struct temps temps;
+  temps_init(&temps, fixture_source(fixture));
+
+  uint64_t rebuilt_at[FIXTURE_TICKS];
+  int rebuild_count = 0;
+  for (fixture->tick = 0; fixture->tick < fixture->tick_count; fixture->tick++) {
+    uint64_t rebuilds = temps.rebuilds;
+    temps_update(&temps);
+    if (temps.rebuilds != rebuilds) rebuilt_at[rebuild_count++] = (uint64_t)fixture->tick + 1;
+
+    struct temp_cluster expected[TEMP_CLUSTERS];
+    reference(fixture, expected);
+    for (int cluster = 0; cluster < TEMP_CLUSTERS; cluster++) {
+      struct temp_cluster* got = &temps.clusters[cluster];
+      struct temp_cluster* want = &expected[cluster];
+      // A vanished sensor only leaves the set after the tick it failed on,
+      // but it is unreadable on that tick, so the readings still agree.
+      if (got->count != want->count
+          || (got->count && (got->min != want->min
+                             || got->max != want->max
+                             || fabs(got->sum - want->sum) > 1e-9))) {
+        fprintf(stderr, "tick %d cluster %d: %d sensors, expected %d\n",
+                fixture->tick + 1, cluster, got->count, want->count);
+        return false;
+      }
+    }
+
+    printf("tick %2d: cpu %d/%d/%d gpu %d/%d/%d (min/avg/max C, %d sensors)\n",
+           fixture->tick + 1,
+           temps_min(&temps, TEMP_CLUSTER_CPU), temps_avg(&temps, TEMP_CLUSTER_CPU),
+           temps_max(&temps, TEMP_CLUSTER_CPU),
+           temps_min(&temps, TEMP_CLUSTER_GPU), temps_avg(&temps, TEMP_CLUSTER_GPU),
+           temps_max(&temps, TEMP_CLUSTER_GPU),
+           temps.count);
+  }
+
+  // The default fixture: initial build, PMU tdev8 vanishing on tick 4 (the
+  // set is rebuilt on tick 5) and the notification on tick 7.
+  uint64_t expected[] = { 1, 5, 7 };
+  bool rebuilds_ok = rebuild_count == 3;
+  for (int i = 0; i < rebuild_count && rebuilds_ok; i++) rebuilds_ok = rebuilt_at[i] == expected[i];
+  if (!rebuilds_ok) {
+    fprintf(stderr, "rebuilt %d times, expected on ticks 1, 5 and 7\n", rebuild_count);
+    return false;
+  }
+  printf("temps matches per-tick classification; %llu rebuilds in %d ticks\n",
+         (unsigned long long)temps.rebuilds, fixture->tick_count);
+  return true;
+}
+
+static struct fixture g_fixture;
+static struct temps g_temps;
+
+static void bench_update(void* ctx) {
+  (void)ctx;
+  temps_update(&g_temps);
+  g_bench_sink += (uint64_t)temps_avg(&g_temps, TEMP_CLUSTER_CPU);
+}
+
+static void bench_reference(void* ctx) {
+  (void)ctx;
+  struct temp_cluster clusters[TEMP_CLUSTERS];
+  reference(&g_fixture, clusters);
+  g_bench_sink += (uint64_t)clusters[TEMP_CLUSTER_CPU].count;
+}
+
+int main(int argc, char** argv) {
+  const char* path = argc > 1 ? argv[1] : "fixtures/temps.txt";
+  if (!fixture_load(&g_fixture, path)) {
+    fprintf(stderr, "Could not load %s\n", path);
+    return 1;
+  }
+  if (!check(&g_fixture)) return 1;
+
+  g_fixture.tick = 0;
+  g_fixture.ticks[0].changed = false;
+  temps_init(&g_temps, fixture_source(&g_fixture));
+  bench_run("temps_update (indexed set)", bench_update, NULL);
+  bench_run("classify + read every tick", bench_reference, NULL);
+  return 0;
+}
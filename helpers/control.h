@@ -0,0 +1,146 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Line-based control channel on a FIFO.
+//
+// The helper creates the FIFO at startup (replacing whatever was left at the
+// path) and keeps a write end open itself, so writers coming and going never
+// leave the read end at EOF. Anything can send a command with
+// `echo "<command>" > <path>`. control_wait() doubles as the helper's sleep:
+// it returns early when a command arrives. Without a path it just sleeps.
+//
+// Helpers that sample periodically share a small vocabulary: `pause` stops
+// collection until `resume`, which resets rate baselines and samples again
+// right away, and `rate <seconds>` changes the sampling interval.
+
+// How long after `resume` the first sample is taken, so that rates have a
+// fresh baseline to be measured against.
+#define CONTROL_RESUME_SETTLE_NS 250000000ull
+
+struct control {
+  const char* path;
+  int fd;
+  int keepalive_fd;
+  char buffer[512];
+  size_t filled;
+};
+
+static inline void control_init(struct control* control) {
+  control->path = NULL;
+  control->fd = -1;
+  control->keepalive_fd = -1;
+  control->filled = 0;
+}
+
+static const char* g_control_path = NULL;
+static struct stat g_control_stat;
+
+// Writers block on a FIFO nobody reads, so it must not outlive the helper.
+// A replacement instance may already have created its own FIFO at the same
+// path, so only the one this process created is removed.
+static inline void control_unlink_own(void) {
+  struct stat st;
+  if (!g_control_path || lstat(g_control_path, &st) != 0) return;
+  if (st.st_dev == g_control_stat.st_dev && st.st_ino == g_control_stat.st_ino) {
+    unlink(g_control_path);
+  }
+}
+
+static inline void control_handle_term(int sig) {
+  (void)sig;
+  control_unlink_own();
+  _exit(0);
+}
+
+static inline bool control_open(struct control* control, const char* path) {
+  unlink(path);
+  if (mkfifo(path, 0600) != 0) return false;
+
+  control->fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (control->fd < 0) return false;
+  control->keepalive_fd = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  control->path = path;
+
+  if (fstat(control->fd, &g_control_stat) == 0) {
+    if (!g_control_path) {
+      atexit(control_unlink_own);
+      signal(SIGTERM, control_handle_term);
+      signal(SIGINT, control_handle_term);
+    }
+    g_control_path = path;
+  }
+  return true;
+}
+
+static inline void control_close(struct control* control) {
+  if (control->path) control_unlink_own();
+  if (control->fd >= 0) close(control->fd);
+  if (control->keepalive_fd >= 0) close(control->keepalive_fd);
+  g_control_path = NULL;
+  control_init(control);
+}
+
+// Sleeps up to timeout_ns; returns true when a command may be ready.
+static inline bool control_wait(struct control* control, uint64_t timeout_ns) {
+  // Waits longer than a minute (a paused helper waits forever) are cut short;
+  // the caller just waits again.
+  if (timeout_ns > 60000000000ull) timeout_ns = 60000000000ull;
+  int timeout_ms = (int)((timeout_ns + 999999) / 1000000);
+  if (control->fd < 0) {
+    struct timespec ts = { (time_t)(timeout_ns / 1000000000ull),
+                           (long)(timeout_ns % 1000000000ull) };
+    nanosleep(&ts, NULL);
+    return false;
+  }
+
+  struct pollfd pfd = { .fd = control->fd, .events = POLLIN };
+  return poll(&pfd, 1, timeout_ms) > 0 && (pfd.revents & POLLIN);
+}
+
+// Pops the next complete command line into line; false when there is none.
+static inline bool control_next(struct control* control, char* line, size_t size) {
+  if (control->fd < 0) return false;
+
+  for (;;) {
+    char* newline = memchr(control->buffer, '\n', control->filled);
+    if (newline) {
+      size_t length = (size_t)(newline - control->buffer);
+      size_t copied = length < size - 1 ? length : size - 1;
+      memcpy(line, control->buffer, copied);
+      line[copied] = '\0';
+      control->filled -= length + 1;
+      memmove(control->buffer, newline + 1, control->filled);
+      return true;
+    }
+
+    // A line that fills the whole buffer is garbage; drop it.
+    if (control->filled == sizeof(control->buffer)) control->filled = 0;
+    ssize_t received = read(control->fd,
+                            control->buffer + control->filled,
+                            sizeof(control->buffer) - control->filled);
+    if (received <= 0) return false;
+    control->filled += (size_t)received;
+  }
+}
+
+// Returns the arguments of line (possibly "") when its first word is name,
+// NULL otherwise.
+static inline const char* control_match(const char* line, const char* name) {
+  size_t length = strlen(name);
+  if (strncmp(line, name, length) != 0) return NULL;
+  if (line[length] != '\0' && line[length] != ' ') return NULL;
+  const char* args = line + length;
+  while (*args == ' ') args++;
+  return args;
+}
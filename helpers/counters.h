@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Rates from snapshots of named cumulative counters, shared by the
+// collectors that read every device in one pass (system_stats' disks,
+// network_load's interfaces). A collector keeps two snapshots and, on every
+// update, takes the interval with counters_interval(), looks each entry's
+// previous counters up with counters_find() and turns the deltas into rates
+// with counters_rate().
+
+// An older baseline no longer describes the current rates.
+#define COUNTERS_MAX_GAP_NS 100000000000ull
+
+struct counters_baseline {
+  bool has_prev;
+  uint64_t prev_ns;
+};
+
+// Seconds since the previous snapshot, and now_ns becomes the next baseline.
+// 0 when there is no usable previous snapshot: on the first update, after
+// counters_reset(), when the clock did not advance or after more than 100s.
+static inline double counters_interval(struct counters_baseline* baseline, uint64_t now_ns) {
+  bool usable = baseline->has_prev && now_ns > baseline->prev_ns
+                && now_ns - baseline->prev_ns <= COUNTERS_MAX_GAP_NS;
+  double seconds = usable ? (double)(now_ns - baseline->prev_ns) / 1e9 : 0.0;
+  baseline->has_prev = true;
+  baseline->prev_ns = now_ns;
+  return seconds;
+}
+
+static inline void counters_reset(struct counters_baseline* baseline) {
+  baseline->has_prev = false;
+}
+
+// Counter delta per second; a counter that went backwards was reset (the
+// device was recreated under the same name) and the interval reports nothing.
+static inline double counters_rate(uint64_t now, uint64_t prev, double seconds) {
+  if (now < prev) return 0.0;
+  return (double)(now - prev) / seconds;
+}
+
+// The entry named name among count entries of stride bytes each, whose first
+// member is their name. Devices usually keep their position between
+// snapshots, so position hint is tried first.
+static inline const void* counters_find(const void* entries,
+                                        int count,
+                                        size_t stride,
+                                        int hint,
+                                        const char* name) {
+  const char* base = entries;
+  if (hint < count && strcmp(base + (size_t)hint * stride, name) == 0) {
+    return base + (size_t)hint * stride;
+  }
+  for (int i = 0; i < count; i++) {
+    if (strcmp(base + (size_t)i * stride, name) == 0) return base + (size_t)i * stride;
+  }
+  return NULL;
+}
+
+// Skips spaces, then parses a decimal number.
+static inline uint64_t counters_parse_u64(const char** cursor, const char* end) {
+  const char* c = *cursor;
+  while (c < end && *c == ' ') c++;
+  uint64_t value = 0;
+  while (c < end && *c >= '0' && *c <= '9') value = value * 10 + (uint64_t)(*c++ - '0');
+  *cursor = c;
+  return value;
+}
+
+// Reads a /proc table, opened on first use and kept open, with pread().
+// Returns the length of its complete lines: a table that does not fit the
+// buffer ends in a truncated line, which is dropped rather than parsed. -1
+// when the file cannot be read (it is closed and reopened next time).
+static inline ssize_t counters_proc_read(int* fd, const char* path, char* buffer, size_t size) {
+  if (*fd < 0) {
+    *fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (*fd < 0) return -1;
+  }
+
+  ssize_t length = pread(*fd, buffer, size, 0);
+  if (length <= 0) {
+    close(*fd);
+    *fd = -1;
+    return -1;
+  }
+  while (length > 0 && buffer[length - 1] != '\n') length--;
+  return length;
+}
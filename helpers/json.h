@@ -0,0 +1,279 @@
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Streaming JSON writer for the one-shot helpers.
+//
+// Output goes into a caller-provided buffer, which is written to fd whenever
+// it fills up, so documents of any size need no allocation. Commas are
+// inserted by the writer; callers only open and close containers and emit
+// keys and values:
+//
+//   char buffer[1024];
+//   struct json_writer json;
+//   json_init(&json, buffer, sizeof(buffer), STDOUT_FILENO);
+//   json_begin_object(&json);
+//   json_field_int(&json, "percent", 87);
+//   json_field_string(&json, "power_source", "AC");
+//   json_end_object(&json);
+//   json_finish(&json);
+//
+// With fd < 0 the document must fit the buffer; json_finish() reports
+// whether it did. Strings are escaped as RFC 8259 requires (quote,
+// backslash, control characters); other bytes, including UTF-8, are copied
+// as they are.
+
+#define JSON_DEPTH_MAX 16
+
+struct json_writer {
+  char* buffer;
+  size_t capacity;
+  size_t length;
+  int fd;
+  bool failed;
+
+  int depth;
+  // Whether the next value at each depth needs a comma in front.
+  bool comma[JSON_DEPTH_MAX];
+  bool after_key;
+};
+
+static inline void json_init(struct json_writer* json, char* buffer, size_t capacity, int fd) {
+  json->buffer = buffer;
+  json->capacity = capacity;
+  json->length = 0;
+  json->fd = fd;
+  json->failed = capacity == 0;
+  json->depth = 0;
+  json->comma[0] = false;
+  json->after_key = false;
+}
+
+static inline bool json_flush(struct json_writer* json) {
+  if (json->fd < 0) return !json->failed;
+  size_t written = 0;
+  while (written < json->length) {
+    ssize_t result = write(json->fd, json->buffer + written, json->length - written);
+    if (result <= 0) {
+      json->failed = true;
+      break;
+    }
+    written += (size_t)result;
+  }
+  json->length = 0;
+  return !json->failed;
+}
+
+static inline void json_append(struct json_writer* json, const char* data, size_t size) {
+  while (!json->failed && size > 0) {
+    if (json->length >= json->capacity) {
+      if (json->fd < 0) {
+        json->failed = true;
+        return;
+      }
+      json_flush(json);
+      continue;
+    }
+    size_t room = json->capacity - json->length;
+    size_t chunk = size < room ? size : room;
+    memcpy(json->buffer + json->length, data, chunk);
+    json->length += chunk;
+    data += chunk;
+    size -= chunk;
+  }
+}
+
+static inline void json_append_char(struct json_writer* json, char c) {
+  if (!json->failed && json->length < json->capacity) {
+    json->buffer[json->length++] = c;
+    return;
+  }
+  json_append(json, &c, 1);
+}
+
+// Comma before every value but the first in its container; none after a key.
+static inline void json_value_start(struct json_writer* json) {
+  if (json->after_key) {
+    json->after_key = false;
+    return;
+  }
+  if (json->comma[json->depth]) json_append_char(json, ',');
+  json->comma[json->depth] = true;
+}
+
+static inline void json_open(struct json_writer* json, char bracket) {
+  json_value_start(json);
+  json_append_char(json, bracket);
+  if (json->depth == JSON_DEPTH_MAX - 1) {
+    json->failed = true;
+    return;
+  }
+  json->comma[++json->depth] = false;
+}
+
+static inline void json_close(struct json_writer* json, char bracket) {
+  if (json->depth == 0) {
+    json->failed = true;
+    return;
+  }
+  json->depth--;
+  json_append_char(json, bracket);
+}
+
+static inline void json_begin_object(struct json_writer* json) { json_open(json, '{'); }
+static inline void json_end_object(struct json_writer* json) { json_close(json, '}'); }
+static inline void json_begin_array(struct json_writer* json) { json_open(json, '['); }
+static inline void json_end_array(struct json_writer* json) { json_close(json, ']'); }
+
+static inline void json_escaped(struct json_writer* json, const char* text, size_t length) {
+  static const char hex[] = "0123456789abcdef";
+  json_append_char(json, '"');
+  size_t run = 0;
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = (unsigned char)text[i];
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+    json_append(json, text + run, i - run);
+    run = i + 1;
+    char escape[6] = { '\\', 0, '0', '0', 0, 0 };
+    switch (c) {
+      case '"': escape[1] = '"'; break;
+      case '\\': escape[1] = '\\'; break;
+      case '\b': escape[1] = 'b'; break;
+      case '\f': escape[1] = 'f'; break;
+      case '\n': escape[1] = 'n'; break;
+      case '\r': escape[1] = 'r'; break;
+      case '\t': escape[1] = 't'; break;
+      default:
+        escape[1] = 'u';
+        escape[4] = hex[c >> 4];
+        escape[5] = hex[c & 0xf];
+        json_append(json, escape, 6);
+        continue;
+    }
+    json_append(json, escape, 2);
+  }
+  json_append(json, text + run, length - run);
+  json_append_char(json, '"');
+}
+
+static inline void json_key(struct json_writer* json, const char* key) {
+  json_value_start(json);
+  json_escaped(json, key, strlen(key));
+  json_append_char(json, ':');
+  json->after_key = true;
+}
+
+static inline void json_string_n(struct json_writer* json, const char* text, size_t length) {
+  json_value_start(json);
+  json_escaped(json, text, length);
+}
+
+static inline void json_string(struct json_writer* json, const char* text) {
+  if (!text) {
+    json_value_start(json);
+    json_append(json, "null", 4);
+    return;
+  }
+  json_string_n(json, text, strlen(text));
+}
+
+static inline void json_uint(struct json_writer* json, uint64_t value) {
+  char digits[20];
+  uint32_t count = 0;
+  do {
+    digits[sizeof(digits) - 1 - count++] = '0' + (char)(value % 10);
+    value /= 10;
+  } while (value);
+  json_value_start(json);
+  json_append(json, digits + sizeof(digits) - count, count);
+}
+
+static inline void json_int(struct json_writer* json, int64_t value) {
+  if (value >= 0) {
+    json_uint(json, (uint64_t)value);
+    return;
+  }
+  char digits[21];
+  uint64_t magnitude = (uint64_t)0 - (uint64_t)value;
+  uint32_t count = 0;
+  do {
+    digits[sizeof(digits) - 1 - count++] = '0' + (char)(magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude);
+  digits[sizeof(digits) - 1 - count++] = '-';
+  json_value_start(json);
+  json_append(json, digits + sizeof(digits) - count, count);
+}
+
+// NaN and infinities have no JSON form and are written as null.
+static inline void json_double(struct json_writer* json, double value, int precision) {
+  json_value_start(json);
+  if (!isfinite(value)) {
+    json_append(json, "null", 4);
+    return;
+  }
+  char text[64];
+  int written = snprintf(text, sizeof(text), "%.*f", precision, value);
+  if (written > 0 && (size_t)written < sizeof(text)) json_append(json, text, (size_t)written);
+  else json_append(json, "null", 4);
+}
+
+static inline void json_bool(struct json_writer* json, bool value) {
+  json_value_start(json);
+  if (value) json_append(json, "true", 4);
+  else json_append(json, "false", 5);
+}
+
+static inline void json_null(struct json_writer* json) {
+  json_value_start(json);
+  json_append(json, "null", 4);
+}
+
+// A value that is already valid JSON text (a number formatted elsewhere).
+static inline void json_raw(struct json_writer* json, const char* text, size_t length) {
+  json_value_start(json);
+  json_append(json, text, length);
+}
+
+static inline void json_field_string(struct json_writer* json, const char* key, const char* value) {
+  json_key(json, key);
+  json_string(json, value);
+}
+
+static inline void json_field_int(struct json_writer* json, const char* key, int64_t value) {
+  json_key(json, key);
+  json_int(json, value);
+}
+
+static inline void json_field_uint(struct json_writer* json, const char* key, uint64_t value) {
+  json_key(json, key);
+  json_uint(json, value);
+}
+
+static inline void json_field_double(struct json_writer* json,
+                                     const char* key,
+                                     double value,
+                                     int precision) {
+  json_key(json, key);
+  json_double(json, value, precision);
+}
+
+static inline void json_field_bool(struct json_writer* json, const char* key, bool value) {
+  json_key(json, key);
+  json_bool(json, value);
+}
+
+// Ends the document with a newline and writes out what is left. False when
+// the document was cut short (buffer too small, failed write, unbalanced
+// containers).
+static inline bool json_finish(struct json_writer* json) {
+  if (json->depth != 0 || json->after_key) json->failed = true;
+  json_append_char(json, '\n');
+  return json_flush(json);
+}
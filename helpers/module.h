@@ -0,0 +1,184 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+#include "control.h"
+#include "sched.h"
+#include "sketchybar.h"
+
+// Host loop for periodic collectors ("modules").
+//
+// A module reports its next deadline and runs whatever is due. The host
+// sleeps until the earliest deadline of all its modules, or until a control
+// command arrives, and then runs every module that is due within slack_ns, so
+// modules with nearby deadlines share one wakeup. A standalone helper hosts
+// a single module; helpers/stats_daemon hosts several behind one control FIFO
+// and one bar connection.
+//
+// Commands whose first word names a module go to that module with the name
+// stripped ("system_stats procs 10"). `report` triggers `helper_report` with
+// the host's wakeups per minute and resident memory. Anything else goes to
+// every module, so `pause` pauses them all.
+
+#define MODULE_MAX 8
+#define MODULE_IDLE_MAX_NS 60000000000ull
+
+struct module {
+  const char* name;
+  void* state;
+  // Absolute deadline of the next run on the sketchybar_now_ns() clock,
+  // UINT64_MAX when there is nothing to do (e.g. paused).
+  uint64_t (*next)(void* state);
+  // Runs everything due by due_ns, which may be up to the host's slack ahead
+  // of now_ns.
+  void (*run)(void* state, uint64_t now_ns, uint64_t due_ns);
+  // One control command, without the module name. Optional.
+  void (*command)(void* state, const char* line);
+
+  uint64_t runs;
+};
+
+struct module_host {
+  const char* name;
+  struct module modules[MODULE_MAX];
+  int count;
+  struct control control;
+  uint64_t slack_ns;
+
+  bool report_added;
+  uint64_t started_ns;
+  uint64_t wakeups;
+};
+
+static inline void module_host_init(struct module_host* host, const char* name, uint64_t slack_ns) {
+  memset(host, 0, sizeof(struct module_host));
+  host->name = name;
+  host->slack_ns = slack_ns;
+  control_init(&host->control);
+}
+
+static inline bool module_host_add(struct module_host* host, struct module module) {
+  if (host->count == MODULE_MAX) return false;
+  module.runs = 0;
+  host->modules[host->count++] = module;
+  return true;
+}
+
+// Resident memory of this process in bytes, 0 when unknown.
+static inline uint64_t module_rss_bytes(void) {
+#ifdef __APPLE__
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+    return 0;
+  }
+  return info.resident_size;
+#else
+  FILE* file = fopen("/proc/self/statm", "r");
+  if (!file) return 0;
+  unsigned long long pages = 0;
+  unsigned long long resident = 0;
+  int matched = fscanf(file, "%llu %llu", &pages, &resident);
+  fclose(file);
+  return matched == 2 ? resident * (uint64_t)sysconf(_SC_PAGESIZE) : 0;
+#endif
+}
+
+static inline double module_host_wakeups_per_minute(const struct module_host* host, uint64_t now_ns) {
+  uint64_t elapsed = now_ns - host->started_ns;
+  return elapsed ? (double)host->wakeups * 60e9 / (double)elapsed : 0.0;
+}
+
+static inline void module_host_report(struct module_host* host) {
+  if (!host->report_added) {
+    char add_event[] = "--add event helper_report";
+    sketchybar(add_event);
+    host->report_added = true;
+  }
+
+  char buffer[512];
+  struct sb_message msg;
+  sb_msg_init(&msg, buffer, sizeof(buffer));
+  sb_msg_arg(&msg, "--trigger");
+  sb_msg_arg(&msg, "helper_report");
+  sb_msg_str(&msg, "helper", host->name);
+  sb_msg_double(&msg, "wakeups_per_min",
+                module_host_wakeups_per_minute(host, sketchybar_now_ns()), 1);
+  sb_msg_uint(&msg, "rss_bytes", module_rss_bytes());
+  sb_msg_key(&msg, "runs");
+  for (int i = 0; i < host->count; i++) {
+    if (i > 0) sb_msg_append(&msg, ",", 1);
+    sb_msg_append(&msg, host->modules[i].name, (uint32_t)strlen(host->modules[i].name));
+    sb_msg_append(&msg, ":", 1);
+    sb_msg_append_uint(&msg, host->modules[i].runs);
+  }
+  sb_msg_end_arg(&msg);
+  sb_msg_send(&msg);
+}
+
+static inline void module_host_command(struct module_host* host, const char* line) {
+  if (control_match(line, "report")) {
+    module_host_report(host);
+    return;
+  }
+
+  for (int i = 0; i < host->count; i++) {
+    const char* args = control_match(line, host->modules[i].name);
+    if (!args) continue;
+    if (host->modules[i].command) host->modules[i].command(host->modules[i].state, args);
+    return;
+  }
+
+  for (int i = 0; i < host->count; i++) {
+    if (host->modules[i].command) host->modules[i].command(host->modules[i].state, line);
+  }
+}
+
+static inline uint64_t module_host_next(const struct module_host* host) {
+  uint64_t next = UINT64_MAX;
+  for (int i = 0; i < host->count; i++) {
+    uint64_t deadline = host->modules[i].next(host->modules[i].state);
+    if (deadline < next) next = deadline;
+  }
+  return next;
+}
+
+// Never returns.
+static inline void module_host_run(struct module_host* host) {
+  host->started_ns = sketchybar_now_ns();
+  for (;;) {
+    uint64_t now = sketchybar_now_ns();
+    uint64_t deadline = module_host_next(host);
+    if (deadline > now) {
+      // Idle waits are cut to a minute so the lifetime checks still run.
+      if (deadline - now > MODULE_IDLE_MAX_NS) deadline = now + MODULE_IDLE_MAX_NS;
+      if (host->control.fd < 0) {
+        sched_sleep_until(deadline);
+      } else if (control_wait(&host->control, deadline - now)) {
+        char command[128];
+        while (control_next(&host->control, command, sizeof(command))) {
+          module_host_command(host, command);
+        }
+      }
+      host->wakeups++;
+      sb_lifetime_check();
+      now = sketchybar_now_ns();
+    }
+
+    uint64_t due = now + host->slack_ns;
+    for (int i = 0; i < host->count; i++) {
+      struct module* module = &host->modules[i];
+      if (module->next(module->state) > due) continue;
+      module->run(module->state, now, due);
+      module->runs++;
+    }
+  }
+}
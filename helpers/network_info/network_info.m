@@ -1,21 +1,16 @@
 #import <Foundation/Foundation.h>
 #import <CoreWLAN/CoreWLAN.h>
 #import <SystemConfiguration/SystemConfiguration.h>
+#include "../json.h"
 #include "../network_interface_resolver.h"
 #include <arpa/inet.h>
 #include <ifaddrs.h>
 #include <net/if.h>
 #include <string.h>
 
-static void set_string(NSMutableDictionary *dict, NSString *key, NSString *value) {
+static void set_string(struct json_writer *json, const char *key, NSString *value) {
   if (value && value.length > 0) {
-    dict[key] = value;
-  }
-}
-
-static void set_number(NSMutableDictionary *dict, NSString *key, NSNumber *value) {
-  if (value) {
-    dict[key] = value;
+    json_field_string(json, key, value.UTF8String);
   }
 }
 
@@ -173,7 +168,7 @@ static void copy_ipconfig_ssid_bssid(NSString *interface_name, NSString **ssid_o
   if (bssid_out && bssid.length > 0) *bssid_out = bssid;
 }
 
-static void add_ipv4_info(NSMutableDictionary *dict, const char *ifname) {
+static void add_ipv4_info(struct json_writer *json, const char *ifname) {
   if (!ifname || ifname[0] == '\0') return;
   struct ifaddrs *ifaddr = NULL;
   if (getifaddrs(&ifaddr) != 0 || !ifaddr) return;
@@ -183,13 +178,13 @@ static void add_ipv4_info(NSMutableDictionary *dict, const char *ifname) {
     char addr_buf[INET_ADDRSTRLEN] = { 0 };
     struct sockaddr_in *addr = (struct sockaddr_in *)ifa->ifa_addr;
     if (inet_ntop(AF_INET, &addr->sin_addr, addr_buf, sizeof(addr_buf))) {
-      set_string(dict, @"ip", [NSString stringWithUTF8String:addr_buf]);
+      json_field_string(json, "ip", addr_buf);
     }
     if (ifa->ifa_netmask) {
       char mask_buf[INET_ADDRSTRLEN] = { 0 };
       struct sockaddr_in *mask = (struct sockaddr_in *)ifa->ifa_netmask;
       if (inet_ntop(AF_INET, &mask->sin_addr, mask_buf, sizeof(mask_buf))) {
-        set_string(dict, @"subnet_mask", [NSString stringWithUTF8String:mask_buf]);
+        json_field_string(json, "subnet_mask", mask_buf);
       }
     }
     break;
@@ -229,15 +224,18 @@ int main(int argc, char **argv) {
       }
     }
 
-    NSMutableDictionary *info = [NSMutableDictionary dictionary];
+    char buffer[1024];
+    struct json_writer info;
+    json_init(&info, buffer, sizeof(buffer), STDOUT_FILENO);
+    json_begin_object(&info);
     if (interface_name.length > 0) {
-      set_string(info, @"interface", interface_name);
-      add_ipv4_info(info, [interface_name UTF8String]);
+      set_string(&info, "interface", interface_name);
+      add_ipv4_info(&info, [interface_name UTF8String]);
     }
 
     CFStringRef computer_name = SCDynamicStoreCopyComputerName(NULL, NULL);
     if (computer_name) {
-      set_string(info, @"hostname", (__bridge_transfer NSString *)computer_name);
+      set_string(&info, "hostname", (__bridge_transfer NSString *)computer_name);
     }
 
     if (iface) {
@@ -262,61 +260,56 @@ int main(int argc, char **argv) {
         if (ssid.length == 0 && ipconfig_ssid.length > 0) ssid = ipconfig_ssid;
         if (bssid.length == 0 && ipconfig_bssid.length > 0) bssid = ipconfig_bssid;
       }
-      set_string(info, @"ssid", ssid);
-      set_string(info, @"bssid", bssid);
-      set_string(info, @"country_code", iface.countryCode);
-      set_string(info, @"adapter_mac", iface.hardwareAddress);
+      set_string(&info, "ssid", ssid);
+      set_string(&info, "bssid", bssid);
+      set_string(&info, "country_code", iface.countryCode);
+      set_string(&info, "adapter_mac", iface.hardwareAddress);
 
       NSString *phy = string_from_phy_mode(iface.activePHYMode);
-      set_string(info, @"phy_mode", phy);
+      set_string(&info, "phy_mode", phy);
 
       NSString *channel = string_from_channel(iface.wlanChannel);
-      set_string(info, @"channel", channel);
+      set_string(&info, "channel", channel);
 
       NSString *security = string_from_security(iface.security);
-      set_string(info, @"security", security);
+      set_string(&info, "security", security);
 
       NSString *mode = string_from_interface_mode(iface.interfaceMode);
-      set_string(info, @"interface_mode", mode);
+      set_string(&info, "interface_mode", mode);
 
       NSInteger rssi = iface.rssiValue;
       NSInteger noise = iface.noiseMeasurement;
       if (rssi != 0) {
-        set_number(info, @"rssi", @(rssi));
+        json_field_int(&info, "rssi", rssi);
       }
       if (noise != 0) {
-        set_number(info, @"noise", @(noise));
+        json_field_int(&info, "noise", noise);
       }
       if (rssi != 0 && noise != 0) {
         NSInteger snr = rssi - noise;
-        set_number(info, @"snr", @(snr));
-        set_string(info, @"signal_noise", [NSString stringWithFormat:@"%ld dBm / %ld dBm", (long)rssi, (long)noise]);
+        json_field_int(&info, "snr", snr);
+        set_string(&info, "signal_noise", [NSString stringWithFormat:@"%ld dBm / %ld dBm", (long)rssi, (long)noise]);
       }
 
       double tx_rate = iface.transmitRate;
       if (tx_rate > 0) {
-        set_string(info, @"transmit_rate", [NSString stringWithFormat:@"%.0f Mbps", tx_rate]);
-        set_number(info, @"transmit_rate_mbps", @(tx_rate));
+        set_string(&info, "transmit_rate", [NSString stringWithFormat:@"%.0f Mbps", tx_rate]);
+        json_field_double(&info, "transmit_rate_mbps", tx_rate, 1);
       }
 
       NSInteger tx_power = iface.transmitPower;
       if (tx_power > 0) {
-        set_string(info, @"transmit_power", [NSString stringWithFormat:@"%ld mW", (long)tx_power]);
-        set_number(info, @"transmit_power_mw", @(tx_power));
+        set_string(&info, "transmit_power", [NSString stringWithFormat:@"%ld mW", (long)tx_power]);
+        json_field_int(&info, "transmit_power_mw", tx_power);
       }
     }
 
     NSString *router = copy_router(store, interface_name);
-    set_string(info, @"router", router);
+    set_string(&info, "router", router);
     if (store) CFRelease(store);
 
-    NSError *error = nil;
-    NSData *json = [NSJSONSerialization dataWithJSONObject:info options:0 error:&error];
-    if (!json) {
-      fprintf(stderr, "Failed to encode JSON: %s\n", error.localizedDescription.UTF8String);
-      return 1;
-    }
-    fwrite(json.bytes, 1, json.length, stdout);
+    json_end_object(&info);
+    if (!json_finish(&info)) return 1;
   }
   return 0;
 }
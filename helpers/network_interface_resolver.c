@@ -1,54 +1,11 @@
 #include "network_interface_resolver.h"
 
 #include <SystemConfiguration/SCNetworkConfiguration.h>
-#include <arpa/inet.h>
-#include <ifaddrs.h>
 #include <net/if.h>
-#include <netinet/in.h>
 #include <string.h>
 
-#define MAX_INTERFACE_CANDIDATES 64
-
-struct interface_candidate {
-  char name[IF_NAMESIZE];
-  int score;
-};
-
-static bool is_virtual_interface_name(const char *name) {
-  static const char *prefixes[] = {
-    "lo",
-    "utun",
-    "ipsec",
-    "ppp",
-    "tun",
-    "tap",
-    "gif",
-    "stf",
-    "llw",
-    "awdl",
-    "ap",
-    "anpi",
-    "bridge",
-    "vnic",
-    "vmnet",
-    "feth",
-  };
-
-  if (!name || name[0] == '\0') return true;
-  for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
-    size_t prefix_len = strlen(prefixes[i]);
-    if (strncmp(name, prefixes[i], prefix_len) == 0) return true;
-  }
-  return false;
-}
-
-static bool is_link_local_ipv4(const struct sockaddr_in *addr) {
-  if (!addr) return false;
-  uint32_t ip = ntohl(addr->sin_addr.s_addr);
-  return (ip & 0xFFFF0000u) == 0xA9FE0000u;
-}
-
-static bool has_router_for_interface(SCDynamicStoreRef store, const char *ifname) {
+static bool has_router_for_interface(void *context, const char *ifname) {
+  SCDynamicStoreRef store = context;
   if (!store || !ifname || ifname[0] == '\0') return false;
 
   CFStringRef key = CFStringCreateWithFormat(NULL,
@@ -95,66 +52,8 @@ bool sb_copy_primary_interface(SCDynamicStoreRef store,
   return false;
 }
 
-static size_t find_candidate_index(struct interface_candidate *candidates,
-                                   size_t count,
-                                   const char *name) {
-  for (size_t i = 0; i < count; i++) {
-    if (strcmp(candidates[i].name, name) == 0) return i;
-  }
-  return SIZE_MAX;
-}
-
-static void upsert_candidate(struct interface_candidate *candidates,
-                             size_t *count,
-                             const char *name,
-                             int score) {
-  size_t index = find_candidate_index(candidates, *count, name);
-  if (index != SIZE_MAX) {
-    if (score > candidates[index].score) candidates[index].score = score;
-    return;
-  }
-
-  if (*count >= MAX_INTERFACE_CANDIDATES) return;
-  strlcpy(candidates[*count].name, name, sizeof(candidates[*count].name));
-  candidates[*count].score = score;
-  (*count)++;
-}
-
-static size_t collect_active_candidates(SCDynamicStoreRef store,
-                                        const char *primary,
-                                        struct interface_candidate *candidates) {
-  struct ifaddrs *ifaddr = NULL;
-  if (getifaddrs(&ifaddr) != 0 || !ifaddr) return 0;
-
-  size_t count = 0;
-  for (struct ifaddrs *ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
-    if (!ifa->ifa_name || !ifa->ifa_addr) continue;
-    if (ifa->ifa_addr->sa_family != AF_INET) continue;
-    if ((ifa->ifa_flags & (IFF_UP | IFF_RUNNING)) != (IFF_UP | IFF_RUNNING)) continue;
-    if ((ifa->ifa_flags & (IFF_LOOPBACK | IFF_POINTOPOINT)) != 0) continue;
-    if (is_virtual_interface_name(ifa->ifa_name)) continue;
-
-    struct sockaddr_in *addr = (struct sockaddr_in *)ifa->ifa_addr;
-    if (is_link_local_ipv4(addr)) continue;
-
-    int score = 0;
-    if (has_router_for_interface(store, ifa->ifa_name)) score += 100;
-    if (strncmp(ifa->ifa_name, "en", 2) == 0) {
-      score += 50;
-    } else if (strncmp(ifa->ifa_name, "bond", 4) == 0) {
-      score += 40;
-    } else {
-      score += 10;
-    }
-    if (primary && primary[0] != '\0' && strcmp(ifa->ifa_name, primary) == 0) {
-      score += 25;
-    }
-
-    upsert_candidate(candidates, &count, ifa->ifa_name, score);
-  }
-
-  freeifaddrs(ifaddr);
-  return count;
+static bool copy_primary_interface(void *context, char *buffer, size_t buffer_size) {
+  return sb_copy_primary_interface(context, buffer, buffer_size);
 }
 
 static bool copy_nonvirtual_service_bsd_name(SCNetworkInterfaceRef interface,
@@ -171,7 +70,7 @@ static bool copy_nonvirtual_service_bsd_name(SCNetworkInterfaceRef interface,
 
     char name[IF_NAMESIZE] = { 0 };
     if (!CFStringGetCString(bsd_name, name, sizeof(name), kCFStringEncodingUTF8)) continue;
-    if (is_virtual_interface_name(name)) continue;
+    if (interface_is_virtual(name)) continue;
 
     strlcpy(buffer, name, buffer_size);
     return true;
@@ -180,30 +79,26 @@ static bool copy_nonvirtual_service_bsd_name(SCNetworkInterfaceRef interface,
   return false;
 }
 
-static bool pick_service_order_candidate(struct interface_candidate *candidates,
-                                         size_t candidate_count,
-                                         char *buffer,
-                                         size_t buffer_size) {
-  if (!buffer || buffer_size == 0 || candidate_count <= 1) return false;
-
+static size_t copy_service_order(void *context, char (*names)[IF_NAMESIZE], size_t max) {
+  (void)context;
   SCPreferencesRef prefs = SCPreferencesCreate(NULL, CFSTR("network_interface_resolver"), NULL);
-  if (!prefs) return false;
+  if (!prefs) return 0;
 
   SCNetworkSetRef set = SCNetworkSetCopyCurrent(prefs);
   if (!set) {
     CFRelease(prefs);
-    return false;
+    return 0;
   }
 
   CFArrayRef service_order = SCNetworkSetGetServiceOrder(set);
   CFArrayRef services = SCNetworkSetCopyServices(set);
-  bool found = false;
+  size_t count = 0;
 
   if (service_order && services) {
     CFIndex order_count = CFArrayGetCount(service_order);
     CFIndex service_count = CFArrayGetCount(services);
 
-    for (CFIndex i = 0; i < order_count && !found; i++) {
+    for (CFIndex i = 0; i < order_count && count < max; i++) {
       CFStringRef wanted_id = CFArrayGetValueAtIndex(service_order, i);
       if (!wanted_id || CFGetTypeID(wanted_id) != CFStringGetTypeID()) continue;
 
@@ -212,16 +107,10 @@ static bool pick_service_order_candidate(struct interface_candidate *candidates,
         CFStringRef service_id = SCNetworkServiceGetServiceID(service);
         if (!service_id || CFStringCompare(wanted_id, service_id, 0) != kCFCompareEqualTo) continue;
 
-        char name[IF_NAMESIZE] = { 0 };
-        if (!copy_nonvirtual_service_bsd_name(SCNetworkServiceGetInterface(service),
-                                              name,
-                                              sizeof(name))) {
-          break;
-        }
-
-        if (find_candidate_index(candidates, candidate_count, name) != SIZE_MAX) {
-          strlcpy(buffer, name, buffer_size);
-          found = true;
+        if (copy_nonvirtual_service_bsd_name(SCNetworkServiceGetInterface(service),
+                                             names[count],
+                                             IF_NAMESIZE)) {
+          count++;
         }
         break;
       }
@@ -231,49 +120,91 @@ static bool pick_service_order_candidate(struct interface_candidate *candidates,
   if (services) CFRelease(services);
   CFRelease(set);
   CFRelease(prefs);
-  return found;
+  return count;
+}
+
+struct interface_store sb_interface_store(SCDynamicStoreRef store) {
+  return (struct interface_store){
+    .name = "dynamic_store",
+    .primary = copy_primary_interface,
+    .addresses = interface_getifaddrs,
+    .has_router = has_router_for_interface,
+    .service_order = copy_service_order,
+    .context = (void *)store,
+  };
 }
 
 bool sb_resolve_effective_interface(SCDynamicStoreRef store,
                                     char *buffer,
                                     size_t buffer_size) {
-  if (!buffer || buffer_size == 0) return false;
+  if (!store) return false;
+  struct interface_store source = sb_interface_store(store);
+  return interface_resolve(&source, buffer, buffer_size);
+}
 
-  buffer[0] = '\0';
-  char primary[IF_NAMESIZE] = { 0 };
-  bool has_primary = sb_copy_primary_interface(store, primary, sizeof(primary));
+static void interface_watch_changed(SCDynamicStoreRef store, CFArrayRef keys, void *info) {
+  (void)store;
+  (void)keys;
+  struct sb_interface_watch *watch = info;
+  interface_cache_invalidate(&watch->cache);
+}
 
-  if (has_primary && !is_virtual_interface_name(primary)) {
-    strlcpy(buffer, primary, buffer_size);
-    return true;
-  }
+// Notifications arrive on a private queue and only bump the cache's
+// generation; the lookup itself runs on the helper's thread when it next
+// asks. Without them every lookup resolves again, as before.
+bool sb_interface_watch_start(struct sb_interface_watch *watch, CFStringRef name) {
+  memset(watch, 0, sizeof(struct sb_interface_watch));
+  watch->store = SCDynamicStoreCreate(NULL, name, NULL, NULL);
+  if (!watch->store) return false;
+  interface_cache_init(&watch->cache, sb_interface_store(watch->store), false);
 
-  struct interface_candidate candidates[MAX_INTERFACE_CANDIDATES] = { 0 };
-  size_t candidate_count = collect_active_candidates(store, primary, candidates);
+  SCDynamicStoreContext context = { 0, watch, NULL, NULL, NULL };
+  watch->notify_store = SCDynamicStoreCreate(NULL, name, interface_watch_changed, &context);
+  if (!watch->notify_store) return true;
 
-  if (candidate_count == 1) {
-    strlcpy(buffer, candidates[0].name, buffer_size);
-    return true;
+  const void *keys[] = {
+    CFSTR("State:/Network/Global/IPv4"),
+    CFSTR("State:/Network/Global/IPv6"),
+    CFSTR("Setup:/Network/Global/IPv4"),
+  };
+  const void *patterns[] = {
+    CFSTR("State:/Network/Interface/[^/]+/IPv4"),
+    CFSTR("State:/Network/Interface/[^/]+/Link"),
+  };
+  CFArrayRef key_list = CFArrayCreate(NULL, keys, 3, &kCFTypeArrayCallBacks);
+  CFArrayRef pattern_list = CFArrayCreate(NULL, patterns, 2, &kCFTypeArrayCallBacks);
+  bool watched = key_list && pattern_list
+                 && SCDynamicStoreSetNotificationKeys(watch->notify_store, key_list, pattern_list);
+  if (key_list) CFRelease(key_list);
+  if (pattern_list) CFRelease(pattern_list);
+
+  if (watched) {
+    watch->queue = dispatch_queue_create("network_interface_resolver", DISPATCH_QUEUE_SERIAL);
+    watched = watch->queue && SCDynamicStoreSetDispatchQueue(watch->notify_store, watch->queue);
   }
-
-  if (candidate_count > 1
-      && pick_service_order_candidate(candidates, candidate_count, buffer, buffer_size)) {
-    return true;
+  if (!watched) {
+    CFRelease(watch->notify_store);
+    watch->notify_store = NULL;
+    if (watch->queue) dispatch_release(watch->queue);
+    watch->queue = NULL;
   }
+  watch->cache.watched = watched;
+  return true;
+}
 
-  if (candidate_count > 0) {
-    size_t best = 0;
-    for (size_t i = 1; i < candidate_count; i++) {
-      if (candidates[i].score > candidates[best].score) best = i;
-    }
-    strlcpy(buffer, candidates[best].name, buffer_size);
-    return true;
-  }
+bool sb_interface_watch_resolve(struct sb_interface_watch *watch,
+                                char *buffer,
+                                size_t buffer_size) {
+  if (!watch->store) return false;
+  return interface_cache_get(&watch->cache, buffer, buffer_size);
+}
 
-  if (has_primary) {
-    strlcpy(buffer, primary, buffer_size);
-    return true;
+void sb_interface_watch_stop(struct sb_interface_watch *watch) {
+  if (watch->notify_store) {
+    SCDynamicStoreSetDispatchQueue(watch->notify_store, NULL);
+    CFRelease(watch->notify_store);
   }
-
-  return false;
+  if (watch->queue) dispatch_release(watch->queue);
+  if (watch->store) CFRelease(watch->store);
+  memset(watch, 0, sizeof(struct sb_interface_watch));
 }
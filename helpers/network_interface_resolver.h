@@ -3,7 +3,9 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <dispatch/dispatch.h>
 #include <SystemConfiguration/SystemConfiguration.h>
+#include "network_interface_store.h"
 
 bool sb_copy_primary_interface(SCDynamicStoreRef store,
                                char *buffer,
@@ -12,4 +14,24 @@ bool sb_resolve_effective_interface(SCDynamicStoreRef store,
                                     char *buffer,
                                     size_t buffer_size);
 
+// The dynamic store, getifaddrs() and the network service order as an
+// interface_store.
+struct interface_store sb_interface_store(SCDynamicStoreRef store);
+
+// Effective interface for long-running helpers: resolved once and again
+// only after the dynamic store reports a change of the global or
+// per-interface network state or of the service order.
+struct sb_interface_watch {
+  SCDynamicStoreRef store;
+  SCDynamicStoreRef notify_store;
+  dispatch_queue_t queue;
+  struct interface_cache cache;
+};
+
+bool sb_interface_watch_start(struct sb_interface_watch *watch, CFStringRef name);
+bool sb_interface_watch_resolve(struct sb_interface_watch *watch,
+                                char *buffer,
+                                size_t buffer_size);
+void sb_interface_watch_stop(struct sb_interface_watch *watch);
+
 #endif
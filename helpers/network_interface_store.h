@@ -0,0 +1,265 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+// Effective interface resolution, independent of where the network state
+// comes from.
+//
+// The primary interface is used unless it is virtual (a VPN tunnel, ...).
+// Then the active physical interfaces are the candidates: a single one wins,
+// several are decided by the network service order and, failing that, by a
+// score (router, en*/bond*, being the primary). A store answers the four
+// questions this needs; network_interface_resolver.c backs it with the
+// SCDynamicStore, the bench with a fake.
+//
+// interface_cache keeps the answer until it is invalidated, which the
+// resolver does from a dynamic store notification, so the lookups run a few
+// times a day instead of on every sample.
+
+#define INTERFACE_CANDIDATES_MAX 64
+
+struct interface_address {
+  char name[IF_NAMESIZE];
+  unsigned int flags;
+  // IPv4 address in host order.
+  uint32_t ipv4;
+};
+
+struct interface_store {
+  const char* name;
+  // Primary interface of the global IPv4 (or else IPv6) state.
+  bool (*primary)(void* context, char* buffer, size_t buffer_size);
+  // Every IPv4 address of every interface.
+  size_t (*addresses)(void* context, struct interface_address* out, size_t max);
+  bool (*has_router)(void* context, const char* ifname);
+  // The first non-virtual interface of each network service, in service
+  // order. Optional.
+  size_t (*service_order)(void* context, char (*names)[IF_NAMESIZE], size_t max);
+  void* context;
+};
+
+struct interface_candidate {
+  char name[IF_NAMESIZE];
+  int score;
+};
+
+static inline void interface_copy_name(char* buffer, size_t buffer_size, const char* name) {
+  size_t length = strlen(name);
+  if (length >= buffer_size) length = buffer_size - 1;
+  memcpy(buffer, name, length);
+  buffer[length] = '\0';
+}
+
+static inline bool interface_is_virtual(const char* name) {
+  static const char* prefixes[] = {
+    "lo",
+    "utun",
+    "ipsec",
+    "ppp",
+    "tun",
+    "tap",
+    "gif",
+    "stf",
+    "llw",
+    "awdl",
+    "ap",
+    "anpi",
+    "bridge",
+    "vnic",
+    "vmnet",
+    "feth",
+  };
+
+  if (!name || name[0] == '\0') return true;
+  for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+    size_t prefix_len = strlen(prefixes[i]);
+    if (strncmp(name, prefixes[i], prefix_len) == 0) return true;
+  }
+  return false;
+}
+
+static inline size_t interface_find_candidate(const struct interface_candidate* candidates,
+                                              size_t count,
+                                              const char* name) {
+  for (size_t i = 0; i < count; i++) {
+    if (strcmp(candidates[i].name, name) == 0) return i;
+  }
+  return SIZE_MAX;
+}
+
+// Up and running physical interfaces with a routable IPv4 address.
+static inline size_t interface_collect_candidates(const struct interface_store* store,
+                                                  const char* primary,
+                                                  struct interface_candidate* candidates) {
+  struct interface_address addresses[INTERFACE_CANDIDATES_MAX];
+  size_t address_count = store->addresses(store->context, addresses, INTERFACE_CANDIDATES_MAX);
+
+  size_t count = 0;
+  for (size_t i = 0; i < address_count; i++) {
+    const struct interface_address* address = &addresses[i];
+    if ((address->flags & (IFF_UP | IFF_RUNNING)) != (IFF_UP | IFF_RUNNING)) continue;
+    if ((address->flags & (IFF_LOOPBACK | IFF_POINTOPOINT)) != 0) continue;
+    if (interface_is_virtual(address->name)) continue;
+    // 169.254/16
+    if ((address->ipv4 & 0xFFFF0000u) == 0xA9FE0000u) continue;
+
+    int score = 0;
+    if (store->has_router(store->context, address->name)) score += 100;
+    if (strncmp(address->name, "en", 2) == 0) {
+      score += 50;
+    } else if (strncmp(address->name, "bond", 4) == 0) {
+      score += 40;
+    } else {
+      score += 10;
+    }
+    if (primary && primary[0] != '\0' && strcmp(address->name, primary) == 0) {
+      score += 25;
+    }
+
+    size_t index = interface_find_candidate(candidates, count, address->name);
+    if (index != SIZE_MAX) {
+      if (score > candidates[index].score) candidates[index].score = score;
+    } else if (count < INTERFACE_CANDIDATES_MAX) {
+      interface_copy_name(candidates[count].name, sizeof(candidates[count].name), address->name);
+      candidates[count].score = score;
+      count++;
+    }
+  }
+  return count;
+}
+
+static inline bool interface_pick_service_order(const struct interface_store* store,
+                                                const struct interface_candidate* candidates,
+                                                size_t candidate_count,
+                                                char* buffer,
+                                                size_t buffer_size) {
+  if (!store->service_order) return false;
+  char names[INTERFACE_CANDIDATES_MAX][IF_NAMESIZE];
+  size_t count = store->service_order(store->context, names, INTERFACE_CANDIDATES_MAX);
+  for (size_t i = 0; i < count; i++) {
+    if (interface_find_candidate(candidates, candidate_count, names[i]) != SIZE_MAX) {
+      interface_copy_name(buffer, buffer_size, names[i]);
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline bool interface_resolve(const struct interface_store* store,
+                                     char* buffer,
+                                     size_t buffer_size) {
+  if (!buffer || buffer_size == 0) return false;
+
+  buffer[0] = '\0';
+  char primary[IF_NAMESIZE] = { 0 };
+  bool has_primary = store->primary(store->context, primary, sizeof(primary));
+
+  if (has_primary && !interface_is_virtual(primary)) {
+    interface_copy_name(buffer, buffer_size, primary);
+    return true;
+  }
+
+  struct interface_candidate candidates[INTERFACE_CANDIDATES_MAX];
+  size_t candidate_count = interface_collect_candidates(store, primary, candidates);
+
+  if (candidate_count == 1) {
+    interface_copy_name(buffer, buffer_size, candidates[0].name);
+    return true;
+  }
+
+  if (candidate_count > 1
+      && interface_pick_service_order(store, candidates, candidate_count, buffer, buffer_size)) {
+    return true;
+  }
+
+  if (candidate_count > 0) {
+    size_t best = 0;
+    for (size_t i = 1; i < candidate_count; i++) {
+      if (candidates[i].score > candidates[best].score) best = i;
+    }
+    interface_copy_name(buffer, buffer_size, candidates[best].name);
+    return true;
+  }
+
+  if (has_primary) {
+    interface_copy_name(buffer, buffer_size, primary);
+    return true;
+  }
+
+  return false;
+}
+
+// Addresses from getifaddrs(), for stores of real systems.
+static inline size_t interface_getifaddrs(void* context,
+                                          struct interface_address* out,
+                                          size_t max) {
+  (void)context;
+  struct ifaddrs* ifaddr = NULL;
+  if (getifaddrs(&ifaddr) != 0 || !ifaddr) return 0;
+
+  size_t count = 0;
+  for (struct ifaddrs* ifa = ifaddr; ifa != NULL && count < max; ifa = ifa->ifa_next) {
+    if (!ifa->ifa_name || !ifa->ifa_addr) continue;
+    if (ifa->ifa_addr->sa_family != AF_INET) continue;
+    interface_copy_name(out[count].name, sizeof(out[count].name), ifa->ifa_name);
+    out[count].flags = ifa->ifa_flags;
+    out[count].ipv4 = ntohl(((struct sockaddr_in*)ifa->ifa_addr)->sin_addr.s_addr);
+    count++;
+  }
+
+  freeifaddrs(ifaddr);
+  return count;
+}
+
+struct interface_cache {
+  struct interface_store store;
+  // Without notifications every lookup resolves again.
+  bool watched;
+
+  // Bumped by interface_cache_invalidate(), possibly from another thread.
+  uint32_t generation;
+  uint32_t resolved_generation;
+  bool fresh;
+  bool found;
+  char name[IF_NAMESIZE];
+  uint32_t resolutions;
+};
+
+static inline void interface_cache_init(struct interface_cache* cache,
+                                        struct interface_store store,
+                                        bool watched) {
+  memset(cache, 0, sizeof(struct interface_cache));
+  cache->store = store;
+  cache->watched = watched;
+}
+
+static inline void interface_cache_invalidate(struct interface_cache* cache) {
+  __atomic_fetch_add(&cache->generation, 1, __ATOMIC_RELEASE);
+}
+
+// The cached answer, resolved again only after an invalidation. A failed
+// resolution (no network) is cached too; connecting invalidates it.
+static inline bool interface_cache_get(struct interface_cache* cache,
+                                       char* buffer,
+                                       size_t buffer_size) {
+  uint32_t generation = __atomic_load_n(&cache->generation, __ATOMIC_ACQUIRE);
+  if (!cache->fresh || !cache->watched || generation != cache->resolved_generation) {
+    // An invalidation during the lookup bumps the generation again, so the
+    // next call resolves once more.
+    cache->found = interface_resolve(&cache->store, cache->name, sizeof(cache->name));
+    cache->resolved_generation = generation;
+    cache->fresh = true;
+    cache->resolutions++;
+  }
+  if (!cache->found || buffer_size == 0) return false;
+  interface_copy_name(buffer, buffer_size, cache->name);
+  return true;
+}
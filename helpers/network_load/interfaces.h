@@ -0,0 +1,285 @@
+#pragma once
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <net/if.h>
+
+#include "../counters.h"
+#include "../network_interface_store.h"
+
+#ifdef __APPLE__
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <net/if_dl.h>
+#include <net/route.h>
+#endif
+
+// Throughput of several interfaces at once.
+//
+// A source fills a snapshot with the byte counters of every interface in one
+// read; interfaces_update() then filters them and computes each interface's
+// up/down rate against the previous snapshot in one pass. Sources:
+// - sysctl: one NET_RT_IFLIST2 sysctl for the whole interface list, into a
+//   buffer that is kept and only grown when the list outgrows it.
+// - proc: /proc/net/dev, kept open and re-read with pread().
+// The snapshot and delta bookkeeping is helpers/counters.h's.
+// Custom sources (recorded or synthetic counters) plug in through
+// interfaces_init_with.
+
+#define INTERFACES_MAX 64
+#define INTERFACES_FILTER_MAX 16
+
+struct interface_counters {
+  char name[IF_NAMESIZE];
+  uint64_t ibytes;
+  uint64_t obytes;
+};
+
+struct interfaces_snapshot {
+  int count;
+  struct interface_counters entries[INTERFACES_MAX];
+};
+
+struct interfaces_source {
+  const char* name;
+  // Fills out with the current counters; false when they cannot be read.
+  bool (*read)(void* context, struct interfaces_snapshot* out);
+  void* context;
+};
+
+struct interface_rate {
+  char name[IF_NAMESIZE];
+  double up_mbps;
+  double down_mbps;
+};
+
+struct interfaces {
+  struct interfaces_source source;
+
+  // Either every interface but loopback that has carried traffic, or the
+  // listed ones (in the order the source reports them). With all, virtual
+  // interfaces (tunnels, bridges, awdl, ...) get rates but stay out of the
+  // totals: their traffic also crosses a physical interface.
+  bool all;
+  int filter_count;
+  char filter[INTERFACES_FILTER_MAX][IF_NAMESIZE];
+
+  struct interfaces_snapshot snapshots[2];
+  int current;
+  struct counters_baseline baseline;
+
+  int count;
+  struct interface_rate rates[INTERFACES_MAX];
+  double up_mbps;
+  double down_mbps;
+};
+
+#ifdef __APPLE__
+struct interfaces_sysctl_source {
+  char* buffer;
+  size_t capacity;
+};
+
+static struct interfaces_sysctl_source g_interfaces_sysctl = { 0 };
+
+static inline bool interfaces_sysctl_read(void* context, struct interfaces_snapshot* out) {
+  struct interfaces_sysctl_source* source = context;
+  int mib[6] = { CTL_NET, PF_ROUTE, 0, 0, NET_RT_IFLIST2, 0 };
+
+  // The list only grows when interfaces appear, so the size is asked for
+  // only when the last buffer was too small.
+  size_t length = source->capacity;
+  while (!source->buffer || sysctl(mib, 6, source->buffer, &length, NULL, 0) != 0) {
+    if (source->buffer && errno != ENOMEM) return false;
+    if (sysctl(mib, 6, NULL, &length, NULL, 0) != 0) return false;
+    length += length / 4;
+    char* buffer = realloc(source->buffer, length);
+    if (!buffer) return false;
+    source->buffer = buffer;
+    source->capacity = length;
+  }
+
+  int count = 0;
+  const char* end = source->buffer + length;
+  const char* c = source->buffer;
+  while (c + sizeof(struct if_msghdr) <= end && count < INTERFACES_MAX) {
+    const struct if_msghdr* header = (const struct if_msghdr*)c;
+    if (header->ifm_msglen == 0) break;
+    c += header->ifm_msglen;
+    if (header->ifm_type != RTM_IFINFO2) continue;
+
+    const struct if_msghdr2* info = (const struct if_msghdr2*)header;
+    const struct sockaddr_dl* link = (const struct sockaddr_dl*)(info + 1);
+    size_t name_length = link->sdl_nlen < IF_NAMESIZE - 1 ? link->sdl_nlen : IF_NAMESIZE - 1;
+    struct interface_counters* entry = &out->entries[count++];
+    memcpy(entry->name, link->sdl_data, name_length);
+    entry->name[name_length] = '\0';
+    entry->ibytes = info->ifm_data.ifi_ibytes;
+    entry->obytes = info->ifm_data.ifi_obytes;
+  }
+  out->count = count;
+  return true;
+}
+
+static inline struct interfaces_source interfaces_sysctl_source(void) {
+  return (struct interfaces_source){ "sysctl", interfaces_sysctl_read, &g_interfaces_sysctl };
+}
+#endif
+
+struct interfaces_proc_source {
+  const char* path;
+  int fd;
+  char buffer[16384];
+};
+
+static struct interfaces_proc_source g_interfaces_proc = { 0 };
+
+// Two header lines, then "<name>: rx_bytes packets errs drop fifo frame
+// compressed multicast tx_bytes ..." per interface.
+static inline bool interfaces_proc_read(void* context, struct interfaces_snapshot* out) {
+  struct interfaces_proc_source* proc = context;
+  ssize_t length = counters_proc_read(&proc->fd, proc->path, proc->buffer, sizeof(proc->buffer));
+  if (length < 0) return false;
+
+  const char* c = proc->buffer;
+  const char* end = proc->buffer + length;
+  int count = 0;
+  for (int line = 0; c < end && count < INTERFACES_MAX; line++) {
+    const char* line_end = memchr(c, '\n', (size_t)(end - c));
+    const char* colon = line >= 2 ? memchr(c, ':', (size_t)(line_end - c)) : NULL;
+    if (colon) {
+      while (c < colon && *c == ' ') c++;
+      size_t name_length = (size_t)(colon - c);
+      if (name_length > IF_NAMESIZE - 1) name_length = IF_NAMESIZE - 1;
+      struct interface_counters* entry = &out->entries[count++];
+      memcpy(entry->name, c, name_length);
+      entry->name[name_length] = '\0';
+
+      c = colon + 1;
+      entry->ibytes = counters_parse_u64(&c, line_end);
+      for (int i = 0; i < 7; i++) counters_parse_u64(&c, line_end);
+      entry->obytes = counters_parse_u64(&c, line_end);
+    }
+    c = line_end + 1;
+  }
+
+  out->count = count;
+  return true;
+}
+
+static inline struct interfaces_source interfaces_proc_source(const char* path) {
+  if (g_interfaces_proc.path && g_interfaces_proc.fd >= 0) close(g_interfaces_proc.fd);
+  g_interfaces_proc.path = path;
+  g_interfaces_proc.fd = -1;
+  return (struct interfaces_source){ "proc", interfaces_proc_read, &g_interfaces_proc };
+}
+
+// "all" or a comma separated list of interface names.
+static inline bool interfaces_set_filter(struct interfaces* interfaces, const char* spec) {
+  interfaces->all = strcmp(spec, "all") == 0;
+  interfaces->filter_count = 0;
+  if (interfaces->all) return true;
+
+  const char* c = spec;
+  while (*c) {
+    const char* comma = strchr(c, ',');
+    size_t length = comma ? (size_t)(comma - c) : strlen(c);
+    if (length > 0) {
+      if (length >= IF_NAMESIZE || interfaces->filter_count == INTERFACES_FILTER_MAX) return false;
+      memcpy(interfaces->filter[interfaces->filter_count], c, length);
+      interfaces->filter[interfaces->filter_count][length] = '\0';
+      interfaces->filter_count++;
+    }
+    if (!comma) break;
+    c = comma + 1;
+  }
+  return interfaces->filter_count > 0;
+}
+
+static inline void interfaces_init_with(struct interfaces* interfaces,
+                                        struct interfaces_source source) {
+  interfaces->source = source;
+  interfaces->current = 0;
+  interfaces->baseline = (struct counters_baseline){ 0 };
+  interfaces->count = 0;
+  interfaces->up_mbps = 0.0;
+  interfaces->down_mbps = 0.0;
+}
+
+static inline void interfaces_init(struct interfaces* interfaces) {
+#ifdef __APPLE__
+  interfaces_init_with(interfaces, interfaces_sysctl_source());
+#else
+  interfaces_init_with(interfaces, interfaces_proc_source("/proc/net/dev"));
+#endif
+}
+
+// Drops the baseline, so the next update only takes one.
+static inline void interfaces_reset(struct interfaces* interfaces) {
+  counters_reset(&interfaces->baseline);
+  interfaces->count = 0;
+  interfaces->up_mbps = 0.0;
+  interfaces->down_mbps = 0.0;
+}
+
+static inline bool interfaces_is_loopback(const char* name) {
+  return name[0] == 'l' && name[1] == 'o' && (name[2] == '\0' || (name[2] >= '0' && name[2] <= '9'));
+}
+
+static inline bool interfaces_wanted(const struct interfaces* interfaces,
+                                     const struct interface_counters* entry) {
+  if (interfaces->all) {
+    return !interfaces_is_loopback(entry->name) && (entry->ibytes || entry->obytes);
+  }
+  for (int i = 0; i < interfaces->filter_count; i++) {
+    if (strcmp(interfaces->filter[i], entry->name) == 0) return true;
+  }
+  return false;
+}
+
+static inline double interfaces_mbps(uint64_t now, uint64_t prev, double seconds) {
+  return counters_rate(now, prev, seconds) * 8.0 / 1e6;
+}
+
+// Reads every interface once and computes the rates of the wanted ones
+// since the previous update. The first update, and one after more than 100s,
+// only takes the baseline.
+static inline bool interfaces_update(struct interfaces* interfaces, uint64_t now_ns) {
+  int next = interfaces->current ^ 1;
+  struct interfaces_snapshot* now = &interfaces->snapshots[next];
+  if (!interfaces->source.read(interfaces->source.context, now)) return false;
+  const struct interfaces_snapshot* prev = &interfaces->snapshots[interfaces->current];
+  interfaces->current = next;
+
+  double seconds = counters_interval(&interfaces->baseline, now_ns);
+
+  int count = 0;
+  double up = 0.0, down = 0.0;
+  for (int i = 0; i < now->count; i++) {
+    const struct interface_counters* entry = &now->entries[i];
+    if (!interfaces_wanted(interfaces, entry)) continue;
+
+    const struct interface_counters* before
+      = seconds > 0.0 ? counters_find(prev->entries, prev->count, sizeof(*entry), i, entry->name)
+                      : NULL;
+
+    struct interface_rate* rate = &interfaces->rates[count++];
+    memcpy(rate->name, entry->name, IF_NAMESIZE);
+    rate->up_mbps = before ? interfaces_mbps(entry->obytes, before->obytes, seconds) : 0.0;
+    rate->down_mbps = before ? interfaces_mbps(entry->ibytes, before->ibytes, seconds) : 0.0;
+    if (interfaces->all && interface_is_virtual(entry->name)) continue;
+    up += rate->up_mbps;
+    down += rate->down_mbps;
+  }
+
+  interfaces->count = count;
+  interfaces->up_mbps = up;
+  interfaces->down_mbps = down;
+  return true;
+}
@@ -1,59 +1,155 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <net/if.h>
+
+#ifdef __APPLE__
 #include <net/if_mib.h>
 #include <sys/sysctl.h>
-#include <time.h>
+#endif
+
+#include "interfaces.h"
+#include "rate.h"
+
+// One interface's counters through the rate engine: network_sample() may run
+// more often than network_update() publishes, the rates then cover the short
+// bursts in between. Sources:
+// - ifmib: one IFMIB_IFDATA sysctl for the interface's row
+// - proc: the interface's line of /proc/net/dev (interfaces.h's reader)
+// Custom sources (recorded counters) plug in through network_init().
+
+struct network_source {
+  const char* name;
+  // Looks the interface up; false when there is none by that name.
+  bool (*open)(void* context, const char* ifname);
+  // The opened interface's byte counters; false when they cannot be read.
+  bool (*read)(void* context, uint64_t* ibytes, uint64_t* obytes);
+  void* context;
+};
+
 struct network {
-  uint32_t row;
-  struct ifmibdata data;
-  struct timespec ts_prev;
+  struct network_source source;
+  struct rate_engine rate;
 
   double up_mbps;
   double down_mbps;
+  double up_peak_mbps;
+  double down_peak_mbps;
 };
 
-static inline void ifdata(uint32_t net_row, struct ifmibdata* data) {
-	static size_t size = sizeof(struct ifmibdata);
-  static int32_t data_option[] = { CTL_NET, PF_LINK, NETLINK_GENERIC, IFMIB_IFDATA, 0, IFDATA_GENERAL };
-  data_option[4] = net_row;
-  sysctl(data_option, 6, data, &size, NULL, 0);
+#ifdef __APPLE__
+struct network_ifmib_source {
+  uint32_t row;
+  struct ifmibdata data;
+};
+
+static struct network_ifmib_source g_network_ifmib = { 0 };
+
+static inline bool network_ifmib_open(void* context, const char* ifname) {
+  struct network_ifmib_source* ifmib = context;
+  ifmib->row = if_nametoindex(ifname);
+  return ifmib->row != 0;
 }
 
-static inline int network_init(struct network* net, const char* ifname) {
-  memset(net, 0, sizeof(struct network));
+static inline bool network_ifmib_read(void* context, uint64_t* ibytes, uint64_t* obytes) {
+  struct network_ifmib_source* ifmib = context;
+  size_t size = sizeof(struct ifmibdata);
+  int32_t mib[] = { CTL_NET, PF_LINK, NETLINK_GENERIC, IFMIB_IFDATA, (int32_t)ifmib->row,
+                    IFDATA_GENERAL };
+  if (sysctl(mib, 6, &ifmib->data, &size, NULL, 0) != 0) return false;
+  *ibytes = ifmib->data.ifmd_data.ifi_ibytes;
+  *obytes = ifmib->data.ifmd_data.ifi_obytes;
+  return true;
+}
 
-  if (!ifname || ifname[0] == '\0') return 0;
-  net->row = if_nametoindex(ifname);
-  if (net->row == 0) return 0;
-  ifdata(net->row, &net->data);
-  return 1;
-}
-
-static inline void network_update(struct network* net) {
-  struct timespec ts_now;
-  clock_gettime(CLOCK_MONOTONIC, &ts_now);
-  if (net->ts_prev.tv_sec == 0 && net->ts_prev.tv_nsec == 0) {
-    net->ts_prev = ts_now;
-    return;
+static inline struct network_source network_ifmib_source(void) {
+  return (struct network_source){ "ifmib", network_ifmib_open, network_ifmib_read,
+                                  &g_network_ifmib };
+}
+#endif
+
+struct network_proc_source {
+  struct interfaces_proc_source proc;
+  char ifname[IF_NAMESIZE];
+  struct interfaces_snapshot snapshot;
+};
+
+static struct network_proc_source g_network_proc = { 0 };
+
+static inline bool network_proc_find(struct network_proc_source* source,
+                                     uint64_t* ibytes,
+                                     uint64_t* obytes) {
+  if (!interfaces_proc_read(&source->proc, &source->snapshot)) return false;
+  for (int i = 0; i < source->snapshot.count; i++) {
+    const struct interface_counters* entry = &source->snapshot.entries[i];
+    if (strcmp(entry->name, source->ifname) != 0) continue;
+    *ibytes = entry->ibytes;
+    *obytes = entry->obytes;
+    return true;
   }
-  double time_scale = (double)(ts_now.tv_sec - net->ts_prev.tv_sec)
-                      + (double)(ts_now.tv_nsec - net->ts_prev.tv_nsec) / 1e9;
-  net->ts_prev = ts_now;
+  return false;
+}
 
-  uint64_t ibytes_nm1 = net->data.ifmd_data.ifi_ibytes;
-  uint64_t obytes_nm1 = net->data.ifmd_data.ifi_obytes;
-  ifdata(net->row, &net->data);
+static inline bool network_proc_open(void* context, const char* ifname) {
+  struct network_proc_source* source = context;
+  if (strlen(ifname) >= sizeof(source->ifname)) return false;
+  strcpy(source->ifname, ifname);
+  uint64_t ibytes, obytes;
+  return network_proc_find(source, &ibytes, &obytes);
+}
+
+static inline bool network_proc_read(void* context, uint64_t* ibytes, uint64_t* obytes) {
+  return network_proc_find(context, ibytes, obytes);
+}
 
-  if (time_scale <= 0.0 || time_scale > 1e2) return;
-  double delta_ibytes = (double)(net->data.ifmd_data.ifi_ibytes - ibytes_nm1)
-                        / time_scale;
-  double delta_obytes = (double)(net->data.ifmd_data.ifi_obytes - obytes_nm1)
-                        / time_scale;
+static inline struct network_source network_proc_source(const char* path) {
+  if (g_network_proc.proc.path && g_network_proc.proc.fd >= 0) close(g_network_proc.proc.fd);
+  g_network_proc.proc.path = path;
+  g_network_proc.proc.fd = -1;
+  return (struct network_source){ "proc", network_proc_open, network_proc_read, &g_network_proc };
+}
 
-  if (delta_ibytes < 0) delta_ibytes = 0;
-  if (delta_obytes < 0) delta_obytes = 0;
+static inline struct network_source network_platform_source(void) {
+#ifdef __APPLE__
+  return network_ifmib_source();
+#else
+  return network_proc_source("/proc/net/dev");
+#endif
+}
+
+// tau_ns and hold_ns as for rate_init(); a sampling gap of four times
+// max(tau, hold) starts a new baseline. Returns 0 when the source has no
+// such interface.
+static inline int network_init(struct network* net,
+                               struct network_source source,
+                               const char* ifname,
+                               uint64_t tau_ns,
+                               uint64_t hold_ns) {
+  memset(net, 0, sizeof(struct network));
+  net->source = source;
+  uint64_t span = tau_ns > hold_ns ? tau_ns : hold_ns;
+  rate_init(&net->rate, tau_ns, hold_ns, 4 * span);
+
+  if (!ifname || ifname[0] == '\0') return 0;
+  return source.open(source.context, ifname) ? 1 : 0;
+}
+
+// A failed read leaves the rates alone; the next one covers the gap.
+static inline void network_sample(struct network* net, uint64_t now_ns) {
+  uint64_t ibytes, obytes;
+  if (!net->source.read(net->source.context, &ibytes, &obytes)) return;
+  rate_push(&net->rate, now_ns, ibytes, obytes);
+}
 
-  net->down_mbps = (delta_ibytes * 8.0) / 1000000.0;
-  net->up_mbps = (delta_obytes * 8.0) / 1000000.0;
+// Samples and publishes the smoothed and peak rates in Mbps.
+static inline void network_update(struct network* net, uint64_t now_ns) {
+  network_sample(net, now_ns);
+  struct rate_estimate estimate = rate_read(&net->rate, now_ns);
+  net->up_mbps = estimate.up / 1e6;
+  net->down_mbps = estimate.down / 1e6;
+  net->up_peak_mbps = estimate.up_peak / 1e6;
+  net->down_peak_mbps = estimate.down_peak / 1e6;
 }
@@ -1,76 +1,34 @@
-#include <stdbool.h>
-#include <stdlib.h>
-#include <string.h>
+#include <stdio.h>
 #include <unistd.h>
-#include <CoreFoundation/CoreFoundation.h>
-#include <SystemConfiguration/SystemConfiguration.h>
-#include "network.h"
-#include "../network_interface_resolver.h"
-#include "../sketchybar.h"
+#include "network_load.h"
 
 int main (int argc, char** argv) {
-  float update_freq;
-  if (argc < 4 || (sscanf(argv[3], "%f", &update_freq) != 1)) {
-    printf("Usage: %s \"<interface|auto>\" \"<event-name>\" \"<event_freq>\"\n", argv[0]);
+  static struct network_load load;
+  if (!network_load_parse(argc, argv, &load)) {
+    network_load_usage(argv[0]);
     exit(1);
   }
 
-  bool auto_mode = (strcmp(argv[1], "auto") == 0) || (strcmp(argv[1], "default") == 0);
-  SCDynamicStoreRef store = NULL;
-  char ifname[IF_NAMESIZE] = { 0 };
-  const char* interface_name = argv[1];
-  if (auto_mode) {
-    store = SCDynamicStoreCreate(NULL, CFSTR("network_load"), NULL, NULL);
-    if (!store || !sb_resolve_effective_interface(store, ifname, sizeof(ifname))) {
-      fprintf(stderr, "Failed to resolve effective interface\n");
-      if (store) CFRelease(store);
-      return 1;
-    }
-    interface_name = ifname;
-  }
-
   alarm(0);
-  // Setup the event in sketchybar
-  char event_message[512];
-  snprintf(event_message, 512, "--add event '%s'", argv[2]);
-  sketchybar(event_message);
+  sketchybar_resilient_start_from_env(argc, argv);
+  if (!network_load_init(&load, sketchybar_now_ns())) return 1;
 
-  struct network network;
-  if (!network_init(&network, interface_name)) {
-    fprintf(stderr, "Interface not found: %s\n", interface_name);
-    if (store) CFRelease(store);
+  // Replayed triggers are sent synchronously, so every one reaches the bar in
+  // order.
+  if (load.replay_path) {
+    if (network_load_replay(&load)) return 0;
+    fprintf(stderr, "%s does not match network_load after record %llu\n", load.replay_path,
+            (unsigned long long)load.tape.records);
     return 1;
   }
-  char trigger_message[512];
-  for (;;) {
-    if (auto_mode) {
-      char current[IF_NAMESIZE] = { 0 };
-      if (sb_resolve_effective_interface(store, current, sizeof(current))
-          && strcmp(current, ifname) != 0) {
-        strlcpy(ifname, current, sizeof(ifname));
-        if (!network_init(&network, ifname)) {
-          fprintf(stderr, "Interface not found: %s\n", ifname);
-          usleep(update_freq * 1000000);
-          continue;
-        }
-      }
-    }
-    // Acquire new info
-    network_update(&network);
-
-    // Prepare the event message
-    snprintf(trigger_message,
-             512,
-             "--trigger '%s' upload='%.2f' download='%.2f'",
-             argv[2],
-             network.up_mbps,
-             network.down_mbps);
-
-    // Trigger the event
-    sketchybar(trigger_message);
 
-    // Wait
-    usleep(update_freq * 1000000);
+  struct module_host host;
+  module_host_init(&host, "network_load", 0);
+  module_host_add(&host, network_load_module(&load));
+  if (load.control_path && !control_open(&host.control, load.control_path)) {
+    fprintf(stderr, "Could not create control fifo %s\n", load.control_path);
   }
+  sketchybar_async_start_from_env();
+  module_host_run(&host);
   return 0;
 }
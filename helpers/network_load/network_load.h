@@ -0,0 +1,382 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "interfaces.h"
+#include "network.h"
+#include "tape_sources.h"
+#include "uplink.h"
+#include "../control.h"
+#include "../module.h"
+#include "../sched.h"
+#include "../sketchybar.h"
+#include "../tape.h"
+
+// The network_load sampler as a module for helpers/module.h, hosted on its
+// own by network_load.c or together with other collectors by stats_daemon.
+//
+// The interface is a name, `auto` (the effective uplink, followed as it
+// changes), or `all` / a comma separated list. The latter read every
+// interface's counters in one sysctl per tick and add the per-interface
+// rates to the trigger.
+//
+// With `--sample <ms>` a single interface is also read between triggers;
+// the rates are smoothed over about one trigger interval, and
+// upload_peak/download_peak carry the highest sub-interval rate of the last
+// interval, so short bursts show up without more triggers.
+//
+// With `--record <tape>` every source read (counters, snapshots, resolved
+// interfaces) is written to a tape together with each tick and command;
+// `--replay <tape>` feeds them back through the same rate code, so the wifi
+// item can be driven from a recording on any machine.
+
+struct network_load_sources {
+  struct network_source network;
+  struct interfaces_source interfaces;
+  struct network_resolver resolver;
+};
+
+struct network_load {
+  const char* interface;
+  const char* event;
+  float update_freq;
+  const char* control_path;
+  float sample_ms;
+  const char* record_path;
+  const char* replay_path;
+  double speed;
+
+  bool auto_mode;
+  struct network_resolver resolver;
+  char ifname[IF_NAMESIZE];
+  struct network_source network_source;
+  struct network network;
+
+  bool multi;
+  struct interfaces interfaces;
+
+  struct sched sched;
+  bool paused;
+  struct tape tape;
+
+  char trigger_buffer[2048];
+  struct sb_message trigger;
+};
+
+static inline void network_load_usage(const char* name) {
+  printf("Usage: %s \"<interface|auto|all|if1,if2,...>\" \"<event-name>\" \"<event_freq>\""
+         " [--control <fifo>] [--sample <ms>] [--record <tape> | --replay <tape> [--speed <x>]]\n",
+         name);
+}
+
+static inline bool network_load_parse(int argc, char** argv, struct network_load* load) {
+  memset(load, 0, sizeof(struct network_load));
+  load->speed = 1.0;
+  if (argc < 4 || (argc - 4) % 2 != 0) return false;
+  for (int i = 4; i < argc; i += 2) {
+    if (strcmp(argv[i], "--control") == 0) {
+      load->control_path = argv[i + 1];
+    } else if (strcmp(argv[i], "--record") == 0) {
+      load->record_path = argv[i + 1];
+    } else if (strcmp(argv[i], "--replay") == 0) {
+      load->replay_path = argv[i + 1];
+    } else if (strcmp(argv[i], "--speed") == 0) {
+      load->speed = atof(argv[i + 1]);
+      if (load->speed < 0.0) return false;
+    } else if (strcmp(argv[i], "--sample") != 0
+               || sscanf(argv[i + 1], "%f", &load->sample_ms) != 1
+               || load->sample_ms <= 0.0f) {
+      return false;
+    }
+  }
+  if (load->record_path && load->replay_path) return false;
+  if (sscanf(argv[3], "%f", &load->update_freq) != 1 || load->update_freq <= 0.0f) {
+    return false;
+  }
+  load->interface = argv[1];
+  load->event = argv[2];
+  return true;
+}
+
+static inline uint64_t network_load_period_ns(const struct network_load* load) {
+  return (uint64_t)(load->update_freq * 1e9);
+}
+
+// Smoothing and peak hold both span one trigger interval.
+static inline bool network_load_open(struct network_load* load, const char* ifname) {
+  uint64_t period_ns = network_load_period_ns(load);
+  return network_init(&load->network, load->network_source, ifname, period_ns, period_ns);
+}
+
+static inline struct network_load_sources network_load_sources(void) {
+  return (struct network_load_sources){
+    network_platform_source(),
+#ifdef __APPLE__
+    interfaces_sysctl_source(),
+#else
+    interfaces_proc_source("/proc/net/dev"),
+#endif
+    network_platform_resolver(),
+  };
+}
+
+// Resolves the interface, registers the event and takes the first baseline.
+// The first trigger is sent at origin_ns; a replay starts at the recorded
+// origin instead. False when there is nothing to watch or the tape cannot be
+// opened.
+static inline bool network_load_init_with(struct network_load* load,
+                                          struct network_load_sources sources,
+                                          uint64_t origin_ns) {
+  struct tape* tape = &load->tape;
+  if (load->replay_path) {
+    struct tape_reader reader;
+    if (!tape_replay(tape, load->replay_path)) {
+      fprintf(stderr, "Could not open tape %s\n", load->replay_path);
+      return false;
+    }
+    if (!tape_next(tape, TAPE_NET_ORIGIN, &reader) || !tape_read_u64(&reader, &origin_ns)) {
+      fprintf(stderr, "%s does not start with an origin\n", load->replay_path);
+      return false;
+    }
+    sources.network = tape_network_replay(tape);
+    sources.interfaces = tape_interfaces_replay(tape);
+    sources.resolver = tape_resolver_replay(tape);
+  } else if (load->record_path) {
+    if (!tape_record(tape, load->record_path)) {
+      fprintf(stderr, "Could not open tape %s\n", load->record_path);
+      return false;
+    }
+    tape_begin(tape, TAPE_NET_ORIGIN, true);
+    tape_write_u64(tape, origin_ns);
+    tape_end(tape);
+    sources.network = tape_network_record(tape, sources.network);
+    sources.interfaces = tape_interfaces_record(tape, sources.interfaces);
+    sources.resolver = tape_resolver_record(tape, sources.resolver);
+  } else {
+    memset(tape, 0, sizeof(struct tape));
+  }
+  load->network_source = sources.network;
+  load->resolver = sources.resolver;
+
+  load->auto_mode = (strcmp(load->interface, "auto") == 0)
+                    || (strcmp(load->interface, "default") == 0);
+  load->multi = strcmp(load->interface, "all") == 0 || strchr(load->interface, ',');
+  const char* interface_name = load->interface;
+  if (load->multi) {
+    interfaces_init_with(&load->interfaces, sources.interfaces);
+    if (!interfaces_set_filter(&load->interfaces, load->interface)
+        || !interfaces_update(&load->interfaces, origin_ns)) {
+      fprintf(stderr, "Failed to read interfaces: %s\n", load->interface);
+      return false;
+    }
+  } else if (load->auto_mode) {
+    if (!load->resolver.start(load->resolver.context)
+        || !load->resolver.resolve(load->resolver.context, load->ifname, sizeof(load->ifname))) {
+      fprintf(stderr, "Failed to resolve effective interface\n");
+      load->resolver.stop(load->resolver.context);
+      return false;
+    }
+    interface_name = load->ifname;
+  }
+
+  if (!load->multi && !network_load_open(load, interface_name)) {
+    fprintf(stderr, "Interface not found: %s\n", interface_name);
+    if (load->auto_mode) load->resolver.stop(load->resolver.context);
+    return false;
+  }
+  if (tape->recording) tape_flush(tape);
+
+  // Setup the event in sketchybar
+  char event_message[512];
+  snprintf(event_message, 512, "--add event '%s'", load->event);
+  sketchybar(event_message);
+
+  sb_msg_init(&load->trigger, load->trigger_buffer, sizeof(load->trigger_buffer));
+  sched_init(&load->sched, origin_ns);
+  sched_add(&load->sched, "network", network_load_period_ns(load));
+  uint64_t sample_ns = (uint64_t)(load->sample_ms * 1e6);
+  if (!load->multi && sample_ns > 0 && sample_ns < network_load_period_ns(load)) {
+    sched_add(&load->sched, "sample", sample_ns);
+  }
+  return true;
+}
+
+static inline bool network_load_init(struct network_load* load, uint64_t origin_ns) {
+  return network_load_init_with(load, network_load_sources(), origin_ns);
+}
+
+// upload/download are the totals; interfaces carries
+// `<name>:<up>:<down>;...` in Mbps, in the order the system lists them.
+static inline void network_load_sample_multi(struct network_load* load, uint64_t now_ns) {
+  if (!interfaces_update(&load->interfaces, now_ns)) return;
+
+  struct sb_message* msg = &load->trigger;
+  sb_msg_reset(msg);
+  sb_msg_arg(msg, "--trigger");
+  sb_msg_arg(msg, load->event);
+  sb_msg_double(msg, "upload", load->interfaces.up_mbps, 2);
+  sb_msg_double(msg, "download", load->interfaces.down_mbps, 2);
+  sb_msg_key(msg, "interfaces");
+  for (int i = 0; i < load->interfaces.count; i++) {
+    const struct interface_rate* rate = &load->interfaces.rates[i];
+    if (i > 0) sb_msg_append(msg, ";", 1);
+    sb_msg_append(msg, rate->name, (uint32_t)strlen(rate->name));
+    sb_msg_append(msg, ":", 1);
+    sb_msg_append_double(msg, rate->up_mbps, 2);
+    sb_msg_append(msg, ":", 1);
+    sb_msg_append_double(msg, rate->down_mbps, 2);
+  }
+  sb_msg_end_arg(msg);
+  sb_msg_send(msg);
+}
+
+// Follows the effective interface in auto mode, false when there is none.
+static inline bool network_load_follow(struct network_load* load) {
+  if (load->auto_mode) {
+    // Cached; resolved again only after a network change notification.
+    char current[IF_NAMESIZE] = { 0 };
+    if (load->resolver.resolve(load->resolver.context, current, sizeof(current))
+        && strcmp(current, load->ifname) != 0) {
+      memcpy(load->ifname, current, sizeof(load->ifname));
+      if (!network_load_open(load, load->ifname)) {
+        fprintf(stderr, "Interface not found: %s\n", load->ifname);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static inline void network_load_sample(struct network_load* load, uint64_t now_ns) {
+  if (load->multi) {
+    network_load_sample_multi(load, now_ns);
+    return;
+  }
+  if (!network_load_follow(load)) return;
+  // Acquire new info
+  network_update(&load->network, now_ns);
+
+  // Prepare and send the event message
+  sb_msg_reset(&load->trigger);
+  sb_msg_arg(&load->trigger, "--trigger");
+  sb_msg_arg(&load->trigger, load->event);
+  sb_msg_double(&load->trigger, "upload", load->network.up_mbps, 2);
+  sb_msg_double(&load->trigger, "download", load->network.down_mbps, 2);
+  if (load->sched.count > 1) {
+    sb_msg_double(&load->trigger, "upload_peak", load->network.up_peak_mbps, 2);
+    sb_msg_double(&load->trigger, "download_peak", load->network.down_peak_mbps, 2);
+  }
+  sb_msg_send(&load->trigger);
+}
+
+static inline uint64_t network_load_next(void* context) {
+  struct network_load* load = context;
+  return load->paused ? UINT64_MAX : sched_next(&load->sched);
+}
+
+// One tick: the trigger task is bit 0, the sampling task bit 1. A trigger
+// that falls on a sample reads the counters only once.
+static inline void network_load_tick(struct network_load* load, uint64_t now_ns, uint32_t due) {
+  if (load->tape.recording) {
+    tape_begin(&load->tape, TAPE_NET_TICK, true);
+    tape_write_u64(&load->tape, now_ns);
+    tape_write_u32(&load->tape, due);
+    tape_end(&load->tape);
+  }
+  if (due & 1) network_load_sample(load, now_ns);
+  else if (due && network_load_follow(load)) network_sample(&load->network, now_ns);
+  if (load->tape.recording) tape_flush(&load->tape);
+}
+
+static inline void network_load_run(void* context, uint64_t now_ns, uint64_t due_ns) {
+  struct network_load* load = context;
+  // Absolute deadlines, so the time spent sampling does not add up.
+  uint32_t due = sched_due(&load->sched, due_ns);
+  if (due) network_load_tick(load, now_ns, due);
+}
+
+// A control command at now_ns (recorded, or replayed from the tape).
+static inline void network_load_command_at(struct network_load* load,
+                                           const char* line,
+                                           uint64_t now_ns) {
+  if (load->tape.recording) {
+    tape_begin(&load->tape, TAPE_NET_COMMAND, true);
+    tape_write_u64(&load->tape, now_ns);
+    tape_write_str(&load->tape, line, TAPE_COMMAND_SIZE);
+    tape_end(&load->tape);
+  }
+  const char* args;
+  if (control_match(line, "pause")) {
+    load->paused = true;
+  } else if (control_match(line, "resume") && load->paused) {
+    // The rate across the pause would average over time nobody saw.
+    load->paused = false;
+    if (load->multi) {
+      interfaces_reset(&load->interfaces);
+      interfaces_update(&load->interfaces, now_ns);
+    } else {
+      rate_reset(&load->network.rate);
+      network_sample(&load->network, now_ns);
+    }
+    sched_reset(&load->sched, now_ns + CONTROL_RESUME_SETTLE_NS);
+  } else if ((args = control_match(line, "rate")) && atof(args) > 0.0) {
+    load->update_freq = (float)atof(args);
+    uint64_t period_ns = network_load_period_ns(load);
+    sched_set_period(&load->sched, 0, period_ns);
+    load->network.rate.tau_ns = period_ns;
+    load->network.rate.hold_ns = period_ns;
+    load->network.rate.max_gap_ns = 4 * period_ns;
+    sched_reset(&load->sched, now_ns);
+  }
+  if (load->tape.recording) tape_flush(&load->tape);
+}
+
+static inline void network_load_command(void* context, const char* line) {
+  network_load_command_at(context, line, sketchybar_now_ns());
+}
+
+// Runs every recorded tick and command at its recorded time through
+// network_load_tick() and network_load_command_at(), paced at speed times
+// the recorded rate. False when the tape stops matching what the module
+// asks for; a tape cut short replays up to the cut.
+static inline bool network_load_replay(struct network_load* load) {
+  struct tape* tape = &load->tape;
+  uint64_t start = sketchybar_now_ns();
+  uint64_t first = 0;
+  bool started = false;
+  int channel;
+  while ((channel = tape_peek(tape)) >= 0) {
+    struct tape_reader reader;
+    uint64_t now = 0;
+    if (!tape_next(tape, (uint16_t)channel, &reader) || !tape_read_u64(&reader, &now)) break;
+    if (!started) first = now;
+    started = true;
+    if (load->speed > 0.0 && now > first) {
+      sched_sleep_until(start + (uint64_t)((double)(now - first) / load->speed));
+    }
+
+    if (channel == TAPE_NET_TICK) {
+      uint32_t due = 0;
+      if (!tape_read_u32(&reader, &due)) break;
+      network_load_tick(load, now, due);
+    } else if (channel == TAPE_NET_COMMAND) {
+      char command[TAPE_COMMAND_SIZE];
+      if (!tape_read_str(&reader, command, sizeof(command))) break;
+      network_load_command_at(load, command, now);
+    } else {
+      tape->failed = true;
+    }
+  }
+  return !tape->failed || tape->ended;
+}
+
+static inline struct module network_load_module(struct network_load* load) {
+  return (struct module){
+    .name = "network_load",
+    .state = load,
+    .next = network_load_next,
+    .run = network_load_run,
+    .command = network_load_command,
+  };
+}
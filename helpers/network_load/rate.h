@@ -0,0 +1,146 @@
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Smoothed byte rates from counters sampled more often than they are shown.
+//
+// rate_push() takes a pair of monotonic byte counters with their timestamp,
+// typically every few hundred milliseconds, and turns the interval into an
+// instantaneous rate. That rate feeds an EWMA with a time constant (so the
+// smoothing does not depend on the sampling interval) and is kept in a ring
+// of recent intervals, from which rate_read() takes the peak over the hold
+// window. A counter that went backwards (the interface was recreated) and a
+// gap much longer than the sampling interval (sleep) start a new baseline
+// instead of producing a spike or a long average. Time is always passed in,
+// so a recorded counter trace replays to the same values.
+
+#define RATE_RING_SIZE 64
+
+struct rate_interval {
+  uint64_t end_ns;
+  double up_bps;
+  double down_bps;
+};
+
+struct rate_estimate {
+  // Bits per second.
+  double up;
+  double down;
+  double up_peak;
+  double down_peak;
+};
+
+struct rate_engine {
+  uint64_t tau_ns;
+  uint64_t hold_ns;
+  uint64_t max_gap_ns;
+
+  bool has_baseline;
+  uint64_t last_ns;
+  uint64_t last_in;
+  uint64_t last_out;
+
+  bool has_ewma;
+  double up_ewma;
+  double down_ewma;
+
+  struct rate_interval ring[RATE_RING_SIZE];
+  uint32_t head;
+  uint32_t count;
+
+  uint64_t resets;
+  uint64_t gaps;
+};
+
+// tau_ns: EWMA time constant; hold_ns: how long a peak is held; an interval
+// longer than max_gap_ns only takes a new baseline.
+static inline void rate_init(struct rate_engine* rate,
+                             uint64_t tau_ns,
+                             uint64_t hold_ns,
+                             uint64_t max_gap_ns) {
+  memset(rate, 0, sizeof(struct rate_engine));
+  rate->tau_ns = tau_ns ? tau_ns : 1;
+  rate->hold_ns = hold_ns;
+  rate->max_gap_ns = max_gap_ns;
+}
+
+// Forgets the history; the next push only takes the baseline.
+static inline void rate_reset(struct rate_engine* rate) {
+  rate->has_baseline = false;
+  rate->has_ewma = false;
+  rate->up_ewma = 0.0;
+  rate->down_ewma = 0.0;
+  rate->head = 0;
+  rate->count = 0;
+}
+
+static inline void rate_push(struct rate_engine* rate,
+                             uint64_t now_ns,
+                             uint64_t bytes_in,
+                             uint64_t bytes_out) {
+  bool had_baseline = rate->has_baseline;
+  uint64_t last_ns = rate->last_ns;
+  uint64_t last_in = rate->last_in;
+  uint64_t last_out = rate->last_out;
+  rate->has_baseline = true;
+  rate->last_ns = now_ns;
+  rate->last_in = bytes_in;
+  rate->last_out = bytes_out;
+  if (!had_baseline || now_ns <= last_ns) return;
+
+  if (bytes_in < last_in || bytes_out < last_out) {
+    rate->resets++;
+    return;
+  }
+  uint64_t elapsed_ns = now_ns - last_ns;
+  if (rate->max_gap_ns && elapsed_ns > rate->max_gap_ns) {
+    // Rates from before the gap say nothing about now.
+    rate->gaps++;
+    rate->has_ewma = false;
+    rate->count = 0;
+    return;
+  }
+
+  double seconds = (double)elapsed_ns / 1e9;
+  double up = (double)(bytes_out - last_out) * 8.0 / seconds;
+  double down = (double)(bytes_in - last_in) * 8.0 / seconds;
+
+  if (rate->has_ewma) {
+    // Weight by elapsed time, so uneven intervals smooth alike.
+    double alpha = -expm1(-(double)elapsed_ns / (double)rate->tau_ns);
+    rate->up_ewma += alpha * (up - rate->up_ewma);
+    rate->down_ewma += alpha * (down - rate->down_ewma);
+  } else {
+    rate->up_ewma = up;
+    rate->down_ewma = down;
+    rate->has_ewma = true;
+  }
+
+  rate->ring[rate->head] = (struct rate_interval){ now_ns, up, down };
+  rate->head = (rate->head + 1) % RATE_RING_SIZE;
+  if (rate->count < RATE_RING_SIZE) rate->count++;
+}
+
+// The smoothed rates and the highest interval rates that ended within the
+// hold window before now_ns (never below the smoothed ones). Zero until two
+// samples were pushed.
+static inline struct rate_estimate rate_read(const struct rate_engine* rate, uint64_t now_ns) {
+  struct rate_estimate estimate = { 0 };
+  if (!rate->has_ewma) return estimate;
+  estimate.up = rate->up_ewma;
+  estimate.down = rate->down_ewma;
+
+  for (uint32_t i = 0; i < rate->count; i++) {
+    const struct rate_interval* interval
+      = &rate->ring[(rate->head + RATE_RING_SIZE - 1 - i) % RATE_RING_SIZE];
+    if (interval->end_ns + rate->hold_ns < now_ns) break;
+    if (interval->up_bps > estimate.up_peak) estimate.up_peak = interval->up_bps;
+    if (interval->down_bps > estimate.down_peak) estimate.down_peak = interval->down_bps;
+  }
+  if (estimate.up_peak < estimate.up) estimate.up_peak = estimate.up;
+  if (estimate.down_peak < estimate.down) estimate.down_peak = estimate.down;
+  return estimate;
+}
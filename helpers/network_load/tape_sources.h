@@ -0,0 +1,216 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "interfaces.h"
+#include "network.h"
+#include "uplink.h"
+#include "../tape.h"
+
+// Recording and replaying the network_load sources (helpers/tape.h), as
+// helpers/system_stats/tape_sources.h does for system_stats: the single
+// interface's counters, the multi-interface snapshots and, in auto mode, the
+// interface the resolver picked. Interface names asked for are recorded with
+// each open and checked on replay. The tape starts with the schedule origin,
+// since the first baseline is taken at it.
+
+enum {
+  TAPE_NET_ORIGIN,
+  TAPE_NET_TICK,
+  TAPE_NET_COMMAND,
+  TAPE_NET_OPEN,
+  TAPE_NET_READ,
+  TAPE_NET_INTERFACES_READ,
+  TAPE_NET_RESOLVER_START,
+  TAPE_NET_RESOLVE
+};
+
+// Single interface
+
+struct tape_network_source {
+  struct tape* tape;
+  struct network_source inner;
+};
+
+static struct tape_network_source g_tape_network = { 0 };
+
+static inline bool tape_network_record_open(void* context, const char* ifname) {
+  struct tape_network_source* source = context;
+  bool ok = source->inner.open(source->inner.context, ifname);
+  tape_begin(source->tape, TAPE_NET_OPEN, ok);
+  tape_write_str(source->tape, ifname, IF_NAMESIZE);
+  tape_end(source->tape);
+  return ok;
+}
+
+static inline bool tape_network_record_read(void* context, uint64_t* ibytes, uint64_t* obytes) {
+  struct tape_network_source* source = context;
+  bool ok = source->inner.read(source->inner.context, ibytes, obytes);
+  tape_begin(source->tape, TAPE_NET_READ, ok);
+  tape_write_u64(source->tape, ok ? *ibytes : 0);
+  tape_write_u64(source->tape, ok ? *obytes : 0);
+  tape_end(source->tape);
+  return ok;
+}
+
+static inline bool tape_network_replay_open(void* context, const char* ifname) {
+  struct tape_network_source* source = context;
+  struct tape_reader reader;
+  char recorded[IF_NAMESIZE];
+  if (!tape_next(source->tape, TAPE_NET_OPEN, &reader)
+      || !tape_read_str(&reader, recorded, sizeof(recorded))) {
+    return false;
+  }
+  if (strcmp(recorded, ifname) != 0) {
+    source->tape->failed = true;
+    return false;
+  }
+  return reader.ok;
+}
+
+static inline bool tape_network_replay_read(void* context, uint64_t* ibytes, uint64_t* obytes) {
+  struct tape_network_source* source = context;
+  struct tape_reader reader;
+  return tape_next(source->tape, TAPE_NET_READ, &reader)
+         && tape_read_u64(&reader, ibytes)
+         && tape_read_u64(&reader, obytes)
+         && reader.ok;
+}
+
+static inline struct network_source tape_network_record(struct tape* tape,
+                                                        struct network_source inner) {
+  g_tape_network = (struct tape_network_source){ tape, inner };
+  return (struct network_source){ inner.name, tape_network_record_open, tape_network_record_read,
+                                  &g_tape_network };
+}
+
+static inline struct network_source tape_network_replay(struct tape* tape) {
+  g_tape_network = (struct tape_network_source){ tape, { 0 } };
+  return (struct network_source){ "tape", tape_network_replay_open, tape_network_replay_read,
+                                  &g_tape_network };
+}
+
+// Several interfaces
+
+struct tape_interfaces_source {
+  struct tape* tape;
+  struct interfaces_source inner;
+};
+
+static struct tape_interfaces_source g_tape_interfaces = { 0 };
+
+static inline bool tape_interfaces_record_read(void* context, struct interfaces_snapshot* out) {
+  struct tape_interfaces_source* source = context;
+  bool ok = source->inner.read(source->inner.context, out);
+  int32_t count = ok ? out->count : 0;
+  tape_begin(source->tape, TAPE_NET_INTERFACES_READ, ok);
+  tape_write_i32(source->tape, count);
+  for (int i = 0; i < count; i++) {
+    const struct interface_counters* entry = &out->entries[i];
+    tape_write_str(source->tape, entry->name, sizeof(entry->name));
+    tape_write_u64(source->tape, entry->ibytes);
+    tape_write_u64(source->tape, entry->obytes);
+  }
+  tape_end(source->tape);
+  return ok;
+}
+
+static inline bool tape_interfaces_replay_read(void* context, struct interfaces_snapshot* out) {
+  struct tape_interfaces_source* source = context;
+  struct tape_reader reader;
+  int32_t count = 0;
+  if (!tape_next(source->tape, TAPE_NET_INTERFACES_READ, &reader)
+      || !tape_read_i32(&reader, &count)
+      || count < 0 || count > INTERFACES_MAX) {
+    return false;
+  }
+  for (int i = 0; i < count; i++) {
+    struct interface_counters* entry = &out->entries[i];
+    if (!tape_read_str(&reader, entry->name, sizeof(entry->name))
+        || !tape_read_u64(&reader, &entry->ibytes)
+        || !tape_read_u64(&reader, &entry->obytes)) {
+      return false;
+    }
+  }
+  out->count = count;
+  return reader.ok;
+}
+
+static inline struct interfaces_source tape_interfaces_record(struct tape* tape,
+                                                              struct interfaces_source inner) {
+  g_tape_interfaces = (struct tape_interfaces_source){ tape, inner };
+  return (struct interfaces_source){ inner.name, tape_interfaces_record_read, &g_tape_interfaces };
+}
+
+static inline struct interfaces_source tape_interfaces_replay(struct tape* tape) {
+  g_tape_interfaces = (struct tape_interfaces_source){ tape, { 0 } };
+  return (struct interfaces_source){ "tape", tape_interfaces_replay_read, &g_tape_interfaces };
+}
+
+// Resolver. Stopping has no result, so it is not recorded.
+
+struct tape_resolver_source {
+  struct tape* tape;
+  struct network_resolver inner;
+};
+
+static struct tape_resolver_source g_tape_resolver = { 0 };
+
+static inline bool tape_resolver_record_start(void* context) {
+  struct tape_resolver_source* source = context;
+  bool ok = source->inner.start(source->inner.context);
+  tape_put(source->tape, TAPE_NET_RESOLVER_START, ok, NULL, 0);
+  return ok;
+}
+
+static inline bool tape_resolver_record_resolve(void* context, char* ifname, size_t size) {
+  struct tape_resolver_source* source = context;
+  bool ok = source->inner.resolve(source->inner.context, ifname, size);
+  tape_begin(source->tape, TAPE_NET_RESOLVE, ok);
+  if (ok) tape_write_str(source->tape, ifname, size);
+  tape_end(source->tape);
+  return ok;
+}
+
+static inline void tape_resolver_record_stop(void* context) {
+  struct tape_resolver_source* source = context;
+  source->inner.stop(source->inner.context);
+}
+
+static inline bool tape_resolver_replay_start(void* context) {
+  struct tape_resolver_source* source = context;
+  struct tape_reader reader;
+  return tape_next(source->tape, TAPE_NET_RESOLVER_START, &reader) && reader.ok;
+}
+
+static inline bool tape_resolver_replay_resolve(void* context, char* ifname, size_t size) {
+  struct tape_resolver_source* source = context;
+  struct tape_reader reader;
+  return tape_next(source->tape, TAPE_NET_RESOLVE, &reader) && reader.ok
+         && tape_read_str(&reader, ifname, size);
+}
+
+static inline void tape_resolver_replay_stop(void* context) {
+  (void)context;
+}
+
+static inline struct network_resolver tape_resolver_record(struct tape* tape,
+                                                           struct network_resolver inner) {
+  g_tape_resolver = (struct tape_resolver_source){ tape, inner };
+  return (struct network_resolver){ inner.name,
+                                    tape_resolver_record_start,
+                                    tape_resolver_record_resolve,
+                                    tape_resolver_record_stop,
+                                    &g_tape_resolver };
+}
+
+static inline struct network_resolver tape_resolver_replay(struct tape* tape) {
+  g_tape_resolver = (struct tape_resolver_source){ tape, { 0 } };
+  return (struct network_resolver){ "tape",
+                                    tape_resolver_replay_start,
+                                    tape_resolver_replay_resolve,
+                                    tape_resolver_replay_stop,
+                                    &g_tape_resolver };
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <net/if.h>
+
+#ifdef __APPLE__
+#include <CoreFoundation/CoreFoundation.h>
+#include "../network_interface_resolver.h"
+#endif
+
+// The effective uplink that network_load's auto mode follows. Sources:
+// - watch: the dynamic store through network_interface_resolver's cached
+//   watch, resolved again only after a network change notification
+// - proc: the default route with the lowest metric in /proc/net/route, read
+//   on every call
+// Custom sources (recorded names) plug in through network_load_init_with().
+
+struct network_resolver {
+  const char* name;
+  bool (*start)(void* context);
+  // The current effective interface; false when there is none.
+  bool (*resolve)(void* context, char* ifname, size_t size);
+  void (*stop)(void* context);
+  void* context;
+};
+
+#ifdef __APPLE__
+static struct sb_interface_watch g_network_watch = { 0 };
+
+static inline bool network_watch_start(void* context) {
+  return sb_interface_watch_start(context, CFSTR("network_load"));
+}
+
+static inline bool network_watch_resolve(void* context, char* ifname, size_t size) {
+  return sb_interface_watch_resolve(context, ifname, size);
+}
+
+static inline void network_watch_stop(void* context) {
+  sb_interface_watch_stop(context);
+}
+
+static inline struct network_resolver network_watch_resolver(void) {
+  return (struct network_resolver){ "watch", network_watch_start, network_watch_resolve,
+                                    network_watch_stop, &g_network_watch };
+}
+#endif
+
+static inline bool network_route_start(void* context) {
+  (void)context;
+  return true;
+}
+
+// "Iface Destination Gateway Flags RefCnt Use Metric Mask ...", hex
+// addresses; a default route has destination and mask 0 and is up (flag 1).
+static inline bool network_route_resolve(void* context, char* ifname, size_t size) {
+  const char* path = context;
+  FILE* file = fopen(path, "r");
+  if (!file) return false;
+
+  char line[256];
+  char best[IF_NAMESIZE] = { 0 };
+  long best_metric = -1;
+  while (fgets(line, sizeof(line), file)) {
+    char name[IF_NAMESIZE];
+    unsigned long destination, gateway, flags, mask;
+    long refs, use, metric;
+    if (sscanf(line, "%15s %lx %lx %lx %ld %ld %ld %lx", name, &destination, &gateway, &flags,
+               &refs, &use, &metric, &mask) != 8) {
+      continue;
+    }
+    if (destination != 0 || mask != 0 || !(flags & 1)) continue;
+    if (best_metric < 0 || metric < best_metric) {
+      memcpy(best, name, sizeof(best));
+      best_metric = metric;
+    }
+  }
+  fclose(file);
+  if (best_metric < 0 || strlen(best) >= size) return false;
+  snprintf(ifname, size, "%s", best);
+  return true;
+}
+
+static inline void network_route_stop(void* context) {
+  (void)context;
+}
+
+static inline struct network_resolver network_route_resolver(const char* path) {
+  return (struct network_resolver){ "proc", network_route_start, network_route_resolve,
+                                    network_route_stop, (void*)path };
+}
+
+static inline struct network_resolver network_platform_resolver(void) {
+#ifdef __APPLE__
+  return network_watch_resolver();
+#else
+  return network_route_resolver("/proc/net/route");
+#endif
+}
@@ -14,6 +14,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "../json.h"
 #include "../sketchybar.h"
 
 // SkyLight (private)
@@ -221,8 +222,14 @@ int main(int argc, char** argv) {
   if (did_uuid) CFRelease(did_uuid);
 
   // JSON output for sbar.exec() (Lua) to parse.
-  printf("{\"space\":%d,\"display\":%d}\n", space_index, display_index);
-  return 0;
+  char buffer[64];
+  struct json_writer json;
+  json_init(&json, buffer, sizeof(buffer), STDOUT_FILENO);
+  json_begin_object(&json);
+  json_field_int(&json, "space", space_index);
+  json_field_int(&json, "display", display_index);
+  json_end_object(&json);
+  return json_finish(&json) ? 0 : 1;
 }
 
 
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+// Multi-rate deadline scheduler for the collectors.
+//
+// Every task has its own period and runs on the absolute grid
+// origin + k * period, so collection time never accumulates as drift and
+// tasks with related periods stay in phase (a 1s and a 5s task run together
+// every fifth second). sched_due() takes the current time and returns the
+// tasks whose deadline passed, as a bit mask, advancing each of them to its
+// next grid point; when the helper fell behind by whole periods those ticks
+// are skipped (counted in `skipped`) rather than run back to back. The core
+// never reads a clock itself, so it can be driven by a fake one.
+
+#define SCHED_MAX_TASKS 16
+
+struct sched_task {
+  const char* name;
+  uint64_t period_ns;
+  uint64_t next_ns;
+
+  uint64_t runs;
+  uint64_t skipped;
+};
+
+struct sched {
+  uint64_t origin_ns;
+  int count;
+  struct sched_task tasks[SCHED_MAX_TASKS];
+};
+
+static inline void sched_init(struct sched* sched, uint64_t origin_ns) {
+  sched->origin_ns = origin_ns;
+  sched->count = 0;
+}
+
+// Adds a task that first runs at the origin; returns its index (its bit in
+// sched_due() masks), or -1 when the table is full or the period is zero.
+static inline int sched_add(struct sched* sched, const char* name, uint64_t period_ns) {
+  if (sched->count == SCHED_MAX_TASKS || period_ns == 0) return -1;
+  struct sched_task* task = &sched->tasks[sched->count];
+  task->name = name;
+  task->period_ns = period_ns;
+  task->next_ns = sched->origin_ns;
+  task->runs = 0;
+  task->skipped = 0;
+  return sched->count++;
+}
+
+// Starts a new grid at origin_ns: every task runs there, then every period.
+static inline void sched_reset(struct sched* sched, uint64_t origin_ns) {
+  sched->origin_ns = origin_ns;
+  for (int i = 0; i < sched->count; i++) sched->tasks[i].next_ns = origin_ns;
+}
+
+static inline void sched_set_period(struct sched* sched, int index, uint64_t period_ns) {
+  if (index < 0 || index >= sched->count || period_ns == 0) return;
+  sched->tasks[index].period_ns = period_ns;
+}
+
+// Earliest deadline over all tasks, UINT64_MAX without tasks.
+static inline uint64_t sched_next(const struct sched* sched) {
+  uint64_t next = UINT64_MAX;
+  for (int i = 0; i < sched->count; i++) {
+    if (sched->tasks[i].next_ns < next) next = sched->tasks[i].next_ns;
+  }
+  return next;
+}
+
+static inline uint32_t sched_due(struct sched* sched, uint64_t now_ns) {
+  uint32_t due = 0;
+  for (int i = 0; i < sched->count; i++) {
+    struct sched_task* task = &sched->tasks[i];
+    if (task->next_ns > now_ns) continue;
+
+    due |= 1u << i;
+    task->runs++;
+    uint64_t missed = (now_ns - task->next_ns) / task->period_ns;
+    task->skipped += missed;
+    task->next_ns += (missed + 1) * task->period_ns;
+  }
+  return due;
+}
+
+// Sleeps until deadline_ns on the sketchybar_now_ns() clock
+// (CLOCK_MONOTONIC). macOS has no clock_nanosleep(), and its monotonic clock
+// is not the mach_absolute_time() base, so the deadline is translated right
+// before waiting.
+static inline void sched_sleep_until(uint64_t deadline_ns) {
+#ifdef __APPLE__
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  uint64_t now = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+  if (deadline_ns <= now) return;
+
+  static mach_timebase_info_data_t timebase;
+  if (timebase.denom == 0) mach_timebase_info(&timebase);
+  uint64_t delta = (deadline_ns - now) * timebase.denom / timebase.numer;
+  mach_wait_until(mach_absolute_time() + delta);
+#else
+  struct timespec ts = { (time_t)(deadline_ns / 1000000000ull),
+                         (long)(deadline_ns % 1000000000ull) };
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+#endif
+}
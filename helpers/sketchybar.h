@@ -1,19 +1,62 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#ifdef __APPLE__
 #include <mach/arm/kern_return.h>
 #include <mach/mach.h>
 #include <mach/mach_port.h>
 #include <mach/message.h>
 #include <bootstrap.h>
-#include <stdlib.h>
-#include <pthread.h>
-#include <stdio.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 typedef char* env;
 
 #define MACH_HANDLER(name) void name(env env)
 typedef MACH_HANDLER(mach_handler);
 
+// Transports
+//
+// Messages are always in the bar's wire format (NUL-separated arguments with a
+// trailing NUL); a transport only decides how those bytes reach the receiver.
+// The Mach backend talks to a live bar through its bootstrap port. The Unix
+// socket backend is selected with SKETCHYBAR_SOCKET=<path> (and is the default
+// off macOS) and is what helpers/bar_stub listens on for profiling.
+struct sketchybar_transport {
+  const char* name;
+  bool (*connect)(void);
+  bool (*send)(char* message, uint32_t length);
+  void (*disconnect)(void);
+};
+
+// Upper bound for a single send in milliseconds; 0 blocks until the receiver
+// takes the message. Only the async sender sets it.
+static uint32_t g_send_timeout_ms = 0;
+
+#ifdef __APPLE__
 struct mach_message {
   mach_msg_header_t header;
   mach_msg_size_t msgh_descriptor_count;
@@ -71,52 +114,1037 @@ static inline bool mach_send_message(mach_port_t port, char* message, uint32_t l
   msg.descriptor.deallocate = false;
   msg.descriptor.type = MACH_MSG_OOL_DESCRIPTOR;
 
+  mach_msg_option_t options = MACH_SEND_MSG;
+  mach_msg_timeout_t timeout = MACH_MSG_TIMEOUT_NONE;
+  if (g_send_timeout_ms) {
+    options |= MACH_SEND_TIMEOUT;
+    timeout = g_send_timeout_ms;
+  }
+
   kern_return_t err = mach_msg(&msg.header,
-                               MACH_SEND_MSG,
+                               options,
                                sizeof(struct mach_message),
                                0,
                                MACH_PORT_NULL,
-                               MACH_MSG_TIMEOUT_NONE,
+                               timeout,
                                MACH_PORT_NULL              );
 
   return err == KERN_SUCCESS;
 }
 
-static inline uint32_t format_message(char* message, char* formatted_message) {
-  // This is not actually robust, switch to stack based messaging.
-  char outer_quote = 0;
+static inline bool mach_transport_connect(void) {
+  g_mach_port = mach_get_bs_port();
+  return g_mach_port != 0;
+}
+
+static inline bool mach_transport_send(char* message, uint32_t length) {
+  return mach_send_message(g_mach_port, message, length);
+}
+
+static inline void mach_transport_disconnect(void) {
+  g_mach_port = 0;
+}
+
+static const struct sketchybar_transport g_mach_transport = {
+  .name = "mach",
+  .connect = mach_transport_connect,
+  .send = mach_transport_send,
+  .disconnect = mach_transport_disconnect,
+};
+#endif
+
+// Every frame on the Unix socket starts with this header. sent_ns is taken from
+// CLOCK_MONOTONIC right before the write so a receiver on the same host can
+// compute per-message latency.
+struct sketchybar_frame_header {
+  uint32_t length;
+  uint32_t reserved;
+  uint64_t sent_ns;
+};
+
+static int g_socket_fd = -1;
+
+static inline uint64_t sketchybar_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline void socket_transport_path(char* buffer, size_t size) {
+  char* path = getenv("SKETCHYBAR_SOCKET");
+  if (path && path[0] != '\0') {
+    snprintf(buffer, size, "%s", path);
+    return;
+  }
+
+  char* name = getenv("BAR_NAME");
+  if (!name) name = "sketchybar";
+  snprintf(buffer, size, "/tmp/%s.socket", name);
+}
+
+static inline bool socket_transport_connect(void) {
+  if (g_socket_fd >= 0) close(g_socket_fd);
+
+  struct sockaddr_un addr = { 0 };
+  addr.sun_family = AF_UNIX;
+  socket_transport_path(addr.sun_path, sizeof(addr.sun_path));
+
+  g_socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (g_socket_fd < 0) return false;
+
+#ifdef SO_NOSIGPIPE
+  int on = 1;
+  setsockopt(g_socket_fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+  if (g_send_timeout_ms) {
+    struct timeval timeout = { .tv_sec = g_send_timeout_ms / 1000,
+                               .tv_usec = (g_send_timeout_ms % 1000) * 1000 };
+    setsockopt(g_socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  }
+
+  if (connect(g_socket_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(g_socket_fd);
+    g_socket_fd = -1;
+    return false;
+  }
+  return true;
+}
+
+static inline bool socket_write_all(struct iovec* iov, int count) {
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+
+  // SO_SNDTIMEO bounds each call; a receiver that keeps taking a few bytes
+  // at a time must not stretch one message past the timeout either.
+  uint64_t deadline = g_send_timeout_ms
+                      ? sketchybar_now_ns() + (uint64_t)g_send_timeout_ms * 1000000ull
+                      : UINT64_MAX;
+  while (count > 0) {
+    struct msghdr msg = { 0 };
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    ssize_t written = sendmsg(g_socket_fd, &msg, flags);
+    if (written < 0) return false;
+
+    while (count > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      if (sketchybar_now_ns() > deadline) return false;
+      iov->iov_base = (char*)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return true;
+}
+
+static inline bool socket_transport_send(char* message, uint32_t length) {
+  if (!message || g_socket_fd < 0) return false;
+
+  struct sketchybar_frame_header header = { 0 };
+  header.length = length;
+  header.sent_ns = sketchybar_now_ns();
+
+  struct iovec iov[2] = {
+    { .iov_base = &header, .iov_len = sizeof(header) },
+    { .iov_base = message, .iov_len = length },
+  };
+  return socket_write_all(iov, 2);
+}
+
+static inline void socket_transport_disconnect(void) {
+  if (g_socket_fd >= 0) close(g_socket_fd);
+  g_socket_fd = -1;
+}
+
+static const struct sketchybar_transport g_socket_transport = {
+  .name = "unix",
+  .connect = socket_transport_connect,
+  .send = socket_transport_send,
+  .disconnect = socket_transport_disconnect,
+};
+
+static const struct sketchybar_transport* g_transport = NULL;
+static bool g_transport_connected = false;
+
+static inline const struct sketchybar_transport* sketchybar_transport(void) {
+  if (g_transport) return g_transport;
+
+#ifdef __APPLE__
+  char* path = getenv("SKETCHYBAR_SOCKET");
+  g_transport = (path && path[0] != '\0') ? &g_socket_transport
+                                          : &g_mach_transport;
+#else
+  g_transport = &g_socket_transport;
+#endif
+  return g_transport;
+}
+
+static inline void sketchybar_set_transport(const struct sketchybar_transport* transport) {
+  if (g_transport && g_transport_connected) g_transport->disconnect();
+  g_transport = transport;
+  g_transport_connected = false;
+}
+
+// Tokenizer
+//
+// format_message() turns a shell-like command string into wire format:
+// unquoted spaces separate arguments, and '...' or "..." group text (spaces
+// included) into one argument with the quotes removed. Inside a quoted span
+// the other quote character is literal, so label="it's" keeps its apostrophe.
+// A backslash escapes a following quote, space or backslash; any other
+// backslash is kept as is. Output is always the arguments followed by two
+// NULs, and never longer than strlen(message) + 2.
+//
+// The tokenizer only stops at bytes that can change its state and copies the
+// runs between them in bulk; sb_scan_special() finds the next such byte 16 or
+// 32 bytes at a time where SIMD is available.
+static inline uint32_t sb_scan_special_scalar(const char* text,
+                                              uint32_t length,
+                                              const char special[4]) {
+  for (uint32_t i = 0; i < length; i++) {
+    char c = text[i];
+    if (c == special[0] || c == special[1] || c == special[2] || c == special[3]) {
+      return i;
+    }
+  }
+  return length;
+}
+
+static inline uint32_t sb_scan_special(const char* text,
+                                       uint32_t length,
+                                       const char special[4]) {
+  uint32_t i = 0;
+#if defined(__AVX2__)
+  const __m256i a = _mm256_set1_epi8(special[0]);
+  const __m256i b = _mm256_set1_epi8(special[1]);
+  const __m256i c = _mm256_set1_epi8(special[2]);
+  const __m256i d = _mm256_set1_epi8(special[3]);
+  for (; i + 32 <= length; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(text + i));
+    __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, a),
+                                                  _mm256_cmpeq_epi8(v, b)),
+                                  _mm256_or_si256(_mm256_cmpeq_epi8(v, c),
+                                                  _mm256_cmpeq_epi8(v, d)));
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+    if (mask) return i + (uint32_t)__builtin_ctz(mask);
+  }
+#elif defined(__SSE2__)
+  const __m128i a = _mm_set1_epi8(special[0]);
+  const __m128i b = _mm_set1_epi8(special[1]);
+  const __m128i c = _mm_set1_epi8(special[2]);
+  const __m128i d = _mm_set1_epi8(special[3]);
+  for (; i + 16 <= length; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(text + i));
+    __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, a),
+                                            _mm_cmpeq_epi8(v, b)),
+                               _mm_or_si128(_mm_cmpeq_epi8(v, c),
+                                            _mm_cmpeq_epi8(v, d)));
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(hit);
+    if (mask) return i + (uint32_t)__builtin_ctz(mask);
+  }
+#elif defined(__ARM_NEON)
+  const uint8x16_t a = vdupq_n_u8((uint8_t)special[0]);
+  const uint8x16_t b = vdupq_n_u8((uint8_t)special[1]);
+  const uint8x16_t c = vdupq_n_u8((uint8_t)special[2]);
+  const uint8x16_t d = vdupq_n_u8((uint8_t)special[3]);
+  for (; i + 16 <= length; i += 16) {
+    uint8x16_t v = vld1q_u8((const uint8_t*)(text + i));
+    uint8x16_t hit = vorrq_u8(vorrq_u8(vceqq_u8(v, a), vceqq_u8(v, b)),
+                              vorrq_u8(vceqq_u8(v, c), vceqq_u8(v, d)));
+    // Narrow every byte to a nibble: bit 4*k is set when byte k matched.
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+                      vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+    if (mask) return i + (uint32_t)(__builtin_ctzll(mask) >> 2);
+  }
+#endif
+  return i + sb_scan_special_scalar(text + i, length - i, special);
+}
+
+static inline uint32_t sb_tokenize(const char* message,
+                                   uint32_t length,
+                                   char* formatted_message,
+                                   bool vectorized) {
+  static const char unquoted[4] = { ' ', '"', '\'', '\\' };
+  char quoted[4] = { 0, '\\', 0, 0 };
+
+  char quote = 0;
   uint32_t caret = 0;
-  uint32_t message_length = strlen(message) + 1;
-  for (int i = 0; i < message_length; ++i) {
-    if (message[i] == '"' || message[i] == '\'') {
-      if (outer_quote && outer_quote == message[i]) outer_quote = 0;
-      else if (!outer_quote) outer_quote = message[i];
-      continue;
+  uint32_t i = 0;
+  while (i < length) {
+    const char* special = unquoted;
+    if (quote) {
+      quoted[0] = quoted[2] = quoted[3] = quote;
+      special = quoted;
+    }
+
+    uint32_t run = vectorized
+                   ? sb_scan_special(message + i, length - i, special)
+                   : sb_scan_special_scalar(message + i, length - i, special);
+    if (run < 16) {
+      for (uint32_t k = 0; k < run; k++) formatted_message[caret + k] = message[i + k];
+    } else {
+      memcpy(formatted_message + caret, message + i, run);
+    }
+    caret += run;
+    i += run;
+    if (i >= length) break;
+
+    char c = message[i++];
+    if (c == '\\') {
+      char next = i < length ? message[i] : 0;
+      bool escapes = quote ? (next == quote || next == '\\')
+                           : (next == ' ' || next == '"' || next == '\'' || next == '\\');
+      if (escapes) {
+        formatted_message[caret++] = next;
+        i++;
+      } else {
+        formatted_message[caret++] = c;
+      }
+    } else if (c == ' ') {
+      formatted_message[caret++] = '\0';
+    } else {
+      // Opening or closing quote; the quote itself is dropped.
+      quote = quote ? 0 : c;
     }
-    formatted_message[caret] = message[i];
-    if (message[i] == ' ' && !outer_quote) formatted_message[caret] = '\0';
-    caret++;
   }
 
-  if (caret > 0 && formatted_message[caret] == '\0'
-      && formatted_message[caret - 1] == '\0') {
-    caret--;
+  formatted_message[caret++] = '\0';
+  formatted_message[caret++] = '\0';
+  return caret;
+}
+
+static inline uint32_t format_message(char* message, char* formatted_message) {
+  return sb_tokenize(message, strlen(message), formatted_message, true);
+}
+
+#define SB_ATOMIC_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define SB_ATOMIC_STORE(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#define SB_ATOMIC_ADD(ptr, value) __atomic_fetch_add(ptr, value, __ATOMIC_RELAXED)
+
+// Message slots
+//
+// Fixed-size copies of wire-format messages, keyed by their first two
+// arguments ("--trigger <event>", "--add event", "--set <item>", ...). Used
+// wherever only the newest message per key matters, which holds for messages
+// that carry the key's full state. Partial ones (see below) are flagged and
+// never stand in for each other.
+#define SB_SLOT_SIZE 4096
+
+struct sb_slot {
+  uint64_t key;
+  uint64_t enqueued_ns;
+  uint32_t length;
+  bool partial;
+  char data[SB_SLOT_SIZE];
+};
+
+// FNV-1a over the first two arguments of the wire-format message.
+static inline uint64_t sb_message_key(const char* message, uint32_t length) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  uint32_t separators = 0;
+  for (uint32_t i = 0; i < length && separators < 2; i++) {
+    if (message[i] == '\0') separators++;
+    hash = (hash ^ (uint8_t)message[i]) * 0x100000001b3ull;
   }
-  formatted_message[caret] = '\0';
-  return caret + 1;
+  return hash;
 }
 
-static inline void sketchybar(char* message) {
-  char formatted_message[strlen(message) + 2];
-  uint32_t length = format_message(message, formatted_message);
-  if (!length) return;
+// Resync
+//
+// sketchybar_send() is for messages that carry their key's full state, so a
+// newer one may replace an older one. sketchybar_send_partial() is for the
+// rest: triggers with only the collectors that ran, diffs, graph --push
+// values. Those are delivered in order and never coalesced or remembered.
+// Whenever one may not have reached the bar (dropped from a full ring, timed
+// out, sent while the bar was away, a reconnect) the resync generation moves
+// on; a sender compares it with the generation it last saw and then sends its
+// full state with sketchybar_send().
+static uint64_t g_resync_generation = 0;
+
+static inline uint64_t sketchybar_resync_generation(void) {
+  return SB_ATOMIC_LOAD(&g_resync_generation);
+}
+
+static inline void sb_resync(void) {
+  SB_ATOMIC_ADD(&g_resync_generation, 1);
+}
+
+// Resilient mode
+//
+// Without it a helper exits as soon as the bar cannot be reached, which throws
+// away its rate baselines on every bar restart. With SKETCHYBAR_RESILIENT set
+// the helper keeps sampling instead: the newest full-state message per key is
+// remembered, reconnects are retried with exponential backoff (250 ms up to
+// 30 s), and on every (re)connect the remembered state is replayed in
+// first-seen order and the resync generation moves on. That replay also
+// re-registers events ("--add event ...") with a restarted bar.
+//
+// The helper's lifetime is tied to SKETCHYBAR_PARENT_PID (exit once that
+// process is gone) and/or SKETCHYBAR_LOCK_FILE (exit once the file is removed
+// or taken over by a newer instance) instead of to a failed send.
+#define SB_RESILIENT_SLOTS 16
+#define SB_BACKOFF_MIN_NS 250000000ull
+#define SB_BACKOFF_MAX_NS 30000000000ull
+#define SB_LIFETIME_CHECK_NS 1000000000ull
+// How long a replaced holder gets to exit after SIGTERM, and then SIGKILL.
+#define SB_CLAIM_TIMEOUT_NS 2000000000ull
+
+struct sb_resilient {
+  bool enabled;
+  uint64_t backoff_ns;
+  uint64_t next_attempt_ns;
+  uint64_t reconnects;
+  uint32_t state_count;
+  struct sb_slot state[SB_RESILIENT_SLOTS];
+
+  pid_t parent;
+  int lock_fd;
+  uint64_t next_lifetime_check_ns;
+  // Set by a relaunch's SIGUSR1 (see sb_claim_instance()); the next send
+  // replays the remembered state first.
+  int replay_requested;
+};
+
+static struct sb_resilient g_resilient = { .lock_fd = -1 };
+
+static inline void sb_resilient_remember(char* message, uint32_t length) {
+  if (length > SB_SLOT_SIZE) return;
+
+  uint64_t key = sb_message_key(message, length);
+  uint32_t index = 0;
+  while (index < g_resilient.state_count && g_resilient.state[index].key != key) index++;
+  if (index == g_resilient.state_count) {
+    if (index == SB_RESILIENT_SLOTS) return;
+    g_resilient.state_count++;
+  }
+
+  struct sb_slot* slot = &g_resilient.state[index];
+  slot->key = key;
+  slot->length = length;
+  memcpy(slot->data, message, length);
+}
+
+static inline void sb_resilient_backoff(void) {
+  g_transport->disconnect();
+  g_transport_connected = false;
+
+  uint64_t backoff = g_resilient.backoff_ns;
+  backoff = backoff ? backoff * 2 : SB_BACKOFF_MIN_NS;
+  if (backoff > SB_BACKOFF_MAX_NS) backoff = SB_BACKOFF_MAX_NS;
+  g_resilient.backoff_ns = backoff;
+  g_resilient.next_attempt_ns = sketchybar_now_ns() + backoff;
+}
+
+static inline bool sb_resilient_replay(void) {
+  for (uint32_t i = 0; i < g_resilient.state_count; i++) {
+    struct sb_slot* slot = &g_resilient.state[i];
+    if (!g_transport->send(slot->data, slot->length)) return false;
+  }
+  return true;
+}
+
+static inline bool sb_resilient_reconnect(void) {
+  __atomic_store_n(&g_resilient.replay_requested, 0, __ATOMIC_RELAXED);
+  if (!g_transport->connect()) {
+    sb_resilient_backoff();
+    return false;
+  }
+  g_transport_connected = true;
+
+  if (!sb_resilient_replay()) {
+    sb_resilient_backoff();
+    return false;
+  }
+
+  g_resilient.backoff_ns = 0;
+  g_resilient.reconnects++;
+  sb_resync();
+  return true;
+}
+
+// A full-state message is remembered first, so the replay on a reconnect
+// already carries it; a partial one goes out after the replay.
+static inline bool sb_resilient_send(char* message, uint32_t length, bool partial) {
+  if (!partial) sb_resilient_remember(message, length);
+  sketchybar_transport();
+
+  // A config reload wiped the bar's events and items while it kept running:
+  // register and send everything again, this message included.
+  if (g_transport_connected
+      && __atomic_exchange_n(&g_resilient.replay_requested, 0, __ATOMIC_ACQ_REL)) {
+    if (sb_resilient_replay()) return !partial || g_transport->send(message, length);
+    g_transport->disconnect();
+    g_transport_connected = false;
+    if (!sb_resilient_reconnect()) return false;
+    return !partial || g_transport->send(message, length);
+  }
+
+  if (!g_transport_connected) {
+    if (sketchybar_now_ns() < g_resilient.next_attempt_ns) return false;
+    if (!sb_resilient_reconnect()) return false;
+    return !partial || g_transport->send(message, length);
+  }
+
+  if (g_transport->send(message, length)) return true;
+
+  // The bar restarted or stalled past the send timeout: try once right away,
+  // then fall back to the backoff schedule.
+  g_transport->disconnect();
+  g_transport_connected = false;
+  if (!sb_resilient_reconnect()) return false;
+  return !partial || g_transport->send(message, length);
+}
+
+static inline void sb_lifetime_check(void) {
+  uint64_t now = sketchybar_now_ns();
+  if (now < g_resilient.next_lifetime_check_ns) return;
+  g_resilient.next_lifetime_check_ns = now + SB_LIFETIME_CHECK_NS;
+
+  if (g_resilient.parent > 0
+      && kill(g_resilient.parent, 0) != 0
+      && errno == ESRCH) {
+    exit(0);
+  }
+
+  if (g_resilient.lock_fd >= 0) {
+    struct stat held;
+    struct stat current;
+    char* path = getenv("SKETCHYBAR_LOCK_FILE");
+    if (!path
+        || fstat(g_resilient.lock_fd, &held) != 0
+        || stat(path, &current) != 0
+        || held.st_ino != current.st_ino
+        || held.st_dev != current.st_dev) {
+      exit(0);
+    }
+  }
+}
+
+// A relaunch for the same bar and arguments means the config was reloaded,
+// which drops the bar's events and items: replay the remembered state on the
+// next send, and have senders follow up with their full state.
+static inline void sb_resync_signal(int signal) {
+  (void)signal;
+  __atomic_store_n(&g_resilient.replay_requested, 1, __ATOMIC_RELAXED);
+  sb_resync();
+}
 
-  if (!g_mach_port) g_mach_port = mach_get_bs_port();
-  if (!mach_send_message(g_mach_port, formatted_message, length)) {
-    g_mach_port = mach_get_bs_port();
-    if (!mach_send_message(g_mach_port, formatted_message, length)) {
+// Retries a non-blocking flock until timeout_ns passed.
+static inline bool sb_lock_within(int fd, uint64_t timeout_ns) {
+  uint64_t deadline = sketchybar_now_ns() + timeout_ns;
+  for (;;) {
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0) return true;
+    if (errno != EWOULDBLOCK && errno != EINTR) return false;
+    if (sketchybar_now_ns() >= deadline) return false;
+    struct timespec pause = { 0, 10000000 };
+    nanosleep(&pause, NULL);
+  }
+}
+
+// Replaces the whole record; a short write would leave one the next
+// claimant cannot parse.
+static inline bool sb_write_record(int fd, const char* record, int length) {
+  if (ftruncate(fd, 0) != 0) return false;
+  for (int done = 0; done < length;) {
+    ssize_t n = pwrite(fd, record + done, (size_t)(length - done), done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    done += (int)n;
+  }
+  return true;
+}
+
+// Takes the instance lock in SKETCHYBAR_LOCK_FILE. The file records the
+// holder's pid, parent and arguments. When a running holder serves the same
+// parent with the same arguments this process tells it with SIGUSR1 and
+// exits, and the holder keeps its baselines; otherwise (bar restarted,
+// arguments changed) the holder is terminated and replaced: SIGTERM, then
+// SIGKILL when it still holds the lock after SB_CLAIM_TIMEOUT_NS. A lock
+// that stays held after that makes this process give up and exit.
+static inline void sb_claim_instance(const char* path, int argc, char** argv) {
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) return;
+
+  uint64_t args_hash = 0xcbf29ce484222325ull;
+  for (int i = 0; i < argc; i++) {
+    for (const char* c = argv[i]; ; c++) {
+      args_hash = (args_hash ^ (uint8_t)*c) * 0x100000001b3ull;
+      if (*c == '\0') break;
+    }
+  }
+
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+    char record[96] = { 0 };
+    long long holder = 0;
+    long long holder_parent = 0;
+    unsigned long long holder_hash = 0;
+    if (pread(fd, record, sizeof(record) - 1, 0) > 0
+        && sscanf(record, "%lld %lld %llx", &holder, &holder_parent, &holder_hash) == 3) {
+      if (holder_parent == (long long)g_resilient.parent && holder_hash == args_hash) {
+        if (holder > 0) kill((pid_t)holder, SIGUSR1);
+        exit(0);
+      }
+      if (holder > 0) kill((pid_t)holder, SIGTERM);
+    }
+    if (!sb_lock_within(fd, SB_CLAIM_TIMEOUT_NS)) {
+      if (holder > 0) kill((pid_t)holder, SIGKILL);
+      if (!sb_lock_within(fd, SB_CLAIM_TIMEOUT_NS)) {
+        fprintf(stderr, "%s: %s is still locked (holder %lld), giving up\n",
+                argc > 0 ? argv[0] : "helper", path, holder);
+        exit(1);
+      }
+    }
+  }
+
+  char record[96];
+  int written = snprintf(record,
+                         sizeof(record),
+                         "%lld %lld %llx\n",
+                         (long long)getpid(),
+                         (long long)g_resilient.parent,
+                         (unsigned long long)args_hash);
+  if (written <= 0 || written >= (int)sizeof(record) || !sb_write_record(fd, record, written)) {
+    fprintf(stderr, "%s: cannot record the instance in %s: %s\n",
+            argc > 0 ? argv[0] : "helper", path, strerror(errno));
+  }
+  g_resilient.lock_fd = fd;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = sb_resync_signal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR1, &action, NULL);
+}
+
+// Enables resilient mode when SKETCHYBAR_RESILIENT is set and applies the
+// lifetime settings. Call once at startup, before the first message.
+static inline bool sketchybar_resilient_start_from_env(int argc, char** argv) {
+  char* parent = getenv("SKETCHYBAR_PARENT_PID");
+  if (parent && parent[0] != '\0') g_resilient.parent = (pid_t)strtol(parent, NULL, 10);
+
+  char* lock = getenv("SKETCHYBAR_LOCK_FILE");
+  if (lock && lock[0] != '\0') sb_claim_instance(lock, argc, argv);
+
+  char* value = getenv("SKETCHYBAR_RESILIENT");
+  g_resilient.enabled = value && value[0] != '\0' && strcmp(value, "0") != 0;
+  return g_resilient.enabled;
+}
+
+static inline bool sb_send_now(char* message, uint32_t length, bool partial) {
+  if (g_resilient.enabled) {
+    if (sb_resilient_send(message, length, partial)) return true;
+    if (partial) sb_resync();
+    return false;
+  }
+
+  const struct sketchybar_transport* transport = sketchybar_transport();
+
+  if (!g_transport_connected) g_transport_connected = transport->connect();
+  if (!g_transport_connected || !transport->send(message, length)) {
+    transport->disconnect();
+    g_transport_connected = transport->connect();
+    if (!g_transport_connected) {
       // No sketchybar instance running, exit.
       exit(0);
     }
+    if (!transport->send(message, length)) {
+      // With a send timeout a busy bar is not a dead one; drop the message.
+      if (!g_send_timeout_ms) exit(0);
+      if (partial) sb_resync();
+      return false;
+    }
+  }
+  return true;
+}
+
+static inline bool sketchybar_send_now(char* message, uint32_t length) {
+  return sb_send_now(message, length, false);
+}
+
+// Async sender
+//
+// Opt-in mode that moves all sends off the caller's thread, so a bar stalled
+// by WindowServer cannot stall sampling. Once sketchybar_async_start() ran,
+// sketchybar_send() only copies the message into a single-producer /
+// single-consumer ring and returns. The ring's indices are atomics; the
+// producer takes the mutex only to wake the sender thread when it is asleep
+// on the condition variable, not while it is busy sending. The sender thread
+// drains the ring and sends with a timeout. A full-state message replaces everything still queued
+// under its key (the first two arguments, e.g. "--trigger <event>"), so a
+// slow bar only sees the newest state; partial messages are all sent, in
+// order. A message that finds the ring full is dropped. All sends must come
+// from one producer thread.
+#define SB_ASYNC_SLOTS 16
+
+struct sb_async_stats {
+  uint64_t enqueued;
+  uint64_t sent;
+  uint64_t dropped;
+  uint64_t coalesced;
+  uint64_t oversized;
+  uint64_t timed_out;
+  uint64_t send_ns_total;
+  uint64_t send_ns_max;
+  uint64_t queue_ns_max;
+};
+
+struct sb_async {
+  bool running;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  // Set by the sender thread, under the lock, before it waits for head.
+  int sleeping;
+  uint32_t head;
+  uint32_t tail;
+  struct sb_slot slots[SB_ASYNC_SLOTS];
+  struct sb_slot pending[SB_ASYNC_SLOTS];
+  struct sb_async_stats stats;
+};
+
+static struct sb_async g_async = { 0 };
+
+static inline void sb_atomic_max(uint64_t* target, uint64_t value) {
+  uint64_t current = __atomic_load_n(target, __ATOMIC_RELAXED);
+  while (value > current
+         && !__atomic_compare_exchange_n(target, &current, value, true,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+static inline uint32_t sb_async_drain(struct sb_async* async, uint32_t pending_count) {
+  uint32_t head = SB_ATOMIC_LOAD(&async->head);
+  uint32_t tail = async->tail;
+
+  for (; tail != head; tail++) {
+    struct sb_slot* slot = &async->slots[tail % SB_ASYNC_SLOTS];
+
+    // Full state supersedes every message still pending under its key,
+    // partial ones included; it is sent where it arrived, after them.
+    if (!slot->partial) {
+      uint32_t kept = 0;
+      for (uint32_t i = 0; i < pending_count; i++) {
+        if (async->pending[i].key == slot->key) {
+          SB_ATOMIC_ADD(&async->stats.coalesced, 1);
+          continue;
+        }
+        if (kept != i) {
+          struct sb_slot* from = &async->pending[i];
+          struct sb_slot* to = &async->pending[kept];
+          to->key = from->key;
+          to->enqueued_ns = from->enqueued_ns;
+          to->length = from->length;
+          to->partial = from->partial;
+          memcpy(to->data, from->data, from->length);
+        }
+        kept++;
+      }
+      pending_count = kept;
+    }
+
+    struct sb_slot* target = &async->pending[pending_count++];
+    target->key = slot->key;
+    target->enqueued_ns = slot->enqueued_ns;
+    target->length = slot->length;
+    target->partial = slot->partial;
+    memcpy(target->data, slot->data, slot->length);
+  }
+
+  SB_ATOMIC_STORE(&async->tail, tail);
+  return pending_count;
+}
+
+static inline void* sb_async_thread(void* context) {
+  struct sb_async* async = context;
+
+  for (;;) {
+    // sleeping and head are a store-then-load pair on each side (see
+    // sketchybar_async_enqueue()), so one side always sees the other's store.
+    pthread_mutex_lock(&async->lock);
+    __atomic_store_n(&async->sleeping, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&async->head, __ATOMIC_SEQ_CST) == async->tail) {
+      pthread_cond_wait(&async->wake, &async->lock);
+    }
+    __atomic_store_n(&async->sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&async->lock);
+
+    // Whatever arrives while these sends are in flight is coalesced in the
+    // next round, so a slow bar only ever sees the newest value per key.
+    uint32_t pending_count = sb_async_drain(async, 0);
+    for (uint32_t i = 0; i < pending_count; i++) {
+      struct sb_slot* message = &async->pending[i];
+      uint64_t start = sketchybar_now_ns();
+      bool sent = sb_send_now(message->data, message->length, message->partial);
+      uint64_t end = sketchybar_now_ns();
+
+      SB_ATOMIC_ADD(sent ? &async->stats.sent : &async->stats.timed_out, 1);
+      SB_ATOMIC_ADD(&async->stats.send_ns_total, end - start);
+      sb_atomic_max(&async->stats.send_ns_max, end - start);
+      sb_atomic_max(&async->stats.queue_ns_max, end - message->enqueued_ns);
+    }
+  }
+  return NULL;
+}
+
+static inline bool sketchybar_async_enqueue(char* message, uint32_t length, bool partial) {
+  struct sb_async* async = &g_async;
+  SB_ATOMIC_ADD(&async->stats.enqueued, 1);
+
+  if (length > SB_SLOT_SIZE) {
+    SB_ATOMIC_ADD(&async->stats.oversized, 1);
+    if (partial) sb_resync();
+    return false;
+  }
+
+  uint32_t head = async->head;
+  if (head - SB_ATOMIC_LOAD(&async->tail) >= SB_ASYNC_SLOTS) {
+    SB_ATOMIC_ADD(&async->stats.dropped, 1);
+    if (partial) sb_resync();
+    return false;
+  }
+
+  struct sb_slot* slot = &async->slots[head % SB_ASYNC_SLOTS];
+  slot->key = sb_message_key(message, length);
+  slot->enqueued_ns = sketchybar_now_ns();
+  slot->length = length;
+  slot->partial = partial;
+  memcpy(slot->data, message, length);
+  __atomic_store_n(&async->head, head + 1, __ATOMIC_SEQ_CST);
+
+  // A sender that is not asleep drains the new message in its next round.
+  if (__atomic_load_n(&async->sleeping, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&async->lock);
+    pthread_cond_signal(&async->wake);
+    pthread_mutex_unlock(&async->lock);
+  }
+  return true;
+}
+
+// Starts the sender thread; every send then times out after timeout_ms.
+static inline bool sketchybar_async_start(uint32_t timeout_ms) {
+  if (g_async.running) return true;
+
+  // Reconnect on the sender thread so the socket picks up the timeout.
+  if (g_transport && g_transport_connected) g_transport->disconnect();
+  g_transport_connected = false;
+
+  g_send_timeout_ms = timeout_ms;
+  pthread_mutex_init(&g_async.lock, NULL);
+  pthread_cond_init(&g_async.wake, NULL);
+  if (pthread_create(&g_async.thread, NULL, sb_async_thread, &g_async) != 0) {
+    g_send_timeout_ms = 0;
+    return false;
+  }
+  pthread_detach(g_async.thread);
+  g_async.running = true;
+  return true;
+}
+
+// Enables async mode when SKETCHYBAR_ASYNC is set. Its value is the send
+// timeout in milliseconds; any non-numeric value selects 250 ms.
+static inline bool sketchybar_async_start_from_env(void) {
+  char* value = getenv("SKETCHYBAR_ASYNC");
+  if (!value || value[0] == '\0' || strcmp(value, "0") == 0) return false;
+
+  char* end = NULL;
+  unsigned long timeout_ms = strtoul(value, &end, 10);
+  if (!end || *end != '\0' || timeout_ms == 0) timeout_ms = 250;
+  return sketchybar_async_start((uint32_t)timeout_ms);
+}
+
+static inline void sketchybar_async_stats(struct sb_async_stats* stats) {
+  stats->enqueued = SB_ATOMIC_LOAD(&g_async.stats.enqueued);
+  stats->sent = SB_ATOMIC_LOAD(&g_async.stats.sent);
+  stats->dropped = SB_ATOMIC_LOAD(&g_async.stats.dropped);
+  stats->coalesced = SB_ATOMIC_LOAD(&g_async.stats.coalesced);
+  stats->oversized = SB_ATOMIC_LOAD(&g_async.stats.oversized);
+  stats->timed_out = SB_ATOMIC_LOAD(&g_async.stats.timed_out);
+  stats->send_ns_total = SB_ATOMIC_LOAD(&g_async.stats.send_ns_total);
+  stats->send_ns_max = SB_ATOMIC_LOAD(&g_async.stats.send_ns_max);
+  stats->queue_ns_max = SB_ATOMIC_LOAD(&g_async.stats.queue_ns_max);
+}
+
+static inline bool sb_send(char* message, uint32_t length, bool partial) {
+  sb_lifetime_check();
+  if (g_async.running) return sketchybar_async_enqueue(message, length, partial);
+  return sb_send_now(message, length, partial);
+}
+
+// A message with the full state of its key.
+static inline bool sketchybar_send(char* message, uint32_t length) {
+  return sb_send(message, length, false);
+}
+
+// A message with part of its key's state; see "Resync" above.
+static inline bool sketchybar_send_partial(char* message, uint32_t length) {
+  return sb_send(message, length, true);
+}
+
+// Message builder
+//
+// Appends arguments straight into a caller-owned buffer in wire format, so hot
+// paths skip the quote parsing in format_message() and never allocate. Several
+// commands (--trigger, --set, --push, ...) can share one buffer; the bar parses
+// them in order. A message that does not fit is flagged and never sent.
+struct sb_message {
+  char* buffer;
+  uint32_t capacity;
+  uint32_t length;
+  bool overflow;
+};
+
+static inline void sb_msg_init(struct sb_message* msg, char* buffer, uint32_t capacity) {
+  msg->buffer = buffer;
+  msg->capacity = capacity;
+  msg->length = 0;
+  msg->overflow = capacity < 2;
+}
+
+static inline void sb_msg_reset(struct sb_message* msg) {
+  msg->length = 0;
+  msg->overflow = msg->capacity < 2;
+}
+
+// One byte is always kept back for the terminating empty argument.
+static inline bool sb_msg_reserve(struct sb_message* msg, uint32_t size) {
+  if (msg->overflow || msg->capacity - 1 - msg->length < size) {
+    msg->overflow = true;
+    return false;
+  }
+  return true;
+}
+
+static inline void sb_msg_append(struct sb_message* msg, const char* data, uint32_t size) {
+  if (!sb_msg_reserve(msg, size)) return;
+  memcpy(msg->buffer + msg->length, data, size);
+  msg->length += size;
+}
+
+static inline void sb_msg_end_arg(struct sb_message* msg) {
+  if (!sb_msg_reserve(msg, 1)) return;
+  msg->buffer[msg->length++] = '\0';
+}
+
+static inline void sb_msg_key(struct sb_message* msg, const char* key) {
+  sb_msg_append(msg, key, strlen(key));
+  sb_msg_append(msg, "=", 1);
+}
+
+static inline void sb_msg_append_uint(struct sb_message* msg, uint64_t value) {
+  char digits[20];
+  uint32_t count = 0;
+  do {
+    digits[sizeof(digits) - 1 - count++] = '0' + (char)(value % 10);
+    value /= 10;
+  } while (value);
+  sb_msg_append(msg, digits + sizeof(digits) - count, count);
+}
+
+static inline void sb_msg_append_int(struct sb_message* msg, int64_t value) {
+  if (value < 0) {
+    sb_msg_append(msg, "-", 1);
+    sb_msg_append_uint(msg, (uint64_t)0 - (uint64_t)value);
+    return;
+  }
+  sb_msg_append_uint(msg, (uint64_t)value);
+}
+
+static inline void sb_msg_append_double(struct sb_message* msg, double value, int precision) {
+  static const double scales[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6 };
+  if (precision < 0) precision = 0;
+  if (precision > 6) precision = 6;
+
+  // Large or non-finite values are rare enough to go through printf.
+  if (!(value > -1e12 && value < 1e12)) {
+    char text[32];
+    int written = snprintf(text, sizeof(text), "%.*f", precision, value);
+    if (written > 0) sb_msg_append(msg, text, (uint32_t)written);
+    return;
+  }
+
+  bool negative = value < 0.0;
+  double scaled = (negative ? -value : value) * scales[precision] + 0.5;
+  uint64_t fixed = (uint64_t)scaled;
+  uint64_t whole = fixed / (uint64_t)scales[precision];
+  uint64_t fraction = fixed % (uint64_t)scales[precision];
+
+  if (negative && fixed > 0) sb_msg_append(msg, "-", 1);
+  sb_msg_append_uint(msg, whole);
+  if (precision == 0) return;
+
+  char digits[7];
+  for (int i = precision - 1; i >= 0; i--) {
+    digits[i] = '0' + (char)(fraction % 10);
+    fraction /= 10;
   }
+  sb_msg_append(msg, ".", 1);
+  sb_msg_append(msg, digits, (uint32_t)precision);
+}
+
+static inline void sb_msg_arg(struct sb_message* msg, const char* arg) {
+  sb_msg_append(msg, arg, strlen(arg));
+  sb_msg_end_arg(msg);
+}
+
+static inline void sb_msg_int(struct sb_message* msg, const char* key, int64_t value) {
+  sb_msg_key(msg, key);
+  sb_msg_append_int(msg, value);
+  sb_msg_end_arg(msg);
+}
+
+static inline void sb_msg_uint(struct sb_message* msg, const char* key, uint64_t value) {
+  sb_msg_key(msg, key);
+  sb_msg_append_uint(msg, value);
+  sb_msg_end_arg(msg);
+}
+
+static inline void sb_msg_double(struct sb_message* msg,
+                                 const char* key,
+                                 double value,
+                                 int precision) {
+  sb_msg_key(msg, key);
+  sb_msg_append_double(msg, value, precision);
+  sb_msg_end_arg(msg);
+}
+
+static inline void sb_msg_str(struct sb_message* msg, const char* key, const char* value) {
+  sb_msg_key(msg, key);
+  sb_msg_append(msg, value, strlen(value));
+  sb_msg_end_arg(msg);
+}
+
+// Terminates the message and returns its wire length (0 if it overflowed).
+static inline uint32_t sb_msg_finish(struct sb_message* msg) {
+  if (msg->overflow || msg->length == 0) return 0;
+  msg->buffer[msg->length] = '\0';
+  return msg->length + 1;
+}
+
+static inline bool sb_msg_send(struct sb_message* msg) {
+  uint32_t length = sb_msg_finish(msg);
+  if (!length) return false;
+
+  return sketchybar_send(msg->buffer, length);
+}
+
+static inline bool sb_msg_send_partial(struct sb_message* msg) {
+  uint32_t length = sb_msg_finish(msg);
+  if (!length) return false;
+
+  return sketchybar_send_partial(msg->buffer, length);
+}
+
+static inline void sketchybar(char* message) {
+  char formatted_message[strlen(message) + 2];
+  uint32_t length = format_message(message, formatted_message);
+  if (!length) return;
+
+  sketchybar_send(formatted_message, length);
 }
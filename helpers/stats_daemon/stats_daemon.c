@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../network_load/network_load.h"
+#include "../system_stats/system_stats.h"
+
+// One process hosting several collectors, started as (one command line)
+//
+//   stats_daemon --control <fifo>
+//     system_stats "system_stats_update 2.0 --period temps=6"
+//     network_load "auto network_update 2.0"
+//
+// Each module takes the arguments of its standalone helper, as one string,
+// except --control: the daemon's FIFO serves all of them.
+// All modules sleep on a shared schedule origin, so equal or nested periods
+// land on the same wakeup, and modules due within --slack of each other run
+// together. Commands on the FIFO are routed by module name
+// ("network_load rate 1"); `pause`, `resume` and `report` go to all of them.
+
+#define ARGS_MAX 1024
+#define ARGV_MAX 32
+
+struct module_args {
+  char buffer[ARGS_MAX];
+  char* argv[ARGV_MAX];
+  int argc;
+};
+
+// Splits a quoted argument string like the shell would, with the module name
+// as argv[0].
+static bool split_args(struct module_args* args, const char* name, const char* line) {
+  uint32_t length = (uint32_t)strlen(line);
+  if (length + 2 > ARGS_MAX) return false;
+  uint32_t size = sb_tokenize(line, length, args->buffer, true);
+
+  args->argc = 0;
+  args->argv[args->argc++] = (char*)name;
+  // The last two bytes terminate the token list.
+  for (uint32_t i = 0; i + 1 < size; i += (uint32_t)strlen(args->buffer + i) + 1) {
+    if (args->argc == ARGV_MAX - 1) return false;
+    args->argv[args->argc++] = args->buffer + i;
+  }
+  args->argv[args->argc] = NULL;
+  return true;
+}
+
+static void usage(const char* name) {
+  printf("Usage: %s [--control <fifo>] [--slack <ms>] <module> \"<args>\"...\n"
+         "Modules: system_stats, network_load\n", name);
+}
+
+int main(int argc, char** argv) {
+  static struct system_stats stats;
+  static struct network_load load;
+  static struct module_args args[2];
+  bool has_stats = false;
+  bool has_load = false;
+
+  const char* control_path = NULL;
+  uint64_t slack_ns = 0;
+  int i = 1;
+  for (; i + 1 < argc && strncmp(argv[i], "--", 2) == 0; i += 2) {
+    if (strcmp(argv[i], "--control") == 0) {
+      control_path = argv[i + 1];
+    } else if (strcmp(argv[i], "--slack") == 0) {
+      slack_ns = (uint64_t)(atof(argv[i + 1]) * 1e6);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (i == argc || (argc - i) % 2 != 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  for (; i < argc; i += 2) {
+    const char* name = argv[i];
+    if (strcmp(name, "system_stats") == 0 && !has_stats) {
+      has_stats = split_args(&args[0], name, argv[i + 1])
+                  && system_stats_parse(args[0].argc, args[0].argv, &stats.options);
+      if (!has_stats) {
+        system_stats_usage(name);
+        return 1;
+      }
+      // Replay drives its own clock, so it only runs in the standalone helper.
+      if (stats.options.replay_path) {
+        fprintf(stderr, "system_stats --replay runs standalone only\n");
+        return 1;
+      }
+      if (stats.options.control_path) {
+        fprintf(stderr, "system_stats: --control is the daemon's when hosted\n");
+        return 1;
+      }
+      // The daemon's FIFO serves the procs queries.
+      stats.options.control_path = control_path;
+    } else if (strcmp(name, "network_load") == 0 && !has_load) {
+      has_load = split_args(&args[1], name, argv[i + 1])
+                 && network_load_parse(args[1].argc, args[1].argv, &load);
+      if (!has_load) {
+        network_load_usage(name);
+        return 1;
+      }
+      if (load.replay_path) {
+        fprintf(stderr, "network_load --replay runs standalone only\n");
+        return 1;
+      }
+      if (load.control_path) {
+        fprintf(stderr, "network_load: --control is the daemon's when hosted\n");
+        return 1;
+      }
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  alarm(0);
+  sketchybar_resilient_start_from_env(argc, argv);
+
+  struct module_host host;
+  module_host_init(&host, "stats_daemon", slack_ns);
+  uint64_t origin = sketchybar_now_ns();
+  if (has_stats) {
+    if (system_stats_init(&stats, origin)) {
+      module_host_add(&host, system_stats_module(&stats));
+    } else {
+      fprintf(stderr, "Could not open tape %s\n", stats.options.record_path);
+    }
+  }
+  if (has_load) {
+    // A missing interface only disables this module.
+    if (network_load_init(&load, origin)) module_host_add(&host, network_load_module(&load));
+  }
+
+  if (control_path && !control_open(&host.control, control_path)) {
+    fprintf(stderr, "Could not create control fifo %s\n", control_path);
+  }
+  sketchybar_async_start_from_env();
+  module_host_run(&host);
+  return 0;
+}
@@ -1,61 +1,360 @@
-#include <mach/mach.h>
+#pragma once
+
 #include <stdbool.h>
-#include <unistd.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <sys/sysctl.h>
+#endif
+
+// Per-core CPU load.
+//
+// A source fills a snapshot of monotonic 64-bit tick counters per core; the
+// snapshot is laid out state-major so cpu_update() can compute every core's
+// delta, its load and the P/E cluster sums in a single loop the compiler
+// vectorizes. Sources:
+// - mach: host_processor_info(PROCESSOR_CPU_LOAD_INFO); its 32-bit counters
+//   are widened by accumulating wrapping deltas.
+// - proc: /proc/stat, kept open and re-read with pread().
+// Custom sources (recorded or synthetic ticks) plug in through cpu_init_with.
+
+#define CPU_MAX_CORES 256
+
+// Same order as mach's CPU_STATE_*.
+enum {
+  CPU_TICK_USER,
+  CPU_TICK_SYSTEM,
+  CPU_TICK_IDLE,
+  CPU_TICK_NICE,
+  CPU_TICK_STATES
+};
+
+enum {
+  CPU_CLUSTER_P,
+  CPU_CLUSTER_E
+};
+
+struct cpu_ticks {
+  int count;
+  uint64_t ticks[CPU_TICK_STATES][CPU_MAX_CORES];
+};
+
+struct cpu_source {
+  const char* name;
+  // Fills out with the current counters; false when they cannot be read.
+  bool (*read)(void* context, struct cpu_ticks* out);
+  // Sets kinds[i] to the CPU_CLUSTER_* of core i. Optional: all cores are
+  // performance cores without it.
+  void (*clusters)(void* context, uint8_t* kinds, int count);
+  void* context;
+};
 
 struct cpu {
-  host_t host;
-  mach_msg_type_number_t count;
-  host_cpu_load_info_data_t load;
-  host_cpu_load_info_data_t prev_load;
+  struct cpu_source source;
+  struct cpu_ticks snapshots[2];
+  int current;
   bool has_prev_load;
 
+  int core_count;
+  uint8_t core_cluster[CPU_MAX_CORES];
+  uint8_t core_load[CPU_MAX_CORES];
+
   int user_load;
   int sys_load;
   int total_load;
+  int max_core_load;
+
+  // Cluster loads, -1 when the machine has no cores of that kind.
+  int p_count;
+  int e_count;
+  int p_load;
+  int e_load;
 };
 
-static inline void cpu_init(struct cpu* cpu) {
-  cpu->host = mach_host_self();
-  cpu->count = HOST_CPU_LOAD_INFO_COUNT;
+#ifdef __APPLE__
+struct cpu_mach_source {
+  host_t host;
+  bool has_last;
+  uint32_t last[CPU_TICK_STATES][CPU_MAX_CORES];
+  uint64_t total[CPU_TICK_STATES][CPU_MAX_CORES];
+};
+
+static struct cpu_mach_source g_cpu_mach = { 0 };
+
+static inline bool cpu_mach_read(void* context, struct cpu_ticks* out) {
+  struct cpu_mach_source* mach = context;
+  natural_t count = 0;
+  processor_info_array_t info = NULL;
+  mach_msg_type_number_t info_count = 0;
+  kern_return_t error = host_processor_info(mach->host,
+                                            PROCESSOR_CPU_LOAD_INFO,
+                                            &count,
+                                            &info,
+                                            &info_count);
+
+  if (error != KERN_SUCCESS) {
+    printf("Error: Could not read cpu processor info.\n");
+    return false;
+  }
+
+  processor_cpu_load_info_t load = (processor_cpu_load_info_t)info;
+  if (count > CPU_MAX_CORES) count = CPU_MAX_CORES;
+  for (int state = 0; state < CPU_TICK_STATES; state++) {
+    for (natural_t i = 0; i < count; i++) {
+      uint32_t ticks = load[i].cpu_ticks[state];
+      // Unsigned 32-bit subtraction is wrap-safe.
+      if (mach->has_last) mach->total[state][i] += ticks - mach->last[state][i];
+      else mach->total[state][i] = ticks;
+      mach->last[state][i] = ticks;
+      out->ticks[state][i] = mach->total[state][i];
+    }
+  }
+  mach->has_last = true;
+  out->count = (int)count;
+
+  vm_deallocate(mach_task_self(), (vm_address_t)info, info_count * sizeof(integer_t));
+  return true;
+}
+
+static inline int cpu_sysctl_int(const char* name, int fallback) {
+  int value = 0;
+  size_t length = sizeof(value);
+  if (sysctlbyname(name, &value, &length, NULL, 0) != 0) return fallback;
+  return value;
+}
+
+// Apple silicon numbers the efficiency cores first (perflevel0 is the
+// performance level), Intel machines have a single level.
+static inline void cpu_mach_clusters(void* context, uint8_t* kinds, int count) {
+  (void)context;
+  int e_count = 0;
+  if (cpu_sysctl_int("hw.nperflevels", 1) > 1) {
+    e_count = cpu_sysctl_int("hw.perflevel1.logicalcpu", 0);
+  }
+  for (int i = 0; i < count; i++) {
+    kinds[i] = i < e_count ? CPU_CLUSTER_E : CPU_CLUSTER_P;
+  }
+}
+
+static inline struct cpu_source cpu_mach_source(void) {
+  g_cpu_mach.host = mach_host_self();
+  g_cpu_mach.has_last = false;
+  return (struct cpu_source){ "mach", cpu_mach_read, cpu_mach_clusters, &g_cpu_mach };
+}
+#endif
+
+struct cpu_proc_source {
+  const char* path;
+  int fd;
+  int ids[CPU_MAX_CORES];
+  char buffer[32768];
+};
+
+static struct cpu_proc_source g_cpu_proc = { 0 };
+
+static inline uint64_t cpu_parse_u64(const char** cursor, const char* end) {
+  const char* c = *cursor;
+  while (c < end && *c == ' ') c++;
+  uint64_t value = 0;
+  while (c < end && *c >= '0' && *c <= '9') value = value * 10 + (uint64_t)(*c++ - '0');
+  *cursor = c;
+  return value;
+}
+
+// cpuN user nice system idle iowait irq softirq steal ...; guest time is
+// already part of user. iowait counts as idle, interrupts and steal as system.
+static inline bool cpu_proc_read(void* context, struct cpu_ticks* out) {
+  struct cpu_proc_source* proc = context;
+  if (proc->fd < 0) {
+    proc->fd = open(proc->path, O_RDONLY | O_CLOEXEC);
+    if (proc->fd < 0) return false;
+  }
+
+  ssize_t length = pread(proc->fd, proc->buffer, sizeof(proc->buffer), 0);
+  if (length <= 0) {
+    close(proc->fd);
+    proc->fd = -1;
+    return false;
+  }
+
+  const char* c = proc->buffer;
+  const char* end = proc->buffer + length;
+  int count = 0;
+  while (c + 3 < end && memcmp(c, "cpu", 3) == 0 && count < CPU_MAX_CORES) {
+    c += 3;
+    if (*c >= '0' && *c <= '9') {
+      proc->ids[count] = (int)cpu_parse_u64(&c, end);
+      uint64_t fields[8] = { 0 };
+      for (int i = 0; i < 8; i++) fields[i] = cpu_parse_u64(&c, end);
+      out->ticks[CPU_TICK_USER][count] = fields[0];
+      out->ticks[CPU_TICK_NICE][count] = fields[1];
+      out->ticks[CPU_TICK_SYSTEM][count] = fields[2] + fields[5] + fields[6] + fields[7];
+      out->ticks[CPU_TICK_IDLE][count] = fields[3] + fields[4];
+      count++;
+    }
+    const char* newline = memchr(c, '\n', (size_t)(end - c));
+    if (!newline) break;
+    c = newline + 1;
+  }
+
+  out->count = count;
+  return count > 0;
+}
+
+static inline bool cpu_read_file(const char* path, char* buffer, size_t size) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  ssize_t length = read(fd, buffer, size - 1);
+  close(fd);
+  if (length <= 0) return false;
+  buffer[length] = '\0';
+  return true;
+}
+
+// Hybrid Intel parts list their efficiency cores in cpu_atom; on ARM the
+// little cores report a lower cpu_capacity than the big ones.
+static inline void cpu_proc_clusters(void* context, uint8_t* kinds, int count) {
+  struct cpu_proc_source* proc = context;
+  for (int i = 0; i < count; i++) kinds[i] = CPU_CLUSTER_P;
+
+  char buffer[256];
+  if (cpu_read_file("/sys/devices/cpu_atom/cpus", buffer, sizeof(buffer))) {
+    const char* c = buffer;
+    while (*c >= '0' && *c <= '9') {
+      long first = strtol(c, (char**)&c, 10);
+      long last = first;
+      if (*c == '-') last = strtol(c + 1, (char**)&c, 10);
+      for (int i = 0; i < count; i++) {
+        if (proc->ids[i] >= first && proc->ids[i] <= last) kinds[i] = CPU_CLUSTER_E;
+      }
+      if (*c == ',') c++;
+    }
+    return;
+  }
+
+  long capacities[CPU_MAX_CORES];
+  long max_capacity = 0;
+  for (int i = 0; i < count; i++) {
+    char path[96];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpu_capacity", proc->ids[i]);
+    capacities[i] = cpu_read_file(path, buffer, sizeof(buffer)) ? atol(buffer) : 0;
+    if (capacities[i] > max_capacity) max_capacity = capacities[i];
+  }
+  for (int i = 0; i < count; i++) {
+    if (capacities[i] > 0 && capacities[i] < max_capacity) kinds[i] = CPU_CLUSTER_E;
+  }
+}
+
+static inline struct cpu_source cpu_proc_source(const char* path) {
+  if (g_cpu_proc.path && g_cpu_proc.fd >= 0) close(g_cpu_proc.fd);
+  g_cpu_proc.path = path;
+  g_cpu_proc.fd = -1;
+  return (struct cpu_source){ "proc", cpu_proc_read, cpu_proc_clusters, &g_cpu_proc };
+}
+
+static inline void cpu_init_with(struct cpu* cpu, struct cpu_source source) {
+  cpu->source = source;
+  cpu->current = 0;
   cpu->has_prev_load = false;
+  cpu->core_count = 0;
   cpu->user_load = 0;
   cpu->sys_load = 0;
   cpu->total_load = 0;
+  cpu->max_core_load = 0;
+  cpu->p_count = 0;
+  cpu->e_count = 0;
+  cpu->p_load = -1;
+  cpu->e_load = -1;
+  memset(cpu->core_load, 0, sizeof(cpu->core_load));
 }
 
-static inline void cpu_update(struct cpu* cpu) {
-  kern_return_t error = host_statistics(cpu->host,
-                                        HOST_CPU_LOAD_INFO,
-                                        (host_info_t)&cpu->load,
-                                        &cpu->count                );
+static inline void cpu_init(struct cpu* cpu) {
+#ifdef __APPLE__
+  cpu_init_with(cpu, cpu_mach_source());
+#else
+  cpu_init_with(cpu, cpu_proc_source("/proc/stat"));
+#endif
+}
 
-  if (error != KERN_SUCCESS) {
-    printf("Error: Could not read cpu host statistics.\n");
-    return;
-  }
+static inline int cpu_percent(uint64_t part, uint64_t total) {
+  return total ? (int)((double)part / (double)total * 100.0) : 0;
+}
+
+// Every core's deltas, its load and the aggregate and cluster sums in one
+// pass over the state-major arrays. A core's tick delta over one interval
+// always fits 32 bits, which keeps the per-core math in 32-bit lanes.
+static inline void cpu_compute(struct cpu* cpu,
+                               const struct cpu_ticks* restrict now,
+                               const struct cpu_ticks* restrict prev) {
+  const int count = now->count;
+  const uint8_t* restrict cluster = cpu->core_cluster;
+  uint8_t* restrict core_load = cpu->core_load;
 
-  if (cpu->has_prev_load) {
-    uint32_t delta_user = cpu->load.cpu_ticks[CPU_STATE_USER]
-                          - cpu->prev_load.cpu_ticks[CPU_STATE_USER];
+  uint64_t user = 0, sys = 0, all = 0;
+  uint64_t e_busy = 0, e_all = 0;
+  int max_load = 0;
+  for (int i = 0; i < count; i++) {
+    uint32_t core_user = (uint32_t)(now->ticks[CPU_TICK_USER][i] - prev->ticks[CPU_TICK_USER][i])
+                         + (uint32_t)(now->ticks[CPU_TICK_NICE][i] - prev->ticks[CPU_TICK_NICE][i]);
+    uint32_t core_sys = (uint32_t)(now->ticks[CPU_TICK_SYSTEM][i] - prev->ticks[CPU_TICK_SYSTEM][i]);
+    uint32_t core_idle = (uint32_t)(now->ticks[CPU_TICK_IDLE][i] - prev->ticks[CPU_TICK_IDLE][i]);
+    uint32_t core_busy = core_user + core_sys;
+    uint32_t core_all = core_busy + core_idle;
 
-    uint32_t delta_system = cpu->load.cpu_ticks[CPU_STATE_SYSTEM]
-                            - cpu->prev_load.cpu_ticks[CPU_STATE_SYSTEM];
+    float busy = (float)(int32_t)core_busy;
+    float total = (float)(int32_t)(core_all ? core_all : 1);
+    int load = (int)(busy * 100.0f / total);
+    core_load[i] = (uint8_t)load;
+    max_load = load > max_load ? load : max_load;
+
+    uint32_t is_e = cluster[i] == CPU_CLUSTER_E ? 0xffffffffu : 0u;
+    user += core_user;
+    sys += core_sys;
+    all += core_all;
+    e_busy += core_busy & is_e;
+    e_all += core_all & is_e;
+  }
 
-    uint32_t delta_idle = cpu->load.cpu_ticks[CPU_STATE_IDLE]
-                          - cpu->prev_load.cpu_ticks[CPU_STATE_IDLE];
+  cpu->user_load = cpu_percent(user, all);
+  cpu->sys_load = cpu_percent(sys, all);
+  cpu->total_load = cpu->user_load + cpu->sys_load;
+  cpu->max_core_load = max_load;
+  cpu->e_load = cpu->e_count ? cpu_percent(e_busy, e_all) : -1;
+  cpu->p_load = cpu->p_count ? cpu_percent(user + sys - e_busy, all - e_all) : -1;
+}
 
-    cpu->user_load = (double)delta_user / (double)(delta_system
-                                                     + delta_user
-                                                     + delta_idle) * 100.0;
+// Drops the baseline; the next update only takes a snapshot and loads keep
+// their previous values until the one after.
+static inline void cpu_reset(struct cpu* cpu) {
+  cpu->has_prev_load = false;
+}
 
-    cpu->sys_load = (double)delta_system / (double)(delta_system
-                                                      + delta_user
-                                                      + delta_idle) * 100.0;
+static inline void cpu_update(struct cpu* cpu) {
+  struct cpu_ticks* now = &cpu->snapshots[cpu->current];
+  struct cpu_ticks* prev = &cpu->snapshots[cpu->current ^ 1];
+  if (!cpu->source.read(cpu->source.context, now)) return;
 
-    cpu->total_load = cpu->user_load + cpu->sys_load;
+  // Cores came or went: re-read the topology and start over from here.
+  if (now->count != cpu->core_count) {
+    cpu->core_count = now->count;
+    for (int i = 0; i < now->count; i++) cpu->core_cluster[i] = CPU_CLUSTER_P;
+    if (cpu->source.clusters) {
+      cpu->source.clusters(cpu->source.context, cpu->core_cluster, now->count);
+    }
+    cpu->e_count = 0;
+    for (int i = 0; i < now->count; i++) cpu->e_count += cpu->core_cluster[i] == CPU_CLUSTER_E;
+    cpu->p_count = now->count - cpu->e_count;
+    cpu->has_prev_load = false;
   }
 
-  cpu->prev_load = cpu->load;
+  if (cpu->has_prev_load) cpu_compute(cpu, now, prev);
+
+  cpu->current ^= 1;
   cpu->has_prev_load = true;
 }
@@ -0,0 +1,341 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../counters.h"
+
+#ifdef __APPLE__
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOKitLib.h>
+#include <IOKit/storage/IOBlockStorageDriver.h>
+#endif
+
+// Disk throughput and operations per second.
+//
+// A source fills a snapshot with the byte and operation counters of every
+// physical disk in one read; disk_update() then computes each disk's rates
+// against the previous snapshot in one pass. Sources:
+// - iokit: the IOBlockStorageDriver services are matched once and kept (with
+//   the BSD name of their media); each read fetches only their Statistics
+//   property. A failed fetch (a disk went away) matches again.
+// - proc: /proc/diskstats, kept open and re-read with pread(). Partitions and
+//   virtual devices (loop, ram, zram, device mapper, md) are skipped, since
+//   their I/O is already counted on the disks below them.
+// The snapshot and delta bookkeeping is helpers/counters.h's.
+// Custom sources (recorded or synthetic counters) plug in through
+// disk_init_with.
+
+#define DISK_MAX_DEVICES 32
+#define DISK_NAME_SIZE 32
+
+struct disk_counters {
+  char name[DISK_NAME_SIZE];
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t reads;
+  uint64_t writes;
+};
+
+struct disk_snapshot {
+  int count;
+  struct disk_counters entries[DISK_MAX_DEVICES];
+};
+
+struct disk_source {
+  const char* name;
+  // Fills out with the current counters; false when they cannot be read.
+  bool (*read)(void* context, struct disk_snapshot* out);
+  void* context;
+};
+
+struct disk_rate {
+  char name[DISK_NAME_SIZE];
+  // Bytes and operations per second.
+  double read_bps;
+  double write_bps;
+  double read_iops;
+  double write_iops;
+};
+
+struct disk {
+  struct disk_source source;
+
+  struct disk_snapshot snapshots[2];
+  int current;
+  struct counters_baseline baseline;
+
+  int count;
+  struct disk_rate rates[DISK_MAX_DEVICES];
+  // Totals over every disk, -1 when the counters cannot be read.
+  double read_bps;
+  double write_bps;
+  double read_iops;
+  double write_iops;
+};
+
+#ifdef __APPLE__
+struct disk_iokit_source {
+  io_service_t services[DISK_MAX_DEVICES];
+  char names[DISK_MAX_DEVICES][DISK_NAME_SIZE];
+  int count;
+  bool matched;
+  uint64_t matches;
+};
+
+static struct disk_iokit_source g_disk_iokit = { 0 };
+
+static inline void disk_iokit_release(struct disk_iokit_source* iokit) {
+  for (int i = 0; i < iokit->count; i++) IOObjectRelease(iokit->services[i]);
+  iokit->count = 0;
+  iokit->matched = false;
+}
+
+// The BSD name ("disk0") is on the IOMedia below the driver.
+static inline void disk_iokit_name(io_service_t service, char* buffer, size_t size, int index) {
+  CFTypeRef name = IORegistryEntrySearchCFProperty(service,
+                                                   kIOServicePlane,
+                                                   CFSTR("BSD Name"),
+                                                   kCFAllocatorDefault,
+                                                   kIORegistryIterateRecursively);
+  bool ok = name && CFGetTypeID(name) == CFStringGetTypeID()
+            && CFStringGetCString(name, buffer, (CFIndex)size, kCFStringEncodingUTF8);
+  if (name) CFRelease(name);
+  if (!ok) snprintf(buffer, size, "disk%d", index);
+}
+
+static inline bool disk_iokit_match(struct disk_iokit_source* iokit) {
+  io_iterator_t iterator;
+  if (IOServiceGetMatchingServices(kIOMainPortDefault,
+                                   IOServiceMatching(kIOBlockStorageDriverClass),
+                                   &iterator) != KERN_SUCCESS) {
+    return false;
+  }
+
+  io_object_t service;
+  while ((service = IOIteratorNext(iterator))) {
+    if (iokit->count < DISK_MAX_DEVICES) {
+      disk_iokit_name(service, iokit->names[iokit->count], DISK_NAME_SIZE, iokit->count);
+      iokit->services[iokit->count++] = service;
+    } else {
+      IOObjectRelease(service);
+    }
+  }
+  IOObjectRelease(iterator);
+  iokit->matches++;
+  iokit->matched = true;
+  return true;
+}
+
+static inline uint64_t disk_iokit_stat(CFDictionaryRef stats, CFStringRef key) {
+  CFNumberRef number = (CFNumberRef)CFDictionaryGetValue(stats, key);
+  int64_t value = 0;
+  if (!number || CFGetTypeID(number) != CFNumberGetTypeID()) return 0;
+  if (!CFNumberGetValue(number, kCFNumberSInt64Type, &value) || value < 0) return 0;
+  return (uint64_t)value;
+}
+
+static inline bool disk_iokit_read(void* context, struct disk_snapshot* out) {
+  struct disk_iokit_source* iokit = context;
+  // A second pass only after the disks changed under the first one.
+  for (int attempt = 0; attempt < 2; attempt++) {
+    if (!iokit->matched && !disk_iokit_match(iokit)) return false;
+
+    int count = 0;
+    bool gone = false;
+    for (int i = 0; i < iokit->count; i++) {
+      CFTypeRef stats = IORegistryEntryCreateCFProperty(iokit->services[i],
+                                                        CFSTR(kIOBlockStorageDriverStatisticsKey),
+                                                        kCFAllocatorDefault,
+                                                        0);
+      if (!stats) {
+        gone = true;
+        break;
+      }
+      if (CFGetTypeID(stats) == CFDictionaryGetTypeID()) {
+        struct disk_counters* entry = &out->entries[count++];
+        memcpy(entry->name, iokit->names[i], DISK_NAME_SIZE);
+        entry->bytes_read
+          = disk_iokit_stat(stats, CFSTR(kIOBlockStorageDriverStatisticsBytesReadKey));
+        entry->bytes_written
+          = disk_iokit_stat(stats, CFSTR(kIOBlockStorageDriverStatisticsBytesWrittenKey));
+        entry->reads = disk_iokit_stat(stats, CFSTR(kIOBlockStorageDriverStatisticsReadsKey));
+        entry->writes = disk_iokit_stat(stats, CFSTR(kIOBlockStorageDriverStatisticsWritesKey));
+      }
+      CFRelease(stats);
+    }
+
+    if (!gone) {
+      out->count = count;
+      return true;
+    }
+    disk_iokit_release(iokit);
+  }
+  return false;
+}
+
+static inline struct disk_source disk_iokit_source(void) {
+  return (struct disk_source){ "iokit", disk_iokit_read, &g_disk_iokit };
+}
+#endif
+
+struct disk_proc_source {
+  const char* path;
+  int fd;
+  char buffer[16384];
+};
+
+static struct disk_proc_source g_disk_proc = { 0 };
+
+static inline bool disk_proc_virtual(const char* name, size_t length) {
+  static const char* const prefixes[] = { "loop", "ram", "zram", "dm-", "md" };
+  for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+    size_t prefix_length = strlen(prefixes[i]);
+    if (length >= prefix_length && memcmp(name, prefixes[i], prefix_length) == 0) return true;
+  }
+  return false;
+}
+
+// Partitions follow their disk and are named like the kernel names them: the
+// disk name plus the number, with a 'p' in between when the disk name ends in
+// a digit ("sda1", "nvme0n1p1", "mmcblk0p1").
+static inline bool disk_proc_partition(const char* name, size_t length, const char* disk) {
+  size_t disk_length = strlen(disk);
+  if (!disk_length || length <= disk_length || memcmp(name, disk, disk_length) != 0) return false;
+  const char* rest = name + disk_length;
+  if (disk[disk_length - 1] >= '0' && disk[disk_length - 1] <= '9') {
+    if (*rest != 'p' || length == disk_length + 1) return false;
+    rest++;
+  }
+  return *rest >= '0' && *rest <= '9';
+}
+
+// "<major> <minor> <name> reads merged sectors_read ms writes merged
+// sectors_written ..." per device; sectors are always 512 bytes.
+static inline bool disk_proc_read(void* context, struct disk_snapshot* out) {
+  struct disk_proc_source* proc = context;
+  ssize_t length = counters_proc_read(&proc->fd, proc->path, proc->buffer, sizeof(proc->buffer));
+  if (length < 0) return false;
+
+  const char* c = proc->buffer;
+  const char* end = proc->buffer + length;
+  const char* disk = "";
+  int count = 0;
+  while (c < end && count < DISK_MAX_DEVICES) {
+    const char* line_end = memchr(c, '\n', (size_t)(end - c));
+
+    counters_parse_u64(&c, line_end);
+    counters_parse_u64(&c, line_end);
+    while (c < line_end && *c == ' ') c++;
+    const char* name = c;
+    while (c < line_end && *c != ' ') c++;
+    size_t name_length = (size_t)(c - name);
+
+    if (name_length > 0 && name_length < DISK_NAME_SIZE && !disk_proc_virtual(name, name_length)
+        && !disk_proc_partition(name, name_length, disk)) {
+      struct disk_counters* entry = &out->entries[count++];
+      memcpy(entry->name, name, name_length);
+      entry->name[name_length] = '\0';
+      disk = entry->name;
+
+      entry->reads = counters_parse_u64(&c, line_end);
+      counters_parse_u64(&c, line_end);
+      entry->bytes_read = counters_parse_u64(&c, line_end) * 512;
+      counters_parse_u64(&c, line_end);
+      entry->writes = counters_parse_u64(&c, line_end);
+      counters_parse_u64(&c, line_end);
+      entry->bytes_written = counters_parse_u64(&c, line_end) * 512;
+    }
+    c = line_end + 1;
+  }
+
+  out->count = count;
+  return true;
+}
+
+static inline struct disk_source disk_proc_source(const char* path) {
+  if (g_disk_proc.path && g_disk_proc.fd >= 0) close(g_disk_proc.fd);
+  g_disk_proc.path = path;
+  g_disk_proc.fd = -1;
+  return (struct disk_source){ "proc", disk_proc_read, &g_disk_proc };
+}
+
+static inline void disk_init_with(struct disk* disk, struct disk_source source) {
+  disk->source = source;
+  disk->current = 0;
+  disk->baseline = (struct counters_baseline){ 0 };
+  disk->count = 0;
+  disk->read_bps = -1.0;
+  disk->write_bps = -1.0;
+  disk->read_iops = -1.0;
+  disk->write_iops = -1.0;
+}
+
+static inline void disk_init(struct disk* disk) {
+#ifdef __APPLE__
+  disk_init_with(disk, disk_iokit_source());
+#else
+  disk_init_with(disk, disk_proc_source("/proc/diskstats"));
+#endif
+}
+
+// Drops the baseline, so the next update only takes one.
+static inline void disk_reset(struct disk* disk) {
+  counters_reset(&disk->baseline);
+  disk->count = 0;
+}
+
+// Reads every disk once and computes the rates since the previous update.
+// The first update, and one after more than 100s, only takes the baseline
+// and reports zero.
+static inline bool disk_update(struct disk* disk, uint64_t now_ns) {
+  int next = disk->current ^ 1;
+  struct disk_snapshot* now = &disk->snapshots[next];
+  if (!disk->source.read(disk->source.context, now)) {
+    counters_reset(&disk->baseline);
+    disk->count = 0;
+    disk->read_bps = -1.0;
+    disk->write_bps = -1.0;
+    disk->read_iops = -1.0;
+    disk->write_iops = -1.0;
+    return false;
+  }
+  const struct disk_snapshot* prev = &disk->snapshots[disk->current];
+  disk->current = next;
+
+  double seconds = counters_interval(&disk->baseline, now_ns);
+
+  double read_bps = 0.0, write_bps = 0.0, read_iops = 0.0, write_iops = 0.0;
+  for (int i = 0; i < now->count; i++) {
+    const struct disk_counters* entry = &now->entries[i];
+    const struct disk_counters* before
+      = seconds > 0.0 ? counters_find(prev->entries, prev->count, sizeof(*entry), i, entry->name)
+                      : NULL;
+
+    struct disk_rate* rate = &disk->rates[i];
+    memcpy(rate->name, entry->name, DISK_NAME_SIZE);
+    if (before) {
+      rate->read_bps = counters_rate(entry->bytes_read, before->bytes_read, seconds);
+      rate->write_bps = counters_rate(entry->bytes_written, before->bytes_written, seconds);
+      rate->read_iops = counters_rate(entry->reads, before->reads, seconds);
+      rate->write_iops = counters_rate(entry->writes, before->writes, seconds);
+    } else {
+      rate->read_bps = rate->write_bps = rate->read_iops = rate->write_iops = 0.0;
+    }
+    read_bps += rate->read_bps;
+    write_bps += rate->write_bps;
+    read_iops += rate->read_iops;
+    write_iops += rate->write_iops;
+  }
+
+  disk->count = now->count;
+  disk->read_bps = read_bps;
+  disk->write_bps = write_bps;
+  disk->read_iops = read_iops;
+  disk->write_iops = write_iops;
+  return true;
+}
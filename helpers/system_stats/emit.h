@@ -0,0 +1,76 @@
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Change gate for the values the Lua item actually renders.
+//
+// A field only counts as changed once it moved at least `threshold` away from
+// the value that was last emitted (not the last sample), so a reading that
+// hovers around a boundary does not flap. Crossing into or out of "unavailable"
+// (a negative reading) always counts. When nothing changed, the sample is
+// suppressed unless `heartbeat_ns` passed since the last emission.
+
+struct emit_field {
+  double threshold;
+  double last;
+  bool has_last;
+};
+
+struct emit_gate {
+  uint64_t heartbeat_ns;
+  uint64_t last_emit_ns;
+  bool has_emitted;
+
+  uint64_t emitted;
+  uint64_t suppressed;
+};
+
+static inline void emit_field_init(struct emit_field* field, double threshold) {
+  field->threshold = threshold;
+  field->last = 0.0;
+  field->has_last = false;
+}
+
+static inline bool emit_field_changed(const struct emit_field* field, double value) {
+  if (!field->has_last) return true;
+  if ((value < 0.0) != (field->last < 0.0)) return true;
+  if (value < 0.0) return false;
+  if (field->threshold <= 0.0) return value != field->last;
+  return fabs(value - field->last) >= field->threshold;
+}
+
+static inline void emit_field_commit(struct emit_field* field, double value) {
+  field->last = value;
+  field->has_last = true;
+}
+
+static inline void emit_gate_init(struct emit_gate* gate, double heartbeat_seconds) {
+  gate->heartbeat_ns = heartbeat_seconds > 0.0 ? (uint64_t)(heartbeat_seconds * 1e9) : 0;
+  gate->last_emit_ns = 0;
+  gate->has_emitted = false;
+  gate->emitted = 0;
+  gate->suppressed = 0;
+}
+
+// The next sample goes out regardless of the fields, e.g. after a pause.
+static inline void emit_gate_reset(struct emit_gate* gate) {
+  gate->has_emitted = false;
+}
+
+// Decides whether a sample goes out. `changed` is true when at least one
+// field passed emit_field_changed(); the caller commits the fields it emitted.
+static inline bool emit_gate_should_emit(struct emit_gate* gate, bool changed, uint64_t now_ns) {
+  bool heartbeat_due = gate->heartbeat_ns
+                       && now_ns - gate->last_emit_ns >= gate->heartbeat_ns;
+  if (!gate->has_emitted || changed || heartbeat_due) {
+    gate->has_emitted = true;
+    gate->last_emit_ns = now_ns;
+    gate->emitted++;
+    return true;
+  }
+
+  gate->suppressed++;
+  return false;
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __APPLE__
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOKitLib.h>
+#endif
+
+// GPU utilization and memory.
+//
+// A source fills one reading per update; gpu_update() derives the graph value
+// from it. Sources:
+// - iokit: the IOAccelerator PerformanceStatistics. The matched accelerator
+//   services are kept across reads and each read fetches only the
+//   PerformanceStatistics property of each one, instead of matching again and
+//   copying every property. A failed fetch (the service went away) drops the
+//   cache, so the next read matches again. A match that fails or finds no
+//   accelerator is not repeated for GPU_REMATCH_BACKOFF_NS.
+// - none: off macOS; every value reads as unavailable.
+// Custom sources (recorded or synthetic readings) plug in through
+// gpu_init_with. Every update is timed; read_calls/read_ns_total/read_ns_max
+// show what a read costs.
+
+#define GPU_MAX_ACCELERATORS 4
+#define GPU_REMATCH_BACKOFF_NS 60000000000ull
+
+// Percentages and bytes, -1 when unavailable.
+struct gpu_reading {
+  int device_util;
+  int renderer_util;
+  int tiler_util;
+  int64_t mem_used_bytes;
+};
+
+struct gpu_source {
+  const char* name;
+  // Fills out with the current reading; false when it cannot be read.
+  bool (*read)(void* context, struct gpu_reading* out);
+  void* context;
+};
+
+struct gpu {
+  struct gpu_source source;
+
+  // Percentages, -1 when unavailable. util is what the graph shows: device
+  // utilization, or renderer utilization where there is none.
+  int util;
+  int device_util;
+  int renderer_util;
+  int tiler_util;
+  // Memory the GPU has in use, -1 when unavailable.
+  int64_t mem_used_bytes;
+
+  uint64_t read_calls;
+  uint64_t read_ns_total;
+  uint64_t read_ns_max;
+};
+
+static inline uint64_t gpu_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#ifdef __APPLE__
+struct gpu_iokit_source {
+  io_service_t services[GPU_MAX_ACCELERATORS];
+  int service_count;
+  bool matched;
+  uint64_t matches;
+  // No match before this, after one that came back empty.
+  uint64_t rematch_at_ns;
+};
+
+static struct gpu_iokit_source g_gpu_iokit = { 0 };
+
+static inline void gpu_iokit_release(struct gpu_iokit_source* iokit) {
+  for (int i = 0; i < iokit->service_count; i++) IOObjectRelease(iokit->services[i]);
+  iokit->service_count = 0;
+  iokit->matched = false;
+}
+
+static inline bool gpu_iokit_match(struct gpu_iokit_source* iokit) {
+  uint64_t now = gpu_now_ns();
+  if (now < iokit->rematch_at_ns) return false;
+  io_iterator_t iterator;
+  if (IOServiceGetMatchingServices(kIOMainPortDefault,
+                                   IOServiceMatching("IOAccelerator"),
+                                   &iterator) != KERN_SUCCESS) {
+    iokit->rematch_at_ns = now + GPU_REMATCH_BACKOFF_NS;
+    return false;
+  }
+
+  io_object_t service;
+  while ((service = IOIteratorNext(iterator))) {
+    if (iokit->service_count < GPU_MAX_ACCELERATORS) {
+      iokit->services[iokit->service_count++] = service;
+    } else {
+      IOObjectRelease(service);
+    }
+  }
+  IOObjectRelease(iterator);
+  iokit->matches++;
+  iokit->matched = iokit->service_count > 0;
+  if (!iokit->matched) iokit->rematch_at_ns = now + GPU_REMATCH_BACKOFF_NS;
+  return iokit->matched;
+}
+
+static inline bool gpu_stat(CFDictionaryRef stats, CFStringRef key, int64_t* value) {
+  CFNumberRef number = (CFNumberRef)CFDictionaryGetValue(stats, key);
+  if (!number || CFGetTypeID(number) != CFNumberGetTypeID()) return false;
+  return CFNumberGetValue(number, kCFNumberSInt64Type, value);
+}
+
+static inline int gpu_percent(int64_t value) {
+  if (value < 0) return 0;
+  if (value > 100) return 100;
+  return (int)value;
+}
+
+// With several accelerators, reports the busiest one.
+static inline bool gpu_iokit_read(void* context, struct gpu_reading* out) {
+  struct gpu_iokit_source* iokit = context;
+  if (!iokit->matched && !gpu_iokit_match(iokit)) return false;
+
+  for (int i = 0; i < iokit->service_count; i++) {
+    CFTypeRef stats = IORegistryEntryCreateCFProperty(iokit->services[i],
+                                                      CFSTR("PerformanceStatistics"),
+                                                      kCFAllocatorDefault,
+                                                      0);
+    if (!stats) {
+      gpu_iokit_release(iokit);
+      break;
+    }
+
+    if (CFGetTypeID(stats) == CFDictionaryGetTypeID()) {
+      int64_t value = 0;
+      if (gpu_stat(stats, CFSTR("Device Utilization %"), &value)
+          && gpu_percent(value) > out->device_util) {
+        out->device_util = gpu_percent(value);
+      }
+      if (gpu_stat(stats, CFSTR("Renderer Utilization %"), &value)
+          && gpu_percent(value) > out->renderer_util) {
+        out->renderer_util = gpu_percent(value);
+      }
+      if (gpu_stat(stats, CFSTR("Tiler Utilization %"), &value)
+          && gpu_percent(value) > out->tiler_util) {
+        out->tiler_util = gpu_percent(value);
+      }
+      // Unified memory on Apple silicon, VRAM on discrete GPUs.
+      if (gpu_stat(stats, CFSTR("In use system memory"), &value)
+          || gpu_stat(stats, CFSTR("vramUsedBytes"), &value)) {
+        if (value > out->mem_used_bytes) out->mem_used_bytes = value;
+      }
+    }
+    CFRelease(stats);
+  }
+  return true;
+}
+
+static inline struct gpu_source gpu_iokit_source(void) {
+  return (struct gpu_source){ "iokit", gpu_iokit_read, &g_gpu_iokit };
+}
+#else
+static inline bool gpu_none_read(void* context, struct gpu_reading* out) {
+  (void)context;
+  (void)out;
+  return false;
+}
+
+static inline struct gpu_source gpu_none_source(void) {
+  return (struct gpu_source){ "none", gpu_none_read, NULL };
+}
+#endif
+
+static inline void gpu_init_with(struct gpu* gpu, struct gpu_source source) {
+  gpu->source = source;
+  gpu->util = -1;
+  gpu->device_util = -1;
+  gpu->renderer_util = -1;
+  gpu->tiler_util = -1;
+  gpu->mem_used_bytes = -1;
+  gpu->read_calls = 0;
+  gpu->read_ns_total = 0;
+  gpu->read_ns_max = 0;
+}
+
+static inline void gpu_init(struct gpu* gpu) {
+#ifdef __APPLE__
+  gpu_init_with(gpu, gpu_iokit_source());
+#else
+  gpu_init_with(gpu, gpu_none_source());
+#endif
+}
+
+static inline void gpu_update(struct gpu* gpu) {
+  uint64_t start = gpu_now_ns();
+  struct gpu_reading reading = { -1, -1, -1, -1 };
+  if (!gpu->source.read(gpu->source.context, &reading)) {
+    reading = (struct gpu_reading){ -1, -1, -1, -1 };
+  }
+
+  gpu->device_util = reading.device_util;
+  gpu->renderer_util = reading.renderer_util;
+  gpu->tiler_util = reading.tiler_util;
+  gpu->mem_used_bytes = reading.mem_used_bytes;
+  gpu->util = gpu->device_util >= 0 ? gpu->device_util : gpu->renderer_util;
+
+  uint64_t elapsed = gpu_now_ns() - start;
+  gpu->read_calls++;
+  gpu->read_ns_total += elapsed;
+  if (elapsed > gpu->read_ns_max) gpu->read_ns_max = elapsed;
+}
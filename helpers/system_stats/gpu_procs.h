@@ -0,0 +1,456 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#ifdef __APPLE__
+#include <libproc.h>
+#include <mach/mach.h>
+#include <mach/task_info.h>
+#endif
+
+// Per-process GPU and energy rates.
+//
+// The tracker keeps a pid-keyed open addressing table across samples. Each
+// entry holds the process name and source handle (looked up once, when the
+// pid first shows up) and the previous GPU time, CPU time and wakeup
+// counters, all from one power info read, so one update costs a listing, a
+// hash lookup and a counter read per process. Pids that vanish
+// from the listing are detached and removed; pids the source cannot attach to
+// are remembered so they are not retried every sample (a pid that exits and
+// is reused within one interval keeps its first owner's entry until it shows
+// up again as gone or unreadable). The top N processes by
+// GPU time, or by energy, used since the previous sample are picked with a
+// bounded heap.
+//
+// Energy is an estimate in the spirit of Activity Monitor's energy impact:
+// CPU time plus GPU time plus a fixed cost per wakeup (the default
+// coefficients weigh one wakeup like 200 us of CPU time), so a process that
+// wakes the CPU often ranks above one that uses the same time in one go.
+
+#define GPU_PROC_NAME_SIZE 64
+#define GPU_PROC_TOP_MAX 32
+#define GPU_PROC_WAKEUP_NS 200000ull
+
+enum {
+  GPU_PROC_RANK_GPU,
+  GPU_PROC_RANK_ENERGY
+};
+
+// Cumulative counters from one read.
+struct gpu_proc_counters {
+  uint64_t gpu_ns;
+  uint64_t cpu_ns;
+  uint64_t wakeups;
+};
+
+struct gpu_proc_source {
+  const char* name;
+  // Writes up to capacity pids and returns how many there are, which may be
+  // more than capacity; negative on failure.
+  int (*list)(void* context, pid_t* pids, int capacity);
+  // Opens pid for reading and looks up its name; false when it cannot be
+  // inspected.
+  bool (*attach)(void* context, pid_t pid, uint64_t* handle, char* name, size_t name_size);
+  // Reads the cumulative counters; false once the process is gone.
+  bool (*read)(void* context, uint64_t handle, struct gpu_proc_counters* out);
+  void (*detach)(void* context, uint64_t handle);
+  void* context;
+};
+
+struct gpu_proc_entry {
+  pid_t pid;  // 0 marks an empty slot
+  bool attached;
+  bool has_prev;
+  uint32_t seen;
+  uint64_t handle;
+  struct gpu_proc_counters counters;
+  // GPU time and energy (see above) since the previous sample.
+  uint64_t delta_ns;
+  uint64_t energy_ns;
+  char name[GPU_PROC_NAME_SIZE];
+};
+
+struct gpu_proc_top {
+  pid_t pid;
+  uint64_t delta_ns;
+  const char* name;
+};
+
+struct gpu_procs {
+  struct gpu_proc_source source;
+  struct gpu_proc_entry* entries;
+  uint32_t capacity;  // power of two
+  uint32_t count;
+  uint32_t epoch;
+
+  pid_t* pids;
+  int pid_capacity;
+
+  uint64_t last_ns;
+  uint64_t interval_ns;
+
+  // Lookups the table saved: attach calls vs. pids listed.
+  uint64_t attaches;
+  uint64_t listed;
+};
+
+static inline uint32_t gpu_procs_slot(const struct gpu_procs* procs, pid_t pid) {
+  return ((uint32_t)pid * 2654435761u) & (procs->capacity - 1);
+}
+
+static inline bool gpu_procs_init(struct gpu_procs* procs, struct gpu_proc_source source) {
+  memset(procs, 0, sizeof(struct gpu_procs));
+  procs->source = source;
+  procs->capacity = 1024;
+  procs->entries = calloc(procs->capacity, sizeof(struct gpu_proc_entry));
+  procs->pid_capacity = 1024;
+  procs->pids = malloc(sizeof(pid_t) * procs->pid_capacity);
+  return procs->entries && procs->pids;
+}
+
+static inline struct gpu_proc_entry* gpu_procs_find(struct gpu_procs* procs, pid_t pid) {
+  uint32_t mask = procs->capacity - 1;
+  for (uint32_t i = gpu_procs_slot(procs, pid);; i = (i + 1) & mask) {
+    struct gpu_proc_entry* entry = &procs->entries[i];
+    if (entry->pid == pid || entry->pid == 0) return entry;
+  }
+}
+
+static inline bool gpu_procs_grow(struct gpu_procs* procs) {
+  struct gpu_proc_entry* old = procs->entries;
+  uint32_t old_capacity = procs->capacity;
+  struct gpu_proc_entry* entries = calloc(old_capacity * 2, sizeof(struct gpu_proc_entry));
+  if (!entries) return false;
+
+  procs->entries = entries;
+  procs->capacity = old_capacity * 2;
+  for (uint32_t i = 0; i < old_capacity; i++) {
+    if (old[i].pid == 0) continue;
+    *gpu_procs_find(procs, old[i].pid) = old[i];
+  }
+  free(old);
+  return true;
+}
+
+// Backward-shift deletion keeps probe chains intact without tombstones.
+static inline void gpu_procs_remove(struct gpu_procs* procs, uint32_t hole) {
+  uint32_t mask = procs->capacity - 1;
+  struct gpu_proc_entry* entries = procs->entries;
+  if (entries[hole].attached) {
+    procs->source.detach(procs->source.context, entries[hole].handle);
+  }
+
+  for (uint32_t i = (hole + 1) & mask; entries[i].pid != 0; i = (i + 1) & mask) {
+    uint32_t home = gpu_procs_slot(procs, entries[i].pid);
+    // Move i into the hole unless its home lies cyclically in (hole, i].
+    bool stays = hole <= i ? (home > hole && home <= i) : (home > hole || home <= i);
+    if (stays) continue;
+    entries[hole] = entries[i];
+    hole = i;
+  }
+  memset(&entries[hole], 0, sizeof(struct gpu_proc_entry));
+  procs->count--;
+}
+
+static inline bool gpu_procs_attach(struct gpu_procs* procs, struct gpu_proc_entry* entry) {
+  procs->attaches++;
+  entry->has_prev = false;
+  entry->delta_ns = 0;
+  entry->energy_ns = 0;
+  entry->attached = procs->source.attach(procs->source.context,
+                                         entry->pid,
+                                         &entry->handle,
+                                         entry->name,
+                                         sizeof(entry->name));
+  return entry->attached;
+}
+
+static inline uint64_t gpu_proc_delta(uint64_t now, uint64_t prev) {
+  return now >= prev ? now - prev : 0;
+}
+
+static inline void gpu_procs_sample(struct gpu_procs* procs, struct gpu_proc_entry* entry) {
+  struct gpu_proc_counters counters = { 0 };
+  if (!procs->source.read(procs->source.context, entry->handle, &counters)) {
+    // The handle outlived its process; the pid may already belong to a new
+    // one, so attach again right away.
+    procs->source.detach(procs->source.context, entry->handle);
+    if (!gpu_procs_attach(procs, entry)) return;
+    if (!procs->source.read(procs->source.context, entry->handle, &counters)) return;
+  }
+
+  if (entry->has_prev) {
+    const struct gpu_proc_counters* prev = &entry->counters;
+    entry->delta_ns = gpu_proc_delta(counters.gpu_ns, prev->gpu_ns);
+    entry->energy_ns = entry->delta_ns + gpu_proc_delta(counters.cpu_ns, prev->cpu_ns)
+                       + gpu_proc_delta(counters.wakeups, prev->wakeups) * GPU_PROC_WAKEUP_NS;
+  }
+  entry->counters = counters;
+  entry->has_prev = true;
+}
+
+// Drops every counter baseline (the attached handles stay); the next update
+// reports no GPU time or energy.
+static inline void gpu_procs_reset(struct gpu_procs* procs) {
+  for (uint32_t i = 0; i < procs->capacity; i++) {
+    procs->entries[i].has_prev = false;
+    procs->entries[i].delta_ns = 0;
+    procs->entries[i].energy_ns = 0;
+  }
+  procs->last_ns = 0;
+}
+
+static inline bool gpu_procs_update(struct gpu_procs* procs, uint64_t now_ns) {
+  int count = procs->source.list(procs->source.context, procs->pids, procs->pid_capacity);
+  while (count > procs->pid_capacity) {
+    int capacity = count + count / 4;
+    pid_t* pids = realloc(procs->pids, sizeof(pid_t) * capacity);
+    if (!pids) return false;
+    procs->pids = pids;
+    procs->pid_capacity = capacity;
+    count = procs->source.list(procs->source.context, procs->pids, procs->pid_capacity);
+  }
+  if (count < 0) return false;
+
+  procs->epoch++;
+  procs->listed += (uint64_t)count;
+  procs->interval_ns = procs->last_ns ? now_ns - procs->last_ns : 0;
+  procs->last_ns = now_ns;
+
+  for (int i = 0; i < count; i++) {
+    pid_t pid = procs->pids[i];
+    if (pid <= 0) continue;
+
+    struct gpu_proc_entry* entry = gpu_procs_find(procs, pid);
+    if (entry->pid == 0) {
+      if ((procs->count + 1) * 2 > procs->capacity) {
+        if (!gpu_procs_grow(procs)) continue;
+        entry = gpu_procs_find(procs, pid);
+      }
+      entry->pid = pid;
+      procs->count++;
+      gpu_procs_attach(procs, entry);
+    }
+    entry->seen = procs->epoch;
+    if (entry->attached) gpu_procs_sample(procs, entry);
+  }
+
+  for (uint32_t i = 0; i < procs->capacity; i++) {
+    while (procs->entries[i].pid != 0 && procs->entries[i].seen != procs->epoch) {
+      gpu_procs_remove(procs, i);
+    }
+  }
+  return true;
+}
+
+static inline bool gpu_proc_top_before(const struct gpu_proc_top* a, const struct gpu_proc_top* b) {
+  if (a->delta_ns != b->delta_ns) return a->delta_ns > b->delta_ns;
+  return a->pid < b->pid;
+}
+
+static inline void gpu_proc_sift_down(struct gpu_proc_top* heap, int count, int i) {
+  for (;;) {
+    int worst = i;
+    int left = 2 * i + 1;
+    int right = left + 1;
+    // The root holds the entry that ranks last.
+    if (left < count && gpu_proc_top_before(&heap[worst], &heap[left])) worst = left;
+    if (right < count && gpu_proc_top_before(&heap[worst], &heap[right])) worst = right;
+    if (worst == i) return;
+    struct gpu_proc_top tmp = heap[i];
+    heap[i] = heap[worst];
+    heap[worst] = tmp;
+    i = worst;
+  }
+}
+
+// Fills top with up to n processes that used the GPU (GPU_PROC_RANK_GPU) or
+// energy (GPU_PROC_RANK_ENERGY) during the last interval, busiest first, with
+// that amount in delta_ns; returns how many.
+static inline int gpu_procs_rank(const struct gpu_procs* procs,
+                                 int rank,
+                                 struct gpu_proc_top* top,
+                                 int n) {
+  if (n > GPU_PROC_TOP_MAX) n = GPU_PROC_TOP_MAX;
+  int count = 0;
+  for (uint32_t i = 0; i < procs->capacity && n > 0; i++) {
+    const struct gpu_proc_entry* entry = &procs->entries[i];
+    uint64_t value = rank == GPU_PROC_RANK_ENERGY ? entry->energy_ns : entry->delta_ns;
+    if (entry->pid == 0 || value == 0) continue;
+
+    struct gpu_proc_top candidate = { entry->pid, value, entry->name };
+    if (count < n) {
+      top[count++] = candidate;
+      for (int j = count / 2 - 1; j >= 0 && count == n; j--) gpu_proc_sift_down(top, count, j);
+    } else if (gpu_proc_top_before(&candidate, &top[0])) {
+      top[0] = candidate;
+      gpu_proc_sift_down(top, count, 0);
+    }
+  }
+
+  if (count < n) {
+    for (int j = count / 2 - 1; j >= 0; j--) gpu_proc_sift_down(top, count, j);
+  }
+  // Heap sort: repeatedly move the last-ranked root to the end.
+  for (int end = count - 1; end > 0; end--) {
+    struct gpu_proc_top tmp = top[0];
+    top[0] = top[end];
+    top[end] = tmp;
+    gpu_proc_sift_down(top, end, 0);
+  }
+  return count;
+}
+
+static inline int gpu_procs_top(const struct gpu_procs* procs, struct gpu_proc_top* top, int n) {
+  return gpu_procs_rank(procs, GPU_PROC_RANK_GPU, top, n);
+}
+
+// "name:percent;..." with the GPU time (or energy) each process used as a
+// share of the last interval; energy is 100 for one fully busy core.
+static inline void gpu_procs_format_rank(const struct gpu_procs* procs,
+                                         int rank,
+                                         char* buffer,
+                                         size_t size,
+                                         int n) {
+  struct gpu_proc_top top[GPU_PROC_TOP_MAX];
+  int count = gpu_procs_rank(procs, rank, top, n);
+
+  size_t offset = 0;
+  buffer[0] = '\0';
+  for (int i = 0; i < count && offset < size - 1; i++) {
+    double percent = procs->interval_ns
+                     ? (double)top[i].delta_ns / (double)procs->interval_ns * 100.0
+                     : 0.0;
+    int written = snprintf(buffer + offset, size - offset, "%s%s:%.1f",
+                           i > 0 ? ";" : "",
+                           top[i].name,
+                           percent);
+    if (written > 0) offset += written;
+  }
+}
+
+static inline void gpu_procs_format(const struct gpu_procs* procs, char* buffer, size_t size, int n) {
+  gpu_procs_format_rank(procs, GPU_PROC_RANK_GPU, buffer, size, n);
+}
+
+#ifdef __APPLE__
+struct gpu_proc_mach_source {
+  mach_timebase_info_data_t timebase;
+};
+
+static struct gpu_proc_mach_source g_gpu_proc_mach = { { 0, 0 } };
+
+static inline int gpu_proc_mach_list(void* context, pid_t* pids, int capacity) {
+  (void)context;
+  int count = proc_listallpids(NULL, 0);
+  if (count <= 0) return -1;
+  // Leave headroom for processes started between the two calls.
+  if (count + 16 > capacity) return count + 16;
+  return proc_listallpids(pids, sizeof(pid_t) * capacity);
+}
+
+static inline bool gpu_proc_mach_attach(void* context,
+                                        pid_t pid,
+                                        uint64_t* handle,
+                                        char* name,
+                                        size_t name_size) {
+  (void)context;
+  mach_port_t task;
+  if (task_for_pid(mach_task_self(), pid, &task) != KERN_SUCCESS) return false;
+
+  name[0] = '\0';
+  proc_name(pid, name, (uint32_t)name_size);
+  if (name[0] == '\0') {
+    mach_port_deallocate(mach_task_self(), task);
+    return false;
+  }
+  *handle = task;
+  return true;
+}
+
+// GPU time, CPU time and wakeups all come from the one TASK_POWER_INFO_V2
+// call. CPU time is in mach absolute time units (not ns on Apple silicon).
+static inline bool gpu_proc_mach_read(void* context,
+                                      uint64_t handle,
+                                      struct gpu_proc_counters* out) {
+  struct gpu_proc_mach_source* mach = context;
+  struct task_power_info_v2 power_info;
+  mach_msg_type_number_t count = TASK_POWER_INFO_V2_COUNT;
+  kern_return_t kr = task_info((mach_port_t)handle,
+                               TASK_POWER_INFO_V2,
+                               (task_info_t)&power_info,
+                               &count);
+  if (kr != KERN_SUCCESS) return false;
+  const struct task_power_info* cpu = &power_info.cpu_energy;
+  out->gpu_ns = power_info.gpu_energy.task_gpu_utilisation;
+  out->cpu_ns = (cpu->total_user + cpu->total_system) * mach->timebase.numer / mach->timebase.denom;
+  // Wakeups that brought the package out of idle are the expensive ones.
+  out->wakeups = cpu->task_platform_idle_wakeups;
+  return true;
+}
+
+static inline void gpu_proc_mach_detach(void* context, uint64_t handle) {
+  (void)context;
+  mach_port_deallocate(mach_task_self(), (mach_port_t)handle);
+}
+
+static inline struct gpu_proc_source gpu_proc_mach_source(void) {
+  if (!g_gpu_proc_mach.timebase.denom) mach_timebase_info(&g_gpu_proc_mach.timebase);
+  return (struct gpu_proc_source){ "mach",
+                                   gpu_proc_mach_list,
+                                   gpu_proc_mach_attach,
+                                   gpu_proc_mach_read,
+                                   gpu_proc_mach_detach,
+                                   &g_gpu_proc_mach };
+}
+#else
+// No per-process GPU time off macOS; the listing fails, so updates report
+// nothing.
+static inline int gpu_proc_none_list(void* context, pid_t* pids, int capacity) {
+  (void)context;
+  (void)pids;
+  (void)capacity;
+  return -1;
+}
+
+static inline bool gpu_proc_none_attach(void* context,
+                                        pid_t pid,
+                                        uint64_t* handle,
+                                        char* name,
+                                        size_t name_size) {
+  (void)context;
+  (void)pid;
+  (void)handle;
+  (void)name;
+  (void)name_size;
+  return false;
+}
+
+static inline bool gpu_proc_none_read(void* context,
+                                      uint64_t handle,
+                                      struct gpu_proc_counters* out) {
+  (void)context;
+  (void)handle;
+  (void)out;
+  return false;
+}
+
+static inline void gpu_proc_none_detach(void* context, uint64_t handle) {
+  (void)context;
+  (void)handle;
+}
+
+static inline struct gpu_proc_source gpu_proc_none_source(void) {
+  return (struct gpu_proc_source){ "none",
+                                   gpu_proc_none_list,
+                                   gpu_proc_none_attach,
+                                   gpu_proc_none_read,
+                                   gpu_proc_none_detach,
+                                   NULL };
+}
+#endif
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+// Label templates for direct-drive mode.
+//
+// A pattern is plain text with {name} placeholders, e.g. "{cpu_total}%
+// {cpu_temp}C". Each placeholder is replaced by the integer value of the
+// variable with that name, or by "--" when the value is negative
+// (unavailable). Unknown placeholders are copied verbatim.
+
+struct label_var {
+  const char* name;
+  int value;
+};
+
+static inline void label_render(char* out,
+                                size_t size,
+                                const char* pattern,
+                                const struct label_var* vars,
+                                int var_count) {
+  if (size == 0) return;
+
+  size_t caret = 0;
+  const char* c = pattern;
+  while (*c && caret + 1 < size) {
+    const char* close = (*c == '{') ? strchr(c, '}') : NULL;
+    const struct label_var* var = NULL;
+    if (close) {
+      size_t name_length = (size_t)(close - c - 1);
+      for (int i = 0; i < var_count; i++) {
+        if (strlen(vars[i].name) == name_length
+            && strncmp(vars[i].name, c + 1, name_length) == 0) {
+          var = &vars[i];
+          break;
+        }
+      }
+    }
+
+    if (!var) {
+      out[caret++] = *c++;
+      continue;
+    }
+
+    int written = var->value >= 0
+                  ? snprintf(out + caret, size - caret, "%d", var->value)
+                  : snprintf(out + caret, size - caret, "--");
+    if (written < 0) break;
+    caret += (size_t)written < size - caret ? (size_t)written : size - caret - 1;
+    c = close + 1;
+  }
+  out[caret] = '\0';
+}
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <sys/sysctl.h>
+#endif
+
+// Memory usage and pressure.
+//
+// A source reports the machine's invariants (total memory, page size) once
+// and then fills one reading per sample; mem_update() derives the swap I/O
+// rates from the reading's monotonic page counters. Sources:
+// - mach: one host_statistics64(HOST_VM_INFO64) on a host port taken once,
+//   plus vm.swapusage and kern.memorystatus_vm_pressure_level through MIBs
+//   looked up once.
+// - proc: /proc/meminfo, /proc/vmstat and /proc/pressure/memory, kept open
+//   and re-read with pread().
+// Custom sources (recorded or synthetic readings) plug in through
+// mem_init_with.
+
+enum {
+  MEM_PRESSURE_UNKNOWN = -1,
+  MEM_PRESSURE_NORMAL,
+  MEM_PRESSURE_WARN,
+  MEM_PRESSURE_CRITICAL
+};
+
+// Bytes, except the swap counters, which count pages since boot.
+struct mem_reading {
+  uint64_t used;
+  uint64_t wired;
+  uint64_t compressed;
+  uint64_t file_backed;
+  uint64_t swap_total;
+  uint64_t swap_used;
+  uint64_t swapins;
+  uint64_t swapouts;
+  int pressure;
+};
+
+struct mem_source {
+  const char* name;
+  // Total memory and page size; asked once.
+  bool (*invariants)(void* context, uint64_t* total_bytes, uint64_t* page_size);
+  // Fills out with the current reading; false when it cannot be read.
+  bool (*read)(void* context, struct mem_reading* out);
+  void* context;
+};
+
+struct mem {
+  struct mem_source source;
+  uint64_t total_bytes;
+  uint64_t page_size;
+
+  struct mem_reading reading;
+  uint64_t prev_swapins;
+  uint64_t prev_swapouts;
+  uint64_t prev_ns;
+  bool has_prev;
+
+  int used_percent;
+  // Bytes per second paged in from / out to swap since the previous update.
+  double swapin_bps;
+  double swapout_bps;
+};
+
+#ifdef __APPLE__
+struct mem_mach_source {
+  host_t host;
+  uint64_t page_size;
+  int swap_mib[CTL_MAXNAME];
+  size_t swap_mib_length;
+  int pressure_mib[CTL_MAXNAME];
+  size_t pressure_mib_length;
+};
+
+static struct mem_mach_source g_mem_mach = { 0 };
+
+static inline bool mem_mach_invariants(void* context, uint64_t* total_bytes, uint64_t* page_size) {
+  struct mem_mach_source* mach = context;
+  size_t length = sizeof(*total_bytes);
+  if (sysctlbyname("hw.memsize", total_bytes, &length, NULL, 0) != 0) return false;
+
+  vm_size_t size = 0;
+  if (host_page_size(mach->host, &size) != KERN_SUCCESS) return false;
+  *page_size = size;
+  mach->page_size = size;
+  return true;
+}
+
+static inline bool mem_mach_read(void* context, struct mem_reading* out) {
+  struct mem_mach_source* mach = context;
+  mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+  vm_statistics64_data_t vmstat;
+  if (host_statistics64(mach->host,
+                        HOST_VM_INFO64,
+                        (host_info64_t)&vmstat,
+                        &count) != KERN_SUCCESS) {
+    return false;
+  }
+
+  uint64_t page = mach->page_size;
+  out->used = ((uint64_t)vmstat.active_count + vmstat.wire_count + vmstat.compressor_page_count)
+              * page;
+  out->wired = (uint64_t)vmstat.wire_count * page;
+  out->compressed = (uint64_t)vmstat.compressor_page_count * page;
+  out->file_backed = (uint64_t)vmstat.external_page_count * page;
+  out->swapins = vmstat.swapins;
+  out->swapouts = vmstat.swapouts;
+
+  struct xsw_usage swap = { 0 };
+  size_t length = sizeof(swap);
+  if (mach->swap_mib_length
+      && sysctl(mach->swap_mib, (u_int)mach->swap_mib_length, &swap, &length, NULL, 0) == 0) {
+    out->swap_total = swap.xsu_total;
+    out->swap_used = swap.xsu_used;
+  }
+
+  // kVMPressureNormal/Warning/Critical are 1, 2 and 4.
+  int level = 0;
+  length = sizeof(level);
+  out->pressure = MEM_PRESSURE_UNKNOWN;
+  if (mach->pressure_mib_length
+      && sysctl(mach->pressure_mib, (u_int)mach->pressure_mib_length, &level, &length, NULL, 0) == 0) {
+    out->pressure = level >= 4 ? MEM_PRESSURE_CRITICAL
+                    : level >= 2 ? MEM_PRESSURE_WARN
+                                 : MEM_PRESSURE_NORMAL;
+  }
+  return true;
+}
+
+static inline struct mem_source mem_mach_source(void) {
+  if (!g_mem_mach.host) g_mem_mach.host = mach_host_self();
+  g_mem_mach.swap_mib_length = CTL_MAXNAME;
+  if (sysctlnametomib("vm.swapusage", g_mem_mach.swap_mib, &g_mem_mach.swap_mib_length) != 0) {
+    g_mem_mach.swap_mib_length = 0;
+  }
+  g_mem_mach.pressure_mib_length = CTL_MAXNAME;
+  if (sysctlnametomib("kern.memorystatus_vm_pressure_level",
+                      g_mem_mach.pressure_mib,
+                      &g_mem_mach.pressure_mib_length) != 0) {
+    g_mem_mach.pressure_mib_length = 0;
+  }
+  return (struct mem_source){ "mach", mem_mach_invariants, mem_mach_read, &g_mem_mach };
+}
+#endif
+
+struct mem_proc_file {
+  const char* path;
+  int fd;
+};
+
+struct mem_proc_source {
+  struct mem_proc_file meminfo;
+  struct mem_proc_file vmstat;
+  struct mem_proc_file pressure;
+  uint64_t page_size;
+  char buffer[8192];
+};
+
+static struct mem_proc_source g_mem_proc = { 0 };
+
+// Reads the whole file into the source's buffer, NUL-terminated.
+static inline ssize_t mem_proc_load(struct mem_proc_source* proc, struct mem_proc_file* file) {
+  if (!file->path) return -1;
+  if (file->fd < 0) {
+    file->fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    if (file->fd < 0) return -1;
+  }
+  ssize_t length = pread(file->fd, proc->buffer, sizeof(proc->buffer) - 1, 0);
+  if (length <= 0) {
+    close(file->fd);
+    file->fd = -1;
+    return -1;
+  }
+  proc->buffer[length] = '\0';
+  return length;
+}
+
+// The number after "<key>:" (meminfo) or "<key> " (vmstat) at the start of
+// a line, 0 when missing.
+static inline uint64_t mem_proc_value(const char* text, const char* key) {
+  size_t key_length = strlen(key);
+  for (const char* line = text; line && *line; ) {
+    if (strncmp(line, key, key_length) == 0
+        && (line[key_length] == ':' || line[key_length] == ' ')) {
+      const char* c = line + key_length;
+      while (*c == ' ' || *c == ':' || *c == '\t') c++;
+      return strtoull(c, NULL, 10);
+    }
+    line = strchr(line, '\n');
+    if (line) line++;
+  }
+  return 0;
+}
+
+static inline bool mem_proc_invariants(void* context, uint64_t* total_bytes, uint64_t* page_size) {
+  struct mem_proc_source* proc = context;
+  if (mem_proc_load(proc, &proc->meminfo) < 0) return false;
+  *total_bytes = mem_proc_value(proc->buffer, "MemTotal") * 1024;
+  *page_size = proc->page_size;
+  return *total_bytes > 0;
+}
+
+// Used is what is not available; "wired" is the unevictable memory and
+// "compressed" the zswap pool. Pressure maps the 10s average of "some"
+// stall time: under 1% normal, under 10% warn, critical above.
+static inline bool mem_proc_read(void* context, struct mem_reading* out) {
+  struct mem_proc_source* proc = context;
+  if (mem_proc_load(proc, &proc->meminfo) < 0) return false;
+  const char* text = proc->buffer;
+  uint64_t total = mem_proc_value(text, "MemTotal") * 1024;
+  uint64_t available = mem_proc_value(text, "MemAvailable") * 1024;
+  out->used = total > available ? total - available : 0;
+  out->wired = mem_proc_value(text, "Unevictable") * 1024;
+  out->compressed = mem_proc_value(text, "Zswap") * 1024;
+  out->file_backed = (mem_proc_value(text, "Active(file)") + mem_proc_value(text, "Inactive(file)"))
+                     * 1024;
+  out->swap_total = mem_proc_value(text, "SwapTotal") * 1024;
+  uint64_t swap_free = mem_proc_value(text, "SwapFree") * 1024;
+  out->swap_used = out->swap_total > swap_free ? out->swap_total - swap_free : 0;
+
+  out->swapins = 0;
+  out->swapouts = 0;
+  if (mem_proc_load(proc, &proc->vmstat) >= 0) {
+    out->swapins = mem_proc_value(proc->buffer, "pswpin");
+    out->swapouts = mem_proc_value(proc->buffer, "pswpout");
+  }
+
+  out->pressure = MEM_PRESSURE_UNKNOWN;
+  if (mem_proc_load(proc, &proc->pressure) >= 0) {
+    const char* avg10 = strstr(proc->buffer, "avg10=");
+    if (avg10) {
+      double stall = strtod(avg10 + 6, NULL);
+      out->pressure = stall < 1.0 ? MEM_PRESSURE_NORMAL
+                      : stall < 10.0 ? MEM_PRESSURE_WARN
+                                     : MEM_PRESSURE_CRITICAL;
+    }
+  }
+  return true;
+}
+
+static inline struct mem_source mem_proc_source(const char* meminfo,
+                                                const char* vmstat,
+                                                const char* pressure) {
+  struct mem_proc_file* files[] = { &g_mem_proc.meminfo, &g_mem_proc.vmstat, &g_mem_proc.pressure };
+  const char* paths[] = { meminfo, vmstat, pressure };
+  for (int i = 0; i < 3; i++) {
+    if (files[i]->path && files[i]->fd >= 0) close(files[i]->fd);
+    files[i]->path = paths[i];
+    files[i]->fd = -1;
+  }
+  long page_size = sysconf(_SC_PAGESIZE);
+  g_mem_proc.page_size = page_size > 0 ? (uint64_t)page_size : 4096;
+  return (struct mem_source){ "proc", mem_proc_invariants, mem_proc_read, &g_mem_proc };
+}
+
+static inline bool mem_init_with(struct mem* mem, struct mem_source source) {
+  memset(mem, 0, sizeof(struct mem));
+  mem->source = source;
+  mem->used_percent = -1;
+  mem->reading.pressure = MEM_PRESSURE_UNKNOWN;
+  return source.invariants(source.context, &mem->total_bytes, &mem->page_size);
+}
+
+static inline bool mem_init(struct mem* mem) {
+#ifdef __APPLE__
+  return mem_init_with(mem, mem_mach_source());
+#else
+  return mem_init_with(mem, mem_proc_source("/proc/meminfo",
+                                            "/proc/vmstat",
+                                            "/proc/pressure/memory"));
+#endif
+}
+
+// Drops the swap rate baseline, so the next update only takes one.
+static inline void mem_reset(struct mem* mem) {
+  mem->has_prev = false;
+  mem->swapin_bps = 0.0;
+  mem->swapout_bps = 0.0;
+}
+
+static inline double mem_page_rate(uint64_t now, uint64_t prev, uint64_t page_size, double seconds) {
+  // Counters that went backwards (wrapped or reset) report nothing.
+  if (now < prev) return 0.0;
+  return (double)(now - prev) * (double)page_size / seconds;
+}
+
+static inline bool mem_update(struct mem* mem, uint64_t now_ns) {
+  if (!mem->source.read(mem->source.context, &mem->reading)) {
+    mem->used_percent = -1;
+    return false;
+  }
+
+  const struct mem_reading* reading = &mem->reading;
+  int percent = mem->total_bytes
+                  ? (int)((double)reading->used / (double)mem->total_bytes * 100.0)
+                  : -1;
+  mem->used_percent = percent > 100 ? 100 : percent;
+
+  if (mem->has_prev && now_ns > mem->prev_ns) {
+    double seconds = (double)(now_ns - mem->prev_ns) / 1e9;
+    mem->swapin_bps = mem_page_rate(reading->swapins, mem->prev_swapins, mem->page_size, seconds);
+    mem->swapout_bps = mem_page_rate(reading->swapouts, mem->prev_swapouts, mem->page_size, seconds);
+  } else {
+    mem->swapin_bps = 0.0;
+    mem->swapout_bps = 0.0;
+  }
+  mem->prev_swapins = reading->swapins;
+  mem->prev_swapouts = reading->swapouts;
+  mem->prev_ns = now_ns;
+  mem->has_prev = true;
+  return true;
+}
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <libproc.h>
+#include <mach/mach_time.h>
+#include <sys/proc_info.h>
+#include <sys/resource.h>
+#endif
+
+// Top processes by CPU and by resident memory, for the stats popup.
+//
+// Each proc_top_sample() reads every process' cumulative CPU time and
+// resident size into a pid-sorted array and keeps the previous one, so CPU
+// usage is the CPU time a process used between the two samples (merge join
+// on pid; a pid whose counter went backwards was reused and is skipped).
+// Names are only looked up for the processes that make a top list. Sources:
+// - mach: proc_pidinfo(PROC_PIDTASKINFO), or proc_pid_rusage() when that is
+//   refused. Without root, other users' processes (WindowServer,
+//   kernel_task, ...) may refuse both; they are left out and counted in
+//   `unreadable`, so the popup can say the lists are incomplete. Nothing is
+//   spawned.
+// - proc: /proc/<pid>/stat, works on Linux for testing and benchmarking
+
+#define PROC_TOP_NAME_SIZE 64
+#define PROC_TOP_MAX 32
+
+struct proc_sample {
+  pid_t pid;
+  uint64_t cpu_ns;
+  uint64_t rss_bytes;
+};
+
+struct proc_top_source {
+  const char* name;
+  // Writes up to capacity pids and returns how many there are, which may be
+  // more than capacity; negative on failure.
+  int (*list)(void* context, pid_t* pids, int capacity);
+  // Fills cpu_ns and rss_bytes; false when the process is gone or hidden.
+  bool (*read)(void* context, pid_t pid, struct proc_sample* out);
+  bool (*lookup_name)(void* context, pid_t pid, char* name, size_t name_size);
+  void* context;
+};
+
+struct proc_top_entry {
+  pid_t pid;
+  uint64_t value;
+  char name[PROC_TOP_NAME_SIZE];
+};
+
+struct proc_top {
+  struct proc_top_source source;
+  pid_t* pids;
+  int pid_capacity;
+
+  struct proc_sample* samples[2];
+  int sample_counts[2];
+  int sample_capacity;
+  int current;
+  uint64_t sampled_ns[2];
+  // Listed processes the latest sample could not read (gone by then, or
+  // refused to this user).
+  int unreadable;
+};
+
+static inline bool proc_top_init(struct proc_top* top, struct proc_top_source source) {
+  memset(top, 0, sizeof(struct proc_top));
+  top->source = source;
+  top->pid_capacity = 1024;
+  top->pids = malloc(sizeof(pid_t) * top->pid_capacity);
+  top->sample_capacity = 1024;
+  top->samples[0] = malloc(sizeof(struct proc_sample) * top->sample_capacity);
+  top->samples[1] = malloc(sizeof(struct proc_sample) * top->sample_capacity);
+  return top->pids && top->samples[0] && top->samples[1];
+}
+
+static inline int proc_top_compare_pid(const void* a, const void* b) {
+  pid_t x = ((const struct proc_sample*)a)->pid;
+  pid_t y = ((const struct proc_sample*)b)->pid;
+  return (x > y) - (x < y);
+}
+
+// Age of the previous sample at the time of the latest one; 0 with fewer
+// than two samples.
+static inline uint64_t proc_top_interval_ns(const struct proc_top* top) {
+  uint64_t now = top->sampled_ns[top->current];
+  uint64_t prev = top->sampled_ns[top->current ^ 1];
+  return prev && now > prev ? now - prev : 0;
+}
+
+static inline bool proc_top_sample(struct proc_top* top, uint64_t now_ns) {
+  int count = top->source.list(top->source.context, top->pids, top->pid_capacity);
+  while (count > top->pid_capacity) {
+    int capacity = count + count / 4;
+    pid_t* pids = realloc(top->pids, sizeof(pid_t) * capacity);
+    if (!pids) return false;
+    top->pids = pids;
+    top->pid_capacity = capacity;
+    count = top->source.list(top->source.context, top->pids, top->pid_capacity);
+  }
+  if (count < 0) return false;
+
+  if (count > top->sample_capacity) {
+    for (int i = 0; i < 2; i++) {
+      struct proc_sample* samples = realloc(top->samples[i], sizeof(struct proc_sample) * count);
+      if (!samples) return false;
+      top->samples[i] = samples;
+    }
+    top->sample_capacity = count;
+  }
+
+  int next = top->current ^ 1;
+  struct proc_sample* samples = top->samples[next];
+  int valid = 0;
+  int unreadable = 0;
+  bool sorted = true;
+  for (int i = 0; i < count; i++) {
+    if (top->pids[i] <= 0) continue;
+    if (!top->source.read(top->source.context, top->pids[i], &samples[valid])) {
+      unreadable++;
+      continue;
+    }
+    samples[valid].pid = top->pids[i];
+    if (valid > 0 && samples[valid - 1].pid > samples[valid].pid) sorted = false;
+    valid++;
+  }
+  if (!sorted) qsort(samples, valid, sizeof(struct proc_sample), proc_top_compare_pid);
+
+  top->sample_counts[next] = valid;
+  top->unreadable = unreadable;
+  top->sampled_ns[next] = now_ns;
+  top->current = next;
+  return true;
+}
+
+static inline bool proc_top_before(const struct proc_top_entry* a, const struct proc_top_entry* b) {
+  if (a->value != b->value) return a->value > b->value;
+  return a->pid < b->pid;
+}
+
+static inline void proc_top_sift_down(struct proc_top_entry* heap, int count, int i) {
+  for (;;) {
+    int worst = i;
+    int left = 2 * i + 1;
+    int right = left + 1;
+    // The root holds the entry that ranks last.
+    if (left < count && proc_top_before(&heap[worst], &heap[left])) worst = left;
+    if (right < count && proc_top_before(&heap[worst], &heap[right])) worst = right;
+    if (worst == i) return;
+    struct proc_top_entry tmp = heap[i];
+    heap[i] = heap[worst];
+    heap[worst] = tmp;
+    i = worst;
+  }
+}
+
+static inline void proc_top_offer(struct proc_top_entry* heap, int* count, int n, pid_t pid, uint64_t value) {
+  struct proc_top_entry candidate = { .pid = pid, .value = value };
+  if (*count < n) {
+    heap[(*count)++] = candidate;
+    if (*count == n) {
+      for (int j = n / 2 - 1; j >= 0; j--) proc_top_sift_down(heap, n, j);
+    }
+  } else if (proc_top_before(&candidate, &heap[0])) {
+    heap[0] = candidate;
+    proc_top_sift_down(heap, n, 0);
+  }
+}
+
+// Orders the heap busiest first and resolves the names of its entries.
+static inline int proc_top_finish(struct proc_top* top, struct proc_top_entry* heap, int count, int n) {
+  if (count < n) {
+    for (int j = count / 2 - 1; j >= 0; j--) proc_top_sift_down(heap, count, j);
+  }
+  for (int end = count - 1; end > 0; end--) {
+    struct proc_top_entry tmp = heap[0];
+    heap[0] = heap[end];
+    heap[end] = tmp;
+    proc_top_sift_down(heap, end, 0);
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (!top->source.lookup_name(top->source.context, heap[i].pid, heap[i].name, sizeof(heap[i].name))) {
+      snprintf(heap[i].name, sizeof(heap[i].name), "%d", (int)heap[i].pid);
+    }
+  }
+  return count;
+}
+
+// Up to n processes by CPU time used between the last two samples (value in
+// ns), busiest first.
+static inline int proc_top_cpu(struct proc_top* top, struct proc_top_entry* entries, int n) {
+  if (n > PROC_TOP_MAX) n = PROC_TOP_MAX;
+  if (proc_top_interval_ns(top) == 0) return 0;
+
+  const struct proc_sample* now = top->samples[top->current];
+  const struct proc_sample* prev = top->samples[top->current ^ 1];
+  int now_count = top->sample_counts[top->current];
+  int prev_count = top->sample_counts[top->current ^ 1];
+
+  int count = 0;
+  int j = 0;
+  for (int i = 0; i < now_count && n > 0; i++) {
+    while (j < prev_count && prev[j].pid < now[i].pid) j++;
+    if (j == prev_count) break;
+    if (prev[j].pid != now[i].pid || now[i].cpu_ns <= prev[j].cpu_ns) continue;
+    proc_top_offer(entries, &count, n, now[i].pid, now[i].cpu_ns - prev[j].cpu_ns);
+  }
+  return proc_top_finish(top, entries, count, n);
+}
+
+// Up to n processes by resident size in the latest sample (value in bytes).
+static inline int proc_top_rss(struct proc_top* top, struct proc_top_entry* entries, int n) {
+  if (n > PROC_TOP_MAX) n = PROC_TOP_MAX;
+  const struct proc_sample* now = top->samples[top->current];
+  int now_count = top->sample_counts[top->current];
+
+  int count = 0;
+  for (int i = 0; i < now_count && n > 0; i++) {
+    if (now[i].rss_bytes == 0) continue;
+    proc_top_offer(entries, &count, n, now[i].pid, now[i].rss_bytes);
+  }
+  return proc_top_finish(top, entries, count, n);
+}
+
+#ifdef __APPLE__
+static mach_timebase_info_data_t g_proc_top_timebase = { 0 };
+
+static inline int proc_top_mach_list(void* context, pid_t* pids, int capacity) {
+  (void)context;
+  int count = proc_listallpids(NULL, 0);
+  if (count <= 0) return -1;
+  // Leave headroom for processes started between the two calls.
+  if (count + 16 > capacity) return count + 16;
+  return proc_listallpids(pids, sizeof(pid_t) * capacity);
+}
+
+// pti_total_user/system and ri_user/system_time are both in mach absolute
+// time units, so a pid read either way gives comparable CPU deltas.
+static inline bool proc_top_mach_read(void* context, pid_t pid, struct proc_sample* out) {
+  (void)context;
+  struct proc_taskinfo info;
+  int size = proc_pidinfo(pid, PROC_PIDTASKINFO, 0, &info, sizeof(info));
+  if (size != (int)sizeof(info)) {
+    struct rusage_info_v2 usage;
+    if (proc_pid_rusage(pid, RUSAGE_INFO_V2, (rusage_info_t*)&usage) != 0) return false;
+    uint64_t ticks = usage.ri_user_time + usage.ri_system_time;
+    out->cpu_ns = ticks * g_proc_top_timebase.numer / g_proc_top_timebase.denom;
+    out->rss_bytes = usage.ri_resident_size;
+    return true;
+  }
+  uint64_t ticks = info.pti_total_user + info.pti_total_system;
+  out->cpu_ns = ticks * g_proc_top_timebase.numer / g_proc_top_timebase.denom;
+  out->rss_bytes = info.pti_resident_size;
+  return true;
+}
+
+static inline bool proc_top_mach_name(void* context, pid_t pid, char* name, size_t name_size) {
+  (void)context;
+  name[0] = '\0';
+  return proc_name(pid, name, (uint32_t)name_size) > 0 && name[0] != '\0';
+}
+
+static inline struct proc_top_source proc_top_mach_source(void) {
+  mach_timebase_info(&g_proc_top_timebase);
+  return (struct proc_top_source){ "mach",
+                                   proc_top_mach_list,
+                                   proc_top_mach_read,
+                                   proc_top_mach_name,
+                                   NULL };
+}
+#endif
+
+struct proc_top_proc_source {
+  const char* root;
+  uint64_t ns_per_tick;
+  uint64_t page_size;
+};
+
+static struct proc_top_proc_source g_proc_top_proc = { 0 };
+
+static inline int proc_top_proc_list(void* context, pid_t* pids, int capacity) {
+  struct proc_top_proc_source* proc = context;
+  DIR* dir = opendir(proc->root);
+  if (!dir) return -1;
+
+  int count = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir))) {
+    const char* c = entry->d_name;
+    if (*c < '1' || *c > '9') continue;
+    long pid = strtol(c, NULL, 10);
+    if (count < capacity) pids[count] = (pid_t)pid;
+    count++;
+  }
+  closedir(dir);
+  return count;
+}
+
+static inline bool proc_top_proc_file(struct proc_top_proc_source* proc,
+                                      pid_t pid,
+                                      const char* file,
+                                      char* buffer,
+                                      size_t size) {
+  char path[64];
+  snprintf(path, sizeof(path), "%s/%d/%s", proc->root, (int)pid, file);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  ssize_t length = read(fd, buffer, size - 1);
+  close(fd);
+  if (length <= 0) return false;
+  buffer[length] = '\0';
+  return true;
+}
+
+// pid (comm) state ppid ... utime(14) stime(15) ... rss(24); comm may
+// contain spaces and parentheses, so fields are counted from the last ')'.
+static inline bool proc_top_proc_read(void* context, pid_t pid, struct proc_sample* out) {
+  struct proc_top_proc_source* proc = context;
+  char buffer[1024];
+  if (!proc_top_proc_file(proc, pid, "stat", buffer, sizeof(buffer))) return false;
+
+  const char* c = strrchr(buffer, ')');
+  if (!c) return false;
+  uint64_t utime = 0, stime = 0, rss = 0;
+  for (int field = 3; *c && field <= 24; field++) {
+    c = strchr(c, ' ');
+    if (!c) return false;
+    c++;
+    if (field == 14) utime = strtoull(c, NULL, 10);
+    else if (field == 15) stime = strtoull(c, NULL, 10);
+    else if (field == 24) rss = strtoull(c, NULL, 10);
+  }
+  out->cpu_ns = (utime + stime) * proc->ns_per_tick;
+  out->rss_bytes = rss * proc->page_size;
+  return true;
+}
+
+static inline bool proc_top_proc_name(void* context, pid_t pid, char* name, size_t name_size) {
+  struct proc_top_proc_source* proc = context;
+  if (!proc_top_proc_file(proc, pid, "comm", name, name_size)) return false;
+  name[strcspn(name, "\n")] = '\0';
+  return name[0] != '\0';
+}
+
+static inline struct proc_top_source proc_top_proc_source(const char* root) {
+  long ticks = sysconf(_SC_CLK_TCK);
+  long page_size = sysconf(_SC_PAGESIZE);
+  g_proc_top_proc.root = root;
+  g_proc_top_proc.ns_per_tick = 1000000000ull / (uint64_t)(ticks > 0 ? ticks : 100);
+  g_proc_top_proc.page_size = (uint64_t)(page_size > 0 ? page_size : 4096);
+  return (struct proc_top_source){ "proc",
+                                   proc_top_proc_list,
+                                   proc_top_proc_read,
+                                   proc_top_proc_name,
+                                   &g_proc_top_proc };
+}
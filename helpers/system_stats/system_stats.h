@@ -0,0 +1,983 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOKitLib.h>
+#include <mach/mach.h>
+#include <sys/sysctl.h>
+#endif
+
+#include "cpu.h"
+#include "disk.h"
+#include "emit.h"
+#include "gpu.h"
+#include "gpu_procs.h"
+#include "label.h"
+#include "mem.h"
+#include "proc_top.h"
+#include "tape_sources.h"
+#include "temps.h"
+#include "../control.h"
+#include "../module.h"
+#include "../sched.h"
+#include "../sketchybar.h"
+
+#define MAX_TOP_PROCS 10
+
+// A process query needs two samples; when the previous one is missing or too
+// old for a meaningful rate, the answer follows a second sample this much
+// later.
+#define PROCS_MIN_INTERVAL_NS 200000000ull
+#define PROCS_MAX_INTERVAL_NS 5000000000ull
+#define PROCS_SETTLE_NS 500000000ull
+
+// Collectors, each run at its own period by the scheduler. Their sched.h
+// task index, and so their bit in a refresh mask, is their position here.
+enum {
+  COLLECT_CPU,
+  COLLECT_MEM,
+  COLLECT_GPU,
+  COLLECT_TEMPS,
+  COLLECT_DISK,
+  COLLECT_GPU_PROCS,
+  COLLECTORS
+};
+
+static const char *const collector_names[COLLECTORS] = {
+  "cpu", "mem", "gpu", "temps", "disk", "gpu_procs"
+};
+
+#define REFRESHED(mask, collector) (((mask) >> (collector)) & 1u)
+
+static inline int system_stats_clamp(int value, int min, int max) {
+  if (value < min) return min;
+  if (value > max) return max;
+  return value;
+}
+
+struct system_stats_options {
+  const char *event;
+  float update_freq;
+  // Per-collector periods in seconds; 0 falls back to update_freq.
+  float periods[COLLECTORS];
+
+  // Emission gate; disabled unless one of its options is given.
+  bool gated;
+  double load_threshold;
+  double temp_threshold;
+  double disk_threshold;
+  double heartbeat;
+
+  // Direct-drive mode: push graph values and labels straight to these items
+  // instead of triggering the event.
+  bool direct;
+  char direct_items[3][128];
+  const char *cpu_label;
+  const char *gpu_label;
+  const char *mem_label;
+
+  // Per-cluster min/avg/max and per-sensor temperatures in triggers.
+  bool temp_detail;
+  // Per-disk rates in triggers.
+  bool disk_detail;
+  // Collector timing counters in triggers.
+  bool timing;
+  // Length of the energy ranking in triggers; 0 leaves it out.
+  int energy_top;
+
+  // Control FIFO for on-demand queries, and the event that answers them.
+  const char *control_path;
+  const char *procs_event;
+
+  // Sample tapes (helpers/tape.h): record what the sources return, or replay
+  // a recording instead of reading them, at speed times the recorded pace
+  // (0 runs it as fast as possible).
+  const char *record_path;
+  const char *replay_path;
+  double speed;
+};
+
+static inline bool parse_direct_items(const char *value, struct system_stats_options *options) {
+  const char *item = value;
+  for (int i = 0; i < 3; i++) {
+    const char *end = strchr(item, ',');
+    size_t length = end ? (size_t)(end - item) : strlen(item);
+    if (length == 0 || length >= sizeof(options->direct_items[i])) return false;
+    memcpy(options->direct_items[i], item, length);
+    options->direct_items[i][length] = '\0';
+    if (i < 2 && !end) return false;
+    item = end ? end + 1 : item + length;
+  }
+  options->direct = true;
+  return true;
+}
+
+// <collector>=<seconds>
+static inline bool parse_period(const char *value, struct system_stats_options *options) {
+  const char *equals = strchr(value, '=');
+  if (!equals) return false;
+  size_t length = (size_t)(equals - value);
+  for (int i = 0; i < COLLECTORS; i++) {
+    if (strlen(collector_names[i]) != length) continue;
+    if (strncmp(collector_names[i], value, length) != 0) continue;
+    float period = (float)atof(equals + 1);
+    if (period <= 0.0f) return false;
+    options->periods[i] = period;
+    return true;
+  }
+  return false;
+}
+
+static inline bool system_stats_parse(int argc, char **argv, struct system_stats_options *options) {
+  if (argc < 3 || (sscanf(argv[2], "%f", &options->update_freq) != 1)) return false;
+  options->event = argv[1];
+  for (int i = 0; i < COLLECTORS; i++) options->periods[i] = 0.0f;
+  options->gated = false;
+  options->load_threshold = 0.0;
+  options->temp_threshold = 0.0;
+  options->disk_threshold = 1.0;
+  options->heartbeat = 0.0;
+  options->direct = false;
+  options->cpu_label = "{cpu_total}% {cpu_temp}C";
+  options->gpu_label = "{gpu_util}% {gpu_temp}C";
+  options->mem_label = "{mem_used_percent}%";
+  options->temp_detail = false;
+  options->disk_detail = false;
+  options->timing = false;
+  options->energy_top = 0;
+  options->control_path = NULL;
+  options->procs_event = "system_stats_procs";
+  options->record_path = NULL;
+  options->replay_path = NULL;
+  options->speed = 1.0;
+
+  for (int i = 3; i < argc; i++) {
+    if (strcmp(argv[i], "--temp-detail") == 0) {
+      options->temp_detail = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--disk-detail") == 0) {
+      options->disk_detail = true;
+      continue;
+    }
+    if (strcmp(argv[i], "--timing") == 0) {
+      options->timing = true;
+      continue;
+    }
+    if (i + 1 >= argc) return false;
+    const char *value = argv[++i];
+    if (strcmp(argv[i - 1], "--load-threshold") == 0) {
+      options->load_threshold = atof(value);
+      options->gated = true;
+    } else if (strcmp(argv[i - 1], "--temp-threshold") == 0) {
+      options->temp_threshold = atof(value);
+      options->gated = true;
+    } else if (strcmp(argv[i - 1], "--disk-threshold") == 0) {
+      options->disk_threshold = atof(value);
+      options->gated = true;
+    } else if (strcmp(argv[i - 1], "--heartbeat") == 0) {
+      options->heartbeat = atof(value);
+      options->gated = true;
+    } else if (strcmp(argv[i - 1], "--period") == 0) {
+      if (!parse_period(value, options)) return false;
+    } else if (strcmp(argv[i - 1], "--direct") == 0) {
+      if (!parse_direct_items(value, options)) return false;
+    } else if (strcmp(argv[i - 1], "--cpu-label") == 0) {
+      options->cpu_label = value;
+    } else if (strcmp(argv[i - 1], "--gpu-label") == 0) {
+      options->gpu_label = value;
+    } else if (strcmp(argv[i - 1], "--mem-label") == 0) {
+      options->mem_label = value;
+    } else if (strcmp(argv[i - 1], "--energy-procs") == 0) {
+      options->energy_top = system_stats_clamp(atoi(value), 0, GPU_PROC_TOP_MAX);
+    } else if (strcmp(argv[i - 1], "--control") == 0) {
+      options->control_path = value;
+    } else if (strcmp(argv[i - 1], "--procs-event") == 0) {
+      options->procs_event = value;
+    } else if (strcmp(argv[i - 1], "--record") == 0) {
+      options->record_path = value;
+    } else if (strcmp(argv[i - 1], "--replay") == 0) {
+      options->replay_path = value;
+    } else if (strcmp(argv[i - 1], "--speed") == 0) {
+      options->speed = atof(value);
+      if (options->speed < 0.0) return false;
+    } else {
+      return false;
+    }
+  }
+  if (options->record_path && options->replay_path) return false;
+  return options->update_freq > 0.0f;
+}
+
+static inline uint64_t collector_period_ns(const struct system_stats_options *options, int collector) {
+  float period = options->periods[collector] > 0.0f
+                 ? options->periods[collector]
+                 : options->update_freq;
+  return (uint64_t)(period * 1e9);
+}
+
+struct system_stats_sample {
+  int cpu_user;
+  int cpu_sys;
+  int cpu_total;
+  int cpu_core_max;
+  int cpu_p;
+  int cpu_e;
+  int mem_percent;
+  uint64_t mem_used;
+  uint64_t mem_total;
+  uint64_t mem_wired;
+  uint64_t mem_compressed;
+  uint64_t mem_file;
+  uint64_t mem_swap_used;
+  uint64_t mem_swap_total;
+  double mem_swapin_bps;
+  double mem_swapout_bps;
+  int mem_pressure;
+  int gpu_util;
+  int gpu_device;
+  int gpu_renderer;
+  int gpu_tiler;
+  int64_t gpu_mem_used;
+  int cpu_temp;
+  int gpu_temp;
+  // Bytes and operations per second over every disk.
+  double disk_read_bps;
+  double disk_write_bps;
+  double disk_read_iops;
+  double disk_write_iops;
+};
+
+// The values the Lua item renders; the emission gate only watches these.
+enum {
+  FIELD_CPU_TOTAL,
+  FIELD_CPU_CORE_MAX,
+  FIELD_GPU_UTIL,
+  FIELD_MEM_PERCENT,
+  FIELD_MEM_PRESSURE,
+  FIELD_CPU_TEMP,
+  FIELD_GPU_TEMP,
+  FIELD_DISK_READ,
+  FIELD_DISK_WRITE,
+  FIELD_COUNT
+};
+
+static const int field_collectors[FIELD_COUNT] = {
+  COLLECT_CPU, COLLECT_CPU, COLLECT_GPU, COLLECT_MEM, COLLECT_MEM, COLLECT_TEMPS, COLLECT_TEMPS,
+  COLLECT_DISK, COLLECT_DISK
+};
+
+static inline void system_stats_sample_init(struct system_stats_sample *sample) {
+  memset(sample, 0, sizeof(struct system_stats_sample));
+  sample->cpu_user = -1;
+  sample->cpu_sys = -1;
+  sample->cpu_total = -1;
+  sample->cpu_core_max = -1;
+  sample->cpu_p = -1;
+  sample->cpu_e = -1;
+  sample->mem_percent = -1;
+  sample->mem_pressure = MEM_PRESSURE_UNKNOWN;
+  sample->gpu_util = -1;
+  sample->gpu_device = -1;
+  sample->gpu_renderer = -1;
+  sample->gpu_tiler = -1;
+  sample->gpu_mem_used = -1;
+  sample->cpu_temp = -1;
+  sample->gpu_temp = -1;
+  sample->disk_read_bps = -1.0;
+  sample->disk_write_bps = -1.0;
+  sample->disk_read_iops = -1.0;
+  sample->disk_write_iops = -1.0;
+}
+
+// Runs the collectors in `due`; the other fields keep their last values.
+// Without mem (its source failed to initialize) memory reads as unavailable.
+static inline void collect_sample(struct cpu *cpu,
+                                  struct mem *mem,
+                                  struct gpu *gpu,
+                                  struct temps *temps,
+                                  struct disk *disk,
+                                  struct system_stats_sample *sample,
+                                  uint64_t now,
+                                  uint32_t due) {
+  if (REFRESHED(due, COLLECT_CPU)) {
+    cpu_update(cpu);
+    sample->cpu_user = cpu->user_load;
+    sample->cpu_sys = cpu->sys_load;
+    sample->cpu_total = cpu->total_load;
+    sample->cpu_core_max = cpu->max_core_load;
+    sample->cpu_p = cpu->p_load;
+    sample->cpu_e = cpu->e_load;
+  }
+
+  if (REFRESHED(due, COLLECT_MEM)) {
+    if (mem && mem_update(mem, now)) {
+      const struct mem_reading *reading = &mem->reading;
+      sample->mem_percent = mem->used_percent;
+      sample->mem_used = reading->used;
+      sample->mem_total = mem->total_bytes;
+      sample->mem_wired = reading->wired;
+      sample->mem_compressed = reading->compressed;
+      sample->mem_file = reading->file_backed;
+      sample->mem_swap_used = reading->swap_used;
+      sample->mem_swap_total = reading->swap_total;
+      sample->mem_swapin_bps = mem->swapin_bps;
+      sample->mem_swapout_bps = mem->swapout_bps;
+      sample->mem_pressure = reading->pressure;
+    } else {
+      sample->mem_used = 0;
+      sample->mem_total = 0;
+      sample->mem_percent = -1;
+      sample->mem_pressure = MEM_PRESSURE_UNKNOWN;
+    }
+  }
+
+  if (REFRESHED(due, COLLECT_GPU)) {
+    gpu_update(gpu);
+    sample->gpu_util = gpu->util;
+    sample->gpu_device = gpu->device_util;
+    sample->gpu_renderer = gpu->renderer_util;
+    sample->gpu_tiler = gpu->tiler_util;
+    sample->gpu_mem_used = gpu->mem_used_bytes;
+  }
+
+  // CPU is the average of the die sensors, GPU the hottest device sensor.
+  if (REFRESHED(due, COLLECT_TEMPS)) {
+    temps_update(temps);
+    sample->cpu_temp = temps_avg(temps, TEMP_CLUSTER_CPU);
+    sample->gpu_temp = temps_max(temps, TEMP_CLUSTER_GPU);
+  }
+
+  if (REFRESHED(due, COLLECT_DISK)) {
+    disk_update(disk, now);
+    sample->disk_read_bps = disk->read_bps;
+    sample->disk_write_bps = disk->write_bps;
+    sample->disk_read_iops = disk->read_iops;
+    sample->disk_write_iops = disk->write_iops;
+  }
+}
+
+// Per-core loads as a comma separated list in core order.
+static inline void append_cores(struct sb_message *msg, const struct cpu *cpu) {
+  sb_msg_key(msg, "cpu_cores");
+  for (int i = 0; i < cpu->core_count; i++) {
+    if (i > 0) sb_msg_append(msg, ",", 1);
+    sb_msg_append_uint(msg, cpu->core_load[i]);
+  }
+  sb_msg_end_arg(msg);
+}
+
+// Cluster statistics and "name:celsius;..." for every classified sensor.
+static inline void append_temp_detail(struct sb_message *msg, const struct temps *temps) {
+  sb_msg_int(msg, "cpu_temp_min", temps_min(temps, TEMP_CLUSTER_CPU));
+  sb_msg_int(msg, "cpu_temp_max", temps_max(temps, TEMP_CLUSTER_CPU));
+  sb_msg_int(msg, "gpu_temp_min", temps_min(temps, TEMP_CLUSTER_GPU));
+  sb_msg_int(msg, "gpu_temp_avg", temps_avg(temps, TEMP_CLUSTER_GPU));
+
+  sb_msg_key(msg, "temp_sensors");
+  for (int i = 0; i < temps->count; i++) {
+    if (i > 0) sb_msg_append(msg, ";", 1);
+    sb_msg_append(msg, temps->sensors[i].name, (uint32_t)strlen(temps->sensors[i].name));
+    sb_msg_append(msg, ":", 1);
+    sb_msg_append_double(msg, temps->sensors[i].celsius, 1);
+  }
+  sb_msg_end_arg(msg);
+}
+
+// "name:read_bps:write_bps:read_iops:write_iops;..." for every disk.
+static inline void append_disk_detail(struct sb_message *msg, const struct disk *disk) {
+  sb_msg_key(msg, "disk_devices");
+  for (int i = 0; i < disk->count; i++) {
+    const struct disk_rate *rate = &disk->rates[i];
+    if (i > 0) sb_msg_append(msg, ";", 1);
+    sb_msg_append(msg, rate->name, (uint32_t)strlen(rate->name));
+    sb_msg_append(msg, ":", 1);
+    sb_msg_append_double(msg, rate->read_bps, 0);
+    sb_msg_append(msg, ":", 1);
+    sb_msg_append_double(msg, rate->write_bps, 0);
+    sb_msg_append(msg, ":", 1);
+    sb_msg_append_double(msg, rate->read_iops, 0);
+    sb_msg_append(msg, ":", 1);
+    sb_msg_append_double(msg, rate->write_iops, 0);
+  }
+  sb_msg_end_arg(msg);
+}
+
+static inline void build_trigger(struct sb_message *msg,
+                                 const struct system_stats_options *options,
+                                 const struct cpu *cpu,
+                                 const struct gpu *gpu,
+                                 const struct temps *temps,
+                                 const struct disk *disk,
+                                 const struct system_stats_sample *sample,
+                                 const char *gpu_procs,
+                                 const char *energy_procs,
+                                 uint64_t suppressed,
+                                 uint32_t refreshed) {
+  sb_msg_arg(msg, "--trigger");
+  sb_msg_arg(msg, options->event);
+  if (REFRESHED(refreshed, COLLECT_CPU)) {
+    sb_msg_int(msg, "cpu_user", sample->cpu_user);
+    sb_msg_int(msg, "cpu_sys", sample->cpu_sys);
+    sb_msg_int(msg, "cpu_total", sample->cpu_total);
+    sb_msg_int(msg, "cpu_core_max", sample->cpu_core_max);
+    sb_msg_int(msg, "cpu_p_load", sample->cpu_p);
+    sb_msg_int(msg, "cpu_e_load", sample->cpu_e);
+    append_cores(msg, cpu);
+  }
+  if (REFRESHED(refreshed, COLLECT_MEM)) {
+    sb_msg_int(msg, "mem_used_percent", sample->mem_percent);
+    sb_msg_uint(msg, "mem_used_bytes", sample->mem_used);
+    sb_msg_uint(msg, "mem_total_bytes", sample->mem_total);
+    sb_msg_uint(msg, "mem_wired_bytes", sample->mem_wired);
+    sb_msg_uint(msg, "mem_compressed_bytes", sample->mem_compressed);
+    sb_msg_uint(msg, "mem_file_bytes", sample->mem_file);
+    sb_msg_uint(msg, "swap_used_bytes", sample->mem_swap_used);
+    sb_msg_uint(msg, "swap_total_bytes", sample->mem_swap_total);
+    sb_msg_double(msg, "swap_in_bps", sample->mem_swapin_bps, 0);
+    sb_msg_double(msg, "swap_out_bps", sample->mem_swapout_bps, 0);
+    sb_msg_int(msg, "mem_pressure", sample->mem_pressure);
+  }
+  if (REFRESHED(refreshed, COLLECT_GPU)) {
+    sb_msg_int(msg, "gpu_util", sample->gpu_util);
+    sb_msg_int(msg, "gpu_device", sample->gpu_device);
+    sb_msg_int(msg, "gpu_renderer", sample->gpu_renderer);
+    sb_msg_int(msg, "gpu_tiler", sample->gpu_tiler);
+    sb_msg_int(msg, "gpu_mem_used_bytes", sample->gpu_mem_used);
+    if (options->timing && gpu->read_calls > 0) {
+      sb_msg_uint(msg, "gpu_read_ns", gpu->read_ns_total / gpu->read_calls);
+      sb_msg_uint(msg, "gpu_read_max_ns", gpu->read_ns_max);
+    }
+  }
+  if (REFRESHED(refreshed, COLLECT_TEMPS)) {
+    sb_msg_int(msg, "cpu_temp", sample->cpu_temp);
+    sb_msg_int(msg, "gpu_temp", sample->gpu_temp);
+    if (options->temp_detail) append_temp_detail(msg, temps);
+  }
+  if (REFRESHED(refreshed, COLLECT_DISK)) {
+    sb_msg_double(msg, "disk_read_bps", sample->disk_read_bps, 0);
+    sb_msg_double(msg, "disk_write_bps", sample->disk_write_bps, 0);
+    sb_msg_double(msg, "disk_read_iops", sample->disk_read_iops, 0);
+    sb_msg_double(msg, "disk_write_iops", sample->disk_write_iops, 0);
+    if (options->disk_detail) append_disk_detail(msg, disk);
+  }
+  if (REFRESHED(refreshed, COLLECT_GPU_PROCS)) {
+    sb_msg_str(msg, "gpu_procs", gpu_procs);
+    if (options->energy_top > 0) sb_msg_str(msg, "energy_procs", energy_procs);
+  }
+  sb_msg_uint(msg, "suppressed", suppressed);
+}
+
+static inline void build_direct_item(struct sb_message *msg,
+                                     const char *item,
+                                     int percent,
+                                     bool push,
+                                     bool set_label,
+                                     const char *pattern,
+                                     const struct label_var *vars,
+                                     int var_count) {
+  if (push && percent >= 0) {
+    sb_msg_arg(msg, "--push");
+    sb_msg_arg(msg, item);
+    sb_msg_append_double(msg, (double)percent / 100.0, 2);
+    sb_msg_end_arg(msg);
+  }
+  if (!set_label) return;
+
+  char label[128];
+  label_render(label, sizeof(label), pattern, vars, var_count);
+  sb_msg_arg(msg, "--set");
+  sb_msg_arg(msg, item);
+  sb_msg_str(msg, "label", label);
+}
+
+static inline int disk_mb_s(double bps) {
+  return bps >= 0 ? (int)(bps / (1 << 20) + 0.5) : -1;
+}
+
+// One message with a --push and --set per graph, so the bar updates all three
+// items without a round trip through the Lua handler. A graph is pushed
+// whenever its collector ran, so each column covers one interval; labels are
+// set for all three (any value may appear in any of them) unless the emission
+// gate held them back.
+static inline void build_direct(struct sb_message *msg,
+                                const struct system_stats_options *options,
+                                const struct system_stats_sample *sample,
+                                uint32_t refreshed,
+                                bool labels) {
+  const struct label_var vars[] = {
+    { "cpu_user", sample->cpu_user },
+    { "cpu_sys", sample->cpu_sys },
+    { "cpu_total", sample->cpu_total },
+    { "cpu_core_max", sample->cpu_core_max },
+    { "cpu_p", sample->cpu_p },
+    { "cpu_e", sample->cpu_e },
+    { "cpu_temp", sample->cpu_temp },
+    { "gpu_util", sample->gpu_util },
+    { "gpu_renderer", sample->gpu_renderer },
+    { "gpu_tiler", sample->gpu_tiler },
+    { "gpu_mem_mb", sample->gpu_mem_used >= 0 ? (int)(sample->gpu_mem_used >> 20) : -1 },
+    { "gpu_temp", sample->gpu_temp },
+    { "mem_used_percent", sample->mem_percent },
+    { "mem_pressure", sample->mem_pressure },
+    { "swap_used_mb", (int)(sample->mem_swap_used >> 20) },
+    { "disk_read_mb_s", disk_mb_s(sample->disk_read_bps) },
+    { "disk_write_mb_s", disk_mb_s(sample->disk_write_bps) },
+    { "disk_iops", sample->disk_read_iops >= 0
+                     ? (int)(sample->disk_read_iops + sample->disk_write_iops + 0.5)
+                     : -1 },
+  };
+  const int var_count = sizeof(vars) / sizeof(vars[0]);
+
+  build_direct_item(msg, options->direct_items[0], sample->cpu_total,
+                    REFRESHED(refreshed, COLLECT_CPU), labels, options->cpu_label, vars, var_count);
+  build_direct_item(msg, options->direct_items[1], sample->gpu_util,
+                    REFRESHED(refreshed, COLLECT_GPU), labels, options->gpu_label, vars, var_count);
+  build_direct_item(msg, options->direct_items[2], sample->mem_percent,
+                    REFRESHED(refreshed, COLLECT_MEM), labels, options->mem_label, vars, var_count);
+}
+
+struct procs_query {
+  struct proc_top top;
+  bool ok;
+  int n;
+  uint64_t due_ns;
+};
+
+// "name:value;..." with ';' in names replaced so the list stays splittable.
+static inline void append_proc_list(struct sb_message *msg,
+                                    const char *key,
+                                    const struct proc_top_entry *entries,
+                                    int count,
+                                    uint64_t interval_ns) {
+  sb_msg_key(msg, key);
+  for (int i = 0; i < count; i++) {
+    if (i > 0) sb_msg_append(msg, ";", 1);
+    for (const char *c = entries[i].name; *c; c++) {
+      sb_msg_append(msg, *c == ';' ? " " : c, 1);
+    }
+    sb_msg_append(msg, ":", 1);
+    if (interval_ns) {
+      sb_msg_append_double(msg, (double)entries[i].value / (double)interval_ns * 100.0, 1);
+    } else {
+      sb_msg_append_uint(msg, entries[i].value);
+    }
+  }
+  sb_msg_end_arg(msg);
+}
+
+// cpu_procs carries percent of one core over the sampled interval, mem_procs
+// resident bytes, procs_unreadable how many processes both lists leave out.
+static inline void send_procs(struct sb_message *msg,
+                              const struct system_stats_options *options,
+                              struct procs_query *query) {
+  struct proc_top_entry entries[PROC_TOP_MAX];
+  sb_msg_reset(msg);
+  sb_msg_arg(msg, "--trigger");
+  sb_msg_arg(msg, options->procs_event);
+  int count = proc_top_cpu(&query->top, entries, query->n);
+  append_proc_list(msg, "cpu_procs", entries, count, proc_top_interval_ns(&query->top));
+  count = proc_top_rss(&query->top, entries, query->n);
+  append_proc_list(msg, "mem_procs", entries, count, 0);
+  sb_msg_int(msg, "procs_unreadable", query->top.unreadable);
+  sb_msg_send(msg);
+}
+
+// The system_stats module (helpers/module.h): collectors, emission gate and
+// the state behind the control commands. Large, so keep it static.
+struct system_stats {
+  struct system_stats_options options;
+  struct cpu cpu;
+  struct mem mem;
+  // The memory source could not be set up (host port, sysctl); memory then
+  // reads as unavailable instead of zero.
+  bool mem_ok;
+  struct gpu gpu;
+  struct temps temps;
+  struct disk disk;
+  struct emit_gate gate;
+  struct emit_field fields[FIELD_COUNT];
+  struct procs_query procs_query;
+  struct gpu_procs gpu_procs;
+  struct sched sched;
+  struct system_stats_sample sample;
+  bool paused;
+  struct tape tape;
+  // Resync generation (sketchybar.h) the last full trigger answered.
+  uint64_t resync_seen;
+
+  char gpu_procs_buffer[2048];
+  char gpu_procs_emitted[2048];
+  char energy_procs_buffer[2048];
+  char energy_procs_emitted[2048];
+  char message_buffer[8192];
+  struct sb_message message;
+};
+
+static inline void system_stats_usage(const char *name) {
+  printf("Usage: %s \"<event-name>\" \"<event_freq>\" "
+         "[--period <collector>=<s>]... "
+         "[--load-threshold <pct>] [--temp-threshold <C>] [--disk-threshold <MB/s>] "
+         "[--heartbeat <s>] "
+         "[--direct <cpu-item>,<gpu-item>,<mem-item> "
+         "[--cpu-label <pattern>] [--gpu-label <pattern>] [--mem-label <pattern>]] "
+         "[--temp-detail] [--disk-detail] [--timing] [--energy-procs <n>] "
+         "[--control <fifo> [--procs-event <name>]] "
+         "[--record <tape> | --replay <tape> [--speed <x>]]\n",
+         name);
+}
+
+// What the collectors read. system_stats_init() takes the platform's;
+// synthetic ones plug in through system_stats_init_with().
+struct system_stats_sources {
+  struct cpu_source cpu;
+  struct mem_source mem;
+  struct gpu_source gpu;
+  struct temp_source temps;
+  struct disk_source disk;
+  struct gpu_proc_source gpu_procs;
+};
+
+static inline struct system_stats_sources system_stats_platform_sources(void) {
+  struct system_stats_sources sources;
+#ifdef __APPLE__
+  sources.cpu = cpu_mach_source();
+  sources.mem = mem_mach_source();
+  sources.gpu = gpu_iokit_source();
+  sources.temps = temp_hid_source();
+  sources.disk = disk_iokit_source();
+  sources.gpu_procs = gpu_proc_mach_source();
+#else
+  sources.cpu = cpu_proc_source("/proc/stat");
+  sources.mem = mem_proc_source("/proc/meminfo", "/proc/vmstat", "/proc/pressure/memory");
+  sources.gpu = gpu_none_source();
+  sources.temps = temp_none_source();
+  sources.disk = disk_proc_source("/proc/diskstats");
+  sources.gpu_procs = gpu_proc_none_source();
+#endif
+  return sources;
+}
+
+// Registers the events and starts the collectors; the options must already
+// be parsed. With --record every source is wrapped to write to the tape; with
+// --replay the tape stands in for all of them. Tasks are added in collector
+// order, so a task's bit is its collector's. GPU processes only appear in
+// triggers, so they are not collected in direct-drive mode. False when the
+// tape cannot be opened.
+static inline bool system_stats_init_with(struct system_stats *stats,
+                                          struct system_stats_sources sources,
+                                          uint64_t origin_ns) {
+  struct system_stats_options *options = &stats->options;
+  struct tape *tape = &stats->tape;
+  if (options->replay_path) {
+    if (!tape_replay(tape, options->replay_path)) return false;
+    sources.cpu = tape_cpu_replay(tape);
+    sources.mem = tape_mem_replay(tape);
+    sources.gpu = tape_gpu_replay(tape);
+    sources.temps = tape_temp_replay(tape);
+    sources.disk = tape_disk_replay(tape);
+    sources.gpu_procs = tape_gpu_proc_replay(tape);
+  } else if (options->record_path) {
+    if (!tape_record(tape, options->record_path)) return false;
+    sources.cpu = tape_cpu_record(tape, sources.cpu);
+    sources.mem = tape_mem_record(tape, sources.mem);
+    sources.gpu = tape_gpu_record(tape, sources.gpu);
+    sources.temps = tape_temp_record(tape, sources.temps);
+    sources.disk = tape_disk_record(tape, sources.disk);
+    sources.gpu_procs = tape_gpu_proc_record(tape, sources.gpu_procs);
+  } else {
+    memset(tape, 0, sizeof(struct tape));
+  }
+  cpu_init_with(&stats->cpu, sources.cpu);
+  stats->mem_ok = mem_init_with(&stats->mem, sources.mem);
+  gpu_init_with(&stats->gpu, sources.gpu);
+  temps_init(&stats->temps, sources.temps);
+  disk_init_with(&stats->disk, sources.disk);
+
+  emit_gate_init(&stats->gate, options->heartbeat);
+  emit_field_init(&stats->fields[FIELD_CPU_TOTAL], options->load_threshold);
+  emit_field_init(&stats->fields[FIELD_CPU_CORE_MAX], options->load_threshold);
+  emit_field_init(&stats->fields[FIELD_GPU_UTIL], options->load_threshold);
+  emit_field_init(&stats->fields[FIELD_MEM_PERCENT], options->load_threshold);
+  emit_field_init(&stats->fields[FIELD_MEM_PRESSURE], 0.0);
+  emit_field_init(&stats->fields[FIELD_CPU_TEMP], options->temp_threshold);
+  emit_field_init(&stats->fields[FIELD_GPU_TEMP], options->temp_threshold);
+  emit_field_init(&stats->fields[FIELD_DISK_READ], options->disk_threshold);
+  emit_field_init(&stats->fields[FIELD_DISK_WRITE], options->disk_threshold);
+
+  char event_message[256];
+  snprintf(event_message, sizeof(event_message), "--add event '%s'", options->event);
+  sketchybar(event_message);
+
+  memset(&stats->procs_query, 0, sizeof(struct procs_query));
+  if (options->control_path) {
+#ifdef __APPLE__
+    stats->procs_query.ok = proc_top_init(&stats->procs_query.top, proc_top_mach_source());
+#else
+    stats->procs_query.ok = proc_top_init(&stats->procs_query.top, proc_top_proc_source("/proc"));
+#endif
+    snprintf(event_message, sizeof(event_message), "--add event '%s'", options->procs_event);
+    sketchybar(event_message);
+  }
+
+  sb_msg_init(&stats->message, stats->message_buffer, sizeof(stats->message_buffer));
+  bool gpu_procs_ok = gpu_procs_init(&stats->gpu_procs, sources.gpu_procs);
+  stats->gpu_procs_buffer[0] = '\0';
+  stats->gpu_procs_emitted[0] = '\0';
+  stats->energy_procs_buffer[0] = '\0';
+  stats->energy_procs_emitted[0] = '\0';
+
+  sched_init(&stats->sched, origin_ns);
+  for (int i = 0; i < COLLECTORS; i++) {
+    if (i == COLLECT_GPU_PROCS && (options->direct || !gpu_procs_ok)) continue;
+    sched_add(&stats->sched, collector_names[i], collector_period_ns(options, i));
+  }
+
+  system_stats_sample_init(&stats->sample);
+  stats->paused = false;
+  stats->resync_seen = sketchybar_resync_generation();
+  return true;
+}
+
+static inline bool system_stats_init(struct system_stats *stats, uint64_t origin_ns) {
+  return system_stats_init_with(stats, system_stats_platform_sources(), origin_ns);
+}
+
+static inline uint64_t system_stats_next(void *context) {
+  struct system_stats *stats = context;
+  uint64_t next = stats->paused ? UINT64_MAX : sched_next(&stats->sched);
+  if (stats->procs_query.due_ns && stats->procs_query.due_ns < next) {
+    next = stats->procs_query.due_ns;
+  }
+  return next;
+}
+
+// While recording, the tick goes on the tape ahead of the source reads it
+// makes, and everything is flushed once it is done.
+//
+// A trigger only carries the collectors that ran, so it is sent as a partial
+// message. When one of those may have been lost (the resync generation
+// moved), the next tick bypasses the gate and sends every collector's latest
+// values as full state. Direct-drive messages push graph values and are
+// always partial.
+static inline void system_stats_tick(struct system_stats *stats, uint64_t now, uint32_t due) {
+  const struct system_stats_options *options = &stats->options;
+  struct system_stats_sample *sample = &stats->sample;
+  if (stats->tape.recording) {
+    tape_begin(&stats->tape, TAPE_TICK, true);
+    tape_write_u64(&stats->tape, now);
+    tape_write_u32(&stats->tape, due);
+    tape_end(&stats->tape);
+  }
+  struct mem *mem = stats->mem_ok ? &stats->mem : NULL;
+  collect_sample(&stats->cpu, mem, &stats->gpu, &stats->temps, &stats->disk, sample, now, due);
+
+  bool changed = !options->gated;
+  if (REFRESHED(due, COLLECT_GPU_PROCS)) {
+    stats->gpu_procs_buffer[0] = '\0';
+    stats->energy_procs_buffer[0] = '\0';
+    if (gpu_procs_update(&stats->gpu_procs, now)) {
+      gpu_procs_format(&stats->gpu_procs, stats->gpu_procs_buffer,
+                       sizeof(stats->gpu_procs_buffer), MAX_TOP_PROCS);
+      // Ranked from the same counter reads.
+      if (options->energy_top > 0) {
+        gpu_procs_format_rank(&stats->gpu_procs, GPU_PROC_RANK_ENERGY, stats->energy_procs_buffer,
+                              sizeof(stats->energy_procs_buffer), options->energy_top);
+      }
+    }
+    changed = changed || strcmp(stats->gpu_procs_buffer, stats->gpu_procs_emitted) != 0
+              || strcmp(stats->energy_procs_buffer, stats->energy_procs_emitted) != 0;
+  }
+
+  double values[FIELD_COUNT];
+  values[FIELD_CPU_TOTAL] = sample->cpu_total;
+  values[FIELD_CPU_CORE_MAX] = sample->cpu_core_max;
+  values[FIELD_GPU_UTIL] = sample->gpu_util;
+  values[FIELD_MEM_PERCENT] = sample->mem_percent;
+  values[FIELD_MEM_PRESSURE] = sample->mem_pressure;
+  values[FIELD_CPU_TEMP] = sample->cpu_temp;
+  values[FIELD_GPU_TEMP] = sample->gpu_temp;
+  values[FIELD_DISK_READ] = sample->disk_read_bps >= 0 ? sample->disk_read_bps / (1 << 20) : -1.0;
+  values[FIELD_DISK_WRITE] = sample->disk_write_bps >= 0 ? sample->disk_write_bps / (1 << 20) : -1.0;
+
+  for (int i = 0; i < FIELD_COUNT && !changed; i++) {
+    if (!REFRESHED(due, field_collectors[i])) continue;
+    changed = emit_field_changed(&stats->fields[i], values[i]);
+  }
+  if (stats->tape.recording) tape_flush(&stats->tape);
+  uint64_t generation = sketchybar_resync_generation();
+  bool resync = generation != stats->resync_seen;
+  if (resync) emit_gate_reset(&stats->gate);
+  if (!emit_gate_should_emit(&stats->gate, changed, now)) {
+    // The graphs still take one sample per interval; only labels and
+    // trigger fields wait for a change.
+    if (options->direct
+        && (REFRESHED(due, COLLECT_CPU) || REFRESHED(due, COLLECT_GPU)
+            || REFRESHED(due, COLLECT_MEM))) {
+      sb_msg_reset(&stats->message);
+      build_direct(&stats->message, options, sample, due, false);
+      sb_msg_send_partial(&stats->message);
+    }
+    return;
+  }
+  for (int i = 0; i < FIELD_COUNT; i++) {
+    if (REFRESHED(due, field_collectors[i])) emit_field_commit(&stats->fields[i], values[i]);
+  }
+
+  sb_msg_reset(&stats->message);
+  if (options->direct) {
+    build_direct(&stats->message, options, sample, due, true);
+  } else {
+    if (REFRESHED(due, COLLECT_GPU_PROCS)) {
+      memcpy(stats->gpu_procs_emitted, stats->gpu_procs_buffer, sizeof(stats->gpu_procs_emitted));
+      memcpy(stats->energy_procs_emitted, stats->energy_procs_buffer,
+             sizeof(stats->energy_procs_emitted));
+    }
+    // Tasks are numbered in collector order, so these are all of them.
+    uint32_t all = (1u << stats->sched.count) - 1;
+    uint32_t refreshed = resync ? all : due;
+    build_trigger(&stats->message, options, &stats->cpu, &stats->gpu, &stats->temps, &stats->disk,
+                  sample, stats->gpu_procs_buffer, stats->energy_procs_buffer, stats->gate.suppressed,
+                  refreshed);
+    if (refreshed == all) {
+      sb_msg_send(&stats->message);
+      stats->resync_seen = generation;
+      return;
+    }
+  }
+  sb_msg_send_partial(&stats->message);
+  stats->resync_seen = generation;
+}
+
+static inline void system_stats_run(void *context, uint64_t now, uint64_t due_ns) {
+  struct system_stats *stats = context;
+  struct procs_query *query = &stats->procs_query;
+  if (query->due_ns && query->due_ns <= due_ns) {
+    query->due_ns = 0;
+    if (proc_top_sample(&query->top, now)) send_procs(&stats->message, &stats->options, query);
+  }
+
+  if (stats->paused) return;
+  uint32_t due = sched_due(&stats->sched, due_ns);
+  if (due) system_stats_tick(stats, now, due);
+}
+
+// procs [n]: top n (default 10) processes by CPU and memory.
+// pause / resume: stop and restart collection.
+// rate <s> | rate <collector>=<s>: change the interval or one period.
+// Commands are recorded too, since resume reads the sources.
+static inline void system_stats_command_at(struct system_stats *stats,
+                                           const char *command,
+                                           uint64_t now) {
+  struct system_stats_options *options = &stats->options;
+  struct procs_query *query = &stats->procs_query;
+  const char *args;
+  if (stats->tape.recording) {
+    tape_begin(&stats->tape, TAPE_COMMAND, true);
+    tape_write_u64(&stats->tape, now);
+    tape_write_str(&stats->tape, command, TAPE_COMMAND_SIZE);
+    tape_end(&stats->tape);
+  }
+  if ((args = control_match(command, "procs")) && query->ok) {
+    int n = atoi(args);
+    query->n = n > 0 ? n : MAX_TOP_PROCS;
+    if (!proc_top_sample(&query->top, now)) return;
+
+    uint64_t interval = proc_top_interval_ns(&query->top);
+    if (interval >= PROCS_MIN_INTERVAL_NS && interval <= PROCS_MAX_INTERVAL_NS) {
+      query->due_ns = 0;
+      send_procs(&stats->message, options, query);
+    } else {
+      query->due_ns = now + PROCS_SETTLE_NS;
+    }
+  } else if (control_match(command, "pause")) {
+    stats->paused = true;
+  } else if (control_match(command, "resume")) {
+    if (!stats->paused) return;
+    stats->paused = false;
+    // Rates across the pause would average over time nobody saw.
+    cpu_reset(&stats->cpu);
+    cpu_update(&stats->cpu);
+    if (stats->mem_ok) {
+      mem_reset(&stats->mem);
+      mem_update(&stats->mem, now);
+    }
+    disk_reset(&stats->disk);
+    disk_update(&stats->disk, now);
+    if (stats->sched.count > COLLECT_GPU_PROCS) {
+      gpu_procs_reset(&stats->gpu_procs);
+      gpu_procs_update(&stats->gpu_procs, now);
+    }
+    emit_gate_reset(&stats->gate);
+    sched_reset(&stats->sched, now + CONTROL_RESUME_SETTLE_NS);
+  } else if ((args = control_match(command, "rate"))) {
+    if (strchr(args, '=')) {
+      if (!parse_period(args, options)) return;
+    } else {
+      float freq = (float)atof(args);
+      if (freq <= 0.0f) return;
+      options->update_freq = freq;
+    }
+    for (int i = 0; i < stats->sched.count; i++) {
+      sched_set_period(&stats->sched, i, collector_period_ns(options, i));
+    }
+    if (!stats->paused) sched_reset(&stats->sched, now);
+  }
+  if (stats->tape.recording) tape_flush(&stats->tape);
+}
+
+static inline void system_stats_command(void *context, const char *command) {
+  system_stats_command_at(context, command, sketchybar_now_ns());
+}
+
+// Runs a --replay tape: every recorded tick goes through system_stats_tick()
+// with its recorded time and collectors, and every command through
+// system_stats_command_at(), paced at options.speed times the recorded rate.
+// False when the tape no longer matches what the collectors ask for; a tape
+// that just ends early (its recorder was killed) replays up to there.
+static inline bool system_stats_replay(struct system_stats *stats) {
+  struct tape *tape = &stats->tape;
+  double speed = stats->options.speed;
+  uint64_t start = sketchybar_now_ns();
+  uint64_t first = 0;
+  bool started = false;
+  int channel;
+  while ((channel = tape_peek(tape)) >= 0) {
+    struct tape_reader reader;
+    uint64_t now = 0;
+    if (!tape_next(tape, (uint16_t)channel, &reader) || !tape_read_u64(&reader, &now)) {
+      break;
+    }
+    if (!started) first = now;
+    started = true;
+    if (speed > 0.0 && now > first) {
+      sched_sleep_until(start + (uint64_t)((double)(now - first) / speed));
+    }
+
+    if (channel == TAPE_TICK) {
+      uint32_t due = 0;
+      if (!tape_read_u32(&reader, &due)) break;
+      system_stats_tick(stats, now, due);
+    } else if (channel == TAPE_COMMAND) {
+      char command[TAPE_COMMAND_SIZE];
+      if (!tape_read_str(&reader, command, sizeof(command))) break;
+      system_stats_command_at(stats, command, now);
+    } else {
+      tape->failed = true;
+    }
+  }
+  return !tape->failed || tape->ended;
+}
+
+static inline struct module system_stats_module(struct system_stats *stats) {
+  return (struct module){ "system_stats", stats, system_stats_next, system_stats_run,
+                          system_stats_command, 0 };
+}
@@ -0,0 +1,523 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "disk.h"
+#include "gpu.h"
+#include "gpu_procs.h"
+#include "mem.h"
+#include "temps.h"
+#include "../tape.h"
+
+// Recording and replaying the system_stats sources (helpers/tape.h).
+//
+// A recording wrapper calls the source it wraps and writes what it returned
+// to the tape; the replaying one returns those records in order, so the
+// collectors compute the same deltas and rates without the machine they were
+// recorded on. Payloads carry only what the call filled in: the counters of
+// the cores, disks and pids listed, not the whole snapshot, each field written
+// on its own (see tape.h). Handles (sensors, processes) are recorded with each
+// read and checked on replay.
+
+enum {
+  TAPE_TICK,
+  TAPE_COMMAND,
+  TAPE_CPU_READ,
+  TAPE_CPU_CLUSTERS,
+  TAPE_MEM_INVARIANTS,
+  TAPE_MEM_READ,
+  TAPE_GPU_READ,
+  TAPE_TEMP_ENUMERATE,
+  TAPE_TEMP_READ,
+  TAPE_TEMP_CHANGED,
+  TAPE_DISK_READ,
+  TAPE_GPU_PROC_LIST,
+  TAPE_GPU_PROC_ATTACH,
+  TAPE_GPU_PROC_READ
+};
+
+// CPU
+
+struct tape_cpu_source {
+  struct tape* tape;
+  struct cpu_source inner;
+};
+
+static struct tape_cpu_source g_tape_cpu = { 0 };
+
+static inline bool tape_cpu_record_read(void* context, struct cpu_ticks* out) {
+  struct tape_cpu_source* source = context;
+  bool ok = source->inner.read(source->inner.context, out);
+  int32_t count = ok ? out->count : 0;
+  tape_begin(source->tape, TAPE_CPU_READ, ok);
+  tape_write_i32(source->tape, count);
+  for (int state = 0; state < CPU_TICK_STATES; state++) {
+    for (int i = 0; i < count; i++) tape_write_u64(source->tape, out->ticks[state][i]);
+  }
+  tape_end(source->tape);
+  return ok;
+}
+
+// Also recorded without an inner clusters callback, since the replay always
+// has one.
+static inline void tape_cpu_record_clusters(void* context, uint8_t* kinds, int count) {
+  struct tape_cpu_source* source = context;
+  if (source->inner.clusters) source->inner.clusters(source->inner.context, kinds, count);
+  tape_put(source->tape, TAPE_CPU_CLUSTERS, true, kinds, (uint32_t)count);
+}
+
+static inline bool tape_cpu_replay_read(void* context, struct cpu_ticks* out) {
+  struct tape_cpu_source* source = context;
+  struct tape_reader reader;
+  int32_t count = 0;
+  if (!tape_next(source->tape, TAPE_CPU_READ, &reader)
+      || !tape_read_i32(&reader, &count)
+      || count < 0 || count > CPU_MAX_CORES) {
+    return false;
+  }
+  out->count = count;
+  for (int state = 0; state < CPU_TICK_STATES; state++) {
+    for (int i = 0; i < count; i++) {
+      if (!tape_read_u64(&reader, &out->ticks[state][i])) return false;
+    }
+  }
+  return reader.ok;
+}
+
+static inline void tape_cpu_replay_clusters(void* context, uint8_t* kinds, int count) {
+  struct tape_cpu_source* source = context;
+  struct tape_reader reader;
+  if (tape_next(source->tape, TAPE_CPU_CLUSTERS, &reader)) {
+    tape_read(&reader, kinds, (uint32_t)count);
+  }
+}
+
+static inline struct cpu_source tape_cpu_record(struct tape* tape, struct cpu_source inner) {
+  g_tape_cpu = (struct tape_cpu_source){ tape, inner };
+  return (struct cpu_source){ inner.name, tape_cpu_record_read, tape_cpu_record_clusters,
+                              &g_tape_cpu };
+}
+
+static inline struct cpu_source tape_cpu_replay(struct tape* tape) {
+  g_tape_cpu = (struct tape_cpu_source){ tape, { 0 } };
+  return (struct cpu_source){ "tape", tape_cpu_replay_read, tape_cpu_replay_clusters,
+                              &g_tape_cpu };
+}
+
+// Memory
+
+struct tape_mem_source {
+  struct tape* tape;
+  struct mem_source inner;
+};
+
+static struct tape_mem_source g_tape_mem = { 0 };
+
+static inline bool tape_mem_record_invariants(void* context, uint64_t* total_bytes, uint64_t* page_size) {
+  struct tape_mem_source* source = context;
+  bool ok = source->inner.invariants(source->inner.context, total_bytes, page_size);
+  tape_begin(source->tape, TAPE_MEM_INVARIANTS, ok);
+  tape_write_u64(source->tape, *total_bytes);
+  tape_write_u64(source->tape, *page_size);
+  tape_end(source->tape);
+  return ok;
+}
+
+static inline bool tape_mem_record_read(void* context, struct mem_reading* out) {
+  struct tape_mem_source* source = context;
+  bool ok = source->inner.read(source->inner.context, out);
+  tape_begin(source->tape, TAPE_MEM_READ, ok);
+  tape_write_u64(source->tape, out->used);
+  tape_write_u64(source->tape, out->wired);
+  tape_write_u64(source->tape, out->compressed);
+  tape_write_u64(source->tape, out->file_backed);
+  tape_write_u64(source->tape, out->swap_total);
+  tape_write_u64(source->tape, out->swap_used);
+  tape_write_u64(source->tape, out->swapins);
+  tape_write_u64(source->tape, out->swapouts);
+  tape_write_i32(source->tape, out->pressure);
+  tape_end(source->tape);
+  return ok;
+}
+
+static inline bool tape_mem_replay_invariants(void* context, uint64_t* total_bytes, uint64_t* page_size) {
+  struct tape_mem_source* source = context;
+  struct tape_reader reader;
+  return tape_next(source->tape, TAPE_MEM_INVARIANTS, &reader)
+         && tape_read_u64(&reader, total_bytes)
+         && tape_read_u64(&reader, page_size)
+         && reader.ok;
+}
+
+static inline bool tape_mem_replay_read(void* context, struct mem_reading* out) {
+  struct tape_mem_source* source = context;
+  struct tape_reader reader;
+  int32_t pressure = 0;
+  bool ok = tape_next(source->tape, TAPE_MEM_READ, &reader)
+            && tape_read_u64(&reader, &out->used)
+            && tape_read_u64(&reader, &out->wired)
+            && tape_read_u64(&reader, &out->compressed)
+            && tape_read_u64(&reader, &out->file_backed)
+            && tape_read_u64(&reader, &out->swap_total)
+            && tape_read_u64(&reader, &out->swap_used)
+            && tape_read_u64(&reader, &out->swapins)
+            && tape_read_u64(&reader, &out->swapouts)
+            && tape_read_i32(&reader, &pressure);
+  out->pressure = pressure;
+  return ok && reader.ok;
+}
+
+static inline struct mem_source tape_mem_record(struct tape* tape, struct mem_source inner) {
+  g_tape_mem = (struct tape_mem_source){ tape, inner };
+  return (struct mem_source){ inner.name, tape_mem_record_invariants, tape_mem_record_read,
+                              &g_tape_mem };
+}
+
+static inline struct mem_source tape_mem_replay(struct tape* tape) {
+  g_tape_mem = (struct tape_mem_source){ tape, { 0 } };
+  return (struct mem_source){ "tape", tape_mem_replay_invariants, tape_mem_replay_read,
+                              &g_tape_mem };
+}
+
+// GPU
+
+struct tape_gpu_source {
+  struct tape* tape;
+  struct gpu_source inner;
+};
+
+static struct tape_gpu_source g_tape_gpu = { 0 };
+
+static inline bool tape_gpu_record_read(void* context, struct gpu_reading* out) {
+  struct tape_gpu_source* source = context;
+  bool ok = source->inner.read(source->inner.context, out);
+  tape_begin(source->tape, TAPE_GPU_READ, ok);
+  tape_write_i32(source->tape, out->device_util);
+  tape_write_i32(source->tape, out->renderer_util);
+  tape_write_i32(source->tape, out->tiler_util);
+  tape_write_i64(source->tape, out->mem_used_bytes);
+  tape_end(source->tape);
+  return ok;
+}
+
+static inline bool tape_gpu_replay_read(void* context, struct gpu_reading* out) {
+  struct tape_gpu_source* source = context;
+  struct tape_reader reader;
+  int32_t device = 0, renderer = 0, tiler = 0;
+  int64_t mem_used = 0;
+  bool ok = tape_next(source->tape, TAPE_GPU_READ, &reader)
+            && tape_read_i32(&reader, &device)
+            && tape_read_i32(&reader, &renderer)
+            && tape_read_i32(&reader, &tiler)
+            && tape_read_i64(&reader, &mem_used);
+  out->device_util = device;
+  out->renderer_util = renderer;
+  out->tiler_util = tiler;
+  out->mem_used_bytes = mem_used;
+  return ok && reader.ok;
+}
+
+static inline struct gpu_source tape_gpu_record(struct tape* tape, struct gpu_source inner) {
+  g_tape_gpu = (struct tape_gpu_source){ tape, inner };
+  return (struct gpu_source){ inner.name, tape_gpu_record_read, &g_tape_gpu };
+}
+
+static inline struct gpu_source tape_gpu_replay(struct tape* tape) {
+  g_tape_gpu = (struct tape_gpu_source){ tape, { 0 } };
+  return (struct gpu_source){ "tape", tape_gpu_replay_read, &g_tape_gpu };
+}
+
+// Temperatures
+
+struct tape_temp_source {
+  struct tape* tape;
+  struct temp_source inner;
+};
+
+static struct tape_temp_source g_tape_temp = { 0 };
+
+static inline int tape_temp_record_enumerate(void* context, struct temp_service* out, int capacity) {
+  struct tape_temp_source* source = context;
+  int32_t count = source->inner.enumerate(source->inner.context, out, capacity);
+  int32_t listed = count < capacity ? count : capacity;
+  tape_begin(source->tape, TAPE_TEMP_ENUMERATE, count >= 0);
+  tape_write_i32(source->tape, count);
+  for (int i = 0; i < listed; i++) {
+    tape_write_str(source->tape, out[i].name, sizeof(out[i].name));
+    tape_write_u64(source->tape, out[i].handle);
+  }
+  tape_end(source->tape);
+  return count;
+}
+
+static inline bool tape_temp_record_read(void* context, uint64_t handle, double* celsius) {
+  struct tape_temp_source* source = context;
+  bool ok = source->inner.read(source->inner.context, handle, celsius);
+  tape_begin(source->tape, TAPE_TEMP_READ, ok);
+  tape_write_u64(source->tape, handle);
+  tape_write_f64(source->tape, *celsius);
+  tape_end(source->tape);
+  return ok;
+}
+
+static inline bool tape_temp_record_changed(void* context) {
+  struct tape_temp_source* source = context;
+  bool changed = source->inner.changed && source->inner.changed(source->inner.context);
+  tape_put(source->tape, TAPE_TEMP_CHANGED, changed, NULL, 0);
+  return changed;
+}
+
+static inline int tape_temp_replay_enumerate(void* context, struct temp_service* out, int capacity) {
+  struct tape_temp_source* source = context;
+  struct tape_reader reader;
+  int32_t count = 0;
+  if (!tape_next(source->tape, TAPE_TEMP_ENUMERATE, &reader)
+      || !tape_read_i32(&reader, &count)) {
+    return -1;
+  }
+  int32_t listed = count < capacity ? count : capacity;
+  for (int i = 0; i < listed; i++) {
+    if (!tape_read_str(&reader, out[i].name, sizeof(out[i].name))
+        || !tape_read_u64(&reader, &out[i].handle)) {
+      return -1;
+    }
+  }
+  return count;
+}
+
+static inline bool tape_temp_replay_read(void* context, uint64_t handle, double* celsius) {
+  struct tape_temp_source* source = context;
+  struct tape_reader reader;
+  uint64_t recorded = 0;
+  if (!tape_next(source->tape, TAPE_TEMP_READ, &reader)
+      || !tape_read_u64(&reader, &recorded)
+      || !tape_read_f64(&reader, celsius)) {
+    return false;
+  }
+  if (recorded != handle) {
+    source->tape->failed = true;
+    return false;
+  }
+  return reader.ok;
+}
+
+static inline bool tape_temp_replay_changed(void* context) {
+  struct tape_temp_source* source = context;
+  struct tape_reader reader;
+  return tape_next(source->tape, TAPE_TEMP_CHANGED, &reader) && reader.ok;
+}
+
+static inline struct temp_source tape_temp_record(struct tape* tape, struct temp_source inner) {
+  g_tape_temp = (struct tape_temp_source){ tape, inner };
+  return (struct temp_source){ inner.name, tape_temp_record_enumerate, tape_temp_record_read,
+                               tape_temp_record_changed, &g_tape_temp };
+}
+
+static inline struct temp_source tape_temp_replay(struct tape* tape) {
+  g_tape_temp = (struct tape_temp_source){ tape, { 0 } };
+  return (struct temp_source){ "tape", tape_temp_replay_enumerate, tape_temp_replay_read,
+                               tape_temp_replay_changed, &g_tape_temp };
+}
+
+// Disks
+
+struct tape_disk_source {
+  struct tape* tape;
+  struct disk_source inner;
+};
+
+static struct tape_disk_source g_tape_disk = { 0 };
+
+static inline bool tape_disk_record_read(void* context, struct disk_snapshot* out) {
+  struct tape_disk_source* source = context;
+  bool ok = source->inner.read(source->inner.context, out);
+  int32_t count = ok ? out->count : 0;
+  tape_begin(source->tape, TAPE_DISK_READ, ok);
+  tape_write_i32(source->tape, count);
+  for (int i = 0; i < count; i++) {
+    const struct disk_counters* entry = &out->entries[i];
+    tape_write_str(source->tape, entry->name, sizeof(entry->name));
+    tape_write_u64(source->tape, entry->bytes_read);
+    tape_write_u64(source->tape, entry->bytes_written);
+    tape_write_u64(source->tape, entry->reads);
+    tape_write_u64(source->tape, entry->writes);
+  }
+  tape_end(source->tape);
+  return ok;
+}
+
+static inline bool tape_disk_replay_read(void* context, struct disk_snapshot* out) {
+  struct tape_disk_source* source = context;
+  struct tape_reader reader;
+  int32_t count = 0;
+  if (!tape_next(source->tape, TAPE_DISK_READ, &reader)
+      || !tape_read_i32(&reader, &count)
+      || count < 0 || count > DISK_MAX_DEVICES) {
+    return false;
+  }
+  for (int i = 0; i < count; i++) {
+    struct disk_counters* entry = &out->entries[i];
+    if (!tape_read_str(&reader, entry->name, sizeof(entry->name))
+        || !tape_read_u64(&reader, &entry->bytes_read)
+        || !tape_read_u64(&reader, &entry->bytes_written)
+        || !tape_read_u64(&reader, &entry->reads)
+        || !tape_read_u64(&reader, &entry->writes)) {
+      return false;
+    }
+  }
+  out->count = count;
+  return reader.ok;
+}
+
+static inline struct disk_source tape_disk_record(struct tape* tape, struct disk_source inner) {
+  g_tape_disk = (struct tape_disk_source){ tape, inner };
+  return (struct disk_source){ inner.name, tape_disk_record_read, &g_tape_disk };
+}
+
+static inline struct disk_source tape_disk_replay(struct tape* tape) {
+  g_tape_disk = (struct tape_disk_source){ tape, { 0 } };
+  return (struct disk_source){ "tape", tape_disk_replay_read, &g_tape_disk };
+}
+
+// GPU processes. A listing that did not fit is recorded without its pids,
+// since the caller lists again with room for them. Detaching has no result,
+// so it is not recorded.
+
+struct tape_gpu_proc_source {
+  struct tape* tape;
+  struct gpu_proc_source inner;
+};
+
+static struct tape_gpu_proc_source g_tape_gpu_proc = { 0 };
+
+static inline int tape_gpu_proc_record_list(void* context, pid_t* pids, int capacity) {
+  struct tape_gpu_proc_source* source = context;
+  int32_t count = source->inner.list(source->inner.context, pids, capacity);
+  int32_t listed = count >= 0 && count <= capacity ? count : 0;
+  tape_begin(source->tape, TAPE_GPU_PROC_LIST, count >= 0);
+  tape_write_i32(source->tape, count);
+  for (int i = 0; i < listed; i++) tape_write_i32(source->tape, pids[i]);
+  tape_end(source->tape);
+  return count;
+}
+
+static inline bool tape_gpu_proc_record_attach(void* context,
+                                               pid_t pid,
+                                               uint64_t* handle,
+                                               char* name,
+                                               size_t name_size) {
+  struct tape_gpu_proc_source* source = context;
+  bool ok = source->inner.attach(source->inner.context, pid, handle, name, name_size);
+  tape_begin(source->tape, TAPE_GPU_PROC_ATTACH, ok);
+  tape_write_i32(source->tape, pid);
+  if (ok) {
+    tape_write_u64(source->tape, *handle);
+    tape_write_str(source->tape, name, name_size);
+  }
+  tape_end(source->tape);
+  return ok;
+}
+
+static inline bool tape_gpu_proc_record_read(void* context,
+                                             uint64_t handle,
+                                             struct gpu_proc_counters* out) {
+  struct tape_gpu_proc_source* source = context;
+  bool ok = source->inner.read(source->inner.context, handle, out);
+  tape_begin(source->tape, TAPE_GPU_PROC_READ, ok);
+  tape_write_u64(source->tape, handle);
+  tape_write_u64(source->tape, out->gpu_ns);
+  tape_write_u64(source->tape, out->cpu_ns);
+  tape_write_u64(source->tape, out->wakeups);
+  tape_end(source->tape);
+  return ok;
+}
+
+static inline void tape_gpu_proc_record_detach(void* context, uint64_t handle) {
+  struct tape_gpu_proc_source* source = context;
+  source->inner.detach(source->inner.context, handle);
+}
+
+static inline int tape_gpu_proc_replay_list(void* context, pid_t* pids, int capacity) {
+  struct tape_gpu_proc_source* source = context;
+  struct tape_reader reader;
+  int32_t count = 0;
+  if (!tape_next(source->tape, TAPE_GPU_PROC_LIST, &reader)
+      || !tape_read_i32(&reader, &count)) {
+    return -1;
+  }
+  int32_t listed = count >= 0 && count <= capacity ? count : 0;
+  for (int i = 0; i < listed; i++) {
+    int32_t pid = 0;
+    if (!tape_read_i32(&reader, &pid)) return -1;
+    pids[i] = pid;
+  }
+  return count;
+}
+
+static inline bool tape_gpu_proc_replay_attach(void* context,
+                                               pid_t pid,
+                                               uint64_t* handle,
+                                               char* name,
+                                               size_t name_size) {
+  struct tape_gpu_proc_source* source = context;
+  struct tape_reader reader;
+  int32_t recorded = 0;
+  if (!tape_next(source->tape, TAPE_GPU_PROC_ATTACH, &reader)
+      || !tape_read_i32(&reader, &recorded)) {
+    return false;
+  }
+  if (recorded != pid) {
+    source->tape->failed = true;
+    return false;
+  }
+  return reader.ok && tape_read_u64(&reader, handle) && tape_read_str(&reader, name, name_size);
+}
+
+static inline bool tape_gpu_proc_replay_read(void* context,
+                                             uint64_t handle,
+                                             struct gpu_proc_counters* out) {
+  struct tape_gpu_proc_source* source = context;
+  struct tape_reader reader;
+  uint64_t recorded = 0;
+  if (!tape_next(source->tape, TAPE_GPU_PROC_READ, &reader)
+      || !tape_read_u64(&reader, &recorded)
+      || !tape_read_u64(&reader, &out->gpu_ns)
+      || !tape_read_u64(&reader, &out->cpu_ns)
+      || !tape_read_u64(&reader, &out->wakeups)) {
+    return false;
+  }
+  if (recorded != handle) {
+    source->tape->failed = true;
+    return false;
+  }
+  return reader.ok;
+}
+
+static inline void tape_gpu_proc_replay_detach(void* context, uint64_t handle) {
+  (void)context;
+  (void)handle;
+}
+
+static inline struct gpu_proc_source tape_gpu_proc_record(struct tape* tape,
+                                                          struct gpu_proc_source inner) {
+  g_tape_gpu_proc = (struct tape_gpu_proc_source){ tape, inner };
+  return (struct gpu_proc_source){ inner.name,
+                                   tape_gpu_proc_record_list,
+                                   tape_gpu_proc_record_attach,
+                                   tape_gpu_proc_record_read,
+                                   tape_gpu_proc_record_detach,
+                                   &g_tape_gpu_proc };
+}
+
+static inline struct gpu_proc_source tape_gpu_proc_replay(struct tape* tape) {
+  g_tape_gpu_proc = (struct tape_gpu_proc_source){ tape, { 0 } };
+  return (struct gpu_proc_source){ "tape",
+                                   tape_gpu_proc_replay_list,
+                                   tape_gpu_proc_replay_attach,
+                                   tape_gpu_proc_replay_read,
+                                   tape_gpu_proc_replay_detach,
+                                   &g_tape_gpu_proc };
+}
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/hid/IOHIDKeys.h>
+#include <IOKit/hidsystem/IOHIDEventSystemClient.h>
+#include <IOKit/hidsystem/IOHIDServiceClient.h>
+#endif
+
+// Temperature sensors, grouped into clusters.
+//
+// The source lists its temperature services once; their names are classified
+// ("PMU tdie*" is CPU, "PMU tdev*" is GPU) into a compact array of handles
+// ordered by cluster, and every other service is dropped. Later updates only
+// read those handles. The array is rebuilt when the source reports that
+// services were added or that a classified one was removed (the hid source
+// gets both as notifications), or after a read fails (sensors may also fail
+// transiently, so such rebuilds happen at most every
+// TEMP_FAILURE_REBUILD_INTERVAL updates). Each update keeps
+// min/avg/max per cluster and the latest reading per sensor.
+
+#define TEMP_MAX_SENSORS 64
+#define TEMP_NAME_SIZE 32
+#define TEMP_FAILURE_REBUILD_INTERVAL 30
+
+enum {
+  TEMP_CLUSTER_CPU,
+  TEMP_CLUSTER_GPU,
+  TEMP_CLUSTERS
+};
+
+struct temp_service {
+  char name[TEMP_NAME_SIZE];
+  uint64_t handle;
+};
+
+struct temp_source {
+  const char* name;
+  // Lists the temperature services; returns how many (at most capacity), or
+  // a negative value on failure.
+  int (*enumerate)(void* context, struct temp_service* out, int capacity);
+  // Reads one sensor in degrees Celsius; false when it is gone.
+  bool (*read)(void* context, uint64_t handle, double* celsius);
+  // True when services appeared or disappeared since the last call. Optional.
+  bool (*changed)(void* context);
+  void* context;
+};
+
+struct temp_sensor {
+  uint64_t handle;
+  uint8_t cluster;
+  double celsius;  // -1 when the last reading was unusable
+  char name[TEMP_NAME_SIZE];
+};
+
+struct temp_cluster {
+  int count;
+  double min;
+  double max;
+  double sum;
+};
+
+struct temps {
+  struct temp_source source;
+  bool valid;
+  int count;
+  struct temp_sensor sensors[TEMP_MAX_SENSORS];
+  struct temp_cluster clusters[TEMP_CLUSTERS];
+
+  uint64_t updates;
+  uint64_t failure_rebuild_at;
+  uint64_t rebuilds;
+  uint64_t read_failures;
+};
+
+static inline int temp_classify(const char* product) {
+  if (strstr(product, "PMU tdie")) return TEMP_CLUSTER_CPU;
+  if (strstr(product, "PMU tdev")) return TEMP_CLUSTER_GPU;
+  return -1;
+}
+
+static inline void temps_init(struct temps* temps, struct temp_source source) {
+  memset(temps, 0, sizeof(struct temps));
+  temps->source = source;
+}
+
+static inline void temps_rebuild(struct temps* temps) {
+  struct temp_service services[TEMP_MAX_SENSORS * 4];
+  int count = temps->source.enumerate(temps->source.context,
+                                      services,
+                                      sizeof(services) / sizeof(services[0]));
+  temps->rebuilds++;
+  temps->count = 0;
+  temps->valid = count >= 0;
+
+  for (int cluster = 0; cluster < TEMP_CLUSTERS; cluster++) {
+    for (int i = 0; i < count && temps->count < TEMP_MAX_SENSORS; i++) {
+      if (temp_classify(services[i].name) != cluster) continue;
+      struct temp_sensor* sensor = &temps->sensors[temps->count++];
+      sensor->handle = services[i].handle;
+      sensor->cluster = (uint8_t)cluster;
+      sensor->celsius = -1.0;
+      memcpy(sensor->name, services[i].name, TEMP_NAME_SIZE);
+    }
+  }
+}
+
+static inline void temps_update(struct temps* temps) {
+  bool changed = temps->source.changed && temps->source.changed(temps->source.context);
+  if (!temps->valid || changed) temps_rebuild(temps);
+  temps->updates++;
+
+  for (int cluster = 0; cluster < TEMP_CLUSTERS; cluster++) {
+    temps->clusters[cluster] = (struct temp_cluster){ 0, 0.0, 0.0, 0.0 };
+  }
+
+  for (int i = 0; i < temps->count; i++) {
+    struct temp_sensor* sensor = &temps->sensors[i];
+    double celsius = -1.0;
+    if (!temps->source.read(temps->source.context, sensor->handle, &celsius)) {
+      temps->read_failures++;
+      if (temps->updates >= temps->failure_rebuild_at) {
+        temps->valid = false;
+        temps->failure_rebuild_at = temps->updates + TEMP_FAILURE_REBUILD_INTERVAL;
+      }
+      celsius = -1.0;
+    }
+    if (!isfinite(celsius) || celsius <= 0.0) celsius = -1.0;
+    sensor->celsius = celsius;
+    if (celsius < 0.0) continue;
+
+    struct temp_cluster* cluster = &temps->clusters[sensor->cluster];
+    if (cluster->count == 0 || celsius < cluster->min) cluster->min = celsius;
+    if (cluster->count == 0 || celsius > cluster->max) cluster->max = celsius;
+    cluster->sum += celsius;
+    cluster->count++;
+  }
+}
+
+// Rounded cluster statistics, -1 when no sensor of the cluster has a reading.
+static inline int temps_min(const struct temps* temps, int cluster) {
+  return temps->clusters[cluster].count ? (int)lround(temps->clusters[cluster].min) : -1;
+}
+
+static inline int temps_max(const struct temps* temps, int cluster) {
+  return temps->clusters[cluster].count ? (int)lround(temps->clusters[cluster].max) : -1;
+}
+
+static inline int temps_avg(const struct temps* temps, int cluster) {
+  const struct temp_cluster* stats = &temps->clusters[cluster];
+  return stats->count ? (int)lround(stats->sum / (double)stats->count) : -1;
+}
+
+#ifdef __APPLE__
+// Private IOHIDEventSystemClient API, as used by other temperature tools.
+typedef struct __IOHIDEvent *IOHIDEventRef;
+typedef void (*IOHIDServiceClientCallback)(void* target, void* refcon, IOHIDServiceClientRef service);
+
+IOHIDEventSystemClientRef IOHIDEventSystemClientCreateWithType(CFAllocatorRef allocator,
+                                                               int type,
+                                                               CFDictionaryRef options);
+void IOHIDEventSystemClientSetMatching(IOHIDEventSystemClientRef client, CFDictionaryRef match);
+void IOHIDEventSystemClientRegisterDeviceMatchingCallback(IOHIDEventSystemClientRef client,
+                                                          IOHIDServiceClientCallback callback,
+                                                          void* target,
+                                                          void* refcon);
+void IOHIDServiceClientRegisterRemovalCallback(IOHIDServiceClientRef service,
+                                               IOHIDServiceClientCallback callback,
+                                               void* target,
+                                               void* refcon);
+void IOHIDEventSystemClientScheduleWithRunLoop(IOHIDEventSystemClientRef client,
+                                               CFRunLoopRef runloop,
+                                               CFStringRef mode);
+IOHIDEventRef IOHIDServiceClientCopyEvent(IOHIDServiceClientRef service,
+                                          int32_t eventType,
+                                          int64_t timestamp,
+                                          uint32_t options);
+double IOHIDEventGetFloatValue(IOHIDEventRef event, int32_t field);
+
+struct temp_hid_source {
+  IOHIDEventSystemClientRef client;
+  CFArrayRef services;
+  bool changed;
+};
+
+static struct temp_hid_source g_temp_hid = { 0 };
+
+// A service appeared, or one of the classified ones went away.
+static inline void temp_hid_changed_callback(void* target,
+                                             void* refcon,
+                                             IOHIDServiceClientRef service) {
+  (void)target;
+  (void)refcon;
+  (void)service;
+  g_temp_hid.changed = true;
+}
+
+static inline bool temp_hid_open(struct temp_hid_source* hid) {
+  if (hid->client) return true;
+  hid->client = IOHIDEventSystemClientCreateWithType(kCFAllocatorDefault, 1, NULL);
+  if (!hid->client) return false;
+
+  // Only temperature sensors (vendor page 0xff00, usage 5).
+  int page = 0xff00;
+  int usage = 5;
+  CFNumberRef values[2] = { CFNumberCreate(NULL, kCFNumberIntType, &page),
+                            CFNumberCreate(NULL, kCFNumberIntType, &usage) };
+  const void* keys[2] = { CFSTR("PrimaryUsagePage"), CFSTR("PrimaryUsage") };
+  CFDictionaryRef match = CFDictionaryCreate(NULL, keys, (const void**)values, 2,
+                                             &kCFTypeDictionaryKeyCallBacks,
+                                             &kCFTypeDictionaryValueCallBacks);
+  IOHIDEventSystemClientSetMatching(hid->client, match);
+  CFRelease(match);
+  CFRelease(values[0]);
+  CFRelease(values[1]);
+
+  IOHIDEventSystemClientRegisterDeviceMatchingCallback(hid->client, temp_hid_changed_callback,
+                                                       NULL, NULL);
+  IOHIDEventSystemClientScheduleWithRunLoop(hid->client, CFRunLoopGetCurrent(), kCFRunLoopDefaultMode);
+  return true;
+}
+
+static inline int temp_hid_enumerate(void* context, struct temp_service* out, int capacity) {
+  struct temp_hid_source* hid = context;
+  if (!temp_hid_open(hid)) return -1;
+  if (hid->services) CFRelease(hid->services);
+  hid->services = IOHIDEventSystemClientCopyServices(hid->client);
+  if (!hid->services) return -1;
+
+  int count = 0;
+  CFIndex service_count = CFArrayGetCount(hid->services);
+  for (CFIndex i = 0; i < service_count && count < capacity; i++) {
+    IOHIDServiceClientRef service = (IOHIDServiceClientRef)CFArrayGetValueAtIndex(hid->services, i);
+    if (!IOHIDServiceClientConformsTo(service, 0xff00, 5)) continue;
+
+    CFTypeRef product = IOHIDServiceClientCopyProperty(service, CFSTR(kIOHIDProductKey));
+    if (!product) continue;
+    bool named = CFGetTypeID(product) == CFStringGetTypeID()
+                 && CFStringGetCString((CFStringRef)product,
+                                       out[count].name,
+                                       sizeof(out[count].name),
+                                       kCFStringEncodingUTF8);
+    CFRelease(product);
+    if (!named) continue;
+
+    // Only sensors temps_rebuild() keeps need to report their removal.
+    if (temp_classify(out[count].name) >= 0) {
+      IOHIDServiceClientRegisterRemovalCallback(service, temp_hid_changed_callback, NULL, NULL);
+    }
+    // The services array keeps the handle alive until the next enumeration.
+    out[count].handle = (uint64_t)(uintptr_t)service;
+    count++;
+  }
+  return count;
+}
+
+static inline bool temp_hid_read(void* context, uint64_t handle, double* celsius) {
+  (void)context;
+  enum { kHIDTemperatureEventType = 15 };
+  const int32_t field = (kHIDTemperatureEventType << 16);
+
+  IOHIDServiceClientRef service = (IOHIDServiceClientRef)(uintptr_t)handle;
+  IOHIDEventRef event = IOHIDServiceClientCopyEvent(service, kHIDTemperatureEventType, 0, 0);
+  if (!event) return false;
+  *celsius = IOHIDEventGetFloatValue(event, field);
+  CFRelease(event);
+  return true;
+}
+
+// Matching and removal notifications are delivered through the run loop;
+// drain them without blocking.
+static inline bool temp_hid_changed(void* context) {
+  struct temp_hid_source* hid = context;
+  if (!hid->client) return false;
+  while (CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0, true) == kCFRunLoopRunHandledSource);
+  bool changed = hid->changed;
+  hid->changed = false;
+  return changed;
+}
+
+static inline struct temp_source temp_hid_source(void) {
+  return (struct temp_source){ "hid", temp_hid_enumerate, temp_hid_read, temp_hid_changed, &g_temp_hid };
+}
+#else
+// No sensors off macOS; every cluster reads as unavailable.
+static inline int temp_none_enumerate(void* context, struct temp_service* out, int capacity) {
+  (void)context;
+  (void)out;
+  (void)capacity;
+  return 0;
+}
+
+static inline bool temp_none_read(void* context, uint64_t handle, double* celsius) {
+  (void)context;
+  (void)handle;
+  (void)celsius;
+  return false;
+}
+
+static inline struct temp_source temp_none_source(void) {
+  return (struct temp_source){ "none", temp_none_enumerate, temp_none_read, NULL, NULL };
+}
+#endif
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Sample tapes: a compact binary log of what a helper's sources returned, so
+// a run can be replayed later through the same delta and emission code.
+//
+// A tape is the magic line followed by records, each a header { u16 channel,
+// u16 ok, u32 length } and length payload bytes, in host byte order. Payloads
+// are written field by field with the typed helpers below, never as raw
+// structs, so a struct may gain fields or padding without changing the tape.
+// The number in the magic is the format version: a change to what any record
+// carries must bump it, and replay rejects a tape whose magic differs instead
+// of misreading it. Channels are numbered by the helper; the recording
+// wrappers write one record per source call, in call order, and the replaying
+// wrappers hand them back in that same order. Replay loads the whole file at
+// once. Asking for a channel other than the next record's (the code under
+// replay calls its sources differently than the recorded run did) marks the
+// tape failed, and every later read fails too, so a replay never silently
+// mixes up records. Running past the end fails the same way but also sets
+// `ended`: a recording that was killed stops at its last complete record.
+
+#define TAPE_MAGIC "SBTAPE2\n"
+#define TAPE_MAGIC_SIZE 8
+#define TAPE_RECORD_MAX 65536
+// Recorded control lines are shorter than this (see control.h).
+#define TAPE_COMMAND_SIZE 512
+
+struct tape_header {
+  uint16_t channel;
+  uint16_t ok;
+  uint32_t length;
+};
+
+struct tape {
+  bool recording;
+  bool failed;
+  bool ended;
+  uint64_t records;
+
+  // Recording: the record being built, written out by tape_end().
+  FILE* file;
+  struct tape_header pending;
+  uint8_t scratch[TAPE_RECORD_MAX];
+
+  // Replay: the whole file and the read position.
+  uint8_t* data;
+  size_t size;
+  size_t offset;
+};
+
+// One record's payload, read front to back.
+struct tape_reader {
+  struct tape* tape;
+  const uint8_t* data;
+  uint32_t length;
+  uint32_t offset;
+  bool ok;
+};
+
+static inline bool tape_record(struct tape* tape, const char* path) {
+  memset(tape, 0, sizeof(struct tape));
+  tape->recording = true;
+  tape->file = fopen(path, "wb");
+  if (!tape->file) return false;
+  return fwrite(TAPE_MAGIC, 1, TAPE_MAGIC_SIZE, tape->file) == TAPE_MAGIC_SIZE;
+}
+
+static inline bool tape_replay(struct tape* tape, const char* path) {
+  memset(tape, 0, sizeof(struct tape));
+  FILE* file = fopen(path, "rb");
+  if (!file) return false;
+  bool ok = fseek(file, 0, SEEK_END) == 0;
+  long size = ok ? ftell(file) : -1;
+  ok = size >= TAPE_MAGIC_SIZE && fseek(file, 0, SEEK_SET) == 0;
+  if (ok) tape->data = malloc((size_t)size);
+  ok = ok && tape->data && fread(tape->data, 1, (size_t)size, file) == (size_t)size
+       && memcmp(tape->data, TAPE_MAGIC, TAPE_MAGIC_SIZE) == 0;
+  fclose(file);
+  if (!ok) {
+    free(tape->data);
+    tape->data = NULL;
+    return false;
+  }
+  tape->size = (size_t)size;
+  tape->offset = TAPE_MAGIC_SIZE;
+  return true;
+}
+
+static inline void tape_close(struct tape* tape) {
+  if (tape->file) fclose(tape->file);
+  free(tape->data);
+  tape->file = NULL;
+  tape->data = NULL;
+}
+
+// Records
+
+static inline void tape_begin(struct tape* tape, uint16_t channel, bool ok) {
+  tape->pending = (struct tape_header){ channel, ok, 0 };
+}
+
+static inline void tape_write(struct tape* tape, const void* data, uint32_t size) {
+  if (tape->pending.length + size > TAPE_RECORD_MAX) {
+    tape->failed = true;
+    return;
+  }
+  memcpy(tape->scratch + tape->pending.length, data, size);
+  tape->pending.length += size;
+}
+
+static inline void tape_end(struct tape* tape) {
+  if (tape->failed || !tape->file) return;
+  if (fwrite(&tape->pending, sizeof(struct tape_header), 1, tape->file) != 1
+      || fwrite(tape->scratch, 1, tape->pending.length, tape->file) != tape->pending.length) {
+    tape->failed = true;
+    return;
+  }
+  tape->records++;
+}
+
+static inline void tape_put(struct tape* tape,
+                            uint16_t channel,
+                            bool ok,
+                            const void* data,
+                            uint32_t size) {
+  tape_begin(tape, channel, ok);
+  tape_write(tape, data, size);
+  tape_end(tape);
+}
+
+static inline void tape_write_u64(struct tape* tape, uint64_t value) {
+  tape_write(tape, &value, sizeof(value));
+}
+
+static inline void tape_write_i64(struct tape* tape, int64_t value) {
+  tape_write(tape, &value, sizeof(value));
+}
+
+static inline void tape_write_u32(struct tape* tape, uint32_t value) {
+  tape_write(tape, &value, sizeof(value));
+}
+
+static inline void tape_write_i32(struct tape* tape, int32_t value) {
+  tape_write(tape, &value, sizeof(value));
+}
+
+static inline void tape_write_f64(struct tape* tape, double value) {
+  tape_write(tape, &value, sizeof(value));
+}
+
+// A string from a fixed-size field: its length, then only its bytes.
+static inline void tape_write_str(struct tape* tape, const char* value, size_t size) {
+  uint16_t length = (uint16_t)strnlen(value, size);
+  tape_write(tape, &length, sizeof(length));
+  tape_write(tape, value, length);
+}
+
+// Pushes the records so far to the file, so a recording that is killed keeps
+// everything up to its last flush.
+static inline void tape_flush(struct tape* tape) {
+  if (tape->file && fflush(tape->file) != 0) tape->failed = true;
+}
+
+// Replay
+
+// The channel of the next record, or -1 at the end of the tape (or after a
+// failure).
+static inline int tape_peek(const struct tape* tape) {
+  if (tape->failed || tape->offset + sizeof(struct tape_header) > tape->size) return -1;
+  struct tape_header header;
+  memcpy(&header, tape->data + tape->offset, sizeof(header));
+  return header.channel;
+}
+
+// Takes the next record, which must be on channel.
+static inline bool tape_next(struct tape* tape, uint16_t channel, struct tape_reader* reader) {
+  memset(reader, 0, sizeof(struct tape_reader));
+  reader->tape = tape;
+  int next = tape_peek(tape);
+  if (next != channel) {
+    tape->ended = tape->ended || (!tape->failed && next < 0);
+    tape->failed = true;
+    return false;
+  }
+  struct tape_header header;
+  memcpy(&header, tape->data + tape->offset, sizeof(header));
+  size_t start = tape->offset + sizeof(header);
+  if (header.length > tape->size - start) {
+    tape->ended = true;
+    tape->failed = true;
+    return false;
+  }
+  reader->data = tape->data + start;
+  reader->length = header.length;
+  reader->ok = header.ok != 0;
+  tape->offset = start + header.length;
+  tape->records++;
+  return true;
+}
+
+// Copies the next size payload bytes; a short payload fails the tape.
+static inline bool tape_read(struct tape_reader* reader, void* out, uint32_t size) {
+  if (reader->tape->failed || size > reader->length - reader->offset) {
+    reader->tape->failed = true;
+    return false;
+  }
+  memcpy(out, reader->data + reader->offset, size);
+  reader->offset += size;
+  return true;
+}
+
+static inline bool tape_read_u64(struct tape_reader* reader, uint64_t* out) {
+  return tape_read(reader, out, sizeof(*out));
+}
+
+static inline bool tape_read_i64(struct tape_reader* reader, int64_t* out) {
+  return tape_read(reader, out, sizeof(*out));
+}
+
+static inline bool tape_read_u32(struct tape_reader* reader, uint32_t* out) {
+  return tape_read(reader, out, sizeof(*out));
+}
+
+static inline bool tape_read_i32(struct tape_reader* reader, int32_t* out) {
+  return tape_read(reader, out, sizeof(*out));
+}
+
+static inline bool tape_read_f64(struct tape_reader* reader, double* out) {
+  return tape_read(reader, out, sizeof(*out));
+}
+
+// Into a field of size bytes, always terminated; a longer string than the
+// field holds fails the tape.
+static inline bool tape_read_str(struct tape_reader* reader, char* out, size_t size) {
+  uint16_t length = 0;
+  if (!tape_read(reader, &length, sizeof(length))) return false;
+  if (length >= size) {
+    reader->tape->failed = true;
+    return false;
+  }
+  if (!tape_read(reader, out, length)) return false;
+  out[length] = '\0';
+  return true;
+}
@@ -60,6 +60,7 @@ require("bar")
 require("default")
 require("mission_control")
 require("items")
+require("native_helpers").start()
 sbar.end_config()
 
 -- Run the event loop of the sketchybar module (without this there will be no
@@ -2,9 +2,7 @@ local icons = require("icons")
 local colors = require("colors")
 local settings = require("settings")
 local center_popup = require("center_popup")
-
--- Battery popup with detailed diagnostics
-local battery_helper_path = os.getenv("HOME") .. "/.config/sketchybar/helpers/battery_info/bin/battery_info"
+local native_helpers = require("native_helpers")
 
 -- State caching for main widget
 local last_charge = nil
@@ -12,24 +10,51 @@ local last_charging = nil
 local last_icon = nil
 local last_color = nil
 
-local function file_exists(path)
-  local f = io.open(path, "r")
-  if not f then return false end
-  f:close()
-  return true
+-- Everything battery_info reports, kept current by the helper's watch mode:
+-- it triggers battery_info_update with the keys that changed (all of them
+-- when full=true), and commands go to its FIFO from Lua
+-- (native_helpers.send), so keeping the widget and the popup current spawns
+-- no process.
+local info = {}
+
+local function parse_value(key, value)
+  if value == nil then return nil end
+  if value == "true" then return true end
+  if value == "false" then return false end
+  if key == "cell_voltage_mv" then
+    local cells = {}
+    for cell in string.gmatch(value, "[^,]+") do cells[#cells + 1] = tonumber(cell) end
+    return cells
+  end
+  return tonumber(value) or value
 end
 
-local function fetch_battery_info(callback)
-  if not file_exists(battery_helper_path) then
-    if callback then callback(nil, 1) end
+-- A full snapshot carries every key without listing them; sketchybar's own
+-- variables (NAME, SENDER, ...) are upper case, battery keys lower case.
+local function apply_update(env)
+  if env.full == "true" then
+    info = {}
+    for key, value in pairs(env) do
+      if key ~= "full" and key:match("^[%l%d_]+$") then info[key] = parse_value(key, value) end
+    end
     return
   end
-  sbar.exec(battery_helper_path, function(info, exit_code)
-    if callback then callback(info, exit_code) end
-  end)
+  for key in string.gmatch(env.keys or "", "[^,]+") do
+    info[key] = parse_value(key, env[key])
+  end
+  for key in string.gmatch(env.removed or "", "[^,]+") do
+    info[key] = nil
+  end
 end
 
-local BATTERY_UPDATE_FREQ = 600
+native_helpers.spawn(
+  "battery_info",
+  "--watch battery_info_update --control \"" .. native_helpers.control_file("battery_info") .. "\""
+)
+-- After a config reload the watcher from before keeps running (the relaunch
+-- exits) and only sends what changed since its last trigger, while `info`
+-- here starts out empty: ask it for everything.
+native_helpers.send("battery_info", "snapshot")
 
 -- Main battery widget
 local battery = sbar.add("item", "widgets.battery", {
@@ -48,7 +73,7 @@ local battery = sbar.add("item", "widgets.battery", {
   },
   padding_left = 0,
   padding_right = 0,
-  update_freq = BATTERY_UPDATE_FREQ,
+  update_freq = 0,
 })
 
 -- Popup setup
@@ -323,59 +348,170 @@ local function format_flags(info)
 end
 
 -- Main widget update
-local function update_battery()
-  if _G.SKETCHYBAR_SUSPENDED then return end
-
-  fetch_battery_info(function(info, exit_code)
-    if exit_code ~= 0 or type(info) ~= "table" then return end
-
-    local charge = tonumber(info.percent)
-    if not charge then return end
-    local charge_i = math.floor(charge + 0.5)
-    local charging = info.is_charging == true
-    local charged = info.is_charged == true
-
-    local color = colors.green
-    local icon = icons.battery._0
-    if charging then
-      icon = icons.battery.charging
-    elseif charged then
+local function show_battery(info)
+  local charge = tonumber(info.percent)
+  if not charge then return end
+  local charge_i = math.floor(charge + 0.5)
+  local charging = info.is_charging == true
+  local charged = info.is_charged == true
+
+  local color = colors.green
+  local icon = icons.battery._0
+  if charging then
+    icon = icons.battery.charging
+  elseif charged then
+    icon = icons.battery._100
+  else
+    if charge > 80 then
       icon = icons.battery._100
+    elseif charge > 60 then
+      icon = icons.battery._75
+    elseif charge > 40 then
+      icon = icons.battery._50
+    elseif charge > 20 then
+      icon = icons.battery._25
+      color = colors.orange
     else
-      if charge > 80 then
-        icon = icons.battery._100
-      elseif charge > 60 then
-        icon = icons.battery._75
-      elseif charge > 40 then
-        icon = icons.battery._50
-      elseif charge > 20 then
-        icon = icons.battery._25
-        color = colors.orange
-      else
-        icon = icons.battery._0
-        color = colors.red
-      end
+      icon = icons.battery._0
+      color = colors.red
     end
+  end
 
-    if last_charge == charge_i and last_charging == charging and last_icon == icon and last_color == color then
-      return
-    end
-    last_charge = charge_i
-    last_charging = charging
-    last_icon = icon
-    last_color = color
-
-    battery:set({
-      icon = { string = icon, color = color },
-      label = { string = tostring(charge_i) },
-    })
-  end)
+  if last_charge == charge_i and last_charging == charging and last_icon == icon and last_color == color then
+    return
+  end
+  last_charge = charge_i
+  last_charging = charging
+  last_icon = icon
+  last_color = color
+
+  battery:set({
+    icon = { string = icon, color = color },
+    label = { string = tostring(charge_i) },
+  })
 end
 
-battery:subscribe({ "forced", "routine", "power_source_change", "system_woke" }, function()
-  update_battery()
+-- Popup content, from the same table as the widget.
+local function render_popup()
+  if info.percent == nil then
+    row_status:set({ label = { string = "Unavailable" } })
+    return
+  end
+
+  local percent = tonumber(info.percent)
+  local charging = info.is_charging == true
+  local charged = info.is_charged == true
+  local power = tostring(info.power_source or "-")
+
+  local status = "Discharging"
+  if power == "AC" and not charging and not charged then
+    status = "Not charging"
+  end
+  if charging then status = "Charging" end
+  if charged then status = "Charged" end
+
+  local time_label = "-"
+  if charging then
+    time_label = format_minutes(info.time_to_full_min)
+  else
+    time_label = format_minutes(info.time_to_empty_min)
+  end
+
+  row_status:set({ label = { string = status } })
+  row_percent:set({ label = { string = percent and (tostring(percent) .. "%") or "-" } })
+  local adapter_watts = tonumber(info.adapter_watts)
+  if adapter_watts then
+    row_power:set({ label = { string = string.format("%s (%dW)", power, adapter_watts) } })
+  else
+    row_power:set({ label = { string = power } })
+  end
+  row_time:set({ label = { string = time_label } })
+  local cycles = info.cycle_count and tostring(info.cycle_count) or "-"
+  local design_cycles = tonumber(info.design_cycle_count)
+  if design_cycles then
+    cycles = string.format("%s / %d", cycles, design_cycles)
+  end
+  row_cycles:set({ label = { string = cycles } })
+
+  local health = "-"
+  local health_pct = tonumber(info.health_percent)
+  if health_pct then
+    health = string.format("%.0f%%", health_pct)
+  elseif info.health and tostring(info.health) ~= "" then
+    health = tostring(info.health)
+  end
+  row_health:set({ label = { string = health } })
+
+  local cap_cur = tonumber(info.raw_current_capacity)
+  local cap_max = tonumber(info.raw_max_capacity)
+  if cap_cur and cap_max and cap_max > 0 then
+    row_capacity:set({ label = { string = string.format("%d / %d mAh", cap_cur, cap_max) } })
+  else
+    row_capacity:set({ label = { string = "-" } })
+  end
+
+  local design_cap = tonumber(info.design_capacity)
+  local nominal_cap = tonumber(info.nominal_capacity)
+  if design_cap and nominal_cap then
+    row_design:set({ label = { string = string.format("%d / %d mAh", design_cap, nominal_cap) } })
+  elseif design_cap then
+    row_design:set({ label = { string = string.format("%d mAh", design_cap) } })
+  else
+    row_design:set({ label = { string = "-" } })
+  end
+
+  row_temp:set({ label = { string = format_temp(info.temperature_c) } })
+  local cur_ma = info.instant_amperage_ma ~= nil and info.instant_amperage_ma or info.amperage_ma
+  row_electrical:set({ label = { string = string.format("%s / %s", format_voltage(info.voltage_mv), format_current(cur_ma)) } })
+
+  local batt_w = format_watts(info.power_w)
+  local sys_w = format_watts(info.telemetry_system_power_in_w)
+  row_power_draw:set({ label = { string = string.format("%s / %s", batt_w, sys_w) } })
+
+  row_cells:set({ label = { string = format_cells(info) } })
+
+  local soc = tonumber(info.soc_percent)
+  local dmin = tonumber(info.daily_min_soc)
+  local dmax = tonumber(info.daily_max_soc)
+  if soc and dmin and dmax then
+    row_soc:set({ label = { string = string.format("%d%% (daily %d–%d)", soc, dmin, dmax) } })
+  elseif soc then
+    row_soc:set({ label = { string = string.format("%d%%", soc) } })
+  else
+    row_soc:set({ label = { string = "-" } })
+  end
+
+  local pack = tonumber(info.pack_reserve)
+  if pack then
+    row_pack:set({ label = { string = tostring(pack) } })
+  else
+    row_pack:set({ label = { string = "-" } })
+  end
+
+  row_charger:set({ label = { string = ellipsize(format_charger_basic(info), 40) } })
+  set_opt_row(row_not_charging, format_reason_mask(info, info.charger_not_charging_reason, "nr"))
+  set_opt_row(row_slow_charging, format_reason_mask(info, info.charger_slow_charging_reason, "slow"))
+  set_opt_row(row_inhibit, format_reason_mask(info, info.charger_inhibit_reason, "inh"))
+  row_system:set({ label = { string = format_system(info) } })
+  row_adapter_info:set({ label = { string = format_adapter(info) } })
+  row_device:set({ label = { string = format_device(info) } })
+  row_flags:set({ label = { string = format_flags(info) } })
+  row_serial:set({ label = { string = info.serial and tostring(info.serial) or "-" } })
+end
+
+battery:subscribe("battery_info_update", function(env)
+  apply_update(env)
+  show_battery(info)
+  if battery_popup.is_showing() then render_popup() end
+end)
+
+battery:subscribe("forced", function()
+  native_helpers.send("battery_info", "snapshot")
+end)
+
+battery:subscribe("system_woke", function()
+  native_helpers.send("battery_info", "refresh")
 end)
-update_battery()
 
 -- Popup click handler
 battery:subscribe("mouse.clicked", function(env)
@@ -391,113 +527,13 @@ battery:subscribe("mouse.clicked", function(env)
   end
 
   battery_popup.show(function()
-    -- Fetch and display battery info
-    row_status:set({ label = { string = "Loading…" } })
-    fetch_battery_info(function(info, exit_code)
-      if exit_code ~= 0 or type(info) ~= "table" then
-        row_status:set({ label = { string = "Unavailable" } })
-        return
-      end
-
-      local percent = tonumber(info.percent)
-      local charging = info.is_charging == true
-      local charged = info.is_charged == true
-      local power = tostring(info.power_source or "-")
-
-      local status = "Discharging"
-      if power == "AC" and not charging and not charged then
-        status = "Not charging"
-      end
-      if charging then status = "Charging" end
-      if charged then status = "Charged" end
-
-      local time_label = "-"
-      if charging then
-        time_label = format_minutes(info.time_to_full_min)
-      else
-        time_label = format_minutes(info.time_to_empty_min)
-      end
-
-      row_status:set({ label = { string = status } })
-      row_percent:set({ label = { string = percent and (tostring(percent) .. "%") or "-" } })
-      local adapter_watts = tonumber(info.adapter_watts)
-      if adapter_watts then
-        row_power:set({ label = { string = string.format("%s (%dW)", power, adapter_watts) } })
-      else
-        row_power:set({ label = { string = power } })
-      end
-      row_time:set({ label = { string = time_label } })
-      local cycles = info.cycle_count and tostring(info.cycle_count) or "-"
-      local design_cycles = tonumber(info.design_cycle_count)
-      if design_cycles then
-        cycles = string.format("%s / %d", cycles, design_cycles)
-      end
-      row_cycles:set({ label = { string = cycles } })
-
-      local health = "-"
-      local health_pct = tonumber(info.health_percent)
-      if health_pct then
-        health = string.format("%.0f%%", health_pct)
-      elseif info.health and tostring(info.health) ~= "" then
-        health = tostring(info.health)
-      end
-      row_health:set({ label = { string = health } })
-
-      local cap_cur = tonumber(info.raw_current_capacity)
-      local cap_max = tonumber(info.raw_max_capacity)
-      if cap_cur and cap_max and cap_max > 0 then
-        row_capacity:set({ label = { string = string.format("%d / %d mAh", cap_cur, cap_max) } })
-      else
-        row_capacity:set({ label = { string = "-" } })
-      end
-
-      local design_cap = tonumber(info.design_capacity)
-      local nominal_cap = tonumber(info.nominal_capacity)
-      if design_cap and nominal_cap then
-        row_design:set({ label = { string = string.format("%d / %d mAh", design_cap, nominal_cap) } })
-      elseif design_cap then
-        row_design:set({ label = { string = string.format("%d mAh", design_cap) } })
-      else
-        row_design:set({ label = { string = "-" } })
-      end
-
-      row_temp:set({ label = { string = format_temp(info.temperature_c) } })
-      local cur_ma = info.instant_amperage_ma ~= nil and info.instant_amperage_ma or info.amperage_ma
-      row_electrical:set({ label = { string = string.format("%s / %s", format_voltage(info.voltage_mv), format_current(cur_ma)) } })
-
-      local batt_w = format_watts(info.power_w)
-      local sys_w = format_watts(info.telemetry_system_power_in_w)
-      row_power_draw:set({ label = { string = string.format("%s / %s", batt_w, sys_w) } })
-
-      row_cells:set({ label = { string = format_cells(info) } })
-
-      local soc = tonumber(info.soc_percent)
-      local dmin = tonumber(info.daily_min_soc)
-      local dmax = tonumber(info.daily_max_soc)
-      if soc and dmin and dmax then
-        row_soc:set({ label = { string = string.format("%d%% (daily %d–%d)", soc, dmin, dmax) } })
-      elseif soc then
-        row_soc:set({ label = { string = string.format("%d%%", soc) } })
-      else
-        row_soc:set({ label = { string = "-" } })
-      end
-
-      local pack = tonumber(info.pack_reserve)
-      if pack then
-        row_pack:set({ label = { string = tostring(pack) } })
-      else
-        row_pack:set({ label = { string = "-" } })
-      end
-
-      row_charger:set({ label = { string = ellipsize(format_charger_basic(info), 40) } })
-      set_opt_row(row_not_charging, format_reason_mask(info, info.charger_not_charging_reason, "nr"))
-      set_opt_row(row_slow_charging, format_reason_mask(info, info.charger_slow_charging_reason, "slow"))
-      set_opt_row(row_inhibit, format_reason_mask(info, info.charger_inhibit_reason, "inh"))
-      row_system:set({ label = { string = format_system(info) } })
-      row_adapter_info:set({ label = { string = format_adapter(info) } })
-      row_device:set({ label = { string = format_device(info) } })
-      row_flags:set({ label = { string = format_flags(info) } })
-      row_serial:set({ label = { string = info.serial and tostring(info.serial) or "-" } })
-    end)
+    -- Registry values (current, telemetry, ...) may have moved without a
+    -- power source change; ask for a fresh snapshot.
+    if info.percent == nil then
+      row_status:set({ label = { string = "Loading…" } })
+    else
+      render_popup()
+    end
+    native_helpers.send("battery_info", "snapshot")
   end)
 end)
@@ -1,8 +1,11 @@
 local colors = require("colors")
 local settings = require("settings")
 local center_popup = require("center_popup")
+local native_helpers = require("native_helpers")
 
-sbar.exec("killall system_stats >/dev/null 2>&1; " .. os.getenv("CONFIG_DIR") .. "/helpers/system_stats/bin/system_stats system_stats_update 2.0")
+-- In direct-drive mode the helper pushes graph values and sets labels itself;
+-- otherwise it triggers system_stats_update and the handler below renders.
+local direct_drive = true
 
 local cpu_gpu_width = 44
 local mem_width = 28
@@ -45,6 +48,17 @@ local mem = make_graph("widgets.sys.mem", "MEM", mem_width, trailing_gap)
 local gpu = make_graph("widgets.sys.gpu", "GPU", cpu_gpu_width, 0)
 local cpu = make_graph("widgets.sys.cpu", "CPU", cpu_gpu_width, 0)
 
+-- Loads every 2s, temperatures every 6s and the GPU process ranking every
+-- 10s. Only emit when a rendered value moves by >= 1% / 1C, with a 30s
+-- heartbeat. The popup's process lists are queried over the control FIFO.
+local helper_args = "system_stats_update 2.0 --period temps=6 --period gpu_procs=10"
+  .. " --load-threshold 1 --temp-threshold 1 --heartbeat 30"
+  .. " --control \"" .. native_helpers.control_file("system_stats") .. "\""
+if direct_drive then
+  helper_args = helper_args .. " --direct " .. cpu.name .. "," .. gpu.name .. "," .. mem.name
+end
+native_helpers.spawn("system_stats", helper_args)
+
 -- Popup setup
 local popup_width = 360
 local stats_popup = center_popup.create("system_stats.popup", {
@@ -99,76 +113,60 @@ for i = 1, 10 do
   mem_rows[i] = add_row("mem_proc" .. i, "")
 end
 
+-- Processes the helper may not read without root are left out of both lists.
+local unreadable_row = add_row("procs_unreadable", "")
+unreadable_row:set({ drawing = false })
+
 stats_popup.add_close_row({ label = "close x" })
 
 -- Fetch and display top processes for both CPU and MEM
 local function refresh_popup()
-  -- Fetch CPU processes
-  sbar.exec("ps -Aceo pcpu,comm -r | head -11 | tail -10", function(output)
-    local text = ""
-    if type(output) == "string" then
-      text = output
-    elseif type(output) == "table" then
-      text = output[1] or output.stdout or ""
-    end
-    text = tostring(text or ""):gsub("^%s+", ""):gsub("%s+$", "")
-
-    local idx = 1
-    for line in text:gmatch("[^\r\n]+") do
-      if idx > 10 then break end
-      local val, name = line:match("^%s*([%d%.]+)%s+(.+)$")
-      if val and name then
-        if #name > max_name_chars then name = name:sub(1, max_name_chars - 3) .. "..." end
-        cpu_rows[idx]:set({
-          icon = { string = name },
-          label = { string = val .. "%" },
-        })
-        idx = idx + 1
-      end
-    end
-    for i = idx, 10 do
-      cpu_rows[i]:set({ icon = { string = "" }, label = { string = "" } })
-    end
-  end)
+  native_helpers.send("system_stats", "procs 10")
+end
 
-  -- Fetch MEM processes
-  sbar.exec("ps -Aceo rss,comm -m | head -11 | tail -10", function(output)
-    local text = ""
-    if type(output) == "string" then
-      text = output
-    elseif type(output) == "table" then
-      text = output[1] or output.stdout or ""
-    end
-    text = tostring(text or ""):gsub("^%s+", ""):gsub("%s+$", "")
-
-    local idx = 1
-    for line in text:gmatch("[^\r\n]+") do
-      if idx > 10 then break end
-      local val, name = line:match("^%s*([%d%.]+)%s+(.+)$")
-      if val and name then
-        if #name > max_name_chars then name = name:sub(1, max_name_chars - 3) .. "..." end
-        local kb = tonumber(val) or 0
-        local display_val
-        if kb >= 1048576 then
-          display_val = string.format("%.1f GB", kb / 1048576)
-        elseif kb >= 1024 then
-          display_val = string.format("%.0f MB", kb / 1024)
-        else
-          display_val = string.format("%d KB", kb)
-        end
-        mem_rows[idx]:set({
-          icon = { string = name },
-          label = { string = display_val },
-        })
-        idx = idx + 1
-      end
-    end
-    for i = idx, 10 do
-      mem_rows[i]:set({ icon = { string = "" }, label = { string = "" } })
+local function format_bytes(bytes)
+  local kb = bytes / 1024
+  if kb >= 1048576 then
+    return string.format("%.1f GB", kb / 1048576)
+  elseif kb >= 1024 then
+    return string.format("%.0f MB", kb / 1024)
+  end
+  return string.format("%d KB", kb)
+end
+
+-- Fills rows from "name:value;..." as sent by the helper.
+local function fill_rows(rows, list, format_value)
+  local idx = 1
+  for entry in tostring(list or ""):gmatch("[^;]+") do
+    if idx > #rows then break end
+    local name, val = entry:match("^(.*):([%d%.]+)$")
+    if name and val then
+      if #name > max_name_chars then name = name:sub(1, max_name_chars - 3) .. "..." end
+      rows[idx]:set({
+        icon = { string = name },
+        label = { string = format_value(tonumber(val) or 0) },
+      })
+      idx = idx + 1
     end
-  end)
+  end
+  for i = idx, #rows do
+    rows[i]:set({ icon = { string = "" }, label = { string = "" } })
+  end
 end
 
+stats_popup.title_item:subscribe("system_stats_procs", function(env)
+  fill_rows(cpu_rows, env.cpu_procs, function(val)
+    return string.format("%.1f%%", val)
+  end)
+  fill_rows(mem_rows, env.mem_procs, format_bytes)
+  local unreadable = tonumber(env.procs_unreadable) or 0
+  unreadable_row:set({
+    drawing = unreadable > 0,
+    icon = { string = string.format("%d processes not readable without root", unreadable) },
+    label = { string = "" },
+  })
+end)
+
 -- Click on header title to refresh
 stats_popup.title_item:subscribe("mouse.clicked", function(env)
   if env.BUTTON == "left" then
@@ -200,13 +198,22 @@ mem:subscribe("mouse.clicked", function(env)
   if env.BUTTON == "left" then toggle_popup() end
 end)
 
-cpu:subscribe("system_stats_update", function(env)
+-- Triggers only carry the fields of the collectors that ran, so values are
+-- merged into the last known state; a graph is only pushed when its value
+-- arrived.
+local stats = {}
+
+local function on_system_stats_update(env)
   if _G.SKETCHYBAR_SUSPENDED then return end
 
-  local cpu_total = tonumber(env.cpu_total)
-  local cpu_temp_val = tonumber(env.cpu_temp)
+  for _, key in ipairs({ "cpu_total", "cpu_temp", "gpu_util", "gpu_temp", "mem_used_percent" }) do
+    if env[key] ~= nil then stats[key] = tonumber(env[key]) end
+  end
+
+  local cpu_total = stats.cpu_total
+  local cpu_temp_val = stats.cpu_temp
   local cpu_label = cpu_total and string.format("%d%%", cpu_total) or "--"
-  if cpu_total then
+  if env.cpu_total and cpu_total then
     cpu:push({ cpu_total / 100.0 })
   end
 
@@ -216,10 +223,10 @@ cpu:subscribe("system_stats_update", function(env)
     cpu_label = string.format("%s --C", cpu_label)
   end
 
-  local gpu_util = tonumber(env.gpu_util)
-  local gpu_temp_val = tonumber(env.gpu_temp)
+  local gpu_util = stats.gpu_util
+  local gpu_temp_val = stats.gpu_temp
   local gpu_label = gpu_util and string.format("%d%%", gpu_util) or "--"
-  if gpu_util and gpu_util >= 0 then
+  if env.gpu_util and gpu_util and gpu_util >= 0 then
     gpu:push({ gpu_util / 100.0 })
   end
 
@@ -232,13 +239,17 @@ cpu:subscribe("system_stats_update", function(env)
   cpu:set({ label = cpu_label })
   gpu:set({ label = gpu_label })
 
-  local mem_percent = tonumber(env.mem_used_percent)
+  local mem_percent = stats.mem_used_percent
   if mem_percent and mem_percent >= 0 then
-    mem:push({ mem_percent / 100.0 })
+    if env.mem_used_percent then mem:push({ mem_percent / 100.0 }) end
     mem:set({
       label = string.format("%d%%", mem_percent),
     })
   else
     mem:set({ label = "--" })
   end
-end)
+end
+
+if not direct_drive then
+  cpu:subscribe("system_stats_update", on_system_stats_update)
+end
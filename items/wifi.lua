@@ -3,11 +3,17 @@ local colors = require("colors")
 local settings = require("settings")
 local center_popup = require("center_popup")
 local scamalytics = require("items.scamalytics")
+local native_helpers = require("native_helpers")
 
 -- Native event provider for network throughput ("network_update") on the
 -- effective uplink interface. This keeps the widget event-driven and avoids
--- frequent shell polling.
-sbar.exec("killall network_load >/dev/null 2>&1; $CONFIG_DIR/helpers/network_load/bin/network_load auto network_update 2.0")
+-- frequent shell polling. mission_control.lua pauses it over the control FIFO.
+-- The counters are read every 250 ms and smoothed, but still sent every 2 s.
+native_helpers.spawn(
+  "network_load",
+  "auto network_update 2.0 --sample 250 --control \""
+    .. native_helpers.control_file("network_load") .. "\""
+)
 
 -- Battery-style compact Wi‑Fi widget:
 -- - Same compact feel as `battery.lua`, but with two stacked numbers:
@@ -3,7 +3,13 @@
 -- Mission Control is owned by Dock and can spam events and increase both
 -- WindowServer and SketchyBar CPU usage. This module detects when Dock becomes
 -- the front app and temporarily disables bar drawing. It also exposes a global
--- flag so other items can skip heavy updates while Mission Control is active.
+-- flag so other items can skip heavy updates while Mission Control is active,
+-- and pauses the sampling helpers, which would otherwise keep collecting (and,
+-- in system_stats' direct-drive mode, drawing) while suspended.
+
+local native_helpers = require("native_helpers")
+
+local paused_helpers = { "system_stats", "network_load", "battery_info" }
 
 _G.SKETCHYBAR_SUSPENDED = _G.SKETCHYBAR_SUSPENDED or false
 
@@ -29,6 +35,11 @@ local function apply_state(suspended)
   last_suspended = suspended
   _G.SKETCHYBAR_SUSPENDED = suspended
 
+  -- Resuming resets the helpers' rate baselines and emits a fresh sample.
+  for _, name in ipairs(paused_helpers) do
+    native_helpers.send(name, suspended and "pause" or "resume")
+  end
+
   -- Keep the bar visible; only expose a global suspended flag so items can skip
   -- expensive updates during Mission Control / Space transitions.
   if not suspended then
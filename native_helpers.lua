@@ -0,0 +1,88 @@
+-- Launching of the long-running native helpers (system_stats, network_load,
+-- battery_info --watch).
+--
+-- Helpers run in resilient mode: they keep sampling while the bar restarts and
+-- replay their latest state once it is back, so a config reload does not
+-- reset their rate baselines. Instead of `killall` + respawn, every launch
+-- goes through the helper's lock file: a relaunch for the same bar with the
+-- same arguments tells the running instance to send its events and full
+-- state again (the reload wiped them) and exits, while a new bar process or
+-- changed arguments replace it. The helper exits
+-- on its own once the bar process is gone.
+--
+-- Helpers listed in `native_helpers.hosted` run as modules of one
+-- stats_daemon process instead: spawn() only records their arguments and
+-- start(), called once all items are loaded, launches the daemon with them.
+-- The items keep their events; commands for a hosted helper go to the
+-- daemon's FIFO prefixed with the helper name.
+
+local native_helpers = {}
+
+local helpers_dir = os.getenv("CONFIG_DIR") .. "/helpers"
+
+native_helpers.hosted = { system_stats = true, network_load = true }
+local pending = {}
+
+-- Resolved here rather than by the shell, so Lua can open the files too.
+local tmp_dir = os.getenv("TMPDIR") or "/tmp"
+
+function native_helpers.lock_file(name)
+  return tmp_dir .. "/sketchybar." .. name .. ".lock"
+end
+
+-- FIFO the helper reads commands from when started with `--control`.
+function native_helpers.control_file(name)
+  return tmp_dir .. "/sketchybar." .. name .. ".control"
+end
+
+-- Sends one command line to a helper's control FIFO, written from Lua so no
+-- shell is spawned. The FIFO is opened read-write, which never blocks: a
+-- FIFO left behind by a helper that was killed has no reader, and the line
+-- is dropped on close. Nothing is sent when there is no FIFO.
+function native_helpers.send(name, command)
+  if native_helpers.hosted[name] then
+    command = name .. " " .. command
+    name = "stats_daemon"
+  end
+  local fifo = io.open(native_helpers.control_file(name), "r+")
+  if not fifo then return end
+  fifo:write(command, "\n")
+  fifo:close()
+end
+
+local function launch(name, args)
+  sbar.exec(
+    "SKETCHYBAR_ASYNC=250 SKETCHYBAR_RESILIENT=1"
+      .. " SKETCHYBAR_PARENT_PID=$(pgrep -xo sketchybar)"
+      .. " SKETCHYBAR_LOCK_FILE=\"" .. native_helpers.lock_file(name) .. "\" "
+      .. helpers_dir .. "/" .. name .. "/bin/" .. name .. " " .. args
+  )
+end
+
+function native_helpers.spawn(name, args)
+  if native_helpers.hosted[name] then
+    pending[#pending + 1] = { name = name, args = args }
+    return
+  end
+  launch(name, args)
+end
+
+-- Launches the daemon with the hosted helpers spawned so far and stops
+-- standalone instances of them left over from an earlier config (a helper
+-- exits once its lock file is removed).
+function native_helpers.start()
+  if #pending == 0 then
+    sbar.exec("rm -f \"" .. native_helpers.lock_file("stats_daemon") .. "\"")
+    return
+  end
+
+  local args = "--control \"" .. native_helpers.control_file("stats_daemon") .. "\""
+  for _, module in ipairs(pending) do
+    sbar.exec("rm -f \"" .. native_helpers.lock_file(module.name) .. "\"")
+    args = args .. " " .. module.name .. " \"" .. module.args:gsub("\"", "\\\"") .. "\""
+  end
+  pending = {}
+  launch("stats_daemon", args)
+end
+
+return native_helpers